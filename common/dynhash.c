@@ -25,15 +25,104 @@
 	} while (0)
 
 /*
- * Expand and rehash our dynhash. If we fail to allocate for whatever reason,
- * just return. In most cases this means the application will die somewhere
- * else, possibly when dynhash_add cannot allocate a dhe and returns false...
+ * The hash functions we are given are often weak in their low bits (e.g.
+ * hash_string), so spread them with a Fibonacci multiply and take the
+ * high bits as the home slot.
+ */
+static inline uint32_t
+dynhash_home(dynhash_t dh, uint32_t hash)
+{
+
+	return ((hash * 2654435769U) >> dh->table_shift);
+}
+
+/* how far an entry sits from its home slot */
+static inline uint32_t
+dynhash_distance(dynhash_t dh, struct dynhash_entry *dhe, uint32_t idx)
+{
+
+	return ((idx - dynhash_home(dh, dhe->hash)) & (dh->table_length - 1));
+}
+
+static bool
+dynhash_alloc_table(dynhash_t dh, uint32_t length)
+{
+	uint32_t shift;
+
+	dh->table = (struct dynhash_entry *)
+	    calloc(length, sizeof(struct dynhash_entry));
+	if (dh->table == NULL)
+		return (false);
+
+	for (shift = 32; length > 1; length >>= 1)
+		shift--;
+	dh->table_length = 1U << (32 - shift);
+	dh->table_shift = shift;
+
+	return (true);
+}
+
+/*
+ * Place an entry known not to be in the table. Robin Hood: an entry that is
+ * further from home than the one in its way takes the slot, and the displaced
+ * one continues probing, which keeps probe lengths short and even.
  */
 static void
+dynhash_insert(dynhash_t dh, void *key, void *value, uint32_t hash)
+{
+	struct dynhash_entry dhe, tmp;
+	uint32_t idx, dist, mask;
+
+	dhe.key = key;
+	dhe.val = value;
+	dhe.hash = hash;
+
+	mask = dh->table_length - 1;
+	idx = dynhash_home(dh, hash);
+	for (dist = 0;; dist++, idx = (idx + 1) & mask) {
+		if (dh->table[idx].key == NULL) {
+			dh->table[idx] = dhe;
+			return;
+		}
+		if (dynhash_distance(dh, &dh->table[idx], idx) < dist) {
+			tmp = dh->table[idx];
+			dh->table[idx] = dhe;
+			dhe = tmp;
+			dist = dynhash_distance(dh, &dhe, idx);
+		}
+	}
+}
+
+/*
+ * Return the slot holding 'key', or NULL. Probing can stop as soon as it
+ * reaches an entry closer to home than the key would be.
+ */
+static struct dynhash_entry *
+dynhash_lookup(dynhash_t dh, void *key, uint32_t hash)
+{
+	struct dynhash_entry *dhe;
+	uint32_t idx, dist, mask;
+
+	mask = dh->table_length - 1;
+	idx = dynhash_home(dh, hash);
+	for (dist = 0;; dist++, idx = (idx + 1) & mask) {
+		dhe = &dh->table[idx];
+		if (dhe->key == NULL || dynhash_distance(dh, dhe, idx) < dist)
+			return (NULL);
+		if (dhe->hash == hash && dh->keycmp(dhe->key, key) == 0)
+			return (dhe);
+	}
+}
+
+/*
+ * Expand and rehash our dynhash. If we fail to allocate for whatever reason,
+ * just return false and keep the current table.
+ */
+static bool
 dynhash_expand(dynhash_t dh)
 {
-	struct dynhash_entry **new_table, *dhe;
-	uint32_t new_length, i, idx;
+	struct dynhash_entry *old_table;
+	uint32_t new_length, old_length, i;
 
 	assert(dh != NULL);
 	assert(dh->table != NULL);
@@ -44,33 +133,24 @@ dynhash_expand(dynhash_t dh)
 
 	/* don't bother if we've overflowed */
 	if (new_length <= dh->table_length)
-		return;
-
-	new_table = (struct dynhash_entry **)
-	    malloc(new_length * sizeof(struct dynhash_entry *));
-	if (new_table == NULL)
-		return;
-
-	memset(new_table, 0, new_length * sizeof(struct dynhash_entry *));
-
-	for (i = 0; i < dh->table_length; i++) {
-		dhe = dh->table[i];
-		while (dhe != NULL) {
-			struct dynhash_entry *dhe_tmp;
-
-			dhe_tmp = dhe->next;
+		return (false);
 
-			idx = dh->hashfn(dhe->key) % new_length;
-			dhe->next = new_table[idx];
-			new_table[idx] = dhe;
+	old_table = dh->table;
+	old_length = dh->table_length;
+	if (!dynhash_alloc_table(dh, new_length)) {
+		dh->table = old_table;
+		return (false);
+	}
 
-			dhe = dhe_tmp;
-		}
+	for (i = 0; i < old_length; i++) {
+		if (old_table[i].key != NULL)
+			dynhash_insert(dh, old_table[i].key, old_table[i].val,
+			    old_table[i].hash);
 	}
 
-	free(dh->table);
-	dh->table = new_table;
-	dh->table_length = new_length;
+	free(old_table);
+
+	return (true);
 }
 
 /*
@@ -90,17 +170,11 @@ dynhash_create(uint32_t (*hashfn)(void *), int (*keycmp)(void *, void *))
 
 	memset(dh, 0, sizeof(*dh));
 
-	dh->table = (struct dynhash_entry **)malloc(DYNHASH_INIT_LENGTH *
-	    sizeof(struct dynhash_entry *));
-	if (dh->table == NULL) {
+	if (!dynhash_alloc_table(dh, DYNHASH_INIT_LENGTH)) {
 		free(dh);
 		return (NULL);
 	}
 
-	memset(dh->table, 0, DYNHASH_INIT_LENGTH *
-	    sizeof(struct dynhash_entry *));
-	
-	dh->table_length = DYNHASH_INIT_LENGTH;
 	dh->table_count = 0;
 	dh->keycmp = keycmp;
 	dh->hashfn = hashfn;
@@ -116,28 +190,12 @@ dynhash_create(uint32_t (*hashfn)(void *), int (*keycmp)(void *, void *))
 void
 dynhash_destroy(dynhash_t dh)
 {
-	struct dynhash_entry *dhe;
-	uint32_t i;
 
 	assert(dh != NULL);
 	assert(dh->table != NULL);
 
 	ASSERT_NOT_ITERATING(dh);
 
-	for (i = 0; i < dh->table_length; i++) {
-		dhe = dh->table[i];
-		while (dhe != NULL) {
-			struct dynhash_entry *dhe_tmp;
-
-			dhe_tmp = dhe;
-			dhe = dhe->next;
-			free(dhe_tmp);
-
-			assert(dh->table_count != 0);
-			dh->table_count--;
-		}
-	}
-
 	free(dh->table);
 	free(dh);
 }
@@ -154,16 +212,12 @@ dynhash_find(dynhash_t dh, void *key, void **rkey, void **rvalue)
 	assert(dh != NULL);
 	assert(dh->table != NULL);
 
-	dhe = dh->table[dh->hashfn(key) % dh->table_length];
-	while (dhe != NULL) {
-		if (dh->keycmp(dhe->key, key) == 0) {
-			if (rkey != NULL)
-				*rkey = dhe->key;
-			if (rvalue != NULL)
-				*rvalue = dhe->val;
-			break;
-		}
-		dhe = dhe->next;
+	dhe = dynhash_lookup(dh, key, dh->hashfn(key));
+	if (dhe != NULL) {
+		if (rkey != NULL)
+			*rkey = dhe->key;
+		if (rvalue != NULL)
+			*rvalue = dhe->val;
 	}
 
 	return (dhe != NULL);
@@ -175,8 +229,7 @@ dynhash_find(dynhash_t dh, void *key, void **rkey, void **rvalue)
 bool
 dynhash_add(dynhash_t dh, void *key, void *value)
 {
-	struct dynhash_entry *dhe;
-	uint32_t idx;
+	uint32_t hash;
 
 	assert(key != NULL);
 	assert(dh != NULL);
@@ -184,23 +237,19 @@ dynhash_add(dynhash_t dh, void *key, void *value)
 
 	ASSERT_NOT_ITERATING(dh);
 
-	if (dynhash_find(dh, key, NULL, NULL))
+	hash = dh->hashfn(key);
+	if (dynhash_lookup(dh, key, hash) != NULL)
 		return (false);
 
-	if (dh->table_count == dh->table_length)
-		dynhash_expand(dh);
-
-	dhe = (struct dynhash_entry *)malloc(sizeof(*dhe));
-	if (dhe == NULL)
-		return (false);
-
-	dhe->key = key;
-	dhe->val = value;
-
-	idx = dh->hashfn(key) % dh->table_length;
+	if ((uint64_t)(dh->table_count + 1) * 100 >
+	    (uint64_t)dh->table_length * DYNHASH_LOAD_PERCENT) {
+		/* we can run fuller, but never completely full */
+		if (!dynhash_expand(dh) &&
+		    dh->table_count + 1 == dh->table_length)
+			return (false);
+	}
 
-	dhe->next = dh->table[idx];
-	dh->table[idx] = dhe;
+	dynhash_insert(dh, key, value, hash);
 
 	dh->table_count++;
 	assert(dh->table_count != 0);
@@ -216,8 +265,8 @@ dynhash_add(dynhash_t dh, void *key, void *value)
 bool
 dynhash_remove(dynhash_t dh, void *key, void **rkey, void **rvalue)
 {
-	struct dynhash_entry *dhe, *dhe_prev;
-	uint32_t idx;
+	struct dynhash_entry *dhe;
+	uint32_t idx, next, mask;
 
 	assert(key != NULL);
 	assert(dh != NULL);
@@ -225,35 +274,26 @@ dynhash_remove(dynhash_t dh, void *key, void **rkey, void **rvalue)
 
 	ASSERT_NOT_ITERATING(dh);
 
-	if (dynhash_find(dh, key, rkey, rvalue) == false)
-		return (false);
-
-	assert(dh->table_count > 0);
-
-	idx = dh->hashfn(key) % dh->table_length;
-
-	dhe_prev = NULL;
-	dhe = dh->table[idx];
-	while (dhe != NULL) {
-		if (dh->keycmp(dhe->key, key) == 0) {
-			if (rkey != NULL)
-				*rkey = dhe->key;
-			if (rvalue != NULL)
-				*rvalue = dhe->val;
-			if (dhe_prev != NULL)
-				dhe_prev->next = dhe->next;
-			else
-				dh->table[idx] = dhe->next;
-			free(dhe);
-			break;
-		}
-		dhe_prev = dhe;
-		dhe = dhe->next;
-	}
-
+	dhe = dynhash_lookup(dh, key, dh->hashfn(key));
 	if (dhe == NULL)
 		return (false);
 
+	if (rkey != NULL)
+		*rkey = dhe->key;
+	if (rvalue != NULL)
+		*rvalue = dhe->val;
+
+	/* shift the entries after it back, no tombstones needed */
+	mask = dh->table_length - 1;
+	idx = (uint32_t)(dhe - dh->table);
+	for (next = (idx + 1) & mask;
+	    dh->table[next].key != NULL &&
+	    dynhash_distance(dh, &dh->table[next], next) != 0;
+	    idx = next, next = (next + 1) & mask)
+		dh->table[idx] = dh->table[next];
+	dh->table[idx].key = NULL;
+	dh->table[idx].val = NULL;
+
 	assert(dh->table_count != 0);
 	dh->table_count--;
 
@@ -295,7 +335,8 @@ dynhash_iterate(dynhash_t dh, void (*iter_func)(void *, void *, void *),
 	dh->iterating = true;
 
 	for (i = 0; i < dh->table_length; i++) {
-		for (dhe = dh->table[i]; dhe != NULL; dhe = dhe->next)
+		dhe = &dh->table[i];
+		if (dhe->key != NULL)
 			iter_func(arg, dhe->key, dhe->val);
 	}
 
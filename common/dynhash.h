@@ -3,19 +3,27 @@
 #ifndef _DYNHASH_H_
 #define _DYNHASH_H_
 
-#define DYNHASH_INIT_LENGTH	1024
+#define DYNHASH_INIT_LENGTH	1024	/* must be a power of two */
 #define DYNHASH_BULGE_FACTOR	2
-
+#define DYNHASH_LOAD_PERCENT	75	/* expand beyond this load */
+
+/*
+ * Entries live in the table itself (open addressing, Robin Hood probing),
+ * an empty slot has a NULL key. The key's hash is kept next to it so that
+ * probing only compares keys whose hashes match, and expanding never calls
+ * the hash function again.
+ */
 struct dynhash_entry {
 	void		     *key;
 	void		     *val;
-	struct dynhash_entry *next;
+	uint32_t	      hash;
 };
 
 struct dynhash {
-	struct dynhash_entry  **table;
+	struct dynhash_entry   *table;
 	uint32_t		table_count;
 	uint32_t		table_length;
+	uint32_t		table_shift;	/* 32 - log2(table_length) */
 
 	uint32_t	       (*hashfn)(void *);
 	int		       (*keycmp)(void *, void *);
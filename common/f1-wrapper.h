@@ -26,9 +26,8 @@
 
 static int const f1_window_cache_size = 1048576;
 
-EXTERN(uint64_t, f1_calls_bypassed, 0);
-
 /* Thread-private */
+EXTERN(uint64_t, f1_calls_bypassed, 0);
 EXTERN(uint32_t, f1_hash_tag, 0);
 
 typedef struct f1_window_cache_entry {
@@ -37,7 +36,21 @@ typedef struct f1_window_cache_entry {
 } f1_window_cache_entry;
 EXTERN(struct f1_window_cache_entry *, f1_window_cache, NULL);
 
-#pragma omp threadprivate(f1_hash_tag, f1_window_cache)
+#pragma omp threadprivate(f1_calls_bypassed, f1_hash_tag, f1_window_cache)
+
+/*
+ * Shared by all threads (--f1-cache-power). The key is the genome window
+ * together with a 64-bit fingerprint of the read, so scores are reused across
+ * reads and threads. An entry holds data = (window hash << 32 | score) and
+ * check = read fingerprint ^ data; both words are read and written atomically,
+ * and an entry torn by two concurrent writers fails the check.
+ */
+typedef struct f1_shared_cache_entry {
+  uint64_t check;
+  uint64_t data;
+} f1_shared_cache_entry;
+EXTERN(struct f1_shared_cache_entry *, f1_shared_cache, NULL);
+EXTERN(int, f1_shared_cache_power, 0);
 
 
 /*
@@ -90,23 +103,85 @@ f1_stats(uint64_t *invocs, uint64_t *cells, double *secs, uint64_t *calls_bypass
 }
 
 
+/*
+ * 64-bit finalizer of MurmurHash3; a bijection.
+ */
+static inline uint64_t
+f1_mix64(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
+/*
+ * 64-bit fingerprint of a read for the shared cache, over the full 4-bit base
+ * codes (unlike hash_genome_window, it tells N from A).
+ */
+static inline uint64_t
+f1_read_fingerprint(uint32_t * read, int len)
+{
+  uint64_t fp = f1_mix64((uint64_t)len);
+  uint64_t buffer;
+  int i, j;
+
+  for (i = 0; i < len; i += 16) {
+    buffer = 0;
+    for (j = i; j < i + 16 && j < len; j++)
+      buffer = (buffer << 4) | EXTRACT(read, j);
+    fp = f1_mix64(fp ^ buffer) + 0x9e3779b97f4a7c15ULL;
+  }
+  return f1_mix64(fp);
+}
+
+/*
+ * Slot of the shared cache for a window hash and a read fingerprint.
+ */
+static inline uint64_t
+f1_shared_cache_slot(uint32_t window_hash, uint64_t read_fp)
+{
+  return f1_mix64(read_fp ^ ((uint64_t)window_hash * 0x9e3779b97f4a7c15ULL))
+    & ((1llu << f1_shared_cache_power) - 1);
+}
+
+
 /*
  * Run SW filter. Called independently by different threads.
- * If tag != 0, look up score in hash table.
+ * If tag != 0, look up score in hash table: the shared one if there is one,
+ * keyed with read_fp (non-zero, see f1_read_fingerprint); otherwise the one
+ * of this thread, keyed with tag.
  */
 static inline int
 f1_run(uint32_t * genome, int glen, int goff, int wlen, uint32_t * read, int rlen, int g_idx, int r_idx,
-       uint32_t * genome_ls, int init_bp, bool is_rna, uint tag, bool gapless)
+       uint32_t * genome_ls, int init_bp, bool is_rna, uint tag, uint64_t read_fp, bool gapless)
 {
   uint32_t hash_val = 0;
+  uint32_t window_hash = 0;
+  uint64_t slot = 0;
+  uint64_t check, data;
   int score;
   
   /* Look-up */
-  if (hash_filter_calls && tag != 0) {
+  if (hash_filter_calls && tag != 0 && f1_shared_cache != NULL) {
+    window_hash = hash_genome_window(genome, goff, wlen);
+    slot = f1_shared_cache_slot(window_hash, read_fp);
+#pragma omp atomic read
+    data = f1_shared_cache[slot].data;
+#pragma omp atomic read
+    check = f1_shared_cache[slot].check;
+
+    if ((check ^ data) == read_fp && (uint32_t)(data >> 32) == window_hash) { // Cache hit
+      f1_calls_bypassed++;
+
+      return (int)(uint32_t)data;
+    }
+  } else if (hash_filter_calls && tag != 0) {
     hash_val = hash_genome_window(genome, goff, wlen) % f1_window_cache_size;
 
     if (f1_window_cache[hash_val].tag == tag) { // Cache hit
-#pragma omp atomic
       f1_calls_bypassed++;
 
       return f1_window_cache[hash_val].score;
@@ -125,7 +200,13 @@ f1_run(uint32_t * genome, int glen, int goff, int wlen, uint32_t * read, int rle
   }
 
   /* Save */
-  if (hash_filter_calls && tag != 0) {
+  if (hash_filter_calls && tag != 0 && f1_shared_cache != NULL) {
+    data = ((uint64_t)window_hash << 32) | (uint32_t)score;
+#pragma omp atomic write
+    f1_shared_cache[slot].data = data;
+#pragma omp atomic write
+    f1_shared_cache[slot].check = read_fp ^ data;
+  } else if (hash_filter_calls && tag != 0) {
     f1_window_cache[hash_val].tag = tag;
     f1_window_cache[hash_val].score = score;
   }
@@ -508,6 +508,7 @@ fasta_get_next_read_with_range(fasta_t fasta, read_entry * re )
 		re->orig_qual=re->qual;
 #ifdef ENABLE_LOW_QUALITY_FILTER
         re->filter_qual = NULL;
+        re->filtered_kmers = NULL;
 #endif
 	}	
 
@@ -134,4 +134,82 @@ count_get_max(count_t * c) {
 }
 
 
+/*
+ * Log-linear histogram of non-negative values, after HDR histograms: every
+ * power of two is cut into HIST_SUB_BUCKETS buckets, so that percentiles are
+ * kept to within 1/HIST_SUB_BUCKETS of the value, whatever its size.
+ */
+#define HIST_SUB_BITS		3
+#define HIST_SUB_BUCKETS	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS		((63 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+typedef struct {
+  int64_t	count;
+  int64_t	max;
+  int64_t	bucket[HIST_BUCKETS];
+} hist_t;
+
+static inline int
+hist_bucket(int64_t val) {
+  if (val < HIST_SUB_BUCKETS)
+    return (int)val;
+
+  int shift = 63 - __builtin_clzll((uint64_t)val) - HIST_SUB_BITS;
+  return ((shift + 1) << HIST_SUB_BITS) + (int)((val >> shift) & (HIST_SUB_BUCKETS - 1));
+}
+
+/* Largest value that falls in bucket b */
+static inline int64_t
+hist_bucket_max(int b) {
+  if (b < 2 * HIST_SUB_BUCKETS)
+    return b;
+
+  int shift = (b >> HIST_SUB_BITS) - 1;
+  return ((int64_t)(HIST_SUB_BUCKETS + (b & (HIST_SUB_BUCKETS - 1))) << shift) + (((int64_t)1 << shift) - 1);
+}
+
+/* Add measurement; negative values are counted as 0 */
+static inline void
+hist_add(hist_t * h, int64_t val) {
+  assert(h != NULL);
+
+  if (val < 0)
+    val = 0;
+  h->bucket[hist_bucket(val)]++;
+  h->count++;
+  if (val > h->max)
+    h->max = val;
+}
+
+/* Add all measurements of src to dst */
+static inline void
+hist_merge(hist_t * dst, hist_t const * src) {
+  assert(dst != NULL && src != NULL);
+
+  for (int i = 0; i < HIST_BUCKETS; i++)
+    dst->bucket[i] += src->bucket[i];
+  dst->count += src->count;
+  if (src->max > dst->max)
+    dst->max = src->max;
+}
+
+/* Get the value below which p percent of the measurements fall */
+static inline int64_t
+hist_get_percentile(hist_t const * h, double p) {
+  assert(h != NULL);
+
+  int64_t target = (int64_t)ceil(p / 100.0 * (double)h->count);
+  int64_t seen = 0;
+
+  if (target < 1)
+    target = 1;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if (seen >= target)
+      return hist_bucket_max(i) < h->max ? hist_bucket_max(i) : h->max;
+  }
+  return h->max;
+}
+
+
 #endif
@@ -54,6 +54,22 @@ sw_gapless_stats(uint64_t * _invocs, uint64_t * _cells, uint64_t * _ticks)
     *_ticks = (uint64_t)count_get_count(&ticks);
 }
 
+/*
+ * Fetch the n <= 8 packed bases starting at base idx into the low nibbles of
+ * a word, the second word is only touched when the bases run into it.
+ */
+static inline uint32_t
+fetch_bases(uint32_t * packed, int idx, int n)
+{
+  int shift = 4 * (idx % 8);
+  uint32_t word = packed[idx / 8] >> shift;
+
+  if (shift != 0 && idx % 8 + n > 8)
+    word |= packed[idx / 8 + 1] << (32 - shift);
+
+  return word;
+}
+
 int
 sw_gapless(uint32_t * genome, int glen, uint32_t * read, int rlen, int g_idx, int r_idx,
 	   uint32_t * genome_ls, int init_bp, bool is_rna)
@@ -94,19 +110,42 @@ sw_gapless(uint32_t * genome, int glen, uint32_t * read, int rlen, int g_idx, in
 
   max_score = score;
 
+  /*
+   * Compare 8 bases a word at a time; the XOR of the packed words folds into
+   * one bit per mismatching nibble, so the score only needs stepping at the
+   * mismatches and the matches in between are added as a run.
+   */
   while (g_right < glen && r_right < rlen) {
-    score += (EXTRACT(genome, g_right) == EXTRACT(read, r_right)? match : mismatch);
+    int n = MIN(8, MIN(glen - g_right, rlen - r_right));
+    uint32_t diff = fetch_bases(genome, g_right, n) ^ fetch_bases(read, r_right, n);
+    int pos = 0;
+
+    diff |= diff >> 2;
+    diff |= diff >> 1;
+    diff &= 0x11111111;
+    if (n < 8)
+      diff &= (1u << (4 * n)) - 1;
+
+    while (diff != 0) {
+      int mm = __builtin_ctz(diff) / 4;
 
+      score += (mm - pos) * match;
+      if (score > max_score)
+	max_score = score;
+
+      score += mismatch;
+      if (score < 0)
+	score = 0;
+
+      pos = mm + 1;
+      diff &= diff - 1;
+    }
+    score += (n - pos) * match;
     if (score > max_score)
       max_score = score;
 
-    g_right++;
-    r_right++;
-    if (score < 0) {
-      g_left = g_right;
-      r_left = r_right;
-      score = 0;
-    }
+    g_right += n;
+    r_right += n;
   }
 
   count_add(&cells, rlen);
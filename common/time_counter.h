@@ -49,6 +49,15 @@ time_counter_get_secs(time_counter const * tc)
     return (double)tc->counter / 1.0e6;
 }
 
+static inline double
+time_counter_usecs_per_unit(time_counter const * tc)
+{
+  if (tc->type == 0)
+    return 1.0e6 / cpuhz();
+  else
+    return 1.0;
+}
+
 
 #define TIME_COUNTER_START(tc)			\
   long long int before = time_counter_check(&(tc));
@@ -7,6 +7,32 @@
 #include "seeds.h"
 
 #define MMAP_ALIGN 8
+#define MMAP_VERSION 2
+
+
+/*
+ * The Hflag word of saved indexes holds the hash table power of hashed (-H)
+ * indexes, and 0 otherwise. Hashed indexes saved before the kmer fingerprints
+ * were added hold 1.
+ */
+static inline uint32_t
+get_hash_word()
+{
+  return (Hflag? (uint32_t)hash_table_power : 0);
+}
+
+static void
+set_hash_word(uint32_t h, char const * file)
+{
+  if (h == 1)
+    crash(1, 0, "hashed index %s has no kmer fingerprints; please save it again with -S", file);
+  if (h != 0 && (h < MIN_HASH_TABLE_POWER || h > MAX_HASH_TABLE_POWER))
+    crash(1, 0, "invalid hash table power in %s: %u", file, h);
+
+  Hflag = (h != 0);
+  if (Hflag)
+    hash_table_power = (int)h;
+}
 
 
 /*
@@ -21,12 +47,14 @@ bool save_genome_map_seed(const char *file, int sn)
    * The file format is a gziped binary format as follows
    *
    * uint32_t				: shrimp_mode
-   * uint32_t				: Hflag
+   * uint32_t				: Hflag (hash table power, or 0)
    * seed_type			: Seed
    * uint32_t				: capacity
    * uint32_t * capacity	: genomemap_len
-   * uint32_t				: total (= sum from 0 to capacity - 1 of genomemap_len)
-   * uint32_t * total		: genomemap (each entry of length genomemap_len)
+   * uint32_t				: total (= sum from 0 to capacity - 1 of genomemap_len,
+   *						   plus GENOMEMAP_FP_WORDS of each if Hflag)
+   * uint32_t * total		: genomemap (each entry of length genomemap_len, followed
+   *						   by its fingerprints if Hflag)
    *
    */
   gzFile fp = gzopen(file, "wb");
@@ -40,27 +68,28 @@ bool save_genome_map_seed(const char *file, int sn)
   xgzwrite(fp, &m, sizeof(uint32_t));
 
   // Hflag
-  uint32_t h = (uint32_t)Hflag;
+  uint32_t h = get_hash_word();
   xgzwrite(fp, &h, sizeof(uint32_t));
 
   // Seed
   xgzwrite(fp, &seed[sn], sizeof(seed_type));
 
   // genomemap_len
-  uint32_t capacity = (uint32_t)power4(Hflag? HASH_TABLE_POWER : seed[sn].weight);
+  uint32_t capacity = (uint32_t)power4(Hflag? hash_table_power : seed[sn].weight);
   xgzwrite(fp, genomemap_len[sn], sizeof(genomemap_len[0][0]) * capacity);
 
   // total
   uint32_t total = 0;
   uint32_t j;
   for (j = 0; j < capacity; j++){
-    total += genomemap_len[sn][j];
+    total += genomemap_len[sn][j] + GENOMEMAP_FP_WORDS(genomemap_len[sn][j]);
   }
   xgzwrite(fp, &total, sizeof(uint32_t));
 
   // genome_map
   for (j = 0; j < capacity; j++) {
-    xgzwrite(fp, (void *)genomemap[sn][j], sizeof(genomemap[0][0][0]) * genomemap_len[sn][j]);
+    xgzwrite(fp, (void *)genomemap[sn][j],
+	     sizeof(genomemap[0][0][0]) * (genomemap_len[sn][j] + GENOMEMAP_FP_WORDS(genomemap_len[sn][j])));
   }
 
   gzclose(fp);
@@ -77,12 +106,14 @@ bool load_genome_map_seed(const char *file)
    * The file format is a gziped binary format as follows
    *
    * uint32_t				: shrimp_mode
-   * uint32_t				: Hflag
+   * uint32_t				: Hflag (hash table power, or 0)
    * seed_type			: Seed
    * uint32_t				: capacity
    * uint32_t * capacity	: genomemap_len
-   * uint32_t				: total (= sum from 0 to capacity - 1 of genomemap_len)
-   * uint32_t * total		: genomemap (each entry of length genomemap_len)
+   * uint32_t				: total (= sum from 0 to capacity - 1 of genomemap_len,
+   *						   plus GENOMEMAP_FP_WORDS of each if Hflag)
+   * uint32_t * total		: genomemap (each entry of length genomemap_len, followed
+   *						   by its fingerprints if Hflag)
    *
    */
   int i;
@@ -105,8 +136,8 @@ bool load_genome_map_seed(const char *file)
   // Hflag
   uint32_t h;
   xgzread(fp, &h, sizeof(uint32_t));
-  if (h != (uint32_t)Hflag){
-    fprintf(stderr,"Hash settings do not match in file %s\n",file);
+  if (h != get_hash_word()) {
+    crash(1, 0, "hash settings in seed file %s do not match the genome file", file);
   }
 
   // Seed
@@ -138,7 +169,7 @@ bool load_genome_map_seed(const char *file)
   avg_seed_span = avg_seed_span/n_seeds;
 
   // genomemap_len
-  uint32_t capacity = (uint32_t)power4(Hflag? HASH_TABLE_POWER : seed[sn].weight);
+  uint32_t capacity = (uint32_t)power4(Hflag? hash_table_power : seed[sn].weight);
   genomemap_len[sn] = (uint32_t *)
     //xmalloc_c(sizeof(genomemap_len[0][0]) * capacity, &mem_genomemap);
     my_malloc(sizeof(genomemap_len[0][0]) * capacity,
@@ -168,7 +199,7 @@ bool load_genome_map_seed(const char *file)
 
   for (j = 0; j < capacity; j++) {
     genomemap[sn][j] = ptr;
-    ptr += genomemap_len[sn][j];
+    ptr += genomemap_len[sn][j] + GENOMEMAP_FP_WORDS(genomemap_len[sn][j]);
   }
 
   gzclose(fp);
@@ -187,7 +218,7 @@ bool save_genome_map(const char *prefix)
    * The file format for the .genome file is a gziped binary format as follows
    *
    * uint32_t					: shrimp_mode
-   * uint32_t					: Hflag
+   * uint32_t					: Hflag (hash table power, or 0)
    * uint32_t 				: num_contigs
    * uint32_t * num_contigs	: genome_len (the length of each contig)
    * uint32_t * num_contigs	: contig_offsets
@@ -227,7 +258,7 @@ bool save_genome_map(const char *prefix)
   xgzwrite(fp,&m,sizeof(uint32_t));
 
   //Hflag
-  uint32_t h = (uint32_t)Hflag;
+  uint32_t h = get_hash_word();
   xgzwrite(fp,&h,sizeof(uint32_t));
 
   // num contigs
@@ -365,7 +396,7 @@ genome_load_map_save_mmap(char * map_name, char const * mmap_name)
   shrimp_mode = (shrimp_mode_t)_shrimp_mode;
 
   xgzread(genome_file, &_Hflag, sizeof(uint32_t));
-  Hflag = _Hflag;
+  set_hash_word(_Hflag, map_name);
   
   xgzread(genome_file, &num_contigs, sizeof(uint32_t));
 
@@ -405,7 +436,7 @@ genome_load_map_save_mmap(char * map_name, char const * mmap_name)
     }
 
     xgzread(seed_file[sn], &_Hflag, sizeof(uint32_t));
-    if (Hflag != _Hflag) {
+    if (_Hflag != get_hash_word()) {
       crash(1, 0, "Hflag in seed file %d does not match Hlag from genome file", sn);
     }
 
@@ -460,13 +491,14 @@ genome_load_map_save_mmap(char * map_name, char const * mmap_name)
     if (Hflag) {
       map_size += up_align(BPTO32BW(max_seed_span) * sizeof(uint32_t));
     }
-    capacity = power4(Hflag? HASH_TABLE_POWER : seed[sn].weight);
+    capacity = power4(Hflag? hash_table_power : seed[sn].weight);
     map_size += up_align(capacity * sizeof(genomemap_len[0][0]));
     map_size += up_align(capacity * sizeof(genomemap[0][0]));
   }
 
-  // for genomemap, in the worst case, each location appears once for every seed
-  map_size += up_align((size_t)total_len * (size_t)n_seeds * sizeof(uint32_t));
+  // for genomemap, in the worst case, each location appears once for every seed,
+  // and with Hflag, in a list of its own with a word of fingerprints
+  map_size += up_align((size_t)total_len * (size_t)n_seeds * sizeof(uint32_t) * (Hflag? 2 : 1));
 
   fprintf(stderr, "Allocating map of size: %.3gG\n", (double)map_size/(1024.0 * 1024.0 * 1024.0));
 
@@ -482,10 +514,11 @@ genome_load_map_save_mmap(char * map_name, char const * mmap_name)
 
   h->map_start = h;
   h->map_end = (char *)h + map_size;
-  h->map_version = 1;
+  h->map_version = MMAP_VERSION;
 
   h->shrimp_mode = shrimp_mode;
   h->Hflag = Hflag;
+  h->hash_table_power = hash_table_power;
   h->num_contigs = num_contigs;
   h->n_seeds = n_seeds;
   h->min_seed_span = min_seed_span;
@@ -567,7 +600,7 @@ genome_load_map_save_mmap(char * map_name, char const * mmap_name)
   add_to_mmap((char*)&h->genomemap_len, &crt_end, n_seeds * sizeof(genomemap_len[0]));
   add_to_mmap((char*)&h->genomemap, &crt_end, n_seeds * sizeof(genomemap[0]));
   for (sn = 0; sn < n_seeds; sn++) {
-    capacity = power4(Hflag? HASH_TABLE_POWER : seed[sn].weight);
+    capacity = power4(Hflag? hash_table_power : seed[sn].weight);
 
     add_to_mmap((char*)&h->genomemap_len[sn], &crt_end, capacity * sizeof(genomemap_len[0][0]));
     xgzread(seed_file[sn], h->genomemap_len[sn], capacity * sizeof(genomemap_len[0][0]));
@@ -584,7 +617,7 @@ genome_load_map_save_mmap(char * map_name, char const * mmap_name)
     uint32_t * ptr = (uint32_t *)h->genomemap[sn][0];
     for (size_t j = 0; j < capacity; j++) {
       h->genomemap[sn][j] = ptr;
-      ptr += h->genomemap_len[sn][j];
+      ptr += h->genomemap_len[sn][j] + GENOMEMAP_FP_WORDS(h->genomemap_len[sn][j]);
     }
   }
 
@@ -616,6 +649,10 @@ bool genome_load_mmap(char const * mmap_name)
   if ((h = (map_header *)mmap(NULL, sizeof(map_header), PROT_READ, MAP_PRIVATE, shm_fd, 0)) == MAP_FAILED) {
     crash(1, 1, "could not read map header from mmap file %s", mmap_name);
   }
+  if (h->map_version != MMAP_VERSION) {
+    crash(1, 0, "mmap file %s is of version %d, expected %d; please save it again", mmap_name,
+	  h->map_version, MMAP_VERSION);
+  }
   map_start = h->map_start;
   map_end = h->map_end;
   fprintf(stderr, "\nLoading shared memory index [%s] of size %.3gG\n", mmap_name,
@@ -629,6 +666,7 @@ bool genome_load_mmap(char const * mmap_name)
 
   shrimp_mode = h->shrimp_mode;
   Hflag = h->Hflag;
+  hash_table_power = h->hash_table_power;
   num_contigs = h->num_contigs;
   n_seeds = h->n_seeds;
   min_seed_span = h->min_seed_span;
@@ -676,7 +714,7 @@ bool load_genome_map(const char *file)
    * The file format for the .genome file is a gziped binary format as follows
    *
    * uint32_t					: shrimp_mode
-   * uint32_t					: Hflag
+   * uint32_t					: Hflag (hash table power, or 0)
    * uint32_t 				: num_contigs
    * uint32_t * num_contigs	: genome_len (the length of each contig)
    * uint32_t * num_contigs	: contig_offsets
@@ -711,7 +749,7 @@ bool load_genome_map(const char *file)
   //Hflag
   uint32_t h;
   xgzread(fp, &h, sizeof(uint32_t));
-  Hflag = h;
+  set_hash_word(h, file);
 
   // num_contigs
   xgzread(fp, &num_contigs, sizeof(uint32_t));
@@ -847,7 +885,7 @@ void print_genomemap_stats()
   fprintf(stderr, "Genome Map stats:\n");
 
   for (sn = 0; sn < n_seeds; sn++) {
-    capacity = (uint32_t)power4(Hflag? HASH_TABLE_POWER : seed[sn].weight);
+    capacity = (uint32_t)power4(Hflag? hash_table_power : seed[sn].weight);
 
     stat_init(&list_size);
     stat_init(&list_size_non0);
@@ -908,7 +946,7 @@ void free_genome(void)
   uint32_t j, capacity;
 
   for (sn = 0; sn < n_seeds; sn++){
-    capacity = (uint32_t)power4(Hflag? HASH_TABLE_POWER : seed[sn].weight);
+    capacity = (uint32_t)power4(Hflag? hash_table_power : seed[sn].weight);
     //uint32_t mapidx = kmer_to_mapidx(kmerWindow, sn);
     if (load_file != NULL) {
       my_free(genomemap_block[sn].ptr, genomemap_block[sn].sz,
@@ -917,7 +955,8 @@ void free_genome(void)
       for (j = 0; j < capacity; j++) {
 	if (genomemap[sn][j] != NULL) {
 	  //free(genomemap[sn][j]);
-	  my_free(genomemap[sn][j], genomemap_len[sn][j] * sizeof(genomemap[0][0][0]),
+	  my_free(genomemap[sn][j],
+		  (genomemap_len[sn][j] + GENOMEMAP_FP_WORDS(genomemap_len[sn][j])) * sizeof(genomemap[0][0][0]),
 		  &mem_genomemap, "genomemap[%d][%u]", sn, j);
 	}
       }
@@ -1031,7 +1070,7 @@ bool load_genome(char **files, int nfiles)
 	      &mem_genomemap, "genomemap_len");
 
   for (sn = 0; sn < n_seeds; sn++) {
-    capacity = (uint32_t)power4(Hflag? HASH_TABLE_POWER : seed[sn].weight);
+    capacity = (uint32_t)power4(Hflag? hash_table_power : seed[sn].weight);
 
     genomemap[sn] = (uint32_t **)
       //xcalloc_c(sizeof(uint32_t *) * capacity, &mem_genomemap);
@@ -1153,14 +1192,27 @@ bool load_genome(char **files, int nfiles)
 	  if (load < seed[sn].span)
 	    continue;
 
-	  uint32_t mapidx = KMER_TO_MAPIDX(kmerWindow, sn);
+	  uint64_t h = 0;
+	  uint32_t mapidx;
+	  if (Hflag) {
+	    h = kmer_hash(kmerWindow, sn);
+	    mapidx = KMER_HASH_TO_MAPIDX(h);
+	  } else {
+	    mapidx = kmer_to_mapidx_orig(kmerWindow, sn);
+	  }
 	  //increase the match count and store the location of the match
-	  genomemap_len[sn][mapidx]++;
+	  uint32_t len = ++genomemap_len[sn][mapidx];
 	  genomemap[sn][mapidx] = (uint32_t *)
 	    //xrealloc_c(genomemap[sn][mapidx], sizeof(uint32_t) * (genomemap_len[sn][mapidx]), sizeof(uint32_t) * (genomemap_len[sn][mapidx] - 1), &mem_genomemap);
-	    my_realloc(genomemap[sn][mapidx], sizeof(uint32_t) * (genomemap_len[sn][mapidx]), sizeof(uint32_t) * (genomemap_len[sn][mapidx] - 1),
+	    my_realloc(genomemap[sn][mapidx], sizeof(uint32_t) * (len + GENOMEMAP_FP_WORDS(len)),
+		       sizeof(uint32_t) * (len - 1 + GENOMEMAP_FP_WORDS(len - 1)),
 		       &mem_genomemap, "genomemap[%d][%u]", sn, mapidx);
-	  genomemap[sn][mapidx][genomemap_len[sn][mapidx] - 1] = i - seed[sn].span + 1;
+	  if (Hflag) {
+	    // the fingerprints follow the postings: shift them over by one posting
+	    memmove(genomemap[sn][mapidx] + len, genomemap[sn][mapidx] + len - 1, len - 1);
+	    genomemap_fp(sn, mapidx)[len - 1] = KMER_HASH_TO_FP(h);
+	  }
+	  genomemap[sn][mapidx][len - 1] = i - seed[sn].span + 1;
 
 	}
       }
@@ -1191,7 +1243,7 @@ void trim_genome()
   uint32_t mapidx, capacity;
 
   for (sn = 0; sn < n_seeds; sn++) {
-    capacity = (uint32_t)power4(Hflag? HASH_TABLE_POWER : seed[sn].weight);
+    capacity = (uint32_t)power4(Hflag? hash_table_power : seed[sn].weight);
 
     for (mapidx = 0; mapidx < capacity; mapidx++) {
       if (genomemap_len[sn][mapidx] > list_cutoff) {
@@ -12,6 +12,8 @@
 #define DEF_MAX_THREADS		100
 #define DEF_CHUNK_SIZE		1000
 #define DEF_PROGRESS		100000
+#define DEF_METRICS_INTERVAL	10	// seconds between live metrics snapshots
+#define DEF_SLOW_READ_USECS	100000	// reads taking longer go to --slow-reads
 #define USE_PREFETCH
 
 #define DEF_HASH_FILTER_CALLS	true
@@ -21,6 +23,7 @@
 #define DEF_USE_REGIONS		true
 #define DEF_REGION_BITS		11
 #define DEF_REGION_OVERLAP	50
+#define DEF_SPARSE_REGIONS	false
 
 #define DEF_ANCHOR_LIST_BIG_GAP	1024
 
@@ -29,6 +32,11 @@
 #define DEF_MAX_INSERT_SIZE	1000
 #define DEF_INSERT_SIZE_MEAN	200
 #define DEF_INSERT_SIZE_STDDEV	100
+#define DEF_MATE_RESCUE		false
+#define DEF_LEARN_INSERT_SIZE	0	// pairs to learn insert sizes from; 0 = don't
+#define DEF_DUP_CACHE_SIZE	0	// distinct reads remembered per thread; 0 = don't
+#define MIN_F1_CACHE_POWER	10	// shared vector SW cache of 2^n entries
+#define MAX_F1_CACHE_POWER	32
 
 #define DEF_WINDOW_LEN		140.0
 #define DEF_WINDOW_OVERLAP	90.0
@@ -155,7 +163,19 @@
 	{"local",0,0,124},\
 	{"no-qv-check",0,0,123},\
 	{"ignore-qvs",0,0,125},\
-	{"enable-seed-qual-filter", 0, 0, 126}\
+	{"enable-seed-qual-filter", 0, 0, 126},\
+	{"sam-read-ordinals",0,0,127},\
+	{"stats-file",1,0,128},\
+	{"metrics",1,0,129},\
+	{"metrics-interval",1,0,130},\
+	{"slow-reads",1,0,131},\
+	{"slow-read-usecs",1,0,132},\
+	{"sparse-regions",0,0,133},\
+	{"hash-power",1,0,134},\
+	{"mate-rescue",0,0,135},\
+	{"learn-insert-size",1,0,136},\
+	{"dup-cache",1,0,137},\
+	{"f1-cache-power",1,0,138}\
 }
 
 #define DEF_COLOUR_SPACE_OPTIONS \
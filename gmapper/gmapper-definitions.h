@@ -38,6 +38,31 @@ typedef struct ptr_and_sz {
   size_t sz;
 } ptr_and_sz;
 
+/* --al/--un read dumps */
+#define READ_DUMP_AL	0
+#define READ_DUMP_UN	1
+
+typedef struct read_dump {
+  char * buffer;
+  size_t size;
+  size_t filled;
+} read_dump;
+
+/* what mapping a read added to the global counters, replayed for its duplicates */
+typedef struct read_tally {
+  llint reads_matched;
+  llint reads_matched_conf;
+  llint reads_dropped;
+  llint single_matches;
+  llint dup_single_matches;
+} read_tally;
+
+/* output of a thread chunk, waiting for its turn to be printed */
+typedef struct output_chunk {
+  ptr_and_sz out;
+  ptr_and_sz dump[2];
+} output_chunk;
+
 /* pair mode */
 #define PAIR_NONE	0
 #define PAIR_OPP_IN	1
@@ -51,7 +76,9 @@ typedef struct ptr_and_sz {
 #define MAX_SEED_SPAN		64
 #define MAX_HASH_SEED_WEIGHT	64
 #define MAX_HASH_SEED_SPAN	64
-#define HASH_TABLE_POWER	12	/* 4^HASH_POWER entries in table */
+#define HASH_TABLE_POWER	12	/* default; 4^hash_table_power entries in table */
+#define MIN_HASH_TABLE_POWER	8
+#define MAX_HASH_TABLE_POWER	15
 
 /* Use positioned seeds (apply seeds only on certain positions on the read) */
 #define ENABLE_SEED_POSITIONS
@@ -93,10 +120,13 @@ typedef struct read_entry {
   char *	orig_qual;
 #ifdef ENABLE_LOW_QUALITY_FILTER
   char *    filter_qual;
+  uint32_t *	filtered_kmers;	/* with SQFflag, bit per mapidx entry: kmer dropped by the quality filter */
 #endif
   char *        plus_line; //The '+' line in fastq
   uint32_t *    read[2];        /* the read as a bitstring */
   uint32_t *    mapidx[2];      /* per-seed list of mapidxs in read */
+  uint8_t *	mapidx_fp[2];	/* with -H, the kmer fingerprints of those */
+  uint64_t	f1_fp[2];	/* fingerprints of read[] for the shared f1 cache; 0 = not computed */
   struct anchor *       anchors[2];     /* list of anchors */
   struct read_hit *     hits[2];        /* list of hits */
   struct range_restriction * ranges;
@@ -132,6 +162,7 @@ typedef struct read_entry {
   bool		paired;
   bool		first_in_pair;
   bool		mapped;
+  llint		read_ordinal;	/* index of the read (pair) in the input */
   struct read_entry * mate_pair;
 } read_entry;
 
@@ -296,6 +327,20 @@ typedef struct pairing_options {
   bool		save_outputs;
 } pairing_options;
 
+/*
+ * Insert size distribution learned from the first confidently paired reads.
+ * The learned window is the mean +- INSERT_SIZE_SIGMAS standard deviations.
+ */
+#define INSERT_SIZE_SIGMAS 4
+
+typedef struct insert_size_model {
+  double	mean;
+  double	stddev;
+  int		min_insert_size;
+  int		max_insert_size;
+  int		n_samples;		// samples kept after discarding outliers
+} insert_size_model;
+
 typedef struct readpair_mapping_options_t {
   // initial computation of region counts controlled by global flag
 
@@ -314,6 +359,7 @@ typedef struct map_header {
 
   shrimp_mode_t	shrimp_mode;
   bool		Hflag;
+  int		hash_table_power;
   int		num_contigs;
   int		n_seeds;
   int		min_seed_span;
@@ -27,6 +27,8 @@
 #include "../gmapper/seeds.h"
 #include "../gmapper/genome.h"
 #include "../gmapper/mapping.h"
+#include "../gmapper/metrics.h"
+#include "../gmapper/output.h"
 
 #include "../common/hash.h"
 #include "../common/fasta.h"
@@ -49,7 +51,7 @@ typedef struct ptr_and_sz {
 } ptr_and_sz;
 */
 //DEF_HEAP(uint32_t, char *, out)
-DEF_HEAP(uint32_t, struct ptr_and_sz, out)
+DEF_HEAP(uint32_t, struct output_chunk, out)
 
 
 
@@ -93,6 +95,9 @@ read_free(struct read_entry * re)
     if (re->filter_qual) {
       free(re->filter_qual);
     }
+    if (re->filtered_kmers) {
+      free(re->filtered_kmers);
+    }
 #endif
     assert(re->plus_line!=NULL);
     free(re->plus_line);
@@ -113,6 +118,10 @@ read_free_full(struct read_entry * re, count_t * counter)
     my_free(re->mapidx[0], n_seeds * re->max_n_kmers * sizeof(re->mapidx[0][0]), counter, "mapidx [%s]", re->name);
   if (re->mapidx[1] != NULL)
     my_free(re->mapidx[1], n_seeds * re->max_n_kmers * sizeof(re->mapidx[0][0]), counter, "mapidx [%s]", re->name);
+  if (re->mapidx_fp[0] != NULL)
+    my_free(re->mapidx_fp[0], n_seeds * re->max_n_kmers * sizeof(re->mapidx_fp[0][0]), counter, "mapidx_fp [%s]", re->name);
+  if (re->mapidx_fp[1] != NULL)
+    my_free(re->mapidx_fp[1], n_seeds * re->max_n_kmers * sizeof(re->mapidx_fp[0][0]), counter, "mapidx_fp [%s]", re->name);
 
   read_free_hit_list(re, counter);
   read_free_anchor_list(re, counter);
@@ -285,6 +294,42 @@ static void trim_read(struct read_entry * re) {
 	return;
 }
 
+/*
+ * Print the SAM output and the read dumps of one chunk, then free them
+ */
+static void
+output_chunk_print(struct output_chunk * oc)
+{
+  int k;
+
+  fprintf(stdout, "%s", (char *)oc->out.ptr);
+  my_free(oc->out.ptr, oc->out.sz,
+	  &mem_thread_buffer, "thread_output_buffer[]");
+  for (k = 0; k < 2; k++) {
+    if (oc->dump[k].ptr == NULL)
+      continue;
+    fwrite(oc->dump[k].ptr, 1, oc->dump[k].sz, k == READ_DUMP_AL? aligned_reads_file : unaligned_reads_file);
+    my_free(oc->dump[k].ptr, oc->dump[k].sz,
+	    &mem_thread_buffer, "thread_read_dump[]");
+  }
+}
+
+/*
+ * Close a read dump; a gzip dump with no reads still gets an (empty) member
+ */
+static void
+read_dump_close(FILE * file, bool gzip)
+{
+  static unsigned char const empty_gzip[] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03,
+    0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+  };
+
+  if (gzip && ftell(file) == 0)
+    fwrite(empty_gzip, 1, sizeof(empty_gzip), file);
+  fclose(file);
+}
+
 /*
  * Launch the threads that will scan the reads
  */
@@ -312,11 +357,20 @@ launch_scan_threads(fasta_t fasta, fasta_t left_fasta, fasta_t right_fasta)
   thread_output_buffer_chunk = (unsigned int *)
     my_calloc(num_threads * sizeof(unsigned int),
 	      &mem_thread_buffer, "thread_output_buffer_chunk");
+  if (aligned_reads_file != NULL)
+    thread_read_dump[READ_DUMP_AL] = (struct read_dump *)
+      my_calloc(num_threads * sizeof(struct read_dump),
+		&mem_thread_buffer, "thread_read_dump");
+  if (unaligned_reads_file != NULL)
+    thread_read_dump[READ_DUMP_UN] = (struct read_dump *)
+      my_calloc(num_threads * sizeof(struct read_dump),
+		&mem_thread_buffer, "thread_read_dump");
   
   unsigned int current_thread_chunk = 1;
   unsigned int next_chunk_to_print = 1;
   struct heap_out h; 
   heap_out_init(&h, thread_output_heap_capacity );
+  metrics_output_chunks = &h.load;
 
   if (progress > 0) {
     fprintf(stderr, "done r/hr r/core-hr\n");
@@ -332,19 +386,27 @@ launch_scan_threads(fasta_t fasta, fasta_t left_fasta, fasta_t right_fasta)
     //llint before, after;
     //re_buffer = (struct read_entry *)xmalloc_m(chunk_size * sizeof(re_buffer[0]), "re_buffer");
     re_buffer = (read_entry *)my_malloc(chunk_size * sizeof(re_buffer[0]), &mem_thread_buffer, "re_buffer");
+    if (metrics_tpg != NULL)
+      metrics_tpg[thread_id] = &tpg;
 
     while (read_more) {
       memset(re_buffer, 0, chunk_size * sizeof(re_buffer[0]));
 
       //before = rdtsc();
       TIME_COUNTER_START(tpg.wait_tc);
+      if (metrics_tpg != NULL) {
+#pragma omp atomic
+	metrics_threads_waiting++;
+      }
 
       //Read in this threads 'chunk'
 #pragma omp critical (fill_reads_buffer)
       {
 	//after = rdtsc();
 	//tpg.wait_ticks += MAX(after - before, 0);
+	llint waited = tpg.wait_tc.counter;
 	TIME_COUNTER_STOP(tpg.wait_tc);
+	hist_add(&tpg.wait_hist, tpg.wait_tc.counter - waited);
 
 	thread_output_buffer_chunk[thread_id]=current_thread_chunk++;
 
@@ -355,6 +417,7 @@ launch_scan_threads(fasta_t fasta, fasta_t left_fasta, fasta_t right_fasta)
 	  //				 &re_buffer[load].range_string, &re_buffer[load].qual))
 	  if (single_reads_file) { 
 	    if (fasta_get_next_read_with_range(fasta, &re_buffer[load])) {
+	      re_buffer[load].read_ordinal = (pair_mode == PAIR_NONE ? nreads + load : (nreads + load) / 2);
 	      load++;
 	    } else { 
 	      read_more = false;
@@ -362,12 +425,14 @@ launch_scan_threads(fasta_t fasta, fasta_t left_fasta, fasta_t right_fasta)
 	  } else {
 	    //read from the left file
 	    if (fasta_get_next_read_with_range(left_fasta, &re_buffer[load])) {
+	      re_buffer[load].read_ordinal = (pair_mode == PAIR_NONE ? nreads + load : (nreads + load) / 2);
 	      load++;
 	    } else {
 	      more_in_left_file = false;
 	    }
 	    //read from the right file
 	    if (fasta_get_next_read_with_range(right_fasta, &re_buffer[load])) {
+	      re_buffer[load].read_ordinal = (pair_mode == PAIR_NONE ? nreads + load : (nreads + load) / 2);
 	      load++;
 	    } else {
 	      more_in_right_file = false;
@@ -398,6 +463,10 @@ launch_scan_threads(fasta_t fasta, fasta_t left_fasta, fasta_t right_fasta)
 	  nreads_mod %= progress;
 	}
       } // end critical section
+      if (metrics_tpg != NULL) {
+#pragma omp atomic
+	metrics_threads_waiting--;
+      }
 
       if (pair_mode != PAIR_NONE)
 	assert(load % 2 == 0); // read even number of reads
@@ -586,24 +655,29 @@ launch_scan_threads(fasta_t fasta, fasta_t left_fasta, fasta_t right_fasta)
 	my_realloc(thread_output_buffer[thread_id], new_size, thread_output_buffer_sizes[thread_id],
 		   &mem_thread_buffer, "thread_output_buffer[]");
 
+      // read dumps are compressed here, outside the critical section
+      struct output_chunk oc;
+      oc.dump[READ_DUMP_AL].ptr = oc.dump[READ_DUMP_UN].ptr = NULL;
+      if (aligned_reads_file != NULL)
+	read_dump_take(READ_DUMP_AL, &oc.dump[READ_DUMP_AL]);
+      if (unaligned_reads_file != NULL)
+	read_dump_take(READ_DUMP_UN, &oc.dump[READ_DUMP_UN]);
+
       //fprintf(stdout,"%s",thread_output_buffer[thread_id]);
 #pragma omp critical
       {
 	struct heap_out_elem tmp;
 	tmp.key = thread_output_buffer_chunk[thread_id];
 	//tmp.rest = thread_output_buffer[thread_id];
-	tmp.rest.ptr = thread_output_buffer[thread_id];
-	tmp.rest.sz = new_size; //thread_output_buffer_sizes[thread_id];
+	tmp.rest = oc;
+	tmp.rest.out.ptr = thread_output_buffer[thread_id];
+	tmp.rest.out.sz = new_size; //thread_output_buffer_sizes[thread_id];
 	thread_output_buffer[thread_id] = NULL;	
 	heap_out_insert(&h, &tmp);
 	heap_out_get_min(&h, &tmp);
 	while (h.load > 0 && tmp.key == next_chunk_to_print) {
 	  heap_out_extract_min(&h, &tmp);
-	  //fprintf(stdout, "%s", tmp.rest);
-	  fprintf(stdout, "%s", (char *)tmp.rest.ptr);
-	  //free(tmp.rest);
-	  my_free(tmp.rest.ptr, tmp.rest.sz,
-		  &mem_thread_buffer, "thread_output_buffer[]");
+	  output_chunk_print(&tmp.rest);
 	  next_chunk_to_print++;
 	}
       }
@@ -612,6 +686,11 @@ launch_scan_threads(fasta_t fasta, fasta_t left_fasta, fasta_t right_fasta)
     //free(re_buffer);
     my_free(re_buffer, chunk_size * sizeof(re_buffer[0]),
 	    &mem_thread_buffer, "re_buffer");
+    for (int k = 0; k < 2; k++) {
+      if (thread_read_dump[k] != NULL && thread_read_dump[k][thread_id].buffer != NULL)
+	my_free(thread_read_dump[k][thread_id].buffer, thread_read_dump[k][thread_id].size,
+		&mem_thread_buffer, "thread_read_dump[]");
+    }
   } // end parallel section
 
   if (progress > 0)
@@ -622,12 +701,10 @@ launch_scan_threads(fasta_t fasta, fasta_t left_fasta, fasta_t right_fasta)
   struct heap_out_elem tmp;
   while (h.load>0) {
     heap_out_extract_min(&h,&tmp);
-    fprintf(stdout,"%s",(char *)tmp.rest.ptr);
-    //free(tmp.rest);
-    my_free(tmp.rest.ptr, tmp.rest.sz,
-	    &mem_thread_buffer, "thread_output_buffer[]");
+    output_chunk_print(&tmp.rest);
   }
   
+  metrics_output_chunks = NULL;
   heap_out_destroy(&h);
 
   //free(thread_output_buffer_sizes);
@@ -642,6 +719,13 @@ launch_scan_threads(fasta_t fasta, fasta_t left_fasta, fasta_t right_fasta)
   //free(thread_output_buffer_chunk);
   my_free(thread_output_buffer_chunk, sizeof(unsigned int) * num_threads,
 	  &mem_thread_buffer, "thread_output_buffer_chunk");
+  for (int k = 0; k < 2; k++) {
+    if (thread_read_dump[k] != NULL) {
+      my_free(thread_read_dump[k], num_threads * sizeof(struct read_dump),
+	      &mem_thread_buffer, "thread_read_dump");
+      thread_read_dump[k] = NULL;
+    }
+  }
 
   return true;
 }
@@ -689,8 +773,146 @@ typedef struct tp_stats_t {
   double anchor_list_secs, hit_list_secs;
   double region_counts_secs, mp_region_counts_secs, duplicate_removal_secs;
   double pass1_secs, get_vector_hits_secs, pass2_secs;
+  uint64_t f1_calls_bypassed;
 } tp_stats_t;
 
+/*
+ * Per-read latency histograms, in the order they are reported: the whole
+ * read, the wait for a chunk of reads, then the stages of a read.
+ */
+#define N_LATENCY_HISTS (N_READ_STAGES + 2)
+
+static inline char const *
+latency_key(int i)
+{
+  return i == 0 ? "read" : i == 1 ? "wait" : read_stage_keys[i - 2];
+}
+static char const * const latency_names[N_LATENCY_HISTS] = {
+  "Read Handling:", "Chunk Wait:", "Region Counts:", "MP Region Counts:", "Anchor List:", "Hit List:",
+  "Pass1:", "Vector Hits:", "Pass2:", "Duplicate Removal:"
+};
+
+static void
+dump_int(FILE * fp, bool json, char const * key, int64_t val)
+{
+  if (json)
+    fprintf(fp, "%s\n  \"%s\": %" PRId64, ftell(fp) == 0 ? "{" : ",", key, val);
+  else
+    fprintf(fp, "%s\t%" PRId64 "\n", key, val);
+}
+
+static void
+dump_real(FILE * fp, bool json, char const * key, double val)
+{
+  if (json)
+    fprintf(fp, "%s\n  \"%s\": %.6f", ftell(fp) == 0 ? "{" : ",", key, val);
+  else
+    fprintf(fp, "%s\t%.6f\n", key, val);
+}
+
+/*
+ * Write the statistics to stats_file, one key and value per line: as a flat
+ * JSON object if the file name ends in ".json", as TSV otherwise.
+ */
+static void
+dump_statistics(tp_stats_t const * tps, tpg_t const * tpgA,
+		hist_t const * lat_hist, double const * lat_scale)
+{
+  FILE * fp;
+  size_t len = strlen(stats_file);
+  bool json = len >= 5 && strcmp(stats_file + len - 5, ".json") == 0;
+  char key[64];
+  uint64_t f1_invocs = 0, f1_cells = 0, f1_calls_bypassed = 0, f2_invocs = 0, f2_cells = 0;
+  uint64_t anchors_fp_discarded = 0;
+  double f1_secs = 0, f2_secs = 0;
+  int i;
+
+  fp = fopen(stats_file, "w");
+  if (fp == NULL)
+    crash(1, 1, "cannot open statistics file [%s]", stats_file);
+
+  for (i = 0; i < num_threads; i++) {
+    f1_invocs += tps[i].f1_invocs;
+    f1_cells += tps[i].f1_cells;
+    f1_calls_bypassed += tps[i].f1_calls_bypassed;
+    f1_secs += tps[i].f1_secs;
+    f2_invocs += tps[i].f2_invocs;
+    f2_cells += tps[i].f2_cells;
+    f2_secs += tps[i].f2_secs;
+    anchors_fp_discarded += tpgA[i].n_anchors_fp_discarded;
+  }
+
+  if (json)
+    fprintf(fp, "{\n  \"version\": \"%s\"", SHRIMP_VERSION_STRING);
+  else
+    fprintf(fp, "version\t%s\n", SHRIMP_VERSION_STRING);
+  dump_int(fp, json, "threads", num_threads);
+  dump_int(fp, json, "reads", nreads);
+  dump_real(fp, json, "load_genome_secs", (double)load_genome_usecs / 1.0e6);
+  dump_real(fp, json, "mapping_secs", (double)mapping_wallclock_usecs / 1.0e6);
+  dump_real(fp, json, "reads_per_hour", mapping_wallclock_usecs == 0 ? 0 :
+	    ((double)nreads / (double)mapping_wallclock_usecs) * 3600.0 * 1.0e6);
+  dump_int(fp, json, "reads_matched", total_reads_matched);
+  dump_int(fp, json, "pairs_matched", total_pairs_matched);
+  if (pair_mode == PAIR_NONE)
+    dump_int(fp, json, "reads_unseeded", total_reads_unseeded);
+  else
+    dump_int(fp, json, "pairs_unseeded", total_pairs_unseeded);
+  if (mate_rescue)
+    dump_int(fp, json, "pairs_rescued", total_pairs_rescued);
+  if (dup_cache_size > 0)
+    dump_int(fp, json, "reads_memoized", total_reads_memoized);
+  if (learned_insert_size != NULL) {
+    dump_real(fp, json, "insert_size_mean", learned_insert_size->mean);
+    dump_real(fp, json, "insert_size_stddev", learned_insert_size->stddev);
+    dump_int(fp, json, "insert_size_min", learned_insert_size->min_insert_size);
+    dump_int(fp, json, "insert_size_max", learned_insert_size->max_insert_size);
+  }
+  if (Hflag)
+    dump_int(fp, json, "anchors_fp_discarded", anchors_fp_discarded);
+  dump_int(fp, json, "f1_invocations", f1_invocs);
+  dump_int(fp, json, "f1_cells", f1_cells);
+  dump_int(fp, json, "f1_calls_bypassed", f1_calls_bypassed);
+  dump_real(fp, json, "f1_secs", f1_secs);
+  dump_int(fp, json, "f2_invocations", f2_invocs);
+  dump_int(fp, json, "f2_cells", f2_cells);
+  dump_real(fp, json, "f2_secs", f2_secs);
+
+  for (i = 0; i < N_LATENCY_HISTS; i++) {
+    sprintf(key, "latency.%s.count", latency_key(i));
+    dump_int(fp, json, key, lat_hist[i].count);
+    sprintf(key, "latency.%s.p50_usecs", latency_key(i));
+    dump_real(fp, json, key, hist_get_percentile(&lat_hist[i], 50) * lat_scale[i]);
+    sprintf(key, "latency.%s.p90_usecs", latency_key(i));
+    dump_real(fp, json, key, hist_get_percentile(&lat_hist[i], 90) * lat_scale[i]);
+    sprintf(key, "latency.%s.p99_usecs", latency_key(i));
+    dump_real(fp, json, key, hist_get_percentile(&lat_hist[i], 99) * lat_scale[i]);
+    sprintf(key, "latency.%s.max_usecs", latency_key(i));
+    dump_real(fp, json, key, lat_hist[i].max * lat_scale[i]);
+  }
+
+  for (i = 0; i < num_threads; i++) {
+    sprintf(key, "thread.%d.f1_invocations", i);
+    dump_int(fp, json, key, tps[i].f1_invocs);
+    sprintf(key, "thread.%d.f1_cells", i);
+    dump_int(fp, json, key, tps[i].f1_cells);
+    sprintf(key, "thread.%d.f1_calls_bypassed", i);
+    dump_int(fp, json, key, tps[i].f1_calls_bypassed);
+    sprintf(key, "thread.%d.f2_cells", i);
+    dump_int(fp, json, key, tps[i].f2_cells);
+    sprintf(key, "thread.%d.reads", i);
+    dump_int(fp, json, key, tpgA[i].read_handle_hist.count);
+    sprintf(key, "thread.%d.read_handle_secs", i);
+    dump_real(fp, json, key, (double)tpgA[i].read_handle_usecs / 1.0e6);
+    sprintf(key, "thread.%d.wait_secs", i);
+    dump_real(fp, json, key, time_counter_get_secs(&tpgA[i].wait_tc));
+  }
+
+  if (json)
+    fprintf(fp, "\n}\n");
+  fclose(fp);
+}
+
 static void
 print_statistics()
 {
@@ -733,7 +955,7 @@ print_statistics()
 
     memcpy(&tpgA[tid], &tpg, sizeof(tpg_t));
 
-    f1_stats(&tps[tid].f1_invocs, &tps[tid].f1_cells, &tps[tid].f1_secs, NULL);
+    f1_stats(&tps[tid].f1_invocs, &tps[tid].f1_cells, &tps[tid].f1_secs, &tps[tid].f1_calls_bypassed);
 
     //tps[tid].f1_secs = (double)tps[tid].f1_ticks / hz;
     tps[tid].f1_cellspersec = (double)tps[tid].f1_cells / tps[tid].f1_secs;
@@ -791,7 +1013,21 @@ print_statistics()
     tps[tid].read_handle_overhead_secs = tps[tid].scan_secs
       - tps[tid].region_counts_secs - tps[tid].anchor_list_secs - tps[tid].hit_list_secs - tps[tid].duplicate_removal_secs;
   }
-  f1_stats(NULL, NULL, NULL, &f1_calls_bypassed);
+
+  // per-read latency histograms, merged over the threads
+  hist_t * lat_hist = (hist_t *)calloc(N_LATENCY_HISTS, sizeof(lat_hist[0]));
+  double lat_scale[N_LATENCY_HISTS];
+  int i, j;
+
+  for (i = 0; i < num_threads; i++) {
+    hist_merge(&lat_hist[0], &tpgA[i].read_handle_hist);
+    hist_merge(&lat_hist[1], &tpgA[i].wait_hist);
+    for (j = 0; j < N_READ_STAGES; j++)
+      hist_merge(&lat_hist[2 + j], &tpgA[i].stage_hist[j]);
+  }
+  lat_scale[0] = 1.0;
+  for (j = 1; j < N_LATENCY_HISTS; j++)
+    lat_scale[j] = time_counter_usecs_per_unit(&tpgA[0].wait_tc);
 
   fprintf(stderr, "\nStatistics:\n");
 
@@ -807,8 +1043,8 @@ print_statistics()
 
   fprintf(stderr, "\n");
 
-  int i;
   for(i = 0; i < num_threads; i++){
+    f1_calls_bypassed += tps[i].f1_calls_bypassed;
     total_scan_secs += tps[i].scan_secs;
     total_readparse_secs += tps[i].readparse_secs;
     total_wait_secs += time_counter_get_secs(&tpgA[i].wait_tc);
@@ -860,12 +1096,35 @@ print_statistics()
 	  stat_get_mean(&tpgA[i].n_anchors_discarded), stat_get_sample_stddev(&tpgA[i].n_anchors_discarded),
 	  stat_get_mean(&tpgA[i].n_big_gaps_anchor_list), stat_get_sample_stddev(&tpgA[i].n_big_gaps_anchor_list));
     }
+    for (i = 0; i < num_threads; i++) {
+      fprintf (stderr, "thrd:%d f1_cells:%s f1_calls_bypassed:%s\n",
+	  i, comma_integer(tps[i].f1_cells), comma_integer(tps[i].f1_calls_bypassed));
+    }
+    fprintf(stderr, "\n");
+
+    fprintf(stderr, "%sPer-Read Latency (usecs):\n", my_tab);
+    fprintf(stderr, "%s%s%-24s" "%15s %11s %11s %11s\n", my_tab, my_tab,
+	    "", "Count", "p50", "p99", "Max");
+    for (j = 0; j < N_LATENCY_HISTS; j++) {
+      fprintf(stderr, "%s%s%-24s" "%15s %11.2f %11.2f %11.2f\n", my_tab, my_tab,
+	      latency_names[j], comma_integer(lat_hist[j].count),
+	      hist_get_percentile(&lat_hist[j], 50) * lat_scale[j],
+	      hist_get_percentile(&lat_hist[j], 99) * lat_scale[j],
+	      lat_hist[j].max * lat_scale[j]);
+    }
     fprintf(stderr, "\n");
   }
 
   fprintf(stderr, "%sSpaced Seed Scan:\n", my_tab);
   fprintf(stderr, "%s%s%-24s" "%.2f seconds\n", my_tab, my_tab,
           "Run-time:", total_scan_secs);
+  if (Hflag) {
+    llint anchors_fp_discarded = 0;
+    for (i = 0; i < num_threads; i++)
+      anchors_fp_discarded += tpgA[i].n_anchors_fp_discarded;
+    fprintf(stderr, "%s%s%-24s" "%s\n", my_tab, my_tab,
+	    "Hash Collisions:", comma_integer(anchors_fp_discarded));
+  }
 
   fprintf(stderr, "\n");
 
@@ -933,6 +1192,10 @@ print_statistics()
             "Reads Dropped:",
             comma_integer(total_reads_dropped),
             (nreads == 0) ? 0 : ((double)total_reads_dropped / (double)nreads) * 100);
+    fprintf(stderr, "%s%s%-24s" "%s    (%.4f%%)\n", my_tab, my_tab,
+            "Reads Without Seeds:",
+            comma_integer(total_reads_unseeded),
+            (nreads == 0) ? 0 : ((double)total_reads_unseeded / (double)nreads) * 100);
     fprintf(stderr, "%s%s%-24s" "%s\n", my_tab, my_tab,
             "Total Matches:",
             comma_integer(total_single_matches));
@@ -942,6 +1205,12 @@ print_statistics()
     fprintf(stderr, "%s%s%-24s" "%s\n", my_tab, my_tab,
             "Duplicate Hits Pruned:",
             comma_integer(total_dup_single_matches));
+    if (dup_cache_size > 0) {
+      fprintf(stderr, "%s%s%-24s" "%s    (%.4f%%)\n", my_tab, my_tab,
+	      "Duplicate Reads Reused:",
+	      comma_integer(total_reads_memoized),
+	      (nreads == 0) ? 0 : ((double)total_reads_memoized / (double)nreads) * 100);
+    }
   }
   else // paired hits
   {
@@ -957,6 +1226,16 @@ print_statistics()
             "Pairs Dropped:",
             comma_integer(total_pairs_dropped),
             (nreads == 0) ? 0 : ((double)total_pairs_dropped / (double)(nreads/2)) * 100);
+    fprintf(stderr, "%s%s%-40s" "%s    (%.4f%%)\n", my_tab, my_tab,
+            "Pairs Without Seeds:",
+            comma_integer(total_pairs_unseeded),
+            (nreads == 0) ? 0 : ((double)total_pairs_unseeded / (double)(nreads/2)) * 100);
+    if (mate_rescue) {
+      fprintf(stderr, "%s%s%-40s" "%s    (%.4f%%)\n", my_tab, my_tab,
+	      "Pairs Rescued:",
+	      comma_integer(total_pairs_rescued),
+	      (nreads == 0) ? 0 : ((double)total_pairs_rescued / (double)(nreads/2)) * 100);
+    }
     fprintf(stderr, "%s%s%-40s" "%s\n", my_tab, my_tab,
             "Total Paired Matches:",
             comma_integer(total_paired_matches));
@@ -966,6 +1245,12 @@ print_statistics()
     fprintf(stderr, "%s%s%-40s" "%s\n", my_tab, my_tab,
             "Duplicate Paired Matches Pruned:",
             comma_integer(total_dup_paired_matches));
+    if (learned_insert_size != NULL) {
+      fprintf(stderr, "%s%s%-40s" "mean:%.1f stddev:%.1f min:%d max:%d\n", my_tab, my_tab,
+	      "Learned Insert Sizes:",
+	      learned_insert_size->mean, learned_insert_size->stddev,
+	      learned_insert_size->min_insert_size, learned_insert_size->max_insert_size);
+    }
 
     if (half_paired) {
       fprintf(stderr, "\n");
@@ -996,11 +1281,20 @@ print_statistics()
   fprintf(stderr, "%s%s%-24s" "%s\n", my_tab, my_tab,
           "Genomemap:",
           comma_integer(count_get_count(&mem_genomemap)));
+  if (f1_shared_cache_power > 0) {
+    fprintf(stderr, "%s%s%-24s" "%s\n", my_tab, my_tab,
+	    "Shared SW Cache:",
+	    comma_integer(count_get_max(&mem_f1_cache)));
+  }
 
   if (Xflag) {
     print_insert_histogram();
   }
 
+  if (stats_file != NULL)
+    dump_statistics(tps, tpgA, lat_hist, lat_scale);
+
+  free(lat_hist);
   free(tps);
   free(tpgA);
 }
@@ -1129,9 +1423,9 @@ usage(char * progname, bool full_usage){
   fprintf(stderr,
 	  "   -2/--downstream      Downstream read pair file\n");
   fprintf(stderr,
-	  "      --un              Dump unaligned reads to file\n");
+	  "      --un              Dump unaligned reads to file (gzip if *.gz)\n");
   fprintf(stderr,
-	  "      --al              Dump aligned reads to file\n");
+	  "      --al              Dump aligned reads to file (gzip if *.gz)\n");
   fprintf(stderr,
 	  "      --read-group      Attach SAM Read Group name\n");
   fprintf(stderr,
@@ -1146,6 +1440,12 @@ usage(char * progname, bool full_usage){
 	  "      --insert-size-dist Specifies the mean and stddev of the insert sizes\n");
   fprintf(stderr,
 	  "      --no-improper-mappings (see README)\n");
+  fprintf(stderr,
+	  "      --mate-rescue     Align unseeded mates near their partner (default: %s)\n", mate_rescue ? "enabled" : "disabled");
+  fprintf(stderr,
+	  "      --learn-insert-size Learn insert sizes from this many pairs (default: %d)\n", learn_insert_size);
+  fprintf(stderr,
+	  "      --dup-cache       Reuse mappings of up to this many distinct reads per thread (default: %d)\n", dup_cache_size);
   if (full_usage) {
   fprintf(stderr,
           "      --trim-front      Trim front of reads by this amount\n");
@@ -1179,6 +1479,20 @@ usage(char * progname, bool full_usage){
           "      --sam-header-pg   (see README)\n");
   fprintf(stderr,
           "      --no-autodetect-input (see README)\n");
+  fprintf(stderr,
+          "      --sam-read-ordinals Tag SAM records with the read ordinal (see README)\n");
+  fprintf(stderr,
+          "      --sparse-regions  Count seed regions per read, without the region maps (see README)\n");
+  fprintf(stderr,
+          "      --stats-file      Dump statistics as JSON (*.json) or TSV (see README)\n");
+  fprintf(stderr,
+          "      --metrics         Write live metrics to a file or unix:<socket> (see README)\n");
+  fprintf(stderr,
+          "      --metrics-interval Seconds between live metrics snapshots (default %d)\n", metrics_interval);
+  fprintf(stderr,
+          "      --slow-reads      Capture reads slower than --slow-read-usecs to this file\n");
+  fprintf(stderr,
+          "      --slow-read-usecs Slow read threshold, in microseconds (default %lld)\n", slow_read_usecs);
   }
   fprintf(stderr, "\n");
   fprintf(stderr, "Options:\n");
@@ -1223,10 +1537,16 @@ usage(char * progname, bool full_usage){
 	  "   -Z/--bypass-off      Disable Cache Bypass for SW\n");
   fprintf(stderr,
 	  "                                    Vector Calls      (default: %s)\n", hash_filter_calls ? "enabled" : "disabled");
+  fprintf(stderr,
+	  "      --f1-cache-power  Vector SW Cache Shared by Threads\n");
+  fprintf(stderr,
+	  "                                    (2^n entries)     (default: %s)\n", f1_shared_cache_power > 0? "enabled" : "disabled");
   fprintf(stderr,
 	  "   -H/--spaced-kmers    Hash Spaced Kmers in Genome\n");
   fprintf(stderr,
 	  "                                    Projection        (default: %s)\n", Hflag ? "enabled" : "disabled");
+  fprintf(stderr,
+	  "      --hash-power      Hashed Projection Size (4^n)  (default: %d)\n", hash_table_power);
   fprintf(stderr,
 	  "   -D/--thread-stats    Individual Thread Statistics  (default: %s)\n", Dflag ? "enabled" : "disabled");
   fprintf(stderr,
@@ -1365,9 +1685,15 @@ print_settings() {
   fprintf(stderr, "\n");
   fprintf(stderr, "%s%-40s%d\n", my_tab, "Number of threads:", num_threads);
   fprintf(stderr, "%s%-40s%d\n", my_tab, "Thread chunk size:", chunk_size);
+  if (Hflag) {
+  fprintf(stderr, "%s%-40s4^%d\n", my_tab, "Hashed index size:", hash_table_power);
+  }
   fprintf(stderr, "%s%-40s%s\n", my_tab, "Window length:", thres_to_buff(buff, &window_len));
 
   fprintf(stderr, "%s%-40s%s\n", my_tab, "Hash filter calls:", hash_filter_calls? "yes" : "no");
+  if (f1_shared_cache_power > 0) {
+  fprintf(stderr, "%s%-40s2^%d entries\n", my_tab, "Shared vector SW cache:", f1_shared_cache_power);
+  }
   fprintf(stderr, "%s%-40s%d%s\n", my_tab, "Anchor width:", anchor_width,
 	  anchor_width == -1? " (disabled)" : "");
   fprintf(stderr, "%s%-40s%d%s\n", my_tab, "Indel taboo Len:", indel_taboo_len,
@@ -1381,6 +1707,7 @@ print_settings() {
   if (use_regions) {
   fprintf(stderr, "%s%-40s%d\n", my_tab, "Region size:", (1 << region_bits));
   fprintf(stderr, "%s%-40s%d\n", my_tab, "Region overlap:", region_overlap);
+  fprintf(stderr, "%s%-40s%s\n", my_tab, "Region counts:", sparse_regions? "sparse" : "dense");
   }
   if (Qflag) {
   fprintf(stderr, "%s%-40s%s\n", my_tab, "Ignore QVs:", ignore_qvs? "yes" : "no");
@@ -1481,8 +1808,15 @@ print_settings() {
   fprintf(stderr, "\n");
 
   fprintf(stderr, "%s%-40s%s\n", my_tab, "Paired mode:", pair_mode_string[pair_mode]);
+  if (dup_cache_size > 0) {
+    fprintf(stderr, "%s%-40s%d reads per thread\n", my_tab, "Duplicate read cache:", dup_cache_size);
+  }
   if (pair_mode != PAIR_NONE) {
     fprintf(stderr, "%s%-40smin:%d max:%d\n", my_tab, "Insert sizes:", min_insert_size, max_insert_size);
+    fprintf(stderr, "%s%-40s%s\n", my_tab, "Mate rescue:", mate_rescue? "yes" : "no");
+    if (learn_insert_size > 0) {
+      fprintf(stderr, "%s%-40sfrom %d pairs\n", my_tab, "Learn insert sizes:", learn_insert_size);
+    }
     if (Xflag) {
       fprintf(stderr, "%s%-40s%d\n", my_tab, "Bucket size:", insert_histogram_bucket_size);
     }
@@ -1808,12 +2142,14 @@ int main(int argc, char **argv){
 			if (unaligned_reads_file==NULL) {
 				fprintf(stderr,"error: cannot open file \"%s\" for writting\n",optarg);	
 			}
+			read_dump_gzip[READ_DUMP_UN] = (strlen(optarg) > 3 && !strcmp(optarg + strlen(optarg) - 3, ".gz"));
 			break;
 		case 11:
 			aligned_reads_file=fopen(optarg,"w");
 			if (aligned_reads_file==NULL) {
 				fprintf(stderr,"error: cannot open file \"%s\" for writting\n",optarg);	
 			}
+			read_dump_gzip[READ_DUMP_AL] = (strlen(optarg) > 3 && !strcmp(optarg + strlen(optarg) - 3, ".gz"));
 			break;
 		case 12:
 			sam_unaligned=true;
@@ -2302,6 +2638,70 @@ int main(int argc, char **argv){
 		case 125: // --ignore-qvs
 		  ignore_qvs = true;
 		  break;
+		case 127: // sam-read-ordinals
+		  sam_read_ordinals = true;
+		  break;
+		case 128: // stats-file
+		  stats_file = optarg;
+		  break;
+		case 129: // metrics
+		  metrics_target = optarg;
+		  break;
+		case 131: // slow-reads
+		  slow_reads_file = fopen(optarg, "w");
+		  if (slow_reads_file == NULL)
+		    crash(1, 1, "cannot open slow reads file [%s]", optarg);
+		  break;
+		case 132: // slow-read-usecs
+		  slow_read_usecs = atoll(optarg);
+		  if (slow_read_usecs < 0) {
+		    fprintf(stderr, "error: slow read threshold must not be negative\n");
+		    exit(1);
+		  }
+		  break;
+		case 133: // sparse-regions
+		  sparse_regions = true;
+		  break;
+		case 134: // hash-power
+		  hash_table_power = atoi(optarg);
+		  if (hash_table_power < MIN_HASH_TABLE_POWER || hash_table_power > MAX_HASH_TABLE_POWER) {
+		    fprintf(stderr, "error: hash power must be between %d and %d\n",
+			    MIN_HASH_TABLE_POWER, MAX_HASH_TABLE_POWER);
+		    exit(1);
+		  }
+		  break;
+		case 135: // mate-rescue
+		  mate_rescue = true;
+		  break;
+		case 136: // learn-insert-size
+		  learn_insert_size = atoi(optarg);
+		  if (learn_insert_size < 0) {
+		    fprintf(stderr, "error: number of pairs to learn insert sizes from must not be negative\n");
+		    exit(1);
+		  }
+		  break;
+		case 138: // f1-cache-power
+		  f1_shared_cache_power = atoi(optarg);
+		  if (f1_shared_cache_power < MIN_F1_CACHE_POWER || f1_shared_cache_power > MAX_F1_CACHE_POWER) {
+		    fprintf(stderr, "error: vector SW cache power must be between %d and %d\n",
+			    MIN_F1_CACHE_POWER, MAX_F1_CACHE_POWER);
+		    exit(1);
+		  }
+		  break;
+		case 137: // dup-cache
+		  dup_cache_size = atoi(optarg);
+		  if (dup_cache_size < 0) {
+		    fprintf(stderr, "error: duplicate read cache size must not be negative\n");
+		    exit(1);
+		  }
+		  break;
+		case 130: // metrics-interval
+		  metrics_interval = atoi(optarg);
+		  if (metrics_interval <= 0) {
+		    fprintf(stderr, "error: metrics interval must be positive\n");
+		    exit(1);
+		  }
+		  break;
 #ifdef ENABLE_LOW_QUALITY_FILTER
 		case 126: //enable-seed-qual-filter
 			SQFflag = true;
@@ -2453,6 +2853,26 @@ int main(int argc, char **argv){
 	  exit(1);
 	}
 	*/
+	if (mate_rescue && pair_mode == PAIR_NONE) {
+	  fprintf(stderr, "warning: mate rescue only applies in paired mode; ignoring --mate-rescue\n");
+	  mate_rescue = false;
+	}
+	if (learn_insert_size > 0 && pair_mode == PAIR_NONE) {
+	  fprintf(stderr, "warning: insert sizes are only learned in paired mode; ignoring --learn-insert-size\n");
+	  learn_insert_size = 0;
+	}
+	if (f1_shared_cache_power > 0 && !hash_filter_calls) {
+	  fprintf(stderr, "warning: vector SW calls are not cached with -Z or ungapped alignment; ignoring --f1-cache-power\n");
+	  f1_shared_cache_power = 0;
+	}
+	if (dup_cache_size > 0 && (pair_mode != PAIR_NONE || !Eflag || sam_read_ordinals)) {
+	  fprintf(stderr, "warning: duplicate reads are only cached for unpaired SAM output without read ordinals; ignoring --dup-cache\n");
+	  dup_cache_size = 0;
+	}
+	if (mate_rescue && gapless_sw && shrimp_mode == MODE_COLOUR_SPACE) {
+	  fprintf(stderr, "warning: mate rescue needs the gapped vector filter in colour space; ignoring --mate-rescue\n");
+	  mate_rescue = false;
+	}
 	if (pair_mode == PAIR_NONE && sam_r2) {
 	  fprintf(stderr, "error: cannot use option sam-r2 in non-paired mode!\n");
 	  exit(1);
@@ -2816,7 +3236,7 @@ int main(int argc, char **argv){
 	  }
 
 	  if (Hflag) {
-	    max_seed_weight = HASH_TABLE_POWER;
+	    max_seed_weight = hash_table_power;
 	  } else {
 	    for (sn = 0; sn < n_seeds; sn++) {
 	      if (seed[sn].weight > max_seed_weight) {
@@ -2916,9 +3336,11 @@ int main(int argc, char **argv){
 	  tpg.pass1_tc.type = DEF_FAST_TIME_COUNTER;
 	  tpg.pass2_tc.type = DEF_FAST_TIME_COUNTER;
 	  tpg.duplicate_removal_tc.type = DEF_FAST_TIME_COUNTER;
+	  if (slow_reads_file != NULL && omp_get_thread_num() == 0)
+	    slow_read_usecs_per_unit = time_counter_usecs_per_unit(&tpg.pass1_tc);
 
 	  /* region handling */
-	  if (use_regions) {
+	  if (use_regions && !sparse_regions) {
 	    region_map_id = 0;
 	    for (int number_in_pair = 0; number_in_pair < 2; number_in_pair++)
 	      for (int st = 0; st < 2; st++)
@@ -3010,8 +3432,15 @@ int main(int argc, char **argv){
 	  puts(output);
 	  free(output);
 	}
+	if (f1_shared_cache_power > 0)
+	  f1_shared_cache = (struct f1_shared_cache_entry *)
+	    my_calloc((1llu << f1_shared_cache_power) * sizeof(f1_shared_cache[0]),
+		      &mem_f1_cache, "f1_shared_cache");
+
 	before = gettimeinusecs();
+	metrics_start();
 	bool launched = launch_scan_threads(fasta, left_fasta, right_fasta);
+	metrics_stop();
 	if (!launched) {
 	  fprintf(stderr,"error: a fatal error occured while launching scan thread(s)!\n");
 	  exit(1);
@@ -3036,8 +3465,11 @@ int main(int argc, char **argv){
 	  }
 	  sw_full_ls_cleanup();
 	  f1_free();
+	  read_memo_free();
 
-	  if (use_regions) {
+	  if (use_regions && sparse_regions) {
+	    region_tables_free();
+	  } else if (use_regions) {
 	    for (int number_in_pair = 0; number_in_pair < 2; number_in_pair++)
 	      for (int st = 0; st < 2; st++)
 		//free(region_map[number_in_pair][st]);
@@ -3048,6 +3480,15 @@ int main(int argc, char **argv){
 
 	gen_st_delete(&contig_offsets_gen_st);
 
+	if (insert_size_samples != NULL)
+	  my_free(insert_size_samples, learn_insert_size * sizeof(insert_size_samples[0]),
+		  &mem_mapping, "insert_size_samples");
+	if (learned_insert_size != NULL)
+	  my_free(learned_insert_size, sizeof(insert_size_model), &mem_mapping, "learned_insert_size");
+	if (f1_shared_cache != NULL)
+	  my_free(f1_shared_cache, (1llu << f1_shared_cache_power) * sizeof(f1_shared_cache[0]),
+		  &mem_f1_cache, "f1_shared_cache");
+
 	if (load_mmap != NULL) {
 	  // munmap?
 	} else {
@@ -3082,9 +3523,11 @@ int main(int argc, char **argv){
 
 	// close some files
 	if (aligned_reads_file != NULL)
-	  fclose(aligned_reads_file);
+	  read_dump_close(aligned_reads_file, read_dump_gzip[READ_DUMP_AL]);
 	if (unaligned_reads_file != NULL)
-	  fclose(unaligned_reads_file);
+	  read_dump_close(unaligned_reads_file, read_dump_gzip[READ_DUMP_UN]);
+	if (slow_reads_file != NULL)
+	  fclose(slow_reads_file);
 	if (sam_header_hd != NULL)
 	  fclose(sam_header_hd);
 	if (sam_header_sq != NULL)
@@ -3103,6 +3546,7 @@ int main(int argc, char **argv){
 	fprintf(stderr, "mem_thread_buffer: max=%lld crt=%lld\n", (long long)count_get_max(&mem_thread_buffer), (long long)count_get_count(&mem_thread_buffer));
 	fprintf(stderr, "mem_small: max=%lld crt=%lld\n", (long long)count_get_max(&mem_small), (long long)count_get_count(&mem_small));
 	fprintf(stderr, "mem_sw: max=%lld crt=%lld\n", (long long)count_get_max(&mem_sw), (long long)count_get_count(&mem_sw));
+	fprintf(stderr, "mem_f1_cache: max=%lld crt=%lld\n", (long long)count_get_max(&mem_f1_cache), (long long)count_get_count(&mem_f1_cache));
 #endif
 	return 0;
 }
@@ -14,6 +14,7 @@
 #include "../common/debug.h"
 #include "../common/util.h"
 #include "../common/time_counter.h"
+#include "../common/dynhash.h"
 #include "../common/gen-st.h"
 
 #undef EXTERN
@@ -143,7 +144,18 @@ EXTERN(int,		min_insert_size,		DEF_MIN_INSERT_SIZE);
 EXTERN(int,		max_insert_size,		DEF_MAX_INSERT_SIZE);
 EXTERN(double,		insert_size_mean,		DEF_INSERT_SIZE_MEAN);
 EXTERN(double,		insert_size_stddev,		DEF_INSERT_SIZE_STDDEV);
+EXTERN(bool,		mate_rescue,			DEF_MATE_RESCUE);	//look for unseeded mates near their partner
+EXTERN(int,		learn_insert_size,		DEF_LEARN_INSERT_SIZE);
+EXTERN(int *,		insert_size_samples,		NULL);	//under critical (insert_size)
+EXTERN(int,		n_insert_size_samples,		0);
+EXTERN(insert_size_model *,	learned_insert_size,		NULL);	//set once, under critical (insert_size); read atomically
+EXTERN(insert_size_model *,	thread_insert_size,		NULL);	//this thread's view of learned_insert_size
+#pragma omp threadprivate(thread_insert_size)
 EXTERN(llint,		insert_histogram[100],		{});
+EXTERN(int,		dup_cache_size,			DEF_DUP_CACHE_SIZE);
+EXTERN(dynhash_t,	thread_read_memo,		NULL);	//this thread's earlier reads, by sequence and qualities
+EXTERN(read_tally *,	thread_read_tally,		NULL);	//set while recording a read for thread_read_memo
+#pragma omp threadprivate(thread_read_memo, thread_read_tally)
 EXTERN(int,		insert_histogram_bucket_size,	1);
 EXTERN(int,		insert_histogram_load,		100);
 EXTERN(char *,		reads_filename,			NULL);
@@ -173,14 +185,23 @@ EXTERN(size_t,			thread_output_buffer_initial,	DEF_THREAD_OUTPUT_BUFFER_INITIAL)
 EXTERN(size_t,			thread_output_buffer_increment,	DEF_THREAD_OUTPUT_BUFFER_INCREMENT);
 EXTERN(size_t,			thread_output_buffer_safety,	DEF_THREAD_OUTPUT_BUFFER_SAFETY);
 EXTERN(unsigned int,		thread_output_heap_capacity,	DEF_THREAD_OUTPUT_HEAP_CAPACITY);
+EXTERN(struct read_dump *,	thread_read_dump[2],		{});
 
 
 /* SAM stuff */
 EXTERN(FILE *,		unaligned_reads_file,		NULL);
 EXTERN(FILE *,		aligned_reads_file,		NULL);
+EXTERN(bool,		read_dump_gzip[2],		{});
 EXTERN(bool,		sam_unaligned,			false);
 EXTERN(bool,		half_paired,			true); //output reads in paired mode that only have one mapping
 EXTERN(bool,		sam_r2,				false);
+EXTERN(bool,		sam_read_ordinals,		false); //tag records with the input read ordinal
+EXTERN(char *,		stats_file,			NULL);	//machine-readable statistics dump
+EXTERN(char *,		metrics_target,			NULL);	//live metrics file, or unix:<socket>
+EXTERN(int,		metrics_interval,		DEF_METRICS_INTERVAL);
+EXTERN(FILE *,		slow_reads_file,		NULL);	//reads that took at least slow_read_usecs
+EXTERN(llint,		slow_read_usecs,		DEF_SLOW_READ_USECS);
+EXTERN(double,		slow_read_usecs_per_unit,	1.0);	//time counter units to usecs
 EXTERN(char *,		sam_header_filename,		NULL);
 EXTERN(char *,		sam_read_group_name,		NULL);
 EXTERN(char *,		sam_sample_name,		NULL);
@@ -199,6 +220,10 @@ EXTERN(llint,			total_reads_matched_conf,	0);
 EXTERN(llint,			total_pairs_matched_conf,	0);
 EXTERN(llint,			total_reads_dropped,		0);
 EXTERN(llint,			total_pairs_dropped,		0);
+EXTERN(llint,			total_pairs_rescued,		0);
+EXTERN(llint,			total_reads_memoized,		0);	/* duplicate reads not mapped again */
+EXTERN(llint,			total_reads_unseeded,		0);	/* skipped: no usable index list */
+EXTERN(llint,			total_pairs_unseeded,		0);	/* skipped: neither read has one */
 EXTERN(llint,			total_single_matches,		0);
 EXTERN(llint,			total_paired_matches,		0);
 EXTERN(llint,			total_dup_single_matches,	0);			/* number of duplicate hits */
@@ -223,6 +248,26 @@ EXTERN(llint,			mapping_wallclock_usecs,	0);
 //EXTERN(stat_t,			n_anchors_discarded,		0);
 EXTERN(int,			anchor_list_big_gap,		DEF_ANCHOR_LIST_BIG_GAP);
 
+/* stages timed per read, for the latency histograms */
+enum {
+  STAGE_REGION_COUNTS,
+  STAGE_MP_REGION_COUNTS,
+  STAGE_ANCHOR_LIST,
+  STAGE_HIT_LIST,
+  STAGE_PASS1,
+  STAGE_GET_VECTOR_HITS,
+  STAGE_PASS2,
+  STAGE_DUPLICATE_REMOVAL,
+  N_READ_STAGES
+};
+
+#define DEF_READ_STAGE_KEYS \
+{\
+	"region_counts", "mp_region_counts", "anchor_list", "hit_list",\
+	"pass1", "get_vector_hits", "pass2", "duplicate_removal"\
+}
+EXTERN(char const *,		read_stage_keys[N_READ_STAGES],	DEF_READ_STAGE_KEYS);
+
 // thread-private globals
 typedef struct tpg_t {
   llint read_handle_usecs;
@@ -247,6 +292,10 @@ typedef struct tpg_t {
   stat_t anchor_list_init_size;
   stat_t n_big_gaps_anchor_list;
   stat_t n_anchors_discarded;
+  llint n_anchors_fp_discarded;		// with -H, postings of other kmers sharing a list
+  hist_t read_handle_hist;		// usecs per read (or pair)
+  hist_t wait_hist;			// time counter units per chunk
+  hist_t stage_hist[N_READ_STAGES];	// time counter units per read that ran the stage
 } tpg_t;
 
 EXTERN(tpg_t,	tpg,	{});
@@ -257,11 +306,13 @@ EXTERN(count_t,			mem_small,			{});
 EXTERN(count_t,			mem_thread_buffer,		{});
 EXTERN(count_t,			mem_mapping,			{});
 EXTERN(count_t,			mem_sw,				{});
+EXTERN(count_t,			mem_f1_cache,			{});
 
 
 /* genome map */
 EXTERN(uint32_t ***,		genomemap,			NULL);
 EXTERN(uint32_t **,		genomemap_len,			NULL);
+EXTERN(int,			hash_table_power,		HASH_TABLE_POWER);
 EXTERN(uint32_t *,		contig_offsets,			NULL);	/* offset info for genome contigs */
 EXTERN(char **,			contig_names,			NULL);
 EXTERN(int,			num_contigs,			0);
@@ -292,7 +343,28 @@ EXTERN(region_map_t *,		region_map[2][2],		{});
 EXTERN(int,			region_map_id,			0);
 EXTERN(int,			region_map_id_bits,		13);
 //EXTERN(int,			region_map_max_count,		((1 << 8) - 1));
-#pragma omp threadprivate(region_map, region_map_id)
+
+/* sparse region counts: the regions hit by one read and strand, see --sparse-regions */
+typedef struct region_table_slot {
+  uint32_t		gen;
+  uint32_t		region;
+  region_map_t		entry;
+} region_table_slot;
+
+typedef struct region_table {
+  region_table_slot *	slots;		// open addressing, (1 << bits) slots
+  int			bits;
+  uint32_t		gen;		// slots of other generations are empty
+  int			map_id;		// region_map_id of the read held
+  uint32_t *		regions;	// distinct regions, in insertion order until sorted
+  int			n_regions;
+  int			max_regions;
+  bool			sorted;
+} region_table;
+
+EXTERN(bool,			sparse_regions,			DEF_SPARSE_REGIONS);
+EXTERN(region_table,		region_tables[2][2],		{});
+#pragma omp threadprivate(region_map, region_map_id, region_tables)
 
 
 /* contains inlined calls; uses gapless_sw and hash_filter_calls vars */
@@ -306,34 +378,59 @@ void		read_free_anchor_list(struct read_entry *);
 void		read_free_full(struct read_entry *);
 
 
-/* pulled off the web; this may or may not be any good */
-static inline uint32_t
-hash(uint32_t a)
+/* 64-bit finalizer of MurmurHash3: every input bit affects every output bit */
+static inline uint64_t
+hash(uint64_t a)
 {
-  a = (a+0x7ed55d16) + (a<<12);
-  a = (a^0xc761c23c) ^ (a>>19);
-  a = (a+0x165667b1) + (a<<5);
-  a = (a+0xd3a2646c) ^ (a<<9);
-  a = (a+0xfd7046c5) + (a<<3);
-  a = (a^0xb55a4f09) ^ (a>>16);
+  a ^= a >> 33;
+  a *= 0xff51afd7ed558ccdllu;
+  a ^= a >> 33;
+  a *= 0xc4ceb9fe1a85ec53llu;
+  a ^= a >> 33;
   return a;
 }
 
 
-/* hash-based version or kmer -> map index function for larger seeds */
-static inline uint32_t
-kmer_to_mapidx_hash(uint32_t *kmerWindow, int sn)
+/*
+ * Hash of the spaced kmer for hashed (-H) genome maps. The low 2*hash_table_power
+ * bits give the map index; the top bits give the kmer fingerprint stored with
+ * every posting, which tells apart kmers that share a list.
+ */
+static inline uint64_t
+kmer_hash(uint32_t *kmerWindow, int sn)
 {
-  static uint32_t maxidx = ((uint32_t)1 << 2*HASH_TABLE_POWER) - 1;
-  uint32_t mapidx = 0;
+  uint64_t h = 0x9e3779b97f4a7c15llu;
   int i;
 
   assert(seed_hash_mask != NULL);
 
   for (i = 0; i < BPTO32BW(max_seed_span); i++)
-    mapidx = hash((kmerWindow[i] & seed_hash_mask[sn][i]) ^ mapidx);
+    h = hash(h ^ (kmerWindow[i] & seed_hash_mask[sn][i]));
+
+  return h;
+}
+
+#define KMER_HASH_TO_MAPIDX(h) ( (uint32_t)(h) & (((uint32_t)1 << 2*hash_table_power) - 1) )
+#define KMER_HASH_TO_FP(h) ( (uint8_t)((h) >> 56) )
+
+/*
+ * With -H, every genomemap list is followed by the fingerprints of its
+ * postings, one byte each, padded to whole words.
+ */
+#define GENOMEMAP_FP_WORDS(len) ( Hflag? ((len) + 3) / 4 : 0 )
+
+static inline uint8_t *
+genomemap_fp(int sn, uint32_t mapidx)
+{
+  return (uint8_t *)(genomemap[sn][mapidx] + genomemap_len[sn][mapidx]);
+}
 
-  return mapidx & maxidx;
+
+/* hash-based version or kmer -> map index function for larger seeds */
+static inline uint32_t
+kmer_to_mapidx_hash(uint32_t *kmerWindow, int sn)
+{
+  return KMER_HASH_TO_MAPIDX(kmer_hash(kmerWindow, sn));
 }
 
 
@@ -449,6 +546,47 @@ exit(1);
 }
   return (subsequence_quality >= AVERAGE_QUALITY_THRESHOLD * seed.weight);
 }
+
+/*
+ * Same test as is_low_quality_read_subsequence, at positions first_pos .. first_pos+n_pos-1
+ * at once, from prefix sums of the processed qualities (qual_prefix[i] = sum of the first i).
+ * The masked sum is one difference per run of 1s in the seed mask. Sets bit (bit_offset + i)
+ * of filtered wherever is_low_quality_read_subsequence() would return true.
+ */
+static inline void
+read_quality_filter_seed(const int * qual_prefix, int first_pos, int n_pos, const seed_type seed,
+			 uint32_t * filtered, int bit_offset)
+{
+  int run_start[seed.span], run_end[seed.span];
+  int n_runs = 0;
+  int i, j, sum;
+
+  for (i = 0; i < seed.span; i++) {
+    if (!bitmap_extract(seed.mask, 1, seed.span - i - 1))
+      continue;
+    if (n_runs > 0 && run_end[n_runs - 1] == i) {
+      run_end[n_runs - 1]++;
+    } else {
+      run_start[n_runs] = i;
+      run_end[n_runs] = i + 1;
+      n_runs++;
+    }
+  }
+
+  for (i = 0; i < n_pos; i++) {
+    sum = 0;
+    for (j = 0; j < n_runs; j++)
+      sum += qual_prefix[first_pos + i + run_end[j]] - qual_prefix[first_pos + i + run_start[j]];
+    if (sum >= AVERAGE_QUALITY_THRESHOLD * seed.weight)
+      filtered[(bit_offset + i) / 32] |= (uint32_t)1 << ((bit_offset + i) % 32);
+  }
+}
+
+static inline bool
+is_filtered_kmer(const uint32_t * filtered, int offset)
+{
+  return filtered != NULL && ((filtered[offset / 32] >> (offset % 32)) & 1);
+}
 #endif
 
 #ifdef __cplusplus
@@ -8,6 +8,7 @@
 #endif
 
 #include <limits.h>
+#include <math.h>
 #include "mapping.h"
 #include "output.h"
 #include "../common/sw-full-common.h"
@@ -44,16 +45,15 @@ read_get_mapidxs_per_strand(struct read_entry * re, int st)
   assert(re != NULL);
   assert(re->mapidx[st] == NULL);
 
-#ifdef ENABLE_LOW_QUALITY_FILTER
-  if (re->filter_qual == NULL) {
-        re->filter_qual = (char *)xmalloc(strlen(re->qual) + 17);
-        read_quality_filter_preprocess (re->qual, re->filter_qual);
-  }
-#endif
   //re->mapidx[st] = (uint32_t *)xmalloc(n_seeds * re->max_n_kmers * sizeof(re->mapidx[0][0]));
   re->mapidx[st] = (uint32_t *)
     my_malloc(n_seeds * re->max_n_kmers * sizeof(re->mapidx[0][0]),
 	      &mem_mapping, "mapidx [%s]", re->name);
+  if (Hflag) {
+    re->mapidx_fp[st] = (uint8_t *)
+      my_malloc(n_seeds * re->max_n_kmers * sizeof(re->mapidx_fp[0][0]),
+		&mem_mapping, "mapidx_fp [%s]", re->name);
+  }
 
   load = 0;
   for (i = 0; i < re->read_len; i++) {
@@ -75,12 +75,20 @@ read_get_mapidxs_per_strand(struct read_entry * re, int st)
       }
 #endif
 #ifdef ENABLE_LOW_QUALITY_FILTER
-      if (Qflag && SQFflag && is_low_quality_read_subsequence(re->filter_qual, r_idx, seed[sn])) {
+      if (is_filtered_kmer(re->filtered_kmers, sn*re->max_n_kmers + (r_idx - re->min_kmer_pos))) {
           re->mapidx[st][sn*re->max_n_kmers + (r_idx - re->min_kmer_pos)] = 0;
+          if (Hflag)
+            re->mapidx_fp[st][sn*re->max_n_kmers + (r_idx - re->min_kmer_pos)] = 0;
     	  continue;
       }
 #endif
-      re->mapidx[st][sn*re->max_n_kmers + (r_idx - re->min_kmer_pos)] = KMER_TO_MAPIDX(kmerWindow, sn);
+      if (Hflag) {
+        uint64_t h = kmer_hash(kmerWindow, sn);
+        re->mapidx[st][sn*re->max_n_kmers + (r_idx - re->min_kmer_pos)] = KMER_HASH_TO_MAPIDX(h);
+        re->mapidx_fp[st][sn*re->max_n_kmers + (r_idx - re->min_kmer_pos)] = KMER_HASH_TO_FP(h);
+      } else {
+        re->mapidx[st][sn*re->max_n_kmers + (r_idx - re->min_kmer_pos)] = kmer_to_mapidx_orig(kmerWindow, sn);
+      }
     }
   }
 
@@ -88,12 +96,45 @@ read_get_mapidxs_per_strand(struct read_entry * re, int st)
 }
 
 
+#ifdef ENABLE_LOW_QUALITY_FILTER
+/*
+ * Run the seed quality filter on every kmer of every seed, once per read;
+ * the result uses the same offsets as re->mapidx.
+ */
+static void
+read_get_filtered_kmers(struct read_entry * re)
+{
+  int qual_len = strlen(re->qual);
+  char filter_qual[qual_len + 1];
+  int qual_prefix[re->read_len + 1];
+  int i, sn;
+
+  assert(re->filtered_kmers == NULL);
+
+  read_quality_filter_preprocess(re->qual, filter_qual);
+  qual_prefix[0] = 0;
+  for (i = 0; i < re->read_len; i++)
+    qual_prefix[i + 1] = qual_prefix[i] + (i < qual_len? MAX(filter_qual[i], UNTRUSTED_QUALITY) : UNTRUSTED_QUALITY);
+
+  re->filtered_kmers = (uint32_t *)xcalloc(ceil_div(n_seeds * re->max_n_kmers, 32) * sizeof(re->filtered_kmers[0]));
+  for (sn = 0; sn < n_seeds; sn++)
+    read_quality_filter_seed(qual_prefix, re->min_kmer_pos,
+			     MAX(re->read_len - seed[sn].span + 1 - re->min_kmer_pos, 0), seed[sn],
+			     re->filtered_kmers, sn * re->max_n_kmers);
+}
+#endif
+
+
 /*
  * Extract spaced kmers from read, save them in re->mapidx.
  */
-static inline void
+void
 read_get_mapidxs(struct read_entry * re)
 {
+#ifdef ENABLE_LOW_QUALITY_FILTER
+  if (Qflag && SQFflag && re->filtered_kmers == NULL)
+    read_get_filtered_kmers(re);
+#endif
   read_get_mapidxs_per_strand(re, 0);
   read_get_mapidxs_per_strand(re, 1);
 
@@ -471,6 +512,218 @@ get_insert_size(struct read_hit *rh, struct read_hit * rh_mp)
 }
 
 
+/*
+ * Sparse region counts (--sparse-regions): rather than stamping region_map,
+ * which is touched at random for every kmer hit, the regions hit by a read go
+ * to a small hash table per mate and strand, holding the same RG_ entries.
+ * The mate pair counts are then found by merging the sorted region lists of
+ * the two mates.
+ */
+static region_map_t region_absent = 0; // returned for regions not hit; never written
+
+static inline region_table_slot *
+region_table_probe(region_table * t, uint32_t region)
+{
+  uint32_t mask = (1 << t->bits) - 1;
+  uint32_t h = (region * 2654435761u) >> (32 - t->bits);
+
+  while (t->slots[h].gen == t->gen && t->slots[h].region != region)
+    h = (h + 1) & mask;
+
+  return &t->slots[h];
+}
+
+
+static void
+region_table_resize(region_table * t, int bits)
+{
+  region_table_slot * old_slots = t->slots;
+  int old_bits = t->bits;
+  int i;
+
+  t->slots = (region_table_slot *)
+    my_calloc((1 << bits) * sizeof(t->slots[0]), &mem_mapping, "region_table");
+  t->bits = bits;
+
+  if (old_slots != NULL) {
+    for (i = 0; i < (1 << old_bits); i++) {
+      if (old_slots[i].gen == t->gen)
+	*region_table_probe(t, old_slots[i].region) = old_slots[i];
+    }
+    my_free(old_slots, (1 << old_bits) * sizeof(old_slots[0]), &mem_mapping, "region_table");
+  }
+}
+
+
+static inline void
+region_table_add(region_table * t, uint32_t region)
+{
+  region_table_slot * s = region_table_probe(t, region);
+
+  if (s->gen == t->gen) {
+    // a previous kmer set it, so there are >=2 kmers in this region
+    RG_SET_HAS_2(s->entry);
+    return;
+  }
+
+  s->gen = t->gen;
+  s->region = region;
+  s->entry = 0;
+  RG_SET_MAP_ID(s->entry, t->map_id);
+
+  if (t->n_regions == t->max_regions) {
+    int new_max = MAX(256, 2 * t->max_regions);
+    t->regions = (uint32_t *)
+      my_realloc(t->regions, new_max * sizeof(t->regions[0]), t->max_regions * sizeof(t->regions[0]),
+		 &mem_mapping, "region_table regions");
+    t->max_regions = new_max;
+  }
+  t->regions[t->n_regions++] = region;
+
+  // keep the load factor at most 1/2
+  if (2 * t->n_regions > (1 << t->bits))
+    region_table_resize(t, t->bits + 1);
+}
+
+
+static int
+region_cmp(void const * a, void const * b)
+{
+  uint32_t x = *(uint32_t const *)a;
+  uint32_t y = *(uint32_t const *)b;
+
+  return (x < y? -1 : (x > y? 1 : 0));
+}
+
+
+static inline void
+region_table_sort(region_table * t)
+{
+  if (!t->sorted) {
+    qsort(t->regions, t->n_regions, sizeof(t->regions[0]), region_cmp);
+    t->sorted = true;
+  }
+}
+
+
+/*
+ * Entry of a region in the counts of the current read, dense or sparse.
+ */
+static inline region_map_t *
+region_map_entry(int nip, int st, int region)
+{
+  region_table * t;
+  region_table_slot * s;
+
+  if (!sparse_regions)
+    return &region_map[nip][st][region];
+
+  t = &region_tables[nip][st];
+  if (t->slots == NULL || t->map_id != region_map_id)
+    return &region_absent;
+
+  s = region_table_probe(t, (uint32_t)region);
+  return (s->gen == t->gen? &s->entry : &region_absent);
+}
+
+
+void
+region_tables_free()
+{
+  for (int nip = 0; nip < 2; nip++) {
+    for (int st = 0; st < 2; st++) {
+      region_table * t = &region_tables[nip][st];
+
+      if (t->slots != NULL)
+	my_free(t->slots, (1 << t->bits) * sizeof(t->slots[0]), &mem_mapping, "region_table");
+      if (t->regions != NULL)
+	my_free(t->regions, t->max_regions * sizeof(t->regions[0]), &mem_mapping, "region_table regions");
+      memset(t, 0, sizeof(*t));
+    }
+  }
+}
+
+
+static void
+read_get_sparse_region_counts(struct read_entry * re, int st)
+{
+  region_table * t = &region_tables[re->first_in_pair? 0 : 1][st];
+  int sn, i, offset;
+  uint j;
+  uint32_t g;
+
+  if (t->slots == NULL)
+    region_table_resize(t, 10);
+
+  // start a new generation, which empties the table
+  t->gen++;
+  if (t->gen == 0) {
+    memset(t->slots, 0, (1 << t->bits) * sizeof(t->slots[0]));
+    t->gen = 1;
+  }
+  t->map_id = region_map_id;
+  t->n_regions = 0;
+  t->sorted = false;
+
+  for (sn = 0; sn < n_seeds; sn++) {
+    for (i = 0; re->min_kmer_pos + i + seed[sn].span - 1 < re->read_len; i++) {
+      offset = sn*re->max_n_kmers + i;
+
+      if (genomemap_len[sn][re->mapidx[st][offset]] > list_cutoff)
+        continue;
+
+      for (j = 0; j < genomemap_len[sn][re->mapidx[st][offset]]; j++) {
+	g = genomemap[sn][re->mapidx[st][offset]][j];
+	region_table_add(t, g >> region_bits);
+
+	// extend regions by region_overlap
+	if ((g & ((1 << region_bits) - 1)) < (uint)region_overlap && (g >> region_bits) > 0)
+	  region_table_add(t, (g >> region_bits) - 1);
+      }
+    }
+  }
+}
+
+
+static void
+read_get_sparse_mp_region_counts(struct read_entry * re, int st)
+{
+  int nip = re->first_in_pair? 0 : 1;
+  region_table * t = &region_tables[nip][st];
+  region_table * t_mp = &region_tables[1-nip][1-st];
+  int i, region, first, last;
+  int lo = 0, hi = 0, n_mp = 0, n_has_2 = 0;
+  region_map_t * e;
+
+  if (t->slots == NULL || t->map_id != region_map_id)
+    return;
+
+  region_table_sort(t);
+  if (t_mp->slots != NULL && t_mp->map_id == region_map_id) {
+    region_table_sort(t_mp);
+    n_mp = t_mp->n_regions;
+  }
+
+  // as the regions of this read increase, both ends of the mate window only move right;
+  // [lo, hi) are the mate regions in the window, n_has_2 of them with >=2 kmers
+  for (i = 0; i < t->n_regions; i++) {
+    region = (int)t->regions[i];
+    first = MAX(0, region + re->delta_region_min[st]);
+    last = MIN(n_regions - 1, region + re->delta_region_max[st]);
+
+    for ( ; hi < n_mp && (int)t_mp->regions[hi] <= last; hi++)
+      n_has_2 += RG_GET_HAS_2(region_table_probe(t_mp, t_mp->regions[hi])->entry);
+    for ( ; lo < hi && (int)t_mp->regions[lo] < first; lo++)
+      n_has_2 -= RG_GET_HAS_2(region_table_probe(t_mp, t_mp->regions[lo])->entry);
+
+    e = &region_table_probe(t, (uint32_t)region)->entry;
+    if (!RG_VALID_MP_CNT(*e)) {
+      RG_SET_MP_CNT(*e, (hi > lo? (n_has_2 > 0? 2 : 1) : 0));
+    }
+  }
+}
+
+
 static void
 read_get_region_counts(struct read_entry * re, int st, struct regions_options * options)
 {
@@ -483,6 +736,14 @@ read_get_region_counts(struct read_entry * re, int st, struct regions_options *
 
   assert(use_regions);
 
+  if (sparse_regions) {
+    if (region_map_id == 0)
+      region_map_id = 1;
+    read_get_sparse_region_counts(re, st);
+    TIME_COUNTER_STOP(tpg.region_counts_tc);
+    return;
+  }
+
   if (region_map_id == 0) {
     region_map_id = 1;
     for (int _nip = 0; _nip < 2; _nip++) {
@@ -567,6 +828,12 @@ read_get_mp_region_counts(struct read_entry * re, int st)
   int first, last, max, k;
   unsigned int j;
 
+  if (sparse_regions) {
+    read_get_sparse_mp_region_counts(re, st);
+    TIME_COUNTER_STOP(tpg.mp_region_counts_tc);
+    return;
+  }
+
   nip = re->first_in_pair? 0 : 1;
   for (sn = 0; sn < n_seeds; sn++) {
     for (i = 0; re->min_kmer_pos + i + seed[sn].span - 1 < re->read_len; i++) {
@@ -671,12 +938,13 @@ advance_index_in_genomemap(struct read_entry * re, int st,
 #ifdef USE_PREFETCH
     if (*idx + 2 < max_idx) {
       int region_ahead = (int)(map[*idx + 2] >> region_bits);
-      _mm_prefetch((char *)&region_map[nip][st][region_ahead], _MM_HINT_T0);
+      if (!sparse_regions)
+	_mm_prefetch((char *)&region_map[nip][st][region_ahead], _MM_HINT_T0);
     }
 #endif
     int region = (int)(map[*idx] >> region_bits);
 
-    assert(RG_GET_MAP_ID(region_map[nip][st][region]) == region_map_id);
+    assert(RG_GET_MAP_ID(*region_map_entry(nip, st, region)) == region_map_id);
 
     // if necessary, compute the mp counts
     if (options->use_mp_region_counts != 0)
@@ -718,8 +986,8 @@ advance_index_in_genomemap(struct read_entry * re, int st,
 	*/
 
 	// BEGIN COPY
-	count_main = (RG_GET_HAS_2(region_map[nip][st][region]) ? 2 : 1);
-	count_mp = RG_GET_MP_CNT(region_map[nip][st][region]);
+	count_main = (RG_GET_HAS_2(*region_map_entry(nip, st, region)) ? 2 : 1);
+	count_mp = RG_GET_MP_CNT(*region_map_entry(nip, st, region));
 	if ((options->use_mp_region_counts == 1 && (count_main >= 2 && count_mp >= 2))
 	    || (options->use_mp_region_counts == 2 && (count_main >= 2 || count_mp >= 2))
 	    || (options->use_mp_region_counts == 3 && (count_mp >= 1 && (count_main + count_mp) >= 3))
@@ -732,8 +1000,8 @@ advance_index_in_genomemap(struct read_entry * re, int st,
           region--;
 
 	  //BEGIN PASTE
-	  count_main = (RG_GET_HAS_2(region_map[nip][st][region]) ? 2 : 1);
-	  count_mp = RG_GET_MP_CNT(region_map[nip][st][region]);
+	  count_main = (RG_GET_HAS_2(*region_map_entry(nip, st, region)) ? 2 : 1);
+	  count_mp = RG_GET_MP_CNT(*region_map_entry(nip, st, region));
 	  if ((options->use_mp_region_counts == 1 && (count_main >= 2 && count_mp >= 2))
 	      || (options->use_mp_region_counts == 2 && (count_main >= 2 || count_mp >= 2))
 	      || (options->use_mp_region_counts == 3 && (count_mp >= 1 && (count_main + count_mp) >= 3))
@@ -745,14 +1013,14 @@ advance_index_in_genomemap(struct read_entry * re, int st,
       }
     else  // don't use mp counts at all
       {
-	if (RG_GET_HAS_2(region_map[nip][st][region]))
+	if (RG_GET_HAS_2(*region_map_entry(nip, st, region)))
 	  break;
 
 	if (region > 0
             && (map[*idx] & ((1 << region_bits) - 1)) < (uint)region_overlap) {
           region--;
 
-	  if (RG_GET_HAS_2(region_map[nip][st][region]))
+	  if (RG_GET_HAS_2(*region_map_entry(nip, st, region)))
 	    break;
 	}
       }
@@ -873,7 +1141,32 @@ expand_anchor(read_entry * re, int st, anchor * a)
 */
 
 
-static void
+/*
+ * Move idx to the next posting of the given kmer that makes an anchor: one that
+ * passes the region filter and, with -H, comes from the same kmer as the read,
+ * rather than from another kmer hashed to the same list.
+ */
+static inline void
+advance_index_to_anchor(struct read_entry * re, int st, struct anchor_list_options * options,
+			int sn, uint offset, uint32_t * idx, int * anchors_discarded, int * fp_discarded)
+{
+  uint32_t mapidx = re->mapidx[st][offset];
+  uint max_idx = genomemap_len[sn][mapidx];
+
+  while (true) {
+    if (options->use_region_counts) {
+      advance_index_in_genomemap(re, st, options, idx, max_idx, genomemap[sn][mapidx],
+				 anchors_discarded);
+    }
+    if (!Hflag || *idx >= max_idx || genomemap_fp(sn, mapidx)[*idx] == re->mapidx_fp[st][offset])
+      break;
+    (*idx)++;
+    (*fp_discarded)++;
+  }
+}
+
+
+void
 read_get_anchor_list_per_strand(struct read_entry * re, int st,
 				struct anchor_list_options * options)
 {
@@ -885,6 +1178,7 @@ read_get_anchor_list_per_strand(struct read_entry * re, int st,
   struct heap_uu_elem tmp;
   int anchor_cache[re->read_len];
   int anchors_discarded = 0;
+  int fp_discarded = 0;
   int big_gaps = 0;
 
   assert(re != NULL && options != NULL);
@@ -933,7 +1227,7 @@ read_get_anchor_list_per_strand(struct read_entry * re, int st,
       }
 #endif
 #ifdef ENABLE_LOW_QUALITY_FILTER
-      if (Qflag && SQFflag && is_low_quality_read_subsequence(re->filter_qual, i, seed[sn])) {
+      if (is_filtered_kmer(re->filtered_kmers, sn*re->max_n_kmers + i)) {
         continue;
       }
 #endif
@@ -944,12 +1238,8 @@ read_get_anchor_list_per_strand(struct read_entry * re, int st,
 	idx[offset] = genomemap_len[sn][re->mapidx[st][offset]];
       }
 
-      if (options->use_region_counts) {
-	advance_index_in_genomemap(re, st, options,
-				   &idx[offset], genomemap_len[sn][re->mapidx[st][offset]],
-				   genomemap[sn][re->mapidx[st][offset]],
-				   &anchors_discarded);
-      }
+      advance_index_to_anchor(re, st, options, sn, offset, &idx[offset],
+			      &anchors_discarded, &fp_discarded);
 
       if (idx[offset] < genomemap_len[sn][re->mapidx[st][offset]]) {
 	tmp.key = genomemap[sn][re->mapidx[st][offset]][idx[offset]];
@@ -996,12 +1286,8 @@ read_get_anchor_list_per_strand(struct read_entry * re, int st,
       }
     }
 
-    if (options->use_region_counts) {
-      advance_index_in_genomemap(re, st, options,
-				 &idx[offset], genomemap_len[sn][re->mapidx[st][offset]],
-				 genomemap[sn][re->mapidx[st][offset]],
-				 &anchors_discarded);
-    }
+    advance_index_to_anchor(re, st, options, sn, offset, &idx[offset],
+			    &anchors_discarded, &fp_discarded);
 
     // load next anchor for that seed/mapidx
     if (idx[offset] < genomemap_len[sn][re->mapidx[st][offset]]) {
@@ -1028,6 +1314,7 @@ read_get_anchor_list_per_strand(struct read_entry * re, int st,
   //  }
 
   stat_add(&tpg.n_anchors_discarded, anchors_discarded);
+  tpg.n_anchors_fp_discarded += fp_discarded;
   stat_add(&tpg.n_big_gaps_anchor_list, big_gaps);
 }
 
@@ -1107,14 +1394,14 @@ read_get_hit_list_per_strand(struct read_entry * re, int st, struct hit_list_opt
 
     if (options->match_mode == 3) {
       int region = re->anchors[st][i].x >> region_bits;
-      assert(RG_VALID_MP_CNT(region_map[re->first_in_pair? 0 : 1][st][region]));
-      heavy_mp = (RG_GET_MP_CNT(region_map[re->first_in_pair? 0 : 1][st][region]) >= 2);
+      assert(RG_VALID_MP_CNT(*region_map_entry(re->first_in_pair? 0 : 1, st, region)));
+      heavy_mp = (RG_GET_MP_CNT(*region_map_entry(re->first_in_pair? 0 : 1, st, region)) >= 2);
 
       if (!heavy_mp && region > 0
 	  && (re->anchors[st][i].x & ((1 << region_bits) - 1)) < (uint)region_overlap) {
 	region--;
-	assert(RG_VALID_MP_CNT(region_map[re->first_in_pair? 0 : 1][st][region]));
-	heavy_mp = (RG_GET_MP_CNT(region_map[re->first_in_pair? 0 : 1][st][region]) >= 2);
+	assert(RG_VALID_MP_CNT(*region_map_entry(re->first_in_pair? 0 : 1, st, region)));
+	heavy_mp = (RG_GET_MP_CNT(*region_map_entry(re->first_in_pair? 0 : 1, st, region)) >= 2);
       }
     }
 
@@ -1278,6 +1565,70 @@ read_get_hit_list(struct read_entry * re, struct hit_list_options * options)
 }
 
 
+/*
+ * Fingerprint of re->read[k] with initial base init_bp for the shared f1
+ * cache. The sequence part is computed on first use; init_bp is mixed in on
+ * every call, since in colour space both strands use the same read[k].
+ */
+static inline uint64_t
+read_f1_fp(struct read_entry * re, int k, int init_bp)
+{
+  uint64_t fp;
+
+  if (f1_shared_cache == NULL)
+    return 0;
+
+  if (re->f1_fp[k] == 0)
+    re->f1_fp[k] = f1_read_fingerprint(re->read[k], re->read_len);
+
+  fp = re->f1_fp[k] ^ f1_mix64((uint64_t)(init_bp + 2));
+  return fp != 0? fp : 1;
+}
+
+
+/*
+ * Run the vector SW filter on this hit, found on strand st of the read.
+ */
+static void
+hit_run_vector_sw(struct read_entry * re, int st, struct read_hit * rh, bool gapless, uint tag)
+{
+  if (shrimp_mode == MODE_COLOUR_SPACE)
+    {
+      uint32_t ** gen_cs;
+      uint32_t ** gen_ls;
+
+      if (rh->st != re->input_strand)
+	reverse_hit(re, rh);
+
+      if (rh->gen_st == 0) {
+	gen_cs = genome_cs_contigs;
+	gen_ls = genome_contigs;
+      } else {
+	gen_cs = genome_cs_contigs_rc;
+	gen_ls = genome_contigs_rc;
+      }
+
+      rh->score_vector = f1_run(gen_cs[rh->cn], genome_len[rh->cn],
+				rh->g_off, rh->w_len,
+				re->read[rh->st], re->read_len,
+				rh->g_off + rh->anchor.x, rh->anchor.y,
+				gen_ls[rh->cn], re->initbp[st], genome_is_rna, tag, read_f1_fp(re, rh->st, re->initbp[st]),
+				gapless);
+    }
+  else
+    {
+      rh->score_vector = f1_run(genome_contigs[rh->cn], genome_len[rh->cn],
+				rh->g_off, rh->w_len,
+				re->read[st], re->read_len,
+				rh->g_off + rh->anchor.x, rh->anchor.y,
+				NULL, -1, genome_is_rna, tag, read_f1_fp(re, st, -1),
+				gapless);
+    }
+
+  rh->pct_score_vector = (1000 * 100 * rh->score_vector)/rh->score_max;
+}
+
+
 static void
 read_pass1_per_strand(struct read_entry * re, int st, struct pass1_options * options)
 {
@@ -1313,42 +1664,7 @@ read_pass1_per_strand(struct read_entry * re, int st, struct pass1_options * opt
     }
 
     if (re->hits[st][i].score_vector <= 0) {
-
-      if (shrimp_mode == MODE_COLOUR_SPACE)
-	{
-	  uint32_t ** gen_cs;
-	  uint32_t ** gen_ls;
-	  struct read_hit * rh = &re->hits[st][i];
-
-	  if (rh->st != re->input_strand)
-	    reverse_hit(re, &re->hits[st][i]);
-
-	  if (re->hits[st][i].gen_st == 0) {
-	    gen_cs = genome_cs_contigs;
-	    gen_ls = genome_contigs;
-	  } else {
-	    gen_cs = genome_cs_contigs_rc;
-	    gen_ls = genome_contigs_rc;
-	  }
-
-	  re->hits[st][i].score_vector = f1_run(gen_cs[re->hits[st][i].cn], genome_len[re->hits[st][i].cn],
-						re->hits[st][i].g_off, re->hits[st][i].w_len,
-						re->read[rh->st], re->read_len,
-						re->hits[st][i].g_off + re->hits[st][i].anchor.x, re->hits[st][i].anchor.y,
-						gen_ls[re->hits[st][i].cn], re->initbp[st], genome_is_rna, f1_hash_tag,
-						options->gapless);
-	}
-      else
-	{
-	  re->hits[st][i].score_vector = f1_run(genome_contigs[re->hits[st][i].cn], genome_len[re->hits[st][i].cn],
-						re->hits[st][i].g_off, re->hits[st][i].w_len,
-						re->read[st], re->read_len,
-						re->hits[st][i].g_off + re->hits[st][i].anchor.x, re->hits[st][i].anchor.y,
-						NULL, -1, genome_is_rna, f1_hash_tag,
-						options->gapless);
-	}
-
-      re->hits[st][i].pct_score_vector = (1000 * 100 * re->hits[st][i].score_vector)/re->hits[st][i].score_max;
+      hit_run_vector_sw(re, st, &re->hits[st][i], options->gapless, f1_hash_tag);
       if (re->hits[st][i].score_vector >= (int)abs_or_pct(options->threshold, re->hits[st][i].score_max)) {
 	last_good_cn = re->hits[st][i].cn;
 	last_good_g_off = re->hits[st][i].g_off_pos_strand;
@@ -1588,6 +1904,8 @@ read_remove_duplicate_hits(struct read_hit * * hits_pass2, int * n_hits_pass2)
   }
 #pragma omp atomic
   total_dup_single_matches += (*n_hits_pass2) - k;
+  if (thread_read_tally != NULL)
+    thread_read_tally->dup_single_matches += (*n_hits_pass2) - k;
 
   *n_hits_pass2 = k;
 
@@ -1613,6 +1931,8 @@ read_remove_duplicate_hits(struct read_hit * * hits_pass2, int * n_hits_pass2)
   }
 #pragma omp atomic
   total_dup_single_matches += (*n_hits_pass2) - k;
+  if (thread_read_tally != NULL)
+    thread_read_tally->dup_single_matches += (*n_hits_pass2) - k;
 
   *n_hits_pass2 = k;
 
@@ -1731,9 +2051,13 @@ read_pass2(struct read_entry * re,
     if (max_alignments == 0 || *n_hits_pass2 <= max_alignments) {
 #pragma omp atomic
       total_reads_matched++;
+      if (thread_read_tally != NULL)
+	thread_read_tally->reads_matched++;
     } else {
 #pragma omp atomic
       total_reads_dropped++;
+      if (thread_read_tally != NULL)
+	thread_read_tally->reads_dropped++;
       *n_hits_pass2 = 0;
     }
   }
@@ -1748,6 +2072,8 @@ read_pass2(struct read_entry * re,
   re->final_matches += *n_hits_pass2;
 #pragma omp atomic
   total_single_matches += re->final_matches;
+  if (thread_read_tally != NULL)
+    thread_read_tally->single_matches += re->final_matches;
 
   // check stop condition
   if (options->stop_count == 0)
@@ -1787,8 +2113,253 @@ read_save_final_hits(read_entry * re, read_hit * * hits_pass2, int n_hits_pass2)
 }
 
 
+/*
+ * Per-read latency histograms: the stage time counters are read before and
+ * after a read is handled, and the difference goes in the thread's histograms.
+ */
+static inline void
+read_stage_counters(llint * c)
+{
+  c[STAGE_REGION_COUNTS] = tpg.region_counts_tc.counter;
+  c[STAGE_MP_REGION_COUNTS] = tpg.mp_region_counts_tc.counter;
+  c[STAGE_ANCHOR_LIST] = tpg.anchor_list_tc.counter;
+  c[STAGE_HIT_LIST] = tpg.hit_list_tc.counter;
+  c[STAGE_PASS1] = tpg.pass1_tc.counter;
+  c[STAGE_GET_VECTOR_HITS] = tpg.get_vector_hits_tc.counter;
+  c[STAGE_PASS2] = tpg.pass2_tc.counter;
+  c[STAGE_DUPLICATE_REMOVAL] = tpg.duplicate_removal_tc.counter;
+}
+
+static inline void
+read_stage_hist_add(llint const * before, llint usecs)
+{
+  llint after[N_READ_STAGES];
+  int i;
+
+  read_stage_counters(after);
+  for (i = 0; i < N_READ_STAGES; i++)
+    if (after[i] > before[i])
+      hist_add(&tpg.stage_hist[i], after[i] - before[i]);
+  hist_add(&tpg.read_handle_hist, usecs);
+}
+
+/*
+ * Slow read capture: a read (or pair) that took at least slow_read_usecs to
+ * handle is written to slow_reads_file as it was read, with its timings in
+ * the header comment, so the file can be mapped again as it is.
+ */
+static void
+read_write_slow(read_entry * re, llint usecs, llint const * delta)
+{
+  int i;
+
+  fprintf(slow_reads_file, "%c%s slow_usecs=%lld", re->qual == NULL ? '>' : '@', re->name, usecs);
+  for (i = 0; i < N_READ_STAGES; i++)
+    fprintf(slow_reads_file, " %s=%.0f", read_stage_keys[i], (double)delta[i] * slow_read_usecs_per_unit);
+  fprintf(slow_reads_file, " anchors=%d hits=%d\n",
+	  re->n_anchors[0] + re->n_anchors[1], re->n_hits[0] + re->n_hits[1]);
+  fasta_write_fasta(slow_reads_file, re->orig_seq);
+  if (re->qual != NULL) {
+    fprintf(slow_reads_file, "%s\n", re->plus_line);
+    fasta_write_fasta(slow_reads_file, re->orig_qual);
+  }
+}
+
+static inline void
+read_capture_slow(read_entry * re1, read_entry * re2, llint usecs, llint const * stage_before)
+{
+  llint delta[N_READ_STAGES];
+  int i;
+
+  if (slow_reads_file == NULL || usecs < slow_read_usecs)
+    return;
+
+  read_stage_counters(delta);
+  for (i = 0; i < N_READ_STAGES; i++)
+    delta[i] -= stage_before[i];
+
+#pragma omp critical (slow_reads_file)
+  {
+    read_write_slow(re1, usecs, delta);
+    if (re2 != NULL)
+      read_write_slow(re2, usecs, delta);
+  }
+}
+
+
+/*
+ * Duplicate reads (--dup-cache).
+ *
+ * A read with the same sequence and qualities as an earlier read maps the
+ * same way, so its output is the SAM output of the earlier read under its own
+ * name. Each thread remembers up to dup_cache_size distinct reads, keeping
+ * their SAM lines without the QNAME, and what they added to the global
+ * counters.
+ */
+struct read_memo {
+  char * lines;
+  size_t lines_size;
+  bool mapped;
+  read_tally tally;
+};
+
+
+static uint32_t
+read_memo_hash(void * key)
+{
+  return hash_string((char *)key);
+}
+
+
+static int
+read_memo_cmp(void * key1, void * key2)
+{
+  return strcmp((char *)key1, (char *)key2);
+}
+
+
+static char *
+read_memo_key(struct read_entry * re)
+{
+  size_t seq_len = strlen(re->seq);
+  size_t qual_len = (re->qual != NULL? strlen(re->qual) : 0);
+  char * key = (char *)
+    my_malloc(seq_len + 1 + qual_len + 1, &mem_mapping, "read_memo key [%s]", re->name);
+
+  memcpy(key, re->seq, seq_len);
+  key[seq_len] = '\t';
+  memcpy(key + seq_len + 1, re->qual, qual_len);
+  key[seq_len + 1 + qual_len] = 0;
+  return key;
+}
+
+
+static void
+read_memo_replay(struct read_entry * re, struct read_memo * memo)
+{
+  read_memo_output(re, memo->lines);
+  re->mapped = memo->mapped;
+
+#pragma omp atomic
+  total_reads_matched += memo->tally.reads_matched;
+#pragma omp atomic
+  total_reads_matched_conf += memo->tally.reads_matched_conf;
+#pragma omp atomic
+  total_reads_dropped += memo->tally.reads_dropped;
+#pragma omp atomic
+  total_single_matches += memo->tally.single_matches;
+#pragma omp atomic
+  total_dup_single_matches += memo->tally.dup_single_matches;
+#pragma omp atomic
+  total_reads_memoized++;
+}
+
+
+/*
+ * Remember a read that was just mapped; its output starts at output_start in
+ * the thread output buffer. The cache takes over the key.
+ */
+static void
+read_memo_save(struct read_entry * re, char * key, read_tally * tally, size_t output_start)
+{
+  int thread_id = omp_get_thread_num();
+  char * start = thread_output_buffer[thread_id] + output_start;
+  char * end = thread_output_buffer_filled[thread_id];
+  size_t name_len = strlen(re->name);
+  struct read_memo * memo;
+  char * p, * q, * dest;
+  int n_lines = 0;
+
+  for (p = start; p < end; p++)
+    if (*p == '\n')
+      n_lines++;
+
+  memo = (struct read_memo *)my_malloc(sizeof(*memo), &mem_mapping, "read_memo [%s]", re->name);
+  memo->lines_size = (end - start) - n_lines * name_len + 1;
+  memo->lines = (char *)my_malloc(memo->lines_size, &mem_mapping, "read_memo lines [%s]", re->name);
+  memo->mapped = re->mapped;
+  memo->tally = *tally;
+
+  // every SAM line starts with the read name
+  dest = memo->lines;
+  for (p = start; p < end; p = q + 1) {
+    q = (char *)memchr(p, '\n', end - p);
+    assert(q != NULL && !strncmp(p, re->name, name_len) && p[name_len] == '\t');
+    memcpy(dest, p + name_len, q + 1 - (p + name_len));
+    dest += q + 1 - (p + name_len);
+  }
+  *dest = 0;
+
+  if (!dynhash_add(thread_read_memo, key, memo)) {
+    my_free(memo->lines, memo->lines_size, &mem_mapping, "read_memo lines [%s]", re->name);
+    my_free(memo, sizeof(*memo), &mem_mapping, "read_memo [%s]", re->name);
+    my_free(key, strlen(key) + 1, &mem_mapping, "read_memo key [%s]", re->name);
+  }
+}
+
+
+static void
+read_memo_free_one(void * arg, void * key, void * val)
+{
+  struct read_memo * memo = (struct read_memo *)val;
+
+  my_free(memo->lines, memo->lines_size, &mem_mapping, "read_memo lines");
+  my_free(memo, sizeof(*memo), &mem_mapping, "read_memo");
+  my_free(key, strlen((char *)key) + 1, &mem_mapping, "read_memo key");
+}
+
+
 void
-handle_read(struct read_entry * re, struct read_mapping_options_t * options, int n_options)
+read_memo_free()
+{
+  if (thread_read_memo == NULL)
+    return;
+
+  dynhash_iterate(thread_read_memo, read_memo_free_one, NULL);
+  dynhash_destroy(thread_read_memo);
+  thread_read_memo = NULL;
+}
+
+
+/*
+ * Check whether some kmer of the read, on a strand that is searched, has an
+ * index list that anchors can come from: non-empty and within list_cutoff.
+ * Every option set uses the same kmers and cutoff, so a read without one
+ * gets no anchors in any round and the whole cascade can be skipped.
+ */
+static bool
+read_has_seed_hits(struct read_entry * re)
+{
+  uint32_t len;
+  int i, sn, st, offset;
+
+  for (st = 0; st < 2; st++) {
+    if (re->mapidx[st] == NULL || (st == 0 && !Fflag) || (st == 1 && !Cflag))
+      continue;
+
+    for (sn = 0; sn < n_seeds; sn++) {
+      for (i = 0; re->min_kmer_pos + i + seed[sn].span - 1 < re->read_len; i++) {
+	offset = sn*re->max_n_kmers + i;
+#ifdef ENABLE_LOW_QUALITY_FILTER
+	if (is_filtered_kmer(re->filtered_kmers, offset))
+	  continue;
+#endif
+	len = genomemap_len[sn][re->mapidx[st][offset]];
+	if (len > 0 && len <= list_cutoff)
+	  return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+
+/*
+ * Map a read, going through the option sets until one of them is done
+ */
+static void
+read_map(struct read_entry * re, struct read_mapping_options_t * options, int n_options)
 {
   bool done;
   int option_index = 0;
@@ -1798,12 +2369,18 @@ handle_read(struct read_entry * re, struct read_mapping_options_t * options, int
   int n_hits_pass1;
   int n_hits_pass2;
 
-  llint before = gettimeinusecs();
-
   if (re->mapidx[0] == NULL) {
     read_get_mapidxs(re);
   }
 
+  if (!read_has_seed_hits(re)) {
+    if (pair_mode == PAIR_NONE) {
+#pragma omp atomic
+      total_reads_unseeded++;
+    }
+    return;
+  }
+
   do {
 
     if (options[option_index].regions.recompute) {
@@ -1860,22 +2437,65 @@ handle_read(struct read_entry * re, struct read_mapping_options_t * options, int
   //if (options_index >= n_options) {
     // this read fell through all the option sets
   //}
+}
+
 
-  tpg.read_handle_usecs += gettimeinusecs() - before;
+void
+handle_read(struct read_entry * re, struct read_mapping_options_t * options, int n_options)
+{
+  char * memo_key = NULL;
+  void * memo = NULL;
+  read_tally tally;
+  size_t output_start = 0;
+
+  llint before = gettimeinusecs();
+  llint stage_before[N_READ_STAGES];
+
+  read_stage_counters(stage_before);
+
+  if (dup_cache_size > 0) {
+    if (thread_read_memo == NULL) {
+      thread_read_memo = dynhash_create(read_memo_hash, read_memo_cmp);
+      if (thread_read_memo == NULL)
+	crash(1, 0, "failed to allocate the duplicate read cache");
+    }
+    memo_key = read_memo_key(re);
+    dynhash_find(thread_read_memo, memo_key, NULL, &memo);
+  }
+
+  if (memo != NULL) {
+    read_memo_replay(re, (struct read_memo *)memo);
+  } else {
+    if (memo_key != NULL && (int)dynhash_count(thread_read_memo) < dup_cache_size) {
+      memset(&tally, 0, sizeof(tally));
+      thread_read_tally = &tally;
+      output_start = thread_output_buffer_filled[omp_get_thread_num()] - thread_output_buffer[omp_get_thread_num()];
+    }
+    read_map(re, options, n_options);
+    if (thread_read_tally != NULL) {
+      thread_read_tally = NULL;
+      read_memo_save(re, memo_key, &tally, output_start);
+      memo_key = NULL;
+    }
+  }
+  if (memo_key != NULL)
+    my_free(memo_key, strlen(memo_key) + 1, &mem_mapping, "read_memo key [%s]", re->name);
+
+  // in paired mode, this is the half-paired fallback: the pair is timed and captured instead
+  if (pair_mode == PAIR_NONE) {
+    llint usecs = gettimeinusecs() - before;
+    tpg.read_handle_usecs += usecs;
+    read_stage_hist_add(stage_before, usecs);
+    read_capture_slow(re, NULL, usecs, stage_before);
+  }
 
   if (pair_mode == PAIR_NONE) {
     if (aligned_reads_file != NULL && re->mapped) {
-#pragma omp critical (aligned_reads_file)
-      {
-        fasta_write_read(aligned_reads_file, re);
-      }
+      read_dump_add(READ_DUMP_AL, re);
     }
     if ((unaligned_reads_file != NULL || sam_unaligned) && !re->mapped) {
-#pragma omp critical (unaligned_reads_file)
-      {
-        if (unaligned_reads_file != NULL) {
-          fasta_write_read(unaligned_reads_file, re);
-        }
+      if (unaligned_reads_file != NULL) {
+        read_dump_add(READ_DUMP_UN, re);
       }
       if (sam_unaligned) {
         hit_output(re, NULL, NULL, false, NULL, 0);
@@ -1890,6 +2510,13 @@ DEF_EXTHEAP(struct read_hit_pair, paired_pass1)
 
 /*
  * Go through the hit lists, constructing paired hits.
+ *
+ * The mate hits of every hit form a window [pair_min, pair_max] of the mate
+ * hit list, and windows usually slide forward. The best vector score in the
+ * window is kept with a monotone queue, and windows where even the best
+ * partner cannot pass the threshold or enter the full heap are skipped. The
+ * other windows are scanned in the same order as before, so the heap ends up
+ * with the same paired hits.
  */
 static void
 readpair_get_vector_hits(struct read_entry * re1, struct read_entry * re2,
@@ -1901,17 +2528,53 @@ readpair_get_vector_hits(struct read_entry * re1, struct read_entry * re2,
 
   int st1, st2, i, j;
   read_hit_pair tmp;
+  int q[MAX(re2->n_hits[0], re2->n_hits[1]) + 1];
 
   assert(re1 != NULL && re2 != NULL && a != NULL);
 
   for (st1 = 0; st1 < 2; st1++) {
     st2 = 1 - st1; // opposite strand
 
+    struct read_hit * hits2 = re2->hits[st2];
+    int q_head = 0, q_tail = 0; // queue of unsaved mate hits, by decreasing score_vector
+    int next = 0;		// next mate hit to enter the queue
+    int last_min = -1;
+    int min_score_max = INT_MAX;
+
+    for (j = 0; j < re2->n_hits[st2]; j++)
+      min_score_max = MIN(min_score_max, hits2[j].score_max);
+
     for (i = 0; i < re1->n_hits[st1]; i++) {
       if (re1->hits[st1][i].saved == 1) continue;
       if (re1->hits[st1][i].pair_min < 0)
 	continue;
 
+      // slide the window; start over if it moved back
+      if (re1->hits[st1][i].pair_min < last_min || re1->hits[st1][i].pair_max < next - 1) {
+	q_head = q_tail = 0;
+	next = re1->hits[st1][i].pair_min;
+      }
+      last_min = re1->hits[st1][i].pair_min;
+      for ( ; next <= re1->hits[st1][i].pair_max; next++) {
+	if (hits2[next].saved == 1) continue;
+	while (q_tail > q_head && hits2[q[q_tail - 1]].score_vector <= hits2[next].score_vector)
+	  q_tail--;
+	q[q_tail++] = next;
+      }
+      while (q_head < q_tail && q[q_head] < re1->hits[st1][i].pair_min)
+	q_head++;
+      if (q_head == q_tail) // all partners are saved
+	continue;
+
+      // bound the score and the key of the best partner
+      int best_score = re1->hits[st1][i].score_vector + hits2[q[q_head]].score_vector;
+      int low_score_max = re1->hits[st1][i].score_max + min_score_max;
+      if (best_score < (int)abs_or_pct(options->pass1_threshold, low_score_max))
+	continue;
+      if (*load == options->pass1_num_outputs && best_score >= 0
+	  && (IS_ABSOLUTE(options->pass1_threshold)? best_score : (1000 * 100 * best_score)/low_score_max) <= a[0].key)
+	continue;
+
       for (j = re1->hits[st1][i].pair_min; j <= re1->hits[st1][i].pair_max; j++) {
 	if (re2->hits[st2][j].saved == 1) continue;
 	//if (re1->hits[st1][i].matches + re2->hits[st2][j].matches < options->min_num_matches)
@@ -2283,12 +2946,23 @@ static void
 readpair_compute_mp_ranges(struct read_entry * re1, struct read_entry * re2,
 			   struct pairing_options * options)
 {
+  int min_insert = options->min_insert_size;
+  int max_insert = options->max_insert_size;
+
+  // narrow down to the learned window, unless the two do not meet
+  if (thread_insert_size != NULL
+      && thread_insert_size->min_insert_size <= max_insert
+      && thread_insert_size->max_insert_size >= min_insert) {
+    min_insert = MAX(min_insert, thread_insert_size->min_insert_size);
+    max_insert = MIN(max_insert, thread_insert_size->max_insert_size);
+  }
+
   switch (pair_mode) {
   case PAIR_OPP_IN:
-    re1->delta_g_off_min[0] =   options->min_insert_size						- re2->window_len;
-    re1->delta_g_off_max[0] =   options->max_insert_size + (re1->window_len - re1->read_len)	- re2->read_len;
-    re1->delta_g_off_min[1] = - options->max_insert_size + re1->read_len				+ (re2->read_len - re2->window_len);
-    re1->delta_g_off_max[1] = - options->min_insert_size + re1->window_len;
+    re1->delta_g_off_min[0] =   min_insert						- re2->window_len;
+    re1->delta_g_off_max[0] =   max_insert + (re1->window_len - re1->read_len)	- re2->read_len;
+    re1->delta_g_off_min[1] = - max_insert + re1->read_len				+ (re2->read_len - re2->window_len);
+    re1->delta_g_off_max[1] = - min_insert + re1->window_len;
 
     re2->delta_g_off_min[0] = - re1->delta_g_off_max[1];
     re2->delta_g_off_max[0] = - re1->delta_g_off_min[1];
@@ -2298,23 +2972,23 @@ readpair_compute_mp_ranges(struct read_entry * re1, struct read_entry * re2,
 
   case PAIR_OPP_OUT:
     /*
-    re1->delta_g_off_min[0] = - options->max_insert_size						- re2->window_len;
-    re1->delta_g_off_max[0] = - options->min_insert_size + (re1->window_len - re1->read_len)	- re2->read_len;
-    re1->delta_g_off_min[1] =   options->min_insert_size + re1->read_len				+ (re2->read_len - re2->window_len);
-    re1->delta_g_off_max[1] =   options->max_insert_size + re1->window_len;
+    re1->delta_g_off_min[0] = - max_insert						- re2->window_len;
+    re1->delta_g_off_max[0] = - min_insert + (re1->window_len - re1->read_len)	- re2->read_len;
+    re1->delta_g_off_min[1] =   min_insert + re1->read_len				+ (re2->read_len - re2->window_len);
+    re1->delta_g_off_max[1] =   max_insert + re1->window_len;
 
     re2->delta_g_off_min[0] = - re1->delta_g_off_max[1];
     re2->delta_g_off_max[0] = - re1->delta_g_off_min[1];
     re2->delta_g_off_min[1] = - re1->delta_g_off_max[0];
     re2->delta_g_off_max[1] = - re1->delta_g_off_min[0];
     */
-    re1->delta_g_off_min[0] =   options->min_insert_size                                                - re2->window_len;
+    re1->delta_g_off_min[0] =   min_insert                                                - re2->window_len;
     re1->delta_g_off_min[0] += re1->read_len + re2->read_len;
-    re1->delta_g_off_max[0] =   options->max_insert_size + (re1->window_len - re1->read_len)    - re2->read_len;
+    re1->delta_g_off_max[0] =   max_insert + (re1->window_len - re1->read_len)    - re2->read_len;
     re1->delta_g_off_max[0] += re1->read_len + re2->read_len;
-    re1->delta_g_off_min[1] = - options->max_insert_size + re1->read_len                                + (re2->read_len - re2->window_len);
+    re1->delta_g_off_min[1] = - max_insert + re1->read_len                                + (re2->read_len - re2->window_len);
     re1->delta_g_off_min[1] -= re1->read_len + re2->read_len;
-    re1->delta_g_off_max[1] = - options->min_insert_size + re1->window_len;
+    re1->delta_g_off_max[1] = - min_insert + re1->window_len;
     re1->delta_g_off_max[1] -= re1->read_len + re2->read_len;
 
     re2->delta_g_off_min[0] = - re1->delta_g_off_max[1];
@@ -2325,23 +2999,23 @@ readpair_compute_mp_ranges(struct read_entry * re1, struct read_entry * re2,
 
   case PAIR_COL_FW:
     /*
-    re1->delta_g_off_min[0] =   options->min_insert_size						+ (re2->read_len - re2->window_len);
-    re1->delta_g_off_max[0] =   options->max_insert_size + (re1->window_len - re1->read_len);
-    re1->delta_g_off_min[1] = - options->max_insert_size + re1->read_len				- re2->window_len;
-    re1->delta_g_off_max[1] = - options->min_insert_size + re1->window_len			- re2->read_len;
+    re1->delta_g_off_min[0] =   min_insert						+ (re2->read_len - re2->window_len);
+    re1->delta_g_off_max[0] =   max_insert + (re1->window_len - re1->read_len);
+    re1->delta_g_off_min[1] = - max_insert + re1->read_len				- re2->window_len;
+    re1->delta_g_off_max[1] = - min_insert + re1->window_len			- re2->read_len;
 
     re2->delta_g_off_min[0] = - re1->delta_g_off_max[0];
     re2->delta_g_off_max[0] = - re1->delta_g_off_min[0];
     re2->delta_g_off_min[1] = - re1->delta_g_off_max[1];
     re2->delta_g_off_max[1] = - re1->delta_g_off_min[1];
     */
-    re1->delta_g_off_min[0] =   options->min_insert_size                                                - re2->window_len;
+    re1->delta_g_off_min[0] =   min_insert                                                - re2->window_len;
     re1->delta_g_off_min[0] += re2->read_len;
-    re1->delta_g_off_max[0] =   options->max_insert_size + (re1->window_len - re1->read_len)    - re2->read_len;
+    re1->delta_g_off_max[0] =   max_insert + (re1->window_len - re1->read_len)    - re2->read_len;
     re1->delta_g_off_max[0] += re2->read_len;
-    re1->delta_g_off_min[1] = - options->max_insert_size + re1->read_len                                + (re2->read_len - re2->window_len);
+    re1->delta_g_off_min[1] = - max_insert + re1->read_len                                + (re2->read_len - re2->window_len);
     re1->delta_g_off_min[1] -= re2->read_len;
-    re1->delta_g_off_max[1] = - options->min_insert_size + re1->window_len;
+    re1->delta_g_off_max[1] = - min_insert + re1->window_len;
     re1->delta_g_off_max[1] -= re2->read_len;
 
     re2->delta_g_off_min[0] = - re1->delta_g_off_max[0];
@@ -2352,10 +3026,10 @@ readpair_compute_mp_ranges(struct read_entry * re1, struct read_entry * re2,
 
   case PAIR_COL_BW:
     /*
-    re1->delta_g_off_min[0] = - options->max_insert_size						+ (re2->read_len - re2->window_len);
-    re1->delta_g_off_max[0] = - options->min_insert_size + (re1->window_len - re1->read_len);
-    re1->delta_g_off_min[1] =   options->min_insert_size + re1->read_len				- re2->window_len;
-    re1->delta_g_off_max[1] =   options->max_insert_size + re1->window_len			- re2->read_len;
+    re1->delta_g_off_min[0] = - max_insert						+ (re2->read_len - re2->window_len);
+    re1->delta_g_off_max[0] = - min_insert + (re1->window_len - re1->read_len);
+    re1->delta_g_off_min[1] =   min_insert + re1->read_len				- re2->window_len;
+    re1->delta_g_off_max[1] =   max_insert + re1->window_len			- re2->read_len;
 
     re2->delta_g_off_min[0] = - re1->delta_g_off_max[0];
     re2->delta_g_off_max[0] = - re1->delta_g_off_min[0];
@@ -2363,13 +3037,13 @@ readpair_compute_mp_ranges(struct read_entry * re1, struct read_entry * re2,
     re2->delta_g_off_max[1] = - re1->delta_g_off_min[1];
     */
 
-    re1->delta_g_off_min[0] =   options->min_insert_size                                                - re2->window_len;
+    re1->delta_g_off_min[0] =   min_insert                                                - re2->window_len;
     re1->delta_g_off_min[0] += re1->read_len;
-    re1->delta_g_off_max[0] =   options->max_insert_size + (re1->window_len - re1->read_len)    - re2->read_len;
+    re1->delta_g_off_max[0] =   max_insert + (re1->window_len - re1->read_len)    - re2->read_len;
     re1->delta_g_off_max[0] += re1->read_len;
-    re1->delta_g_off_min[1] = - options->max_insert_size + re1->read_len                                + (re2->read_len - re2->window_len);
+    re1->delta_g_off_min[1] = - max_insert + re1->read_len                                + (re2->read_len - re2->window_len);
     re1->delta_g_off_min[1] -= re1->read_len;
-    re1->delta_g_off_max[1] = - options->min_insert_size + re1->window_len;
+    re1->delta_g_off_max[1] = - min_insert + re1->window_len;
     re1->delta_g_off_max[1] -= re1->read_len;
 
     re2->delta_g_off_min[0] = - re1->delta_g_off_max[0];
@@ -2464,6 +3138,316 @@ readpair_save_final_hits(pair_entry * pe, read_hit_pair * hits_pass2, int n_hits
 }
 
 
+static int
+insert_size_cmp(void const * a, void const * b)
+{
+  int x = *(int const *)a;
+  int y = *(int const *)b;
+
+  return (x > y) - (x < y);
+}
+
+
+/*
+ * Estimate the insert size distribution from the samples, ignoring those
+ * more than 3 interquartile ranges away from the middle half.
+ */
+static void
+insert_size_estimate(int * samples, int n, insert_size_model * m)
+{
+  double sum = 0, sum_sq = 0;
+  int q1, q3, lo, hi;
+  int i, cnt = 0;
+
+  qsort(samples, n, sizeof(samples[0]), insert_size_cmp);
+  q1 = samples[n / 4];
+  q3 = samples[(3 * n) / 4];
+  lo = q1 - 3 * (q3 - q1);
+  hi = q3 + 3 * (q3 - q1);
+
+  for (i = 0; i < n; i++) {
+    if (samples[i] < lo || samples[i] > hi)
+      continue;
+    sum += samples[i];
+    sum_sq += (double)samples[i] * samples[i];
+    cnt++;
+  }
+
+  m->n_samples = cnt;
+  m->mean = sum / cnt;
+  m->stddev = cnt > 1? sqrt(MAX(sum_sq - sum * sum / cnt, 0) / (cnt - 1)) : 0;
+  if (m->stddev < 1)
+    m->stddev = 1;
+  m->min_insert_size = MAX((int)floor(m->mean - INSERT_SIZE_SIGMAS * m->stddev), 0);
+  m->max_insert_size = (int)ceil(m->mean + INSERT_SIZE_SIGMAS * m->stddev);
+}
+
+
+/*
+ * Pick up the learned insert sizes once they are published. Until then,
+ * add the insert size of a confidently paired read, if given (i.e., >= 0).
+ * The thread filling the last slot publishes the estimate. Once it is out,
+ * this only takes an atomic read; the lock is only taken to add a sample.
+ */
+static void
+insert_size_update(int sample)
+{
+  insert_size_model * m;
+
+#pragma omp atomic read seq_cst
+  m = learned_insert_size;
+
+  if (m == NULL && sample >= 0) {
+#pragma omp critical (insert_size)
+    {
+      if (learned_insert_size == NULL) {
+	if (insert_size_samples == NULL)
+	  insert_size_samples = (int *)
+	    my_malloc(learn_insert_size * sizeof(insert_size_samples[0]),
+		      &mem_mapping, "insert_size_samples");
+	insert_size_samples[n_insert_size_samples++] = sample;
+
+	if (n_insert_size_samples == learn_insert_size) {
+	  m = (insert_size_model *)
+	    my_malloc(sizeof(insert_size_model), &mem_mapping, "learned_insert_size");
+	  insert_size_estimate(insert_size_samples, n_insert_size_samples, m);
+#pragma omp atomic write seq_cst
+	  learned_insert_size = m;
+	  logit(0, "learned insert sizes from %d pairs: mean:%.1f stddev:%.1f window:[%d,%d]",
+		n_insert_size_samples, m->mean, m->stddev, m->min_insert_size, m->max_insert_size);
+	}
+      }
+      m = learned_insert_size;
+    }
+  }
+
+  thread_insert_size = m;
+}
+
+
+/*
+ * Save or output the paired hits found by pass2, then release the full SW
+ * results of the pass1 hits that were not kept.
+ */
+static void
+readpair_finish_pass2(pair_entry * pe, struct read_hit_pair * hits_pass1, int n_hits_pass1,
+		      struct read_hit_pair * hits_pass2, int n_hits_pass2,
+		      struct pairing_options * options)
+{
+  int i;
+
+  // a single, proper paired hit is a confident one
+  if (learn_insert_size > 0 && thread_insert_size == NULL
+      && n_hits_pass2 == 1 && !hits_pass2[0].improper_mapping && hits_pass2[0].insert_size > 0)
+    insert_size_update(hits_pass2[0].insert_size);
+
+  if (n_hits_pass2 > 0) {
+    if (options->save_outputs)
+      readpair_save_final_hits(pe, hits_pass2, n_hits_pass2);
+    else {
+      readpair_output_no_mqv(pe, hits_pass2, n_hits_pass2);
+      for (i = 0; i < n_hits_pass2; i++) {
+	hits_pass2[i].rh[0]->sfrp->in_use = false;
+	hits_pass2[i].rh[1]->sfrp->in_use = false;
+      }
+    }
+    pe->mapped = true;
+  }
+
+  for (i = 0; i < n_hits_pass1; i++) {
+    if (hits_pass1[i].rh[0]->sfrp != NULL && !hits_pass1[i].rh[0]->sfrp->in_use)
+      free_sfrp(&hits_pass1[i].rh[0]->sfrp, pe->re[0], &mem_mapping);
+    if (hits_pass1[i].rh[1]->sfrp != NULL && !hits_pass1[i].rh[1]->sfrp->in_use)
+      free_sfrp(&hits_pass1[i].rh[1]->sfrp, pe->re[1], &mem_mapping);
+  }
+}
+
+
+/*
+ * Mate rescue.
+ *
+ * For every unsaved hit of one read that passes its vector filter, look for
+ * the mate in the genome range allowed by the insert sizes and the pair mode,
+ * without using seeds: the range is tiled with windows of the mate's window
+ * length, overlapping by the mate's length, and every tile is run through the
+ * mate's vector filter. Tiles that pass are paired with the hit that produced
+ * them, which is recorded in pair_min/pair_max.
+ *
+ * Tiles are stored in rescue_hits[nip][st], nip being the number of the mate.
+ */
+static void
+readpair_rescue_get_vector_hits(struct read_entry * * re, struct read_hit * rescue_hits[2][2],
+				int n_rescue_hits[2][2], int max_rescue_hits[2][2],
+				struct read_hit_pair * a, int * load,
+				struct readpair_mapping_options_t * options)
+{
+  TIME_COUNTER_START(tpg.pass1_tc);
+
+  int nip, st, st_mp, i;
+  read_hit_pair tmp;
+
+  for (nip = 0; nip < 2; nip++) {
+    struct read_entry * re_a = re[1 - nip]; // the read with the hits
+    struct read_entry * re_mp = re[nip];   // the mate being rescued
+    struct pass1_options * options_a = &options->read[1 - nip].pass1;
+    struct pass1_options * options_mp = &options->read[nip].pass1;
+
+    for (st = 0; st < 2; st++) {
+      st_mp = 1 - st; // opposite strand
+      uint tag_a = ++f1_hash_tag;
+      uint tag_mp = ++f1_hash_tag;
+
+      for (i = 0; i < re_a->n_hits[st]; i++) {
+	struct read_hit * rh = &re_a->hits[st][i];
+	int cn = rh->cn;
+	int w_len = re_mp->window_len;
+	int step = MAX(re_mp->window_len - re_mp->read_len, 1);
+	llint goff, goff_min, goff_max;
+
+	if (rh->saved == 1)
+	  continue;
+	if (rh->score_vector < 0)
+	  hit_run_vector_sw(re_a, st, rh, options_a->gapless, tag_a);
+	if (rh->score_vector < (int)abs_or_pct(options_a->threshold, rh->score_max))
+	  continue;
+
+	if ((uint32_t)w_len > genome_len[cn])
+	  w_len = (int)genome_len[cn];
+	goff_min = MAX(rh->g_off_pos_strand + re_a->delta_g_off_min[st], 0);
+	goff_max = MIN(rh->g_off_pos_strand + re_a->delta_g_off_max[st], (llint)genome_len[cn] - w_len);
+
+	if (goff_min > goff_max)
+	  continue;
+
+	// the last tile ends where the range does
+	for (goff = goff_min; goff < goff_max + step; goff += step) {
+	  struct read_hit * rh_mp;
+
+	  if (n_rescue_hits[nip][st_mp] == max_rescue_hits[nip][st_mp]) {
+	    int new_max = MAX(2 * max_rescue_hits[nip][st_mp], 16);
+	    rescue_hits[nip][st_mp] = (struct read_hit *)
+	      my_realloc(rescue_hits[nip][st_mp], new_max * sizeof(rescue_hits[0][0][0]),
+			 max_rescue_hits[nip][st_mp] * sizeof(rescue_hits[0][0][0]),
+			 &mem_mapping, "rescue_hits [%s]", re_mp->name);
+	    max_rescue_hits[nip][st_mp] = new_max;
+	  }
+	  rh_mp = &rescue_hits[nip][st_mp][n_rescue_hits[nip][st_mp]];
+	  memset(rh_mp, 0, sizeof(*rh_mp));
+
+	  // no seed to anchor the full SW: let it search the whole window
+	  struct anchor corners[2];
+	  corners[0].x = 0;
+	  corners[0].y = re_mp->read_len - 1;
+	  corners[1].x = w_len - 1;
+	  corners[1].y = 0;
+	  corners[0].length = corners[1].length = 1;
+	  corners[0].width = corners[1].width = 1;
+	  corners[0].weight = corners[1].weight = 0;
+	  corners[0].cn = corners[1].cn = cn;
+	  anchor_join(corners, 2, &rh_mp->anchor);
+
+	  rh_mp->g_off = MIN(goff, goff_max);
+	  rh_mp->g_off_pos_strand = rh_mp->g_off;
+	  rh_mp->w_len = w_len;
+	  rh_mp->cn = cn;
+	  rh_mp->st = st_mp;
+	  rh_mp->gen_st = 0;
+	  rh_mp->score_vector = -1;
+	  rh_mp->score_full = -1;
+	  rh_mp->score_max = (re_mp->read_len < w_len? re_mp->read_len : w_len) * match_score;
+	  rh_mp->pair_min = i;
+	  rh_mp->pair_max = i;
+	  rh_mp->mapping_quality = 255;
+
+	  hit_run_vector_sw(re_mp, st_mp, rh_mp, false, tag_mp);
+	  if (rh_mp->score_vector >= (int)abs_or_pct(options_mp->threshold, rh_mp->score_max))
+	    n_rescue_hits[nip][st_mp]++;
+	}
+      }
+    }
+  }
+
+  // the tiles are in place; pair them up
+  for (nip = 0; nip < 2; nip++) {
+    for (st_mp = 0; st_mp < 2; st_mp++) {
+      st = 1 - st_mp;
+      for (i = 0; i < n_rescue_hits[nip][st_mp]; i++) {
+	tmp.rh[nip] = &rescue_hits[nip][st_mp][i];
+	tmp.rh[1 - nip] = &re[1 - nip]->hits[st][tmp.rh[nip]->pair_min];
+	tmp.score = tmp.rh[0]->score_vector + tmp.rh[1]->score_vector;
+	tmp.score_max = tmp.rh[0]->score_max + tmp.rh[1]->score_max;
+	tmp.pct_score = (1000 * 100 * tmp.score)/tmp.score_max;
+	tmp.key = (IS_ABSOLUTE(options->pairing.pass1_threshold)? tmp.score : tmp.pct_score);
+	tmp.improper_mapping = false;
+	tmp.rh_idx[0] = -1;
+	tmp.rh_idx[1] = -1;
+	tmp.insert_size = 0;
+
+	if (tmp.score >= (int)abs_or_pct(options->pairing.pass1_threshold, tmp.score_max)
+	    && (*load < options->pairing.pass1_num_outputs || tmp.key > a[0].key)) {
+	  if (*load < options->pairing.pass1_num_outputs)
+	    extheap_paired_pass1_insert(a, load, tmp);
+	  else
+	    extheap_paired_pass1_replace_min(a, load, tmp);
+	}
+      }
+    }
+  }
+
+  TIME_COUNTER_STOP(tpg.pass1_tc);
+}
+
+
+/*
+ * Try to rescue a pair that the current option set left unpaired.
+ * Return true if any paired hit was found.
+ */
+static bool
+readpair_rescue(pair_entry * pe, struct readpair_mapping_options_t * options)
+{
+  read_entry * re1 = pe->re[0];
+  read_entry * re2 = pe->re[1];
+  struct read_hit * rescue_hits[2][2] = { { NULL, NULL }, { NULL, NULL } };
+  int n_rescue_hits[2][2] = { { 0, 0 }, { 0, 0 } };
+  int max_rescue_hits[2][2] = { { 0, 0 }, { 0, 0 } };
+  struct read_hit_pair * hits_pass1 = NULL;
+  struct read_hit_pair * hits_pass2 = NULL;
+  int n_hits_pass1;
+  int n_hits_pass2;
+  int nip, st;
+
+  hits_pass1 = (struct read_hit_pair *)
+    my_malloc(options->pairing.pass1_num_outputs * sizeof(hits_pass1[0]), &mem_mapping, "hits_pass1 [%s,%s]", re1->name, re2->name);
+  n_hits_pass1 = 0;
+  readpair_rescue_get_vector_hits(pe->re, rescue_hits, n_rescue_hits, max_rescue_hits,
+				  hits_pass1, &n_hits_pass1, options);
+
+  hits_pass2 = (struct read_hit_pair *)
+    my_malloc(options->pairing.pass1_num_outputs * sizeof(hits_pass2[0]), &mem_mapping, "hits_pass2 [%s,%s]", re1->name, re2->name);
+  n_hits_pass2 = 0;
+  if (n_hits_pass1 > 0) {
+    readpair_pass2(re1, re2, hits_pass1, n_hits_pass1, hits_pass2, &n_hits_pass2, &options->pairing,
+		   &options->read[0].pass2, &options->read[1].pass2);
+    readpair_finish_pass2(pe, hits_pass1, n_hits_pass1, hits_pass2, n_hits_pass2, &options->pairing);
+  }
+
+  if (n_hits_pass2 > 0) {
+#pragma omp atomic
+    total_pairs_rescued++;
+  }
+
+  my_free(hits_pass1, options->pairing.pass1_num_outputs * sizeof(hits_pass1[0]), &mem_mapping, "hits_pass1 [%s,%s]", re1->name, re2->name);
+  my_free(hits_pass2, options->pairing.pass1_num_outputs * sizeof(hits_pass2[0]), &mem_mapping, "hits_pass2 [%s,%s]", re1->name, re2->name);
+  for (nip = 0; nip < 2; nip++)
+    for (st = 0; st < 2; st++)
+      if (rescue_hits[nip][st] != NULL)
+	my_free(rescue_hits[nip][st], max_rescue_hits[nip][st] * sizeof(rescue_hits[0][0][0]),
+		&mem_mapping, "rescue_hits [%s]", pe->re[nip]->name);
+
+  return n_hits_pass2 > 0;
+}
+
+
 void
 handle_readpair(pair_entry * pe,
 		struct readpair_mapping_options_t * options, int n_options)
@@ -2472,18 +3456,30 @@ handle_readpair(pair_entry * pe,
   read_entry * re2 = pe->re[1];
   bool done;
   int option_index = 0;
-  int i;
   struct read_hit_pair * hits_pass1 = NULL;
   struct read_hit_pair * hits_pass2 = NULL;
   int n_hits_pass1;
   int n_hits_pass2;
 
   llint before = gettimeinusecs();
+  llint stage_before[N_READ_STAGES];
+
+  read_stage_counters(stage_before);
+
+  if (learn_insert_size > 0 && thread_insert_size == NULL)
+    insert_size_update(-1);
 
   read_get_mapidxs(re1);
   read_get_mapidxs(re2);
 
-  do {
+  if (!read_has_seed_hits(re1) && !read_has_seed_hits(re2)) {
+    // neither read gets anchors, so there is nothing to pair up or rescue
+#pragma omp atomic
+    total_pairs_unseeded++;
+    option_index = n_options;
+  }
+
+  while (option_index < n_options) {
     readpair_compute_mp_ranges(re1, re2, &options[option_index].pairing);
 
     if (options[option_index].read[0].regions.recompute || options[option_index].read[1].regions.recompute) {
@@ -2542,32 +3538,20 @@ handle_readpair(pair_entry * pe,
     done = readpair_pass2(re1, re2, hits_pass1, n_hits_pass1, hits_pass2, &n_hits_pass2, &options[option_index].pairing,
 			  &options[option_index].read[0].pass2, &options[option_index].read[1].pass2);
 
-    if (n_hits_pass2 > 0) {
-      if (options[option_index].pairing.save_outputs)
-	readpair_save_final_hits(pe, hits_pass2, n_hits_pass2);
-      else {
-	readpair_output_no_mqv(pe, hits_pass2, n_hits_pass2);
-	for (i = 0; i < n_hits_pass2; i++) {
-	  hits_pass2[i].rh[0]->sfrp->in_use = false;
-	  hits_pass2[i].rh[1]->sfrp->in_use = false;
-	}
-      }
-      pe->mapped = true;
-    }
-
-    for (i = 0; i < n_hits_pass1; i++) {
-      if (hits_pass1[i].rh[0]->sfrp != NULL && !hits_pass1[i].rh[0]->sfrp->in_use)
-	free_sfrp(&hits_pass1[i].rh[0]->sfrp, re1, &mem_mapping);
-      if (hits_pass1[i].rh[1]->sfrp != NULL && !hits_pass1[i].rh[1]->sfrp->in_use)
-	free_sfrp(&hits_pass1[i].rh[1]->sfrp, re2, &mem_mapping);
-    }
+    readpair_finish_pass2(pe, hits_pass1, n_hits_pass1, hits_pass2, n_hits_pass2, &options[option_index].pairing);
 
     my_free(hits_pass1, options[option_index].pairing.pass1_num_outputs * sizeof(hits_pass1[0]), &mem_mapping, "hits_pass1 [%s,%s]", re1->name, re2->name);
     my_free(hits_pass2, options[option_index].pairing.pass1_num_outputs * sizeof(hits_pass2[0]), &mem_mapping, "hits_pass2 [%s,%s]", re1->name, re2->name);
 
-  } while (!done && ++option_index < n_options);
+    if (mate_rescue && n_hits_pass2 == 0) {
+      // rescued pairs end the cascade: later option sets could find them again
+      done = readpair_rescue(pe, &options[option_index]) || done;
+    }
 
-  tpg.read_handle_usecs += gettimeinusecs() - before;
+    if (done)
+      break;
+    option_index++;
+  }
 
   if (option_index >= n_options && half_paired) {
     // this read pair fell through all the option sets; try unpaired mapping
@@ -2575,23 +3559,23 @@ handle_readpair(pair_entry * pe,
     handle_read(re2, unpaired_mapping_options[1], n_unpaired_mapping_options[1]);
   }
 
+  // the pair is one sample, fallback included
+  llint usecs = gettimeinusecs() - before;
+  tpg.read_handle_usecs += usecs;
+  read_stage_hist_add(stage_before, usecs);
+  read_capture_slow(re1, re2, usecs, stage_before);
+
   // OUTPUT
   readpair_output(pe);
 
   if (aligned_reads_file != NULL && (pe->mapped || re1->mapped || re2->mapped)) {
-#pragma omp critical (aligned_reads_file)
-    {
-      fasta_write_read(aligned_reads_file, re1);
-      fasta_write_read(aligned_reads_file, re2);
-    }
+    read_dump_add(READ_DUMP_AL, re1);
+    read_dump_add(READ_DUMP_AL, re2);
   }
   if ((unaligned_reads_file != NULL || sam_unaligned) && !(pe->mapped || re1->mapped || re2->mapped)) {
-#pragma omp critical (unaligned_reads_file)
-    {
-      if (unaligned_reads_file != NULL) {
-	fasta_write_read(unaligned_reads_file, re1);
-	fasta_write_read(unaligned_reads_file, re2);
-      }
+    if (unaligned_reads_file != NULL) {
+      read_dump_add(READ_DUMP_UN, re1);
+      read_dump_add(READ_DUMP_UN, re2);
     }
     if (sam_unaligned) {
       hit_output(re1, NULL, NULL, true, NULL, 0);
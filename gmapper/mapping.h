@@ -23,6 +23,12 @@
 void		handle_read(read_entry *, struct read_mapping_options_t *, int);
 void		handle_readpair(pair_entry *, struct readpair_mapping_options_t *, int);
 int		get_insert_size(read_hit *, read_hit *);
+void		region_tables_free();
+void		read_memo_free();
+
+// single stages, for tests/bench
+void		read_get_mapidxs(read_entry *);
+void		read_get_anchor_list_per_strand(read_entry *, int, struct anchor_list_options *);
 
 
 static inline double
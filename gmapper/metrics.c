@@ -0,0 +1,260 @@
+#define _MODULE_METRICS
+
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics.h"
+#include "../common/version.h"
+
+#define METRICS_UNIX_PREFIX "unix:"
+
+static pthread_t monitor;
+static int stop_pipe[2] = { -1, -1 };
+static int listen_fd = -1;
+static double hz;
+static llint start_usecs;
+
+// the last snapshot, for the rate over the interval
+static llint last_usecs;
+static llint last_nreads;
+static llint last_progress_usecs;
+static llint last_progress_nreads;
+
+
+static double
+tc_secs(time_counter const * tc)
+{
+  if (tc->type == 0)
+    return (double)tc->counter / hz;
+  else
+    return (double)tc->counter / 1.0e6;
+}
+
+static llint
+rss_bytes()
+{
+  FILE * fp = fopen("/proc/self/statm", "r");
+  long pages = 0;
+
+  if (fp == NULL)
+    return 0;
+  if (fscanf(fp, "%*d %ld", &pages) != 1)
+    pages = 0;
+  fclose(fp);
+  return (llint)pages * sysconf(_SC_PAGESIZE);
+}
+
+static void
+write_mem(FILE * fp, char const * name, count_t * c)
+{
+  fprintf(fp, ",\n    \"%s\": %lld, \"%s_max\": %lld", name, (long long)count_get_count(c),
+	  name, (long long)count_get_max(c));
+}
+
+/*
+ * Write a snapshot of the metrics to fp, as a JSON object. The counters are
+ * read while the mapping threads update them, so they are only consistent
+ * to within a read or so.
+ */
+static void
+metrics_write(FILE * fp, bool done)
+{
+  llint now = gettimeinusecs();
+  llint n = nreads;
+  double elapsed = (double)(now - start_usecs) / 1.0e6;
+  double interval = (double)(now - last_usecs) / 1.0e6;
+  double stage_secs[N_READ_STAGES];
+  double wait_secs = 0, read_handle_secs = 0;
+  int i, j;
+
+  if (n != last_progress_nreads) {
+    last_progress_nreads = n;
+    last_progress_usecs = now;
+  }
+
+  for (j = 0; j < N_READ_STAGES; j++)
+    stage_secs[j] = 0;
+  for (i = 0; i < num_threads; i++) {
+    tpg_t * t = metrics_tpg[i];
+    if (t == NULL)
+      continue;
+    wait_secs += tc_secs(&t->wait_tc);
+    read_handle_secs += (double)t->read_handle_usecs / 1.0e6;
+    stage_secs[STAGE_REGION_COUNTS] += tc_secs(&t->region_counts_tc);
+    stage_secs[STAGE_MP_REGION_COUNTS] += tc_secs(&t->mp_region_counts_tc);
+    stage_secs[STAGE_ANCHOR_LIST] += tc_secs(&t->anchor_list_tc);
+    stage_secs[STAGE_HIT_LIST] += tc_secs(&t->hit_list_tc);
+    stage_secs[STAGE_PASS1] += tc_secs(&t->pass1_tc);
+    stage_secs[STAGE_GET_VECTOR_HITS] += tc_secs(&t->get_vector_hits_tc);
+    stage_secs[STAGE_PASS2] += tc_secs(&t->pass2_tc);
+    stage_secs[STAGE_DUPLICATE_REMOVAL] += tc_secs(&t->duplicate_removal_tc);
+  }
+
+  // shares are of the total thread time since mapping started
+  double thread_secs = elapsed * num_threads;
+  if (thread_secs <= 0)
+    thread_secs = 1;
+
+  fprintf(fp, "{\n  \"state\": \"%s\"", done ? "done" : "mapping");
+  fprintf(fp, ",\n  \"version\": \"%s\"", SHRIMP_VERSION_STRING);
+  fprintf(fp, ",\n  \"pid\": %d", (int)getpid());
+  fprintf(fp, ",\n  \"threads\": %d", num_threads);
+  fprintf(fp, ",\n  \"mapping_secs\": %.3f", elapsed);
+  fprintf(fp, ",\n  \"reads\": %lld", (long long)n);
+  fprintf(fp, ",\n  \"reads_per_sec\": %.2f", interval > 0 ? (double)(n - last_nreads) / interval : 0);
+  fprintf(fp, ",\n  \"reads_per_sec_avg\": %.2f", elapsed > 0 ? (double)n / elapsed : 0);
+  fprintf(fp, ",\n  \"secs_since_progress\": %.3f", (double)(now - last_progress_usecs) / 1.0e6);
+  fprintf(fp, ",\n  \"threads_waiting_for_reads\": %d", metrics_threads_waiting);
+  fprintf(fp, ",\n  \"output_chunks_pending\": %u",
+	  metrics_output_chunks != NULL ? *metrics_output_chunks : 0);
+
+  fprintf(fp, ",\n  \"time_share\": {\n    \"read_handling\": %.4f", read_handle_secs / thread_secs);
+  fprintf(fp, ",\n    \"wait\": %.4f", wait_secs / thread_secs);
+  for (j = 0; j < N_READ_STAGES; j++)
+    fprintf(fp, ",\n    \"%s\": %.4f", read_stage_keys[j], stage_secs[j] / thread_secs);
+  fprintf(fp, "\n  }");
+
+  fprintf(fp, ",\n  \"memory\": {\n    \"rss\": %lld", (long long)rss_bytes());
+  write_mem(fp, "genomemap", &mem_genomemap);
+  write_mem(fp, "mapping", &mem_mapping);
+  write_mem(fp, "thread_buffer", &mem_thread_buffer);
+  write_mem(fp, "sw", &mem_sw);
+  write_mem(fp, "small", &mem_small);
+  fprintf(fp, "\n  }\n}\n");
+
+  last_usecs = now;
+  last_nreads = n;
+}
+
+/*
+ * Replace the metrics file, through a temporary file so that readers never
+ * see half a snapshot.
+ */
+static void
+metrics_write_file(bool done)
+{
+  char tmp_name[strlen(metrics_target) + 5];
+  FILE * fp;
+
+  sprintf(tmp_name, "%s.tmp", metrics_target);
+  fp = fopen(tmp_name, "w");
+  if (fp == NULL) {
+    logit(0, "cannot write metrics file [%s]", tmp_name);
+    return;
+  }
+  metrics_write(fp, done);
+  fclose(fp);
+  rename(tmp_name, metrics_target);
+}
+
+static void *
+monitor_main(void * arg)
+{
+  struct pollfd pfd[2];
+  int nfds = 1;
+  llint next_usecs = gettimeinusecs() + (llint)metrics_interval * 1000000;
+
+  pfd[0].fd = stop_pipe[0];
+  pfd[0].events = POLLIN;
+  if (listen_fd >= 0) {
+    pfd[1].fd = listen_fd;
+    pfd[1].events = POLLIN;
+    nfds = 2;
+  }
+
+  while (true) {
+    llint now = gettimeinusecs();
+    int timeout = next_usecs > now ? (int)((next_usecs - now) / 1000) : 0;
+
+    if (poll(pfd, nfds, timeout) < 0)
+      continue;
+    if (pfd[0].revents & POLLIN)
+      break;
+
+    if (nfds == 2 && (pfd[1].revents & POLLIN)) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0) {
+	FILE * fp = fdopen(fd, "w");
+	if (fp != NULL) {
+	  metrics_write(fp, false);
+	  fclose(fp);
+	} else
+	  close(fd);
+      }
+    }
+
+    if ((llint)gettimeinusecs() >= next_usecs) {
+      if (listen_fd < 0)
+	metrics_write_file(false);
+      next_usecs += (llint)metrics_interval * 1000000;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Start the monitor thread, if --metrics was given. Must be called before
+ * the mapping threads start.
+ */
+void
+metrics_start()
+{
+  if (metrics_target == NULL)
+    return;
+
+  metrics_tpg = (tpg_t * *)xcalloc(num_threads * sizeof(metrics_tpg[0]));
+  hz = cpuhz();
+  start_usecs = last_usecs = last_progress_usecs = gettimeinusecs();
+  last_nreads = last_progress_nreads = nreads;
+
+  if (strncmp(metrics_target, METRICS_UNIX_PREFIX, strlen(METRICS_UNIX_PREFIX)) == 0) {
+    char const * path = metrics_target + strlen(METRICS_UNIX_PREFIX);
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+      crash(1, 0, "metrics socket path too long [%s]", path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0
+	|| bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+	|| listen(listen_fd, 8) != 0)
+      crash(1, 1, "cannot serve metrics on socket [%s]", path);
+  }
+
+  if (pipe(stop_pipe) != 0)
+    crash(1, 1, "cannot create metrics pipe");
+  if (pthread_create(&monitor, NULL, monitor_main, NULL) != 0)
+    crash(1, 0, "cannot start metrics thread");
+}
+
+/*
+ * Stop the monitor thread once mapping is done. A metrics file is left with
+ * a final snapshot; a socket is removed.
+ */
+void
+metrics_stop()
+{
+  if (metrics_target == NULL)
+    return;
+
+  if (write(stop_pipe[1], "x", 1) != 1)
+    crash(1, 1, "cannot stop metrics thread");
+  pthread_join(monitor, NULL);
+  close(stop_pipe[0]);
+  close(stop_pipe[1]);
+
+  if (listen_fd >= 0) {
+    close(listen_fd);
+    unlink(metrics_target + strlen(METRICS_UNIX_PREFIX));
+  } else
+    metrics_write_file(true);
+
+  free(metrics_tpg);
+  metrics_tpg = NULL;
+}
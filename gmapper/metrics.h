@@ -0,0 +1,41 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#ifdef __cplusplus
+//extern "C" {
+#endif
+
+#include "gmapper.h"
+#include "../common/util.h"
+
+#undef EXTERN
+#undef STATIC
+#ifdef _MODULE_METRICS
+#define EXTERN(_type, _id, _init_val) _type _id = _init_val
+#define STATIC(_type, _id, _init_val) static _type _id = _init_val
+#else
+#define EXTERN(_type, _id, _init_val) extern _type _id
+#define STATIC(_type, _id, _init_val)
+#endif
+
+
+/*
+ * Live metrics: while mapping, a monitor thread periodically writes a JSON
+ * snapshot of the progress to a file, or serves it on a Unix socket.
+ * The mapping threads only publish where their counters are; the monitor
+ * reads them as they are, without any locking.
+ */
+EXTERN(tpg_t * *,		metrics_tpg,			NULL);	/* each mapping thread's globals */
+EXTERN(int,			metrics_threads_waiting,	0);	/* threads waiting for a chunk of reads */
+EXTERN(uint const *,		metrics_output_chunks,		NULL);	/* chunks waiting to be printed */
+
+
+void		metrics_start();
+void		metrics_stop();
+
+
+#ifdef __cplusplus
+//} /* extern "C" */
+#endif
+
+#endif
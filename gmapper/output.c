@@ -462,6 +462,9 @@ hit_output(struct read_entry * re, struct read_hit * rh, struct read_hit * rh_mp
 			//extra+=sprintf(extra,"\tRG:Z:%s",sam_read_group_name);
 			*output_buffer += snprintf(*output_buffer,output_buffer_end-*output_buffer,"\tRG:Z:%s",sam_read_group_name);
 		}
+		if (sam_read_ordinals) {
+			*output_buffer += snprintf(*output_buffer,output_buffer_end-*output_buffer,"\tZO:i:%lld",re->read_ordinal);
+		}
 		*output_buffer += snprintf(*output_buffer,output_buffer_end-*output_buffer,"\n");	
 		assert(satisfying_alignments==0);
 		assert(stored_alignments==0);
@@ -754,6 +757,10 @@ hit_output(struct read_entry * re, struct read_hit * rh, struct read_hit * rh_mp
 				     editstr);
 	  free(editstr);
 	}
+	//mergesam finds the read ordinal as the last field
+	if (sam_read_ordinals) {
+		*output_buffer += snprintf(*output_buffer,output_buffer_end-*output_buffer,"\tZO:i:%lld",re->read_ordinal);
+	}
 	if (cigar_binary!=NULL) {
 		free_cigar(cigar_binary);
 		free(cigar);
@@ -797,7 +804,9 @@ static inline double
 get_pr_insert_size(double insert_size)
 {
   double res;
-  res = normal_cdf(insert_size + 10, insert_size_mean, insert_size_stddev) - normal_cdf(insert_size - 10, insert_size_mean, insert_size_stddev);
+  double mean = (thread_insert_size != NULL? thread_insert_size->mean : insert_size_mean);
+  double stddev = (thread_insert_size != NULL? thread_insert_size->stddev : insert_size_stddev);
+  res = normal_cdf(insert_size + 10, mean, stddev) - normal_cdf(insert_size - 10, mean, stddev);
   //int bucket = (insert_size - min_insert_size) / insert_histogram_bucket_size;
   //if (bucket < 0) bucket = 0;
   //if (bucket > 99) bucket = 99;
@@ -1004,6 +1013,8 @@ read_output(struct read_entry * re, struct read_hit * * hits_pass2, int n_hits_p
   if (pair_mode == PAIR_NONE && good_unpair) {
 #pragma omp atomic
     total_reads_matched_conf++;
+    if (thread_read_tally != NULL)
+      thread_read_tally->reads_matched_conf++;
   }
 }
 
@@ -1289,3 +1300,143 @@ readpair_output(pair_entry * pe)
     total_reads_matched_conf++;
   }
 }
+
+
+/*
+ * --al/--un read dumps.
+ *
+ * Each thread appends the reads of its chunk to its own buffer, in the format
+ * of the input. The buffer is handed over with the SAM output of the chunk,
+ * so the dumps are printed in input order and without a critical section per
+ * read. When the target file name ends in .gz, the worker compresses the chunk
+ * into a gzip member of its own; concatenated members form a valid gzip file.
+ */
+static void
+read_dump_put(read_dump * rd, char const * s, size_t len)
+{
+  if (rd->filled + len > rd->size) {
+    size_t new_size = MAX(MAX(2 * rd->size, rd->filled + len), (size_t)thread_output_buffer_safety);
+    rd->buffer = (char *)
+      my_realloc(rd->buffer, new_size, rd->size,
+		 &mem_thread_buffer, "thread_read_dump[]");
+    rd->size = new_size;
+  }
+  memcpy(rd->buffer + rd->filled, s, len);
+  rd->filled += len;
+}
+
+
+// same line breaks as fasta_write_fasta()
+static void
+read_dump_put_fasta(read_dump * rd, char const * seq)
+{
+  size_t length = strlen(seq);
+  size_t index;
+
+  for (index = 0; index < length; index += FASTA_PER_LINE - 1) {
+    read_dump_put(rd, seq + index, MIN((size_t)(FASTA_PER_LINE - 1), length - index));
+    read_dump_put(rd, "\n", 1);
+  }
+}
+
+
+void
+read_dump_add(int k, read_entry * re)
+{
+  read_dump * rd = &thread_read_dump[k][omp_get_thread_num()];
+
+  read_dump_put(rd, re->qual == NULL? ">" : "@", 1);
+  read_dump_put(rd, re->name, strlen(re->name));
+  read_dump_put(rd, "\n", 1);
+  read_dump_put_fasta(rd, re->orig_seq);
+  if (re->qual != NULL) {
+    read_dump_put(rd, re->plus_line, strlen(re->plus_line));
+    read_dump_put(rd, "\n", 1);
+    read_dump_put_fasta(rd, re->orig_qual);
+  }
+}
+
+
+/*
+ * Hand over the dump of the current chunk; res->ptr is NULL if it is empty.
+ */
+void
+read_dump_take(int k, ptr_and_sz * res)
+{
+  read_dump * rd = &thread_read_dump[k][omp_get_thread_num()];
+
+  res->ptr = NULL;
+  res->sz = 0;
+  if (rd->filled == 0)
+    return;
+
+  if (read_dump_gzip[k]) {
+    z_stream zs;
+    size_t bound;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      crash(1, 0, "deflateInit2 failed");
+    bound = deflateBound(&zs, rd->filled);
+    res->ptr = my_malloc(bound, &mem_thread_buffer, "thread_read_dump[]");
+    zs.next_in = (Bytef *)rd->buffer;
+    zs.avail_in = rd->filled;
+    zs.next_out = (Bytef *)res->ptr;
+    zs.avail_out = bound;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+      crash(1, 0, "deflate failed");
+    res->sz = zs.total_out;
+    deflateEnd(&zs);
+    res->ptr = my_realloc(res->ptr, res->sz, bound,
+			  &mem_thread_buffer, "thread_read_dump[]");
+    rd->filled = 0; // keep the buffer for the next chunk
+  } else {
+    res->sz = rd->filled;
+    res->ptr = my_realloc(rd->buffer, res->sz, rd->size,
+			  &mem_thread_buffer, "thread_read_dump[]");
+    rd->buffer = NULL;
+    rd->size = 0;
+    rd->filled = 0;
+  }
+}
+
+
+/*
+ * Print the SAM lines of an earlier read with the same sequence and qualities
+ * (--dup-cache); the lines come without the QNAME, which is taken from re.
+ */
+void
+read_memo_output(read_entry * re, char const * lines)
+{
+  int thread_id = omp_get_thread_num();
+  size_t name_len = strlen(re->name);
+  size_t need = strlen(lines) + 1;
+  char const * p, * q;
+
+  for (p = lines; *p != 0; p++)
+    if (*p == '\n')
+      need += name_len;
+
+  while ((size_t)(thread_output_buffer[thread_id] + thread_output_buffer_sizes[thread_id] - thread_output_buffer_filled[thread_id]) < need) {
+    size_t new_size = thread_output_buffer_sizes[thread_id] + thread_output_buffer_increment;
+    size_t filled = thread_output_buffer_filled[thread_id] - thread_output_buffer[thread_id];
+
+    thread_output_buffer[thread_id] = (char *)
+      my_realloc(thread_output_buffer[thread_id], new_size, thread_output_buffer_sizes[thread_id],
+		 &mem_thread_buffer, "realloc thread_output_buffer");
+    thread_output_buffer_sizes[thread_id] = new_size;
+    thread_output_buffer_filled[thread_id] = thread_output_buffer[thread_id] + filled;
+  }
+
+  char * dest = thread_output_buffer_filled[thread_id];
+  for (p = lines; *p != 0; p = q + 1) {
+    q = strchr(p, '\n');
+    assert(q != NULL);
+    memcpy(dest, re->name, name_len);
+    dest += name_len;
+    memcpy(dest, p, q + 1 - p);
+    dest += q + 1 - p;
+  }
+  *dest = 0;
+  thread_output_buffer_filled[thread_id] = dest;
+}
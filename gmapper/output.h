@@ -25,6 +25,9 @@ void	hit_output(struct read_entry *, struct read_hit *, struct read_hit *,
 void	read_output(read_entry *, struct read_hit * *, int);
 void	readpair_output_no_mqv(pair_entry *, struct read_hit_pair *, int);
 void	readpair_output(pair_entry *);
+void	read_dump_add(int, read_entry *);
+void	read_memo_output(read_entry *, char const *);
+void	read_dump_take(int, ptr_and_sz *);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,568 @@
+#include <zlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <omp.h>
+#include "bgzf_reader.h"
+
+//BGZF blocks are at most this big, compressed or inflated
+#define BGZF_MAX_BLOCK_SIZE 65536
+#define BGZF_HEADER_SIZE 12
+#define BGZF_FOOTER_SIZE 8
+#ifndef MIN
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+
+static void fill_batch(bgzf_reader * br);
+
+//BAM is little endian, as are the machines we run on
+static inline int32_t get_int32(const char * p) {
+	int32_t x;
+	memcpy(&x,p,sizeof(int32_t));
+	return x;
+}
+
+static inline uint32_t get_uint32(const char * p) {
+	uint32_t x;
+	memcpy(&x,p,sizeof(uint32_t));
+	return x;
+}
+
+static inline uint16_t get_uint16(const char * p) {
+	uint16_t x;
+	memcpy(&x,p,sizeof(uint16_t));
+	return x;
+}
+
+//find the size of the whole block in the BC field of the gzip extra data,
+//returns 0 if there is none
+static size_t bgzf_block_size(const unsigned char * extra, size_t extra_length) {
+	size_t i=0;
+	while (i+4<=extra_length) {
+		const size_t subfield_length=extra[i+2]|(extra[i+3]<<8);
+		if (extra[i]=='B' && extra[i+1]=='C' && subfield_length==2 && i+6<=extra_length) {
+			return (size_t)(extra[i+4]|(extra[i+5]<<8))+1;
+		}
+		i+=4+subfield_length;
+	}
+	return 0;
+}
+
+//peek at the first block header, the file is left at its start
+bool is_bgzf_file(FILE * file) {
+	unsigned char header[BGZF_HEADER_SIZE+6];
+	const size_t got=fread(header,1,sizeof(header),file);
+	rewind(file);
+	if (got<sizeof(header) || header[0]!=31 || header[1]!=139 || header[2]!=8 || (header[3]&4)==0) {
+		return false;
+	}
+	const size_t extra_length=header[10]|(header[11]<<8);
+	return bgzf_block_size(header+BGZF_HEADER_SIZE,MIN(extra_length,6))!=0;
+}
+
+bgzf_reader * bgzf_open(FILE * file,int threads) {
+	bgzf_reader * br=(bgzf_reader*)malloc(sizeof(bgzf_reader));
+	if (br==NULL) {
+		fprintf(stderr,"bgzf_reader : failed to allocate base structure\n");
+		exit(1);
+	}
+	memset(br,0,sizeof(bgzf_reader));
+	br->file=file;
+	br->batch_blocks=(threads>0 ? threads : 1)*4;
+	br->blocks=(char**)malloc(sizeof(char*)*br->batch_blocks);
+	br->block_lengths=(size_t*)malloc(sizeof(size_t)*br->batch_blocks);
+	br->block_offsets=(size_t*)malloc(sizeof(size_t)*br->batch_blocks);
+	if (br->blocks==NULL || br->block_lengths==NULL || br->block_offsets==NULL) {
+		fprintf(stderr,"bgzf_reader : failed to allocate block tables\n");
+		exit(1);
+	}
+	int i;
+	for (i=0; i<br->batch_blocks; i++) {
+		br->blocks[i]=(char*)malloc(BGZF_MAX_BLOCK_SIZE);
+		if (br->blocks[i]==NULL) {
+			fprintf(stderr,"bgzf_reader : failed to allocate block buffer\n");
+			exit(1);
+		}
+	}
+	br->data_size=(size_t)br->batch_blocks*BGZF_MAX_BLOCK_SIZE*2;
+	br->data=(char*)malloc(br->data_size);
+	if (br->data==NULL) {
+		fprintf(stderr,"bgzf_reader : failed to allocate %lu bytes for inflated data\n",br->data_size);
+		exit(1);
+	}
+	//BAM and bgzip'ed SAM are told apart by the magic of the inflated stream
+	fill_batch(br);
+	br->bam=(br->data_used>=4 && memcmp(br->data,"BAM\1",4)==0);
+	return br;
+}
+
+void bgzf_close(bgzf_reader * br) {
+	int i;
+	for (i=0; i<br->batch_blocks; i++) {
+		free(br->blocks[i]);
+	}
+	for (i=0; i<br->n_refs; i++) {
+		free(br->ref_names[i]);
+	}
+	free(br->ref_names);
+	free(br->blocks);
+	free(br->block_lengths);
+	free(br->block_offsets);
+	free(br->data);
+	free(br->text);
+	fclose(br->file);
+	free(br);
+}
+
+//read the next compressed block whole, returns false at the end of the file
+static bool read_block(bgzf_reader * br, int i) {
+	unsigned char * const block=(unsigned char*)br->blocks[i];
+	const size_t got=fread(block,1,BGZF_HEADER_SIZE,br->file);
+	if (got==0) {
+		return false;
+	}
+	if (got!=BGZF_HEADER_SIZE || block[0]!=31 || block[1]!=139 || block[2]!=8 || (block[3]&4)==0) {
+		fprintf(stderr,"bgzf_reader : corrupt or truncated BGZF block header\n");
+		exit(1);
+	}
+	const size_t extra_length=block[10]|(block[11]<<8);
+	if (BGZF_HEADER_SIZE+extra_length+BGZF_FOOTER_SIZE>BGZF_MAX_BLOCK_SIZE || fread(block+BGZF_HEADER_SIZE,1,extra_length,br->file)!=extra_length) {
+		fprintf(stderr,"bgzf_reader : truncated BGZF block header\n");
+		exit(1);
+	}
+	const size_t block_size=bgzf_block_size(block+BGZF_HEADER_SIZE,extra_length);
+	const size_t read_so_far=BGZF_HEADER_SIZE+extra_length;
+	if (block_size<read_so_far+BGZF_FOOTER_SIZE || block_size>BGZF_MAX_BLOCK_SIZE) {
+		fprintf(stderr,"bgzf_reader : bad BGZF block size %lu\n",block_size);
+		exit(1);
+	}
+	if (fread(block+read_so_far,1,block_size-read_so_far,br->file)!=block_size-read_so_far) {
+		fprintf(stderr,"bgzf_reader : truncated BGZF block\n");
+		exit(1);
+	}
+	br->block_lengths[i]=block_size;
+	return true;
+}
+
+static inline size_t block_inflated_size(bgzf_reader * br, int i) {
+	return get_uint32(br->blocks[i]+br->block_lengths[i]-4);
+}
+
+static void inflate_block(bgzf_reader * br, int i) {
+	const unsigned char * const block=(unsigned char*)br->blocks[i];
+	const size_t extra_length=block[10]|(block[11]<<8);
+	const size_t inflated_size=block_inflated_size(br,i);
+	if (inflated_size==0) {
+		return;
+	}
+	z_stream zs;
+	memset(&zs,0,sizeof(z_stream));
+	if (inflateInit2(&zs,-15)!=Z_OK) {
+		fprintf(stderr,"bgzf_reader : failed to initialize inflate\n");
+		exit(1);
+	}
+	zs.next_in=(Bytef*)(block+BGZF_HEADER_SIZE+extra_length);
+	zs.avail_in=br->block_lengths[i]-BGZF_HEADER_SIZE-extra_length-BGZF_FOOTER_SIZE;
+	zs.next_out=(Bytef*)(br->data+br->block_offsets[i]);
+	zs.avail_out=inflated_size;
+	const int ret=inflate(&zs,Z_FINISH);
+	if (ret!=Z_STREAM_END || zs.total_out!=inflated_size) {
+		fprintf(stderr,"bgzf_reader : failed to inflate BGZF block\n");
+		exit(1);
+	}
+	inflateEnd(&zs);
+}
+
+//read the next batch of blocks and inflate them in parallel after the data
+//not yet handed out, each block knows its inflated size so the blocks can
+//be placed before they are inflated
+static void fill_batch(bgzf_reader * br) {
+	memmove(br->data,br->data+br->data_seen,br->data_used-br->data_seen);
+	br->data_used-=br->data_seen;
+	br->data_seen=0;
+	int blocks=0;
+	size_t offset=br->data_used;
+	while (blocks<br->batch_blocks) {
+		if (!read_block(br,blocks)) {
+			br->file_eof=true;
+			break;
+		}
+		br->block_offsets[blocks]=offset;
+		offset+=block_inflated_size(br,blocks);
+		blocks++;
+	}
+	if (offset>br->data_size) {
+		br->data_size=offset*2;
+		br->data=(char*)realloc(br->data,br->data_size);
+		if (br->data==NULL) {
+			fprintf(stderr,"bgzf_reader : failed to grow inflated data to %lu bytes\n",br->data_size);
+			exit(1);
+		}
+	}
+	int i;
+	if (omp_in_parallel()) {
+		//called from a task or loop of the merge, let idle threads help
+		#pragma omp taskloop grainsize(1)
+		for (i=0; i<blocks; i++) {
+			inflate_block(br,i);
+		}
+	} else {
+		#pragma omp parallel for schedule(dynamic)
+		for (i=0; i<blocks; i++) {
+			inflate_block(br,i);
+		}
+	}
+	br->data_used=offset;
+}
+
+static void ensure_text(bgzf_reader * br, size_t length) {
+	if (br->text_used+length>br->text_size) {
+		br->text_size=(br->text_used+length)*2;
+		br->text=(char*)realloc(br->text,br->text_size);
+		if (br->text==NULL) {
+			fprintf(stderr,"bgzf_reader : failed to grow SAM text to %lu bytes\n",br->text_size);
+			exit(1);
+		}
+	}
+}
+
+static inline char * put_int(char * p, long long x) {
+	char digits[24];
+	int n=0;
+	unsigned long long u=(x<0 ? -(unsigned long long)x : (unsigned long long)x);
+	if (x<0) {
+		*p++='-';
+	}
+	do {
+		digits[n++]='0'+u%10;
+		u/=10;
+	} while (u!=0);
+	while (n>0) {
+		*p++=digits[--n];
+	}
+	return p;
+}
+
+//the BAM header is the SAM header text followed by the reference table,
+//returns false if it is not all inflated yet
+static bool convert_bam_header(bgzf_reader * br) {
+	const char * const start=br->data+br->data_seen;
+	const size_t available=br->data_used-br->data_seen;
+	if (available<12) {
+		return false;
+	}
+	const int32_t l_text=get_int32(start+4);
+	if (l_text<0 || available<8+(size_t)l_text+4) {
+		return false;
+	}
+	const int32_t n_refs=get_int32(start+8+l_text);
+	size_t used=8+l_text+4;
+	int i;
+	for (i=0; i<n_refs; i++) {
+		if (available<used+4 || available<used+4+get_int32(start+used)+4) {
+			return false;
+		}
+		used+=4+get_int32(start+used)+4;
+	}
+	br->n_refs=n_refs;
+	br->ref_names=(char**)malloc(sizeof(char*)*(n_refs>0 ? n_refs : 1));
+	if (br->ref_names==NULL) {
+		fprintf(stderr,"bgzf_reader : failed to allocate BAM reference names\n");
+		exit(1);
+	}
+	//text may be NUL padded
+	size_t text_length=strnlen(start+8,l_text);
+	ensure_text(br,text_length+used*2+1);
+	memcpy(br->text,start+8,text_length);
+	br->text_used=text_length;
+	if (text_length>0 && br->text[text_length-1]!='\n') {
+		br->text[br->text_used++]='\n';
+	}
+	//old BAM files may keep the references only in the binary table
+	const bool have_sq=(text_length>=3 && (strncmp(br->text,"@SQ",3)==0 || memmem(br->text,text_length,"\n@SQ",4)!=NULL));
+	size_t offset=8+l_text+4;
+	for (i=0; i<n_refs; i++) {
+		const int32_t l_name=get_int32(start+offset);
+		br->ref_names[i]=strndup(start+offset+4,l_name);
+		if (br->ref_names[i]==NULL) {
+			fprintf(stderr,"bgzf_reader : failed to allocate BAM reference name\n");
+			exit(1);
+		}
+		const size_t name_length=strlen(br->ref_names[i]);
+		if (name_length>br->max_ref_name) {
+			br->max_ref_name=name_length;
+		}
+		if (!have_sq) {
+			ensure_text(br,name_length+40);
+			char * p=br->text+br->text_used;
+			memcpy(p,"@SQ\tSN:",7); p+=7;
+			memcpy(p,br->ref_names[i],name_length); p+=name_length;
+			memcpy(p,"\tLN:",4); p+=4;
+			p=put_int(p,get_int32(start+offset+4+l_name));
+			*p++='\n';
+			br->text_used=p-br->text;
+		}
+		offset+=4+l_name+4;
+	}
+	br->data_seen+=used;
+	br->bam_header_done=true;
+	return true;
+}
+
+static const char * ref_name(bgzf_reader * br, int32_t ref_id) {
+	if (ref_id<0) {
+		return "*";
+	}
+	if (ref_id>=br->n_refs) {
+		fprintf(stderr,"bgzf_reader : BAM record refers to unknown reference %d\n",ref_id);
+		exit(1);
+	}
+	return br->ref_names[ref_id];
+}
+
+static inline char * put_string(char * p, const char * s) {
+	const size_t length=strlen(s);
+	memcpy(p,s,length);
+	return p+length;
+}
+
+//size of the values of a BAM array or numeric field, 0 for unknown types
+static inline size_t aux_value_size(char type) {
+	switch (type) {
+	case 'A': case 'c': case 'C': return 1;
+	case 's': case 'S': return 2;
+	case 'i': case 'I': case 'f': return 4;
+	default: return 0;
+	}
+}
+
+//an auxiliary field claims more bytes than are left in its record
+static inline void check_aux_length(const char * x, size_t length, const char * end) {
+	if (length>(size_t)(end-x)) {
+		fprintf(stderr,"bgzf_reader : corrupt BAM auxiliary field\n");
+		exit(1);
+	}
+}
+
+//turn one BAM alignment record into a SAM line, returns the new end of text
+static char * convert_bam_record(bgzf_reader * br, const char * record, size_t record_size, char * p) {
+	const int32_t ref_id=get_int32(record);
+	const int32_t pos=get_int32(record+4);
+	const unsigned int l_read_name=(unsigned char)record[8];
+	const unsigned int mapq=(unsigned char)record[9];
+	const unsigned int n_cigar_op=get_uint16(record+12);
+	const unsigned int flag=get_uint16(record+14);
+	const int32_t l_seq=get_int32(record+16);
+	const int32_t next_ref_id=get_int32(record+20);
+	const int32_t next_pos=get_int32(record+24);
+	const int32_t tlen=get_int32(record+28);
+	const char * x=record+32;
+	const char * const end=record+record_size;
+	if (l_read_name==0 || l_seq<0 || x+l_read_name+n_cigar_op*4+(l_seq+1)/2+l_seq>end) {
+		fprintf(stderr,"bgzf_reader : corrupt BAM record\n");
+		exit(1);
+	}
+	memcpy(p,x,l_read_name-1); p+=l_read_name-1;
+	x+=l_read_name;
+	*p++='\t'; p=put_int(p,flag);
+	*p++='\t'; p=put_string(p,ref_name(br,ref_id));
+	*p++='\t'; p=put_int(p,(long long)pos+1);
+	*p++='\t'; p=put_int(p,mapq);
+	*p++='\t';
+	if (n_cigar_op==0) {
+		*p++='*';
+	} else {
+		unsigned int i;
+		for (i=0; i<n_cigar_op; i++) {
+			const uint32_t op=get_uint32(x+4*i);
+			p=put_int(p,op>>4);
+			*p++="MIDNSHP=X???????"[op&0xf];
+		}
+	}
+	x+=n_cigar_op*4;
+	*p++='\t';
+	if (next_ref_id>=0 && next_ref_id==ref_id) {
+		*p++='=';
+	} else {
+		p=put_string(p,ref_name(br,next_ref_id));
+	}
+	*p++='\t'; p=put_int(p,(long long)next_pos+1);
+	*p++='\t'; p=put_int(p,tlen);
+	*p++='\t';
+	int32_t i;
+	if (l_seq==0) {
+		*p++='*';
+	} else {
+		for (i=0; i<l_seq; i++) {
+			*p++="=ACMGRSVTWYHKDBN"[((unsigned char)x[i/2]>>((i&1) ? 0 : 4))&0xf];
+		}
+	}
+	x+=(l_seq+1)/2;
+	*p++='\t';
+	if (l_seq==0 || (unsigned char)x[0]==0xff) {
+		*p++='*';
+	} else {
+		for (i=0; i<l_seq; i++) {
+			*p++=x[i]+33;
+		}
+	}
+	x+=l_seq;
+	while (x<end) {
+		if (x+3>end) {
+			fprintf(stderr,"bgzf_reader : corrupt BAM auxiliary field\n");
+			exit(1);
+		}
+		const char type=x[2];
+		*p++='\t'; *p++=x[0]; *p++=x[1]; *p++=':';
+		x+=3;
+		check_aux_length(x,aux_value_size(type),end);
+		switch (type) {
+		case 'A':
+			*p++='A'; *p++=':'; *p++=*x++;
+			break;
+		case 'c':
+			*p++='i'; *p++=':'; p=put_int(p,(int8_t)*x); x+=1;
+			break;
+		case 'C':
+			*p++='i'; *p++=':'; p=put_int(p,(uint8_t)*x); x+=1;
+			break;
+		case 's':
+			*p++='i'; *p++=':'; p=put_int(p,(int16_t)get_uint16(x)); x+=2;
+			break;
+		case 'S':
+			*p++='i'; *p++=':'; p=put_int(p,get_uint16(x)); x+=2;
+			break;
+		case 'i':
+			*p++='i'; *p++=':'; p=put_int(p,get_int32(x)); x+=4;
+			break;
+		case 'I':
+			*p++='i'; *p++=':'; p=put_int(p,get_uint32(x)); x+=4;
+			break;
+		case 'f': {
+			float f;
+			memcpy(&f,x,sizeof(float));
+			x+=4;
+			p+=sprintf(p,"f:%g",f);
+			break;
+		}
+		case 'Z':
+		case 'H': {
+			const char * const string_end=(const char*)memchr(x,'\0',end-x);
+			if (string_end==NULL) {
+				fprintf(stderr,"bgzf_reader : unterminated BAM string field\n");
+				exit(1);
+			}
+			*p++=type; *p++=':';
+			memcpy(p,x,string_end-x); p+=string_end-x;
+			x=string_end+1;
+			break;
+		}
+		case 'B': {
+			check_aux_length(x,5,end);
+			const char subtype=x[0];
+			const int32_t count=get_int32(x+1);
+			x+=5;
+			const size_t elem_size=aux_value_size(subtype);
+			if (elem_size==0 || subtype=='A') {
+				fprintf(stderr,"bgzf_reader : unknown BAM array type '%c'\n",subtype);
+				exit(1);
+			}
+			if (count<0) {
+				fprintf(stderr,"bgzf_reader : corrupt BAM auxiliary field\n");
+				exit(1);
+			}
+			check_aux_length(x,(size_t)count*elem_size,end);
+			*p++='B'; *p++=':'; *p++=subtype;
+			int32_t j;
+			for (j=0; j<count; j++) {
+				*p++=',';
+				switch (subtype) {
+				case 'c': p=put_int(p,(int8_t)*x); x+=1; break;
+				case 'C': p=put_int(p,(uint8_t)*x); x+=1; break;
+				case 's': p=put_int(p,(int16_t)get_uint16(x)); x+=2; break;
+				case 'S': p=put_int(p,get_uint16(x)); x+=2; break;
+				case 'i': p=put_int(p,get_int32(x)); x+=4; break;
+				case 'I': p=put_int(p,get_uint32(x)); x+=4; break;
+				case 'f': {
+					float f;
+					memcpy(&f,x,sizeof(float));
+					x+=4;
+					p+=sprintf(p,"%g",f);
+					break;
+				}
+				default:
+					fprintf(stderr,"bgzf_reader : unknown BAM array type '%c'\n",subtype);
+					exit(1);
+				}
+			}
+			break;
+		}
+		default:
+			fprintf(stderr,"bgzf_reader : unknown BAM field type '%c'\n",type);
+			exit(1);
+		}
+	}
+	*p++='\n';
+	return p;
+}
+
+//convert all complete BAM records inflated so far into SAM text
+static void convert_bam(bgzf_reader * br) {
+	br->text_used=0;
+	br->text_seen=0;
+	if (!br->bam_header_done && !convert_bam_header(br)) {
+		return;
+	}
+	while (br->data_used-br->data_seen>=4) {
+		const int32_t block_size=get_int32(br->data+br->data_seen);
+		if (block_size<32) {
+			fprintf(stderr,"bgzf_reader : corrupt BAM record size %d\n",block_size);
+			exit(1);
+		}
+		if (br->data_used-br->data_seen<4+(size_t)block_size) {
+			break;
+		}
+		//every byte of a record turns into at most a few characters of text,
+		//only the reference names are not stored in the record
+		ensure_text(br,(size_t)block_size*8+br->max_ref_name*2+64);
+		char * const end=convert_bam_record(br,br->data+br->data_seen+4,block_size,br->text+br->text_used);
+		br->text_used=end-br->text;
+		br->data_seen+=4+block_size;
+	}
+}
+
+//hand out up to length bytes of SAM text, returns 0 only at the end of file
+size_t bgzf_read(bgzf_reader * br, char * dest, size_t length) {
+	while (true) {
+		if (br->bam) {
+			if (br->text_seen==br->text_used) {
+				convert_bam(br);
+			}
+			if (br->text_seen<br->text_used) {
+				const size_t n=MIN(length,br->text_used-br->text_seen);
+				memcpy(dest,br->text+br->text_seen,n);
+				br->text_seen+=n;
+				return n;
+			}
+		} else if (br->data_seen<br->data_used) {
+			const size_t n=MIN(length,br->data_used-br->data_seen);
+			memcpy(dest,br->data+br->data_seen,n);
+			br->data_seen+=n;
+			return n;
+		}
+		if (br->file_eof) {
+			if (br->data_seen!=br->data_used) {
+				fprintf(stderr,"bgzf_reader : BAM file ends in the middle of a record\n");
+				exit(1);
+			}
+			return 0;
+		}
+		fill_batch(br);
+	}
+}
+
+bool bgzf_eof(bgzf_reader * br) {
+	return br->file_eof && br->data_seen==br->data_used && br->text_seen==br->text_used;
+}
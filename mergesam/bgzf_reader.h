@@ -0,0 +1,39 @@
+#ifndef __BGZF_READER__
+#define __BGZF_READER__
+#include <stdio.h>
+#include <stdbool.h>
+
+//reads BGZF files (the block gzip format of BAM and of bgzip), inflating
+//batches of blocks in parallel, and turns BAM records back into SAM text
+//so the rest of mergesam only ever sees SAM lines
+typedef struct bgzf_reader {
+	FILE * file;
+	int batch_blocks; //how many blocks are inflated at once
+	char ** blocks; //compressed blocks of the current batch
+	size_t * block_lengths;
+	size_t * block_offsets; //where each block inflates to in data
+	//inflated stream, not yet converted or handed out
+	char * data;
+	size_t data_size;
+	size_t data_used;
+	size_t data_seen;
+	//SAM text made from the BAM records
+	char * text;
+	size_t text_size;
+	size_t text_used;
+	size_t text_seen;
+	bool file_eof;
+	bool bam;
+	bool bam_header_done;
+	int n_refs;
+	char ** ref_names;
+	size_t max_ref_name;
+} bgzf_reader;
+
+bool is_bgzf_file(FILE * file);
+bgzf_reader * bgzf_open(FILE * file,int threads);
+void bgzf_close(bgzf_reader * br);
+size_t bgzf_read(bgzf_reader * br,char * dest,size_t length);
+bool bgzf_eof(bgzf_reader * br);
+
+#endif
@@ -0,0 +1,538 @@
+#include <zlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <ctype.h>
+#include <omp.h>
+#include "bgzf_writer.h"
+
+//BGZF blocks are at most this big, and hold this much data so that even
+//data that does not compress fits
+#define BGZF_MAX_BLOCK_SIZE 65536
+#define BGZF_BLOCK_DATA 0xff00
+#define BGZF_HEADER_SIZE 18
+#define BGZF_FOOTER_SIZE 8
+#ifndef MIN
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+
+//the empty block that marks the end of a BGZF file
+static const unsigned char bgzf_eof_block[28]={31,139,8,4,0,0,0,0,0,255,6,0,'B','C',2,0,27,0,3,0,0,0,0,0,0,0,0,0};
+
+//BAM is little endian, as are the machines we run on
+static inline char * put_int32(char * p, int32_t x) {
+	memcpy(p,&x,sizeof(int32_t));
+	return p+sizeof(int32_t);
+}
+
+static inline char * put_uint32(char * p, uint32_t x) {
+	memcpy(p,&x,sizeof(uint32_t));
+	return p+sizeof(uint32_t);
+}
+
+static inline char * put_uint16(char * p, uint16_t x) {
+	memcpy(p,&x,sizeof(uint16_t));
+	return p+sizeof(uint16_t);
+}
+
+bgzf_writer * bgzf_writer_open(FILE * file,int threads) {
+	bgzf_writer * bw=(bgzf_writer*)malloc(sizeof(bgzf_writer));
+	if (bw==NULL) {
+		fprintf(stderr,"bgzf_writer : failed to allocate base structure\n");
+		exit(1);
+	}
+	memset(bw,0,sizeof(bgzf_writer));
+	bw->file=file;
+	bw->batch_blocks=(threads>0 ? threads : 1)*4;
+	bw->blocks=(char**)malloc(sizeof(char*)*bw->batch_blocks);
+	bw->block_lengths=(size_t*)malloc(sizeof(size_t)*bw->batch_blocks);
+	if (bw->blocks==NULL || bw->block_lengths==NULL) {
+		fprintf(stderr,"bgzf_writer : failed to allocate block tables\n");
+		exit(1);
+	}
+	int i;
+	for (i=0; i<bw->batch_blocks; i++) {
+		bw->blocks[i]=(char*)malloc(BGZF_MAX_BLOCK_SIZE);
+		if (bw->blocks[i]==NULL) {
+			fprintf(stderr,"bgzf_writer : failed to allocate block buffer\n");
+			exit(1);
+		}
+	}
+	bw->data_size=(size_t)bw->batch_blocks*BGZF_BLOCK_DATA*2;
+	bw->data=(char*)malloc(bw->data_size);
+	if (bw->data==NULL) {
+		fprintf(stderr,"bgzf_writer : failed to allocate %lu bytes for BAM data\n",bw->data_size);
+		exit(1);
+	}
+	return bw;
+}
+
+static void ensure_data(bgzf_writer * bw, size_t length) {
+	if (bw->data_used+length>bw->data_size) {
+		bw->data_size=(bw->data_used+length)*2;
+		bw->data=(char*)realloc(bw->data,bw->data_size);
+		if (bw->data==NULL) {
+			fprintf(stderr,"bgzf_writer : failed to grow BAM data to %lu bytes\n",bw->data_size);
+			exit(1);
+		}
+	}
+}
+
+static void deflate_block(bgzf_writer * bw, int i, const char * data, size_t length) {
+	unsigned char * const block=(unsigned char*)bw->blocks[i];
+	z_stream zs;
+	memset(&zs,0,sizeof(z_stream));
+	if (deflateInit2(&zs,Z_DEFAULT_COMPRESSION,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY)!=Z_OK) {
+		fprintf(stderr,"bgzf_writer : failed to initialize deflate\n");
+		exit(1);
+	}
+	zs.next_in=(Bytef*)data;
+	zs.avail_in=length;
+	zs.next_out=(Bytef*)(block+BGZF_HEADER_SIZE);
+	zs.avail_out=BGZF_MAX_BLOCK_SIZE-BGZF_HEADER_SIZE-BGZF_FOOTER_SIZE;
+	if (deflate(&zs,Z_FINISH)!=Z_STREAM_END) {
+		fprintf(stderr,"bgzf_writer : failed to deflate BGZF block\n");
+		exit(1);
+	}
+	const size_t block_size=BGZF_HEADER_SIZE+zs.total_out+BGZF_FOOTER_SIZE;
+	deflateEnd(&zs);
+	memcpy(block,bgzf_eof_block,BGZF_HEADER_SIZE);
+	block[16]=(block_size-1)&0xff;
+	block[17]=(block_size-1)>>8;
+	char * p=(char*)block+block_size-BGZF_FOOTER_SIZE;
+	p=put_uint32(p,crc32(crc32(0L,Z_NULL,0),(const Bytef*)data,length));
+	put_uint32(p,length);
+	bw->block_lengths[i]=block_size;
+}
+
+//deflate the BAM data in parallel, a block at a time, and write it out,
+//only whole blocks are written until the end of the file
+static void flush_data(bgzf_writer * bw, bool all) {
+	const size_t total_blocks=(all ? (bw->data_used+BGZF_BLOCK_DATA-1)/BGZF_BLOCK_DATA : bw->data_used/BGZF_BLOCK_DATA);
+	size_t done=0;
+	while (done<total_blocks) {
+		const int blocks=MIN(total_blocks-done,(size_t)bw->batch_blocks);
+		const char * const data=bw->data+done*BGZF_BLOCK_DATA;
+		const size_t data_left=bw->data_used-done*BGZF_BLOCK_DATA;
+		int i;
+		if (omp_in_parallel()) {
+			//called from the task writing out a window, let idle threads help
+			#pragma omp taskloop grainsize(1)
+			for (i=0; i<blocks; i++) {
+				deflate_block(bw,i,data+(size_t)i*BGZF_BLOCK_DATA,MIN((size_t)BGZF_BLOCK_DATA,data_left-(size_t)i*BGZF_BLOCK_DATA));
+			}
+		} else {
+			#pragma omp parallel for schedule(dynamic)
+			for (i=0; i<blocks; i++) {
+				deflate_block(bw,i,data+(size_t)i*BGZF_BLOCK_DATA,MIN((size_t)BGZF_BLOCK_DATA,data_left-(size_t)i*BGZF_BLOCK_DATA));
+			}
+		}
+		for (i=0; i<blocks; i++) {
+			if (fwrite(bw->blocks[i],1,bw->block_lengths[i],bw->file)!=bw->block_lengths[i]) {
+				perror("bgzf_writer : failed to write BGZF block ");
+				exit(1);
+			}
+		}
+		done+=blocks;
+	}
+	const size_t flushed=MIN(done*BGZF_BLOCK_DATA,bw->data_used);
+	memmove(bw->data,bw->data+flushed,bw->data_used-flushed);
+	bw->data_used-=flushed;
+}
+
+void bgzf_write_header(bgzf_writer * bw, const char * text, size_t length) {
+	assert(!bw->header_done);
+	if (bw->header_used+length>bw->header_size) {
+		bw->header_size=(bw->header_used+length)*2;
+		bw->header=(char*)realloc(bw->header,bw->header_size);
+		if (bw->header==NULL) {
+			fprintf(stderr,"bgzf_writer : failed to grow SAM header to %lu bytes\n",bw->header_size);
+			exit(1);
+		}
+	}
+	memcpy(bw->header+bw->header_used,text,length);
+	bw->header_used+=length;
+}
+
+static int ref_compare(const void * a, const void * b) {
+	return strcmp(((const bgzf_ref*)a)->name,((const bgzf_ref*)b)->name);
+}
+
+//find the value of a tag like "SN:" in a header line, returns its length
+static size_t header_field(const char * line, const char * line_end, const char * tag, const char ** value) {
+	const char * p=line;
+	while (p!=NULL && p<line_end) {
+		p=(const char*)memchr(p,'\t',line_end-p);
+		if (p==NULL) {
+			break;
+		}
+		p++;
+		if (line_end-p>=3 && memcmp(p,tag,3)==0) {
+			*value=p+3;
+			const char * end=(const char*)memchr(*value,'\t',line_end-*value);
+			return (end!=NULL ? end : line_end)-*value;
+		}
+	}
+	return 0;
+}
+
+//the BAM header is the SAM header text followed by the reference table of
+//its @SQ lines, the records refer to references by their index in it
+static void write_bam_header(bgzf_writer * bw) {
+	const char * const text=bw->header;
+	const char * const text_end=bw->header+bw->header_used;
+	const char * line;
+	int n_refs=0;
+	for (line=text; line<text_end; ) {
+		const char * line_end=(const char*)memchr(line,'\n',text_end-line);
+		line_end=(line_end!=NULL ? line_end : text_end);
+		if (line_end-line>=4 && memcmp(line,"@SQ\t",4)==0) {
+			n_refs++;
+		}
+		line=line_end+1;
+	}
+	bw->refs=(bgzf_ref*)malloc(sizeof(bgzf_ref)*(n_refs>0 ? n_refs : 1));
+	if (bw->refs==NULL) {
+		fprintf(stderr,"bgzf_writer : failed to allocate BAM reference names\n");
+		exit(1);
+	}
+	ensure_data(bw,12+bw->header_used);
+	char * p=bw->data+bw->data_used;
+	memcpy(p,"BAM\1",4); p+=4;
+	p=put_int32(p,bw->header_used);
+	memcpy(p,text,bw->header_used); p+=bw->header_used;
+	p=put_int32(p,n_refs);
+	bw->data_used=p-bw->data;
+	for (line=text; line<text_end; ) {
+		const char * line_end=(const char*)memchr(line,'\n',text_end-line);
+		line_end=(line_end!=NULL ? line_end : text_end);
+		if (line_end-line>=4 && memcmp(line,"@SQ\t",4)==0) {
+			const char * name;
+			const char * ref_length;
+			const size_t name_length=header_field(line,line_end,"SN:",&name);
+			if (name_length==0 || header_field(line,line_end,"LN:",&ref_length)==0) {
+				fprintf(stderr,"bgzf_writer : @SQ header line without SN or LN\n");
+				exit(1);
+			}
+			bgzf_ref * const ref=bw->refs+bw->n_refs;
+			ref->name=strndup(name,name_length);
+			if (ref->name==NULL) {
+				fprintf(stderr,"bgzf_writer : failed to allocate BAM reference name\n");
+				exit(1);
+			}
+			ref->id=bw->n_refs++;
+			if (name_length>bw->max_ref_name) {
+				bw->max_ref_name=name_length;
+			}
+			ensure_data(bw,name_length+9);
+			p=bw->data+bw->data_used;
+			p=put_int32(p,name_length+1);
+			memcpy(p,name,name_length); p+=name_length;
+			*p++='\0';
+			p=put_int32(p,strtol(ref_length,NULL,10));
+			bw->data_used=p-bw->data;
+		}
+		line=line_end+1;
+	}
+	qsort(bw->refs,bw->n_refs,sizeof(bgzf_ref),ref_compare);
+	bw->ref_name=(char*)malloc(bw->max_ref_name+1);
+	if (bw->ref_name==NULL) {
+		fprintf(stderr,"bgzf_writer : failed to allocate BAM reference name\n");
+		exit(1);
+	}
+	bw->header_done=true;
+}
+
+static int32_t ref_id(bgzf_writer * bw, const char * name, size_t length) {
+	if (length==1 && name[0]=='*') {
+		return -1;
+	}
+	if (length<=bw->max_ref_name) {
+		memcpy(bw->ref_name,name,length);
+		bw->ref_name[length]='\0';
+		bgzf_ref key;
+		key.name=bw->ref_name;
+		const bgzf_ref * ref=(const bgzf_ref*)bsearch(&key,bw->refs,bw->n_refs,sizeof(bgzf_ref),ref_compare);
+		if (ref!=NULL) {
+			return ref->id;
+		}
+	}
+	fprintf(stderr,"bgzf_writer : SAM line refers to reference '%.*s' missing from the header\n",(int)length,name);
+	exit(1);
+}
+
+//the smallest BAM bin that holds [beg,end)
+static inline int reg2bin(int64_t beg, int64_t end) {
+	--end;
+	if (beg>>14==end>>14) return ((1<<15)-1)/7+(beg>>14);
+	if (beg>>17==end>>17) return ((1<<12)-1)/7+(beg>>17);
+	if (beg>>20==end>>20) return ((1<<9)-1)/7+(beg>>20);
+	if (beg>>23==end>>23) return ((1<<6)-1)/7+(beg>>23);
+	if (beg>>26==end>>26) return ((1<<3)-1)/7+(beg>>26);
+	return 0;
+}
+
+static inline int seq_code(char c) {
+	const char * const code=strchr("=ACMGRSVTWYHKDBN",toupper(c));
+	return (code!=NULL && c!='\0' ? code-"=ACMGRSVTWYHKDBN" : 15);
+}
+
+static void malformed_line(const char * line, const char * line_end) {
+	fprintf(stderr,"bgzf_writer : malformed SAM line '%.*s'\n",(int)(line_end-line),line);
+	exit(1);
+}
+
+//the next tab separated field of a SAM line
+static inline const char * next_field(const char ** p, const char * line, const char * line_end, size_t * length) {
+	const char * const field=*p;
+	if (field>line_end) {
+		malformed_line(line,line_end);
+	}
+	const char * end=(const char*)memchr(field,'\t',line_end-field);
+	end=(end!=NULL ? end : line_end);
+	*length=end-field;
+	*p=end+1;
+	return field;
+}
+
+static inline long long field_int(const char * field, size_t length, const char * line, const char * line_end) {
+	char * end;
+	const long long x=strtoll(field,&end,10);
+	if (length==0 || end!=field+length) {
+		malformed_line(line,line_end);
+	}
+	return x;
+}
+
+static inline long long next_int_field(const char ** p, const char * line, const char * line_end) {
+	size_t length;
+	const char * const field=next_field(p,line,line_end,&length);
+	return field_int(field,length,line,line_end);
+}
+
+//a SAM integer tag is stored in the smallest BAM type that holds it
+static inline char * put_aux_int(char * p, long long x) {
+	if (x<0) {
+		if (x>=INT8_MIN) {
+			*p++='c'; *p++=(int8_t)x;
+		} else if (x>=INT16_MIN) {
+			*p++='s'; p=put_uint16(p,(uint16_t)(int16_t)x);
+		} else {
+			*p++='i'; p=put_int32(p,(int32_t)x);
+		}
+	} else {
+		if (x<=UINT8_MAX) {
+			*p++='C'; *p++=(uint8_t)x;
+		} else if (x<=UINT16_MAX) {
+			*p++='S'; p=put_uint16(p,(uint16_t)x);
+		} else {
+			*p++='I'; p=put_uint32(p,(uint32_t)x);
+		}
+	}
+	return p;
+}
+
+//turn one SAM line into a BAM record, returns the new end of data, a record
+//is never more than twice the size of its line plus the fixed fields
+static char * convert_sam_line(bgzf_writer * bw, const char * line, const char * line_end, char * p) {
+	const char * x=line;
+	size_t length;
+	char * const record=p;
+	p+=4;
+	const char * const qname=next_field(&x,line,line_end,&length);
+	const size_t qname_length=length;
+	const int flag=next_int_field(&x,line,line_end);
+	const char * const rname=next_field(&x,line,line_end,&length);
+	const int32_t rid=ref_id(bw,rname,length);
+	const int64_t pos=next_int_field(&x,line,line_end)-1;
+	const int mapq=next_int_field(&x,line,line_end);
+	const char * const cigar=next_field(&x,line,line_end,&length);
+	const size_t cigar_length=length;
+	const char * const rnext=next_field(&x,line,line_end,&length);
+	const int32_t next_rid=(length==1 && rnext[0]=='=' ? rid : ref_id(bw,rnext,length));
+	const int64_t next_pos=next_int_field(&x,line,line_end)-1;
+	const int64_t tlen=next_int_field(&x,line,line_end);
+	const char * const seq=next_field(&x,line,line_end,&length);
+	const size_t l_seq=(length==1 && seq[0]=='*' ? 0 : length);
+	const char * const qual=next_field(&x,line,line_end,&length);
+	if (qname_length==0 || qname_length>254 || (length!=l_seq && !(length==1 && qual[0]=='*'))) {
+		malformed_line(line,line_end);
+	}
+	//the cigar goes after the read name, its reference length sets the bin
+	char * const cigar_ops=p+32+qname_length+1;
+	int n_cigar_op=0;
+	int64_t ref_length=0;
+	if (!(cigar_length==1 && cigar[0]=='*')) {
+		const char * c=cigar;
+		while (c<cigar+cigar_length) {
+			char * end;
+			const unsigned long op_length=strtoul(c,&end,10);
+			const char * const op=(end<cigar+cigar_length ? strchr("MIDNSHP=X",*end) : NULL);
+			if (end==c || op==NULL || *op=='\0') {
+				malformed_line(line,line_end);
+			}
+			put_uint32(cigar_ops+4*n_cigar_op++,(uint32_t)(op_length<<4|(op-"MIDNSHP=X")));
+			if (strchr("MDN=X",*op)!=NULL) {
+				ref_length+=op_length;
+			}
+			c=end+1;
+		}
+	}
+	if (n_cigar_op>UINT16_MAX) {
+		malformed_line(line,line_end);
+	}
+	const int64_t end=((flag&0x4) || rid<0 || pos<0 || ref_length==0 ? pos+1 : pos+ref_length);
+	p=put_int32(p,rid);
+	p=put_int32(p,pos);
+	*p++=qname_length+1;
+	*p++=mapq;
+	p=put_uint16(p,reg2bin(pos,end));
+	p=put_uint16(p,n_cigar_op);
+	p=put_uint16(p,flag);
+	p=put_int32(p,l_seq);
+	p=put_int32(p,next_rid);
+	p=put_int32(p,next_pos);
+	p=put_int32(p,tlen);
+	memcpy(p,qname,qname_length); p+=qname_length;
+	*p++='\0';
+	assert(p==cigar_ops);
+	p+=4*n_cigar_op;
+	size_t i;
+	for (i=0; i<l_seq; i+=2) {
+		*p++=seq_code(seq[i])<<4|(i+1<l_seq ? seq_code(seq[i+1]) : 0);
+	}
+	for (i=0; i<l_seq; i++) {
+		*p++=(length==l_seq ? qual[i]-33 : 0xff);
+	}
+	//auxiliary fields are TAG:TYPE:VALUE
+	while (x<=line_end) {
+		const char * const field=next_field(&x,line,line_end,&length);
+		if (length==0 && x>line_end) {
+			//a trailing tab
+			break;
+		}
+		if (length<5 || field[2]!=':' || field[4]!=':') {
+			malformed_line(line,line_end);
+		}
+		const char type=field[3];
+		const char * const value=field+5;
+		const size_t value_length=length-5;
+		*p++=field[0]; *p++=field[1];
+		switch (type) {
+		case 'A':
+			if (value_length!=1) {
+				malformed_line(line,line_end);
+			}
+			*p++='A'; *p++=value[0];
+			break;
+		case 'i':
+			p=put_aux_int(p,field_int(value,value_length,line,line_end));
+			break;
+		case 'f': {
+			char * f_end;
+			const float f=strtof(value,&f_end);
+			if (value_length==0 || f_end!=value+value_length) {
+				malformed_line(line,line_end);
+			}
+			*p++='f';
+			memcpy(p,&f,sizeof(float)); p+=sizeof(float);
+			break;
+		}
+		case 'Z':
+		case 'H':
+			*p++=type;
+			memcpy(p,value,value_length); p+=value_length;
+			*p++='\0';
+			break;
+		case 'B': {
+			if (value_length==0 || strchr("cCsSiIf",value[0])==NULL) {
+				malformed_line(line,line_end);
+			}
+			const char subtype=value[0];
+			*p++='B'; *p++=subtype;
+			char * const count=p;
+			p+=4;
+			int32_t n=0;
+			const char * v=value+1;
+			while (v<value+value_length) {
+				if (*v!=',') {
+					malformed_line(line,line_end);
+				}
+				v++;
+				char * v_end;
+				if (subtype=='f') {
+					const float f=strtof(v,&v_end);
+					memcpy(p,&f,sizeof(float)); p+=sizeof(float);
+				} else {
+					const long long e=strtoll(v,&v_end,10);
+					switch (subtype) {
+					case 'c': case 'C': *p++=(char)e; break;
+					case 's': case 'S': p=put_uint16(p,(uint16_t)e); break;
+					default: p=put_uint32(p,(uint32_t)e); break;
+					}
+				}
+				if (v_end==v || v_end>value+value_length) {
+					malformed_line(line,line_end);
+				}
+				v=v_end;
+				n++;
+			}
+			put_int32(count,n);
+			break;
+		}
+		default:
+			malformed_line(line,line_end);
+		}
+	}
+	put_int32(record,p-record-4);
+	return p;
+}
+
+//convert the whole SAM lines in text into BAM records
+void bgzf_write(bgzf_writer * bw, const char * text, size_t length) {
+	if (!bw->header_done) {
+		write_bam_header(bw);
+	}
+	const char * line=text;
+	const char * const text_end=text+length;
+	while (line<text_end) {
+		const char * line_end=(const char*)memchr(line,'\n',text_end-line);
+		if (line_end==NULL) {
+			fprintf(stderr,"bgzf_writer : SAM output does not end in a newline\n");
+			exit(1);
+		}
+		ensure_data(bw,(line_end-line)*2+64);
+		bw->data_used=convert_sam_line(bw,line,line_end,bw->data+bw->data_used)-bw->data;
+		if (bw->data_used>=(size_t)bw->batch_blocks*BGZF_BLOCK_DATA) {
+			flush_data(bw,false);
+		}
+		line=line_end+1;
+	}
+}
+
+void bgzf_writer_close(bgzf_writer * bw) {
+	if (!bw->header_done) {
+		write_bam_header(bw);
+	}
+	flush_data(bw,true);
+	if (fwrite(bgzf_eof_block,1,sizeof(bgzf_eof_block),bw->file)!=sizeof(bgzf_eof_block) || fflush(bw->file)!=0) {
+		perror("bgzf_writer : failed to write BGZF end of file block ");
+		exit(1);
+	}
+	int i;
+	for (i=0; i<bw->batch_blocks; i++) {
+		free(bw->blocks[i]);
+	}
+	for (i=0; i<bw->n_refs; i++) {
+		free(bw->refs[i].name);
+	}
+	free(bw->refs);
+	free(bw->ref_name);
+	free(bw->blocks);
+	free(bw->block_lengths);
+	free(bw->data);
+	free(bw->header);
+	free(bw);
+}
@@ -0,0 +1,39 @@
+#ifndef __BGZF_WRITER__
+#define __BGZF_WRITER__
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//writes BAM, turning the SAM text mergesam makes into BAM records and
+//deflating batches of BGZF blocks in parallel
+typedef struct bgzf_ref {
+	char * name;
+	int32_t id;
+} bgzf_ref;
+
+typedef struct bgzf_writer {
+	FILE * file;
+	int batch_blocks; //how many blocks are deflated at once
+	char ** blocks; //compressed blocks of the current batch
+	size_t * block_lengths;
+	//BAM stream, not yet deflated
+	char * data;
+	size_t data_size;
+	size_t data_used;
+	//SAM header text, the BAM header is made from it before the first record
+	char * header;
+	size_t header_size;
+	size_t header_used;
+	bool header_done;
+	int n_refs;
+	bgzf_ref * refs; //sorted by name
+	char * ref_name; //scratch for looking up a reference name
+	size_t max_ref_name;
+} bgzf_writer;
+
+bgzf_writer * bgzf_writer_open(FILE * file,int threads);
+void bgzf_writer_close(bgzf_writer * bw);
+void bgzf_write_header(bgzf_writer * bw,const char * text,size_t length);
+void bgzf_write(bgzf_writer * bw,const char * text,size_t length);
+
+#endif
@@ -64,11 +64,15 @@ bool auto_detect_fastq(gzFile fp, char * reads_filename) {
 void fb_close(file_buffer * fb) {
 	free(fb->base);
 	free(fb->frb.base);
-	gzclose(fb->frb.file);
+	if (fb->frb.bgzf!=NULL) {
+		bgzf_close(fb->frb.bgzf);
+	} else {
+		gzclose(fb->frb.file);
+	}
 	free(fb);
 }
 
-file_buffer * fb_open(char * path,size_t buffer_size,size_t read_size) {
+static file_buffer * fb_alloc(size_t buffer_size,size_t read_size) {
 	//allocate some memory
 	file_buffer * fb = (file_buffer*)malloc(sizeof(file_buffer));
 	if (fb==NULL) {
@@ -96,6 +100,11 @@ file_buffer * fb_open(char * path,size_t buffer_size,size_t read_size) {
 	fb->frb.filled=0;
 	fb->frb.unseen=0;
 	fb->frb.eof=0;
+	return fb;
+}
+
+file_buffer * fb_open(char * path,size_t buffer_size,size_t read_size) {
+	file_buffer * fb = fb_alloc(buffer_size,read_size);
 	//open the file
 	fb->frb.file=(strcmp(path,"-")==0) ? gzdopen(fileno(stdin),"r") : gzopen(path,"r");
 	if (fb->frb.file==NULL) {
@@ -105,6 +114,26 @@ file_buffer * fb_open(char * path,size_t buffer_size,size_t read_size) {
 	return fb;
 }
 
+//like fb_open, but BGZF compressed files (BAM or bgzip'ed text) have their
+//blocks inflated on threads, BAM records are handed out as SAM text
+file_buffer * fb_open_bgzf(char * path,size_t buffer_size,size_t read_size,int threads) {
+	if (strcmp(path,"-")==0) {
+		return fb_open(path,buffer_size,read_size);
+	}
+	FILE * file=fopen(path,"rb");
+	if (file==NULL) {
+		fprintf(stderr,"file_buffer : failed to open file %s\n",path);
+		exit(1);
+	}
+	if (!is_bgzf_file(file)) {
+		fclose(file);
+		return fb_open(path,buffer_size,read_size);
+	}
+	file_buffer * fb = fb_alloc(buffer_size,read_size);
+	fb->frb.bgzf=bgzf_open(file,threads);
+	return fb;
+}
+
 void fill_read_buffer(file_read_buffer * frb) {
 	if (frb->unseen==frb->size) {
 		return;
@@ -114,14 +143,20 @@ void fill_read_buffer(file_read_buffer * frb) {
 	//assert(frb->unseen==0 || !frb->pad);
 	memmove(frb->base,frb->base+frb->filled-frb->unseen,frb->unseen);
 	//read into the rest of the buffer
-	int ret = gzread(frb->file,frb->base+frb->unseen,frb->size-frb->unseen);
+	long ret;
+	if (frb->bgzf!=NULL) {
+		ret = bgzf_read(frb->bgzf,frb->base+frb->unseen,frb->size-frb->unseen);
+		frb->eof=bgzf_eof(frb->bgzf);
+	} else {
+		ret = gzread(frb->file,frb->base+frb->unseen,frb->size-frb->unseen);
+		frb->eof=gzeof(frb->file);
+	}
 	assert(frb->size-frb->unseen!=0);
 	//fprintf(stderr,"trying to read %lu\n",frb->size-frb->unseen);
 	if (ret<0) {
 		fprintf(stderr,"A gzread error has occured\n");
 		exit(1);
 	}	
-	frb->eof=gzeof(frb->file);
 	//fprintf(stderr,"EOF %d ret %d\n",frb->eof,ret);
 	if (ret==0 && frb->eof==0) {
 		fprintf(stderr,"A error has occured in reading\n");
@@ -152,8 +187,8 @@ void mark_partial_line(file_read_buffer * frb,size_t offset) {
 	if (ptr!=NULL) {
 		size_t offset=(ptr-frb->base)+1;
 		frb->unseen=frb->filled-offset;
-	} else if (frb->eof==1) {	
-		fprintf(stderr,"EOF\n");
+	} else if (frb->eof==1 && frb->exhausted) {
+		//the last line has no newline, take it only if it fits
 		frb->unseen=0;
 	}
 }
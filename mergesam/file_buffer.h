@@ -2,9 +2,11 @@
 #define __FILE_BUFFER__
 #include <stdbool.h>
 #include <zlib.h>
+#include "bgzf_reader.h"
 
 typedef struct file_read_buffer {
         gzFile file;
+	bgzf_reader * bgzf; //BGZF/BAM files are read through this instead of file
         char * base;
         size_t size;
         size_t filled;
@@ -28,6 +30,7 @@ typedef struct file_buffer {
 bool auto_detect_fastq(gzFile fp, char * reads_filename);
 void fb_close(file_buffer * fb);
 file_buffer * fb_open(char * path,size_t buffer_size,size_t read_size);
+file_buffer * fb_open_bgzf(char * path,size_t buffer_size,size_t read_size,int threads);
 void fill_read_buffer(file_read_buffer * frb);
 void mark_partial_line(file_read_buffer * frb, size_t);
 void add_read_buffer_to_main(file_buffer * fb);
@@ -12,6 +12,7 @@
 #include "file_buffer.h"
 #include "fastx_readnames.h"
 #include "sam_reader.h"
+#include "bgzf_writer.h"
 #include "../common/util.h"
 #include "../gmapper/gmapper-defaults.h"
 #include "../gmapper/gmapper.h"
@@ -40,6 +41,24 @@ int64_t genome_length=0;
 
 char * command_line=NULL;
 
+//set with --bam, everything written to stdout goes through it
+bgzf_writer * bam_output=NULL;
+
+//header text goes to stdout, or into the header of the BAM output
+static void write_header_text(const char * text, size_t length) {
+	if (bam_output!=NULL) {
+		bgzf_write_header(bam_output,text,length);
+	} else if (fwrite(text,1,length,stdout)!=length) {
+		perror("Failed to write output ");
+		exit(1);
+	}
+}
+
+static void write_header_line(const char * line) {
+	write_header_text(line,strlen(line));
+	write_header_text("\n",1);
+}
+
 
 //char * reads_filename;
 //reads_filename=NULL;
@@ -120,17 +139,17 @@ void process_sam_headers() {
 		qsort(sam_lines, header_entries, sizeof(char*),sam_header_sort);
 		//want to print the headers here
 		assert(index>0);
-		fprintf(stdout,"%s\n",sam_lines[0]);
+		write_header_line(sam_lines[0]);
 		bool printed_pg_self=false;
 		if (sam_header_filename==NULL) { 
 		for (i=1; i<index; i++) {
 			int ret=sam_lines[i-1]!=NULL ? strcmp(sam_lines[i],sam_lines[i-1]) : 1;
 			if (!printed_pg_self && strncmp(sam_lines[i],"@PG",strlen("@PG"))==0) {
-				fprintf(stdout,"%s\n",command_line);
+				write_header_line(command_line);
 				printed_pg_self=true;
 			}
 			if (ret!=0) {
-				fprintf(stdout,"%s\n",sam_lines[i]);
+				write_header_line(sam_lines[i]);
 			}	
 			if (strncmp(sam_lines[i],"@PG	ID:",strlen("@PG	ID:"))==0) {
 				free(sam_lines[i]);
@@ -139,7 +158,7 @@ void process_sam_headers() {
 		}	
 		}
 		if (!printed_pg_self) {
-			fprintf(stdout,"%s\n",command_line);
+			write_header_line(command_line);
 			printed_pg_self=true;
 		}
 		//get the genome length!!!
@@ -153,9 +172,11 @@ void usage(char * s) {
 	fprintf(stderr, 
 	"usage: %s [options/parameters] <r> <s1> <s2> ...\n", s);
 	fprintf(stderr,
+	"       %s --read-ordinals [options/parameters] <s1> <s2> ...\n", s);
+	fprintf(stderr,
 	"   <r>     Reads filename, if paired then one of the two paired files\n");
 	fprintf(stderr,
-	"   <s?>    A SAM file input for mergigng\n");
+	"   <s?>    A SAM input for merging, may also be BAM or BGZF compressed SAM\n");
 	fprintf(stderr,
 	"Runtime:      (all sizes are in bytes unless specified)\n");
 	fprintf(stderr,
@@ -167,6 +188,8 @@ void usage(char * s) {
 	fprintf(stderr,
 	"      --read-rate      How many reads to process at once     (Default: %d)\n",DEF_READ_RATE);
 	fprintf(stderr,
+	"      --max-memory     Limit for growing the input buffers   (Default: none)\n");
+	fprintf(stderr,
 	"Output options:\n");
 	fprintf(stderr,
 	"      --un                    Output unaligned FAST(A/Q) file       (Default: disabled)\n");
@@ -181,6 +204,8 @@ void usage(char * s) {
 	fprintf(stderr,
 	"   -E/--sam                   Output in SAM format                  (Default: disabled)\n");
 	fprintf(stderr,
+	"      --bam                   Output in BAM format, implies --sam   (Default: disabled)\n");
+	fprintf(stderr,
 	"   -Q/--fastq                 Reads are in fastq format             (Default: auto-detect)\n");
 	fprintf(stderr,
 	"      --strata                Print only the best scoring hits\n");
@@ -209,6 +234,8 @@ void usage(char * s) {
 	fprintf(stderr,
 	"      --no-autodetect-input   Do not try to auto-detect FAST(A/Q)  (Default: disabled)\n");
 	fprintf(stderr,
+	"      --read-ordinals         Merge on gmapper's ZO:i read ordinals (Default: disabled)\n");
+	fprintf(stderr,
 	"      --help                  This usage screen\n");
 	exit(1);
 }
@@ -234,6 +261,7 @@ struct option long_op[] =
 		{"sam-header",1,0,2},
 		{"no-improper-mappings",0,0,42},
 		{"no-autodetect-input",0,0,48},
+		{"read-ordinals",0,0,43},
 		
 		{"leave-mapq-untouched",0,0,3},
                 {"help", 0, 0, 5},
@@ -242,6 +270,8 @@ struct option long_op[] =
 		{"read-rate",1,0,8},
 		{"stack-size",1,0,'s'},
 		{"min-mapq",1,0,4},
+		{"max-memory",1,0,15},
+		{"bam",0,0,16},
                 {0,0,0,0}
         };
 
@@ -306,6 +336,175 @@ static size_t inline string_to_byte_size(char * s) {
 	return ret*multiplier;
 }
 
+//refill and parse one SAM file, the text of the window currently being merged
+//lies between window_start and the parse position and must survive the refill
+static void parse_sam_file(sam_reader * sr) {
+	if (!sam_eof(sr)) {
+		const size_t parse_start=sr->fb->unseen_start;
+		sr->fb->unseen_start=sr->window_start;
+		//merged windows may have freed space since the buffer was last filled
+		sr->fb->exhausted=false;
+		fill_fb(sr->fb);
+		sr->fb->unseen_start=parse_start;
+		parse_sam(sr,&fxrn);
+	}
+}
+
+static void parse_sam_files() {
+	int i;
+	#pragma omp parallel for schedule(guided)
+	for (i=0; i<options.number_of_sam_files; i++) {
+		parse_sam_file(sam_files[i]);
+	}
+	process_sam_headers();
+}
+
+//find the number of reads with complete alignments in memory across all files
+static int reads_ready(bool * have_non_eof_file) {
+	int reads_to_process=options.read_rate;
+	int i;
+	*have_non_eof_file=false;
+	for (i=0; i<options.number_of_sam_files; i++) {
+		if (!sam_eof(sam_files[i])) {
+			reads_to_process=MIN(reads_to_process,sam_files[i]->last_tested-fxrn.reads_seen);
+			*have_non_eof_file=true;
+		}
+	}
+	if (!*have_non_eof_file) {
+		//without a reads file the last read is the last one seen in any file,
+		//it is still pending at last_tested as no later read has closed it
+		reads_to_process=options.read_ordinals ? 0 : fxrn.reads_filled-fxrn.reads_seen;
+		for (i=0; i<options.number_of_sam_files; i++) {
+			const size_t last_pending=sam_files[i]->last_tested+(options.read_ordinals ? 1 : 0);
+			if (last_pending>fxrn.reads_seen) {
+				const size_t pending=MIN(last_pending-fxrn.reads_seen,(size_t)options.read_rate);
+				reads_to_process=MAX(reads_to_process,(int)pending);
+			}
+		}
+		reads_to_process=MIN(reads_to_process,options.read_rate);
+	}
+	return reads_to_process;
+}
+
+//memory held by the input buffers and alignment stacks of all files
+static size_t input_memory() {
+	size_t memory=0;
+	int i;
+	for (i=0; i<options.number_of_sam_files; i++) {
+		memory+=sam_files[i]->fb->size+sam_files[i]->pretty_stack_size*sizeof(pretty);
+	}
+	return memory;
+}
+
+//a file that has not got all alignments of the next read in memory holds up
+//the merge, double whichever of its buffer or stack is full, as long as the
+//memory budget allows it
+static bool grow_stuck_files() {
+	bool grown=false;
+	int i;
+	for (i=0; i<options.number_of_sam_files; i++) {
+		sam_reader * const sr=sam_files[i];
+		if (sam_eof(sr) || sr->last_tested!=fxrn.reads_seen) {
+			continue;
+		}
+		size_t buffer_size=sr->fb->size;
+		size_t stack_size=sr->pretty_stack_size;
+		if (sr->pretty_stack_end-sr->pretty_stack_start>=stack_size) {
+			stack_size*=2;
+		} else {
+			buffer_size*=2;
+		}
+		const size_t growth=(buffer_size-sr->fb->size)+(stack_size-sr->pretty_stack_size)*sizeof(pretty);
+		if (options.max_memory!=0 && input_memory()+growth>options.max_memory) {
+			continue;
+		}
+		fprintf(stderr," + Growing file %d to a %lu byte buffer and %lu alignments stack for read %lu\n",i,buffer_size,stack_size,fxrn.reads_seen);
+		sam_resize(sr,buffer_size,stack_size,fxrn.reads_seen);
+		grown=true;
+	}
+	return grown;
+}
+
+//give memory back once the reads that needed it have been merged, a grown
+//file is halved only after QUIET_WINDOWS windows in a row used less than a
+//quarter of it, so a file that keeps needing the room does not thrash
+static void shrink_grown_files() {
+	int i;
+	for (i=0; i<options.number_of_sam_files; i++) {
+		sam_reader * const sr=sam_files[i];
+		if (sr->fb->size<=options.buffer_size && sr->pretty_stack_size<=options.alignments_stack_size) {
+			continue;
+		}
+		if (sr->fb->unseen_end-sr->window_start>=sr->fb->size/4
+			|| sr->pretty_stack_end-sr->pretty_stack_start>=sr->pretty_stack_size/4) {
+			sr->quiet_windows=0;
+			continue;
+		}
+		if (++sr->quiet_windows<QUIET_WINDOWS) {
+			continue;
+		}
+		const size_t buffer_size=MAX(options.buffer_size,sr->fb->size/2);
+		const size_t stack_size=MAX(options.alignments_stack_size,sr->pretty_stack_size/2);
+		fprintf(stderr," + Shrinking file %d to a %lu byte buffer and %lu alignments stack\n",i,buffer_size,stack_size);
+		sam_resize(sr,buffer_size,stack_size,fxrn.reads_seen);
+	}
+}
+
+//the output of a window can be as large as the input text it came from,
+//which grown files can make larger than the default output buffers
+static void grow_output_buffers(output_buffer * obs, size_t window_input) {
+	const size_t size=((size_t)(MAX(options.buffer_size,window_input)*GROWTH_FACTOR))+1;
+	int i;
+	for (i=0; i<options.threads; i++) {
+		if (obs[i].size<size) {
+			obs[i].size=size;
+			obs[i].base=(char*)realloc(obs[i].base,sizeof(char)*obs[i].size);
+			if (obs[i].base==NULL) {
+				fprintf(stderr," ! Failed to allocate memory for the output buffers!\n");
+				exit(1);
+			}
+		}
+	}
+}
+
+//merge reads [from,to) of the current window, the output text of each read
+//is left contiguous in the output buffer of the thread that merged it
+static void merge_reads(int from, int to, output_buffer * obs, output_span * spans) {
+	int i;
+	for (i=from; i<to; i++) {
+		const size_t read_id=(fxrn.reads_seen+i)%options.read_rate;
+		int thread_num = omp_get_thread_num();
+		spans[i].thread=thread_num;
+		spans[i].start=obs[thread_num].used;
+		pp_ll_combine_and_check(master_ll+i,pp_ll_index+read_id*options.number_of_sam_files,thread_heaps+thread_num,obs+thread_num);
+		spans[i].length=obs[thread_num].used-spans[i].start;
+		int j;
+		for (j=0; j<options.number_of_sam_files; j++) {
+			memset(pp_ll_index[read_id*options.number_of_sam_files+j],0,sizeof(pp_ll)*LL_ALL);
+		}
+		memset(master_ll+i,0,sizeof(pp_ll));
+	}
+}
+
+//write out a merged window in read order, coalescing reads that are adjacent
+//in the same thread buffer into a single large write
+static void write_window(FILE * output_file, output_buffer * obs, output_span * spans, int reads) {
+	int i=0;
+	while (i<reads) {
+		const output_span * span=spans+i;
+		size_t length=span->length;
+		for (i++; i<reads && spans[i].thread==span->thread && spans[i].start==span->start+length; i++) {
+			length+=spans[i].length;
+		}
+		if (length>0 && bam_output!=NULL) {
+			bgzf_write(bam_output,obs[span->thread].base+span->start,length);
+		} else if (length>0 && fwrite(obs[span->thread].base+span->start,1,length,output_file)!=length) {
+			perror("Failed to write output ");
+			exit(1);
+		}
+	}
+}
+
 int main (int argc, char ** argv) {
 	int i;
 	char pg_line_prefix[]="@PG	ID:mergesam	VN:2.2.0	CL:";
@@ -346,6 +545,7 @@ int main (int argc, char ** argv) {
 	options.no_autodetect_input=autodetect_input ? false : true;
 
 	options.leave_mapq=false;
+	options.read_ordinals=false;
 
 	options.paired=false;
 	options.unpaired=false;
@@ -356,7 +556,10 @@ int main (int argc, char ** argv) {
 	options.read_size=DEF_READ_SIZE;
 	options.read_rate=DEF_READ_RATE;
 	options.alignments_stack_size=DEF_ALIGNMENTS_STACK_SIZE;
+	options.max_memory=0;
 	options.min_mapq=0;
+	options.bam_format=false;
+	FILE * sam_header_file=NULL;
 	found_sam_headers=false;
         int op_id;
         char short_op[] = "o:QN:Es:au";
@@ -383,6 +586,10 @@ int main (int argc, char ** argv) {
 		case 7:
 			options.read_size=string_to_byte_size(optarg);
 			break;
+		//max-memory
+		case 15:
+			options.max_memory=string_to_byte_size(optarg);
+			break;
 		//read-rate
 		case 8:
 			options.read_rate=atol(optarg);
@@ -431,31 +638,21 @@ int main (int argc, char ** argv) {
 		case 2:
 			{
 			sam_header_filename=optarg;
-			FILE * sam_header_file = fopen(sam_header_filename,"r");
+			sam_header_file = fopen(sam_header_filename,"r");
 			if (sam_header_file==NULL) {
 				perror("Failed to open sam header file ");
 				usage(argv[0]);
 			}
-			size_t buffer_size=2046;
-			char buffer[buffer_size];
-			size_t read; bool ends_in_newline=true;
-			while ((read=fread(buffer,1,buffer_size-1,sam_header_file))) {
-				buffer[read]='\0';
-				fprintf(stdout,"%s",buffer);
-				if (buffer[read-1]=='\n') {
-					ends_in_newline=true;
-				} else {
-					ends_in_newline=false;
-				}
-			}
-			if (!ends_in_newline) {
-				fprintf(stdout,"\n");
-			}
 			}
 		//sam format
 		case 'E':
 			options.sam_format=true;
 			break;
+		//bam
+		case 16:
+			options.sam_format=true;
+			options.bam_format=true;
+			break;
 		//stack-size
 		case 's':
 			options.alignments_stack_size=atoi(optarg);
@@ -514,6 +711,10 @@ int main (int argc, char ** argv) {
 		case 4:
 			options.min_mapq=atoi(optarg);
 			break;
+		//read ordinals
+		case 43:
+			options.read_ordinals=true;
+			break;
 		default:
 			fprintf(stderr,"%d : %c , %d is not an option!\n",c,(char)c,op_id);
 			usage(argv[0]);
@@ -547,6 +748,11 @@ int main (int argc, char ** argv) {
 		exit(1);
 	}
 	
+	if (options.bam_format && (options.unaligned_reads_file!=NULL || options.aligned_reads_file!=NULL)) {
+		fprintf(stderr," ! '--bam' cannot be used in combination with '--un' or '--al'\n");
+		exit(1);
+	}
+
 	if (!options.sam_format && options.unaligned_reads_file==NULL && options.aligned_reads_file==NULL) {
 		fprintf(stderr," ! Mergesam currently only supports output in SAM or FAST(A/Q) format, please use one of '--un','--al',or '--sam'\n");
 		exit(1);
@@ -566,18 +772,45 @@ int main (int argc, char ** argv) {
 
 	omp_set_num_threads(options.threads); 
 	fprintf(stderr," + Running with %d threads!\n",options.threads);
+
+	if (options.bam_format) {
+		bam_output=bgzf_writer_open(stdout,options.threads);
+	}
+	if (sam_header_file!=NULL) {
+		size_t buffer_size=2046;
+		char buffer[buffer_size];
+		size_t read; bool ends_in_newline=true;
+		while ((read=fread(buffer,1,buffer_size,sam_header_file))) {
+			write_header_text(buffer,read);
+			ends_in_newline=(buffer[read-1]=='\n');
+		}
+		if (!ends_in_newline) {
+			write_header_text("\n",1);
+		}
+		fclose(sam_header_file);
+	}
 	
-	if (argc<=optind+1) {
+	if (options.read_ordinals) {
+		if (argc<=optind) {
+			fprintf(stderr," ! Please specify at least one sam file!\n");
+			usage(argv[0]);
+		}
+	} else if (argc<=optind+1) {
 		fprintf(stderr," ! Please specify reads file and at least one sam file!\n");
 		usage(argv[0]);
 	}
 
 	memset(&fxrn,0,sizeof(fastx_readnames));
-	fxrn.reads_inmem=20*options.read_rate;
-	fxrn.read_names=(char*)malloc(sizeof(char)*fxrn.reads_inmem*SIZE_READ_NAME);
-	if (fxrn.read_names==NULL) {
-		fprintf(stderr," ! Failed to allocate memory for read_names\n");
-		exit(1);
+	if (options.read_ordinals) {
+		//reads are identified by their ordinal, there are no names to keep
+		fxrn.reads_filled=(size_t)-1;
+	} else {
+		fxrn.reads_inmem=20*options.read_rate;
+		fxrn.read_names=(char*)malloc(sizeof(char)*fxrn.reads_inmem*SIZE_READ_NAME);
+		if (fxrn.read_names==NULL) {
+			fprintf(stderr," ! Failed to allocate memory for read_names\n");
+			exit(1);
+		}
 	}
 	//memset(fxrn.read_names,'Z',sizeof(char)*fxrn.reads_inmem*SIZE_READ_NAME);
 
@@ -586,10 +819,12 @@ int main (int argc, char ** argv) {
 	argv+=optind;
 	
 	//Variables for IO of read names
-	reads_filename=argv[0];
-	fprintf(stderr," + Using %s as reads filename\n",reads_filename);
-	argc--;
-	argv++;
+	if (!options.read_ordinals) {
+		reads_filename=argv[0];
+		fprintf(stderr," + Using %s as reads filename\n",reads_filename);
+		argc--;
+		argv++;
+	}
 
 	options.number_of_sam_files=argc;
 	//Open each sam input file	
@@ -646,17 +881,30 @@ int main (int argc, char ** argv) {
 		fprintf(stderr," + Initializing thread_heap for thread %d at address %p\n",i,thread_heaps+i);
 	}	
 
-	//initialize the thread buffers for each thread
-	output_buffer obs[options.threads];
-	for (i=0; i<options.threads; i++) {
-		obs[i].size=((size_t)(options.buffer_size*GROWTH_FACTOR))+1;
-		obs[i].base=(char*)malloc(sizeof(char)*obs[i].size);
-		if (obs[i].base==NULL) {
-			fprintf(stderr," ! Failed to allocate memory for the output buffers!\n");
+	//initialize the thread buffers for each thread, one set is merged into
+	//while the other is being written out
+	output_buffer obs[2][options.threads];
+	output_span * spans[2];
+	int set;
+	for (set=0; set<2; set++) {
+		for (i=0; i<options.threads; i++) {
+			obs[set][i].size=((size_t)(options.buffer_size*GROWTH_FACTOR))+1;
+			obs[set][i].base=(char*)malloc(sizeof(char)*obs[set][i].size);
+			if (obs[set][i].base==NULL) {
+				fprintf(stderr," ! Failed to allocate memory for the output buffers!\n");
+				exit(1);
+			}
+			obs[set][i].used=0;
+		}
+		spans[set]=(output_span*)malloc(sizeof(output_span)*options.read_rate);
+		if (spans[set]==NULL) {
+			fprintf(stderr," ! Failed to allocate memory for the output spans!\n");
 			exit(1);
 		}
-		obs[i].used=0;
 	}
+	set=0;
+	//reads merged into the other set, not written out yet
+	int pending_reads=0;
 
 	size_t reads_processed=0;
 	clock_t start_time=clock();
@@ -664,9 +912,11 @@ int main (int argc, char ** argv) {
 	//get the hit list, process it, do it again!
 	fprintf(stderr," + Setting up buffer with size %lu and read_size %lu\n",options.buffer_size,options.read_size);
 	bool have_non_eof_file=true;
-	fxrn.fb=fb_open(reads_filename,options.buffer_size,options.read_size);
-	if (!options.no_autodetect_input && !options.fastq_set) {
-		options.fastq=auto_detect_fastq(fxrn.fb->frb.file,reads_filename);
+	if (!options.read_ordinals) {
+		fxrn.fb=fb_open(reads_filename,options.buffer_size,options.read_size);
+		if (!options.no_autodetect_input && !options.fastq_set) {
+			options.fastq=auto_detect_fastq(fxrn.fb->frb.file,reads_filename);
+		}
 	}
 
 	assert(options.unaligned_reads_file==NULL || options.aligned_reads_file==NULL);
@@ -674,7 +924,7 @@ int main (int argc, char ** argv) {
 	while (!fxrn.reads_exhausted && have_non_eof_file) {
 		//fprintf(stderr,"Reads seen %lu, reads unseen %lu, reads filled %lu\n",fxrn.reads_seen,fxrn.reads_unseen,fxrn.reads_filled);
 		//Populate the hitlist to as large as possible
-		while (!fxrn.reads_exhausted) {
+		while (!fxrn.reads_exhausted && !options.read_ordinals) {
 			fill_fb(fxrn.fb);
 			parse_reads(&fxrn);	
 		}
@@ -683,107 +933,92 @@ int main (int argc, char ** argv) {
 		memset(sam_headers,0,sizeof(pp_ll)*options.number_of_sam_files);	
 	
 		//Hit list in memory start processing!
-		
+		//Each iteration merges the window of reads parsed so far, while the
+		//reads after it are parsed and the previous window is written out
 		int i;	
 		clock_t last_time = clock ();
 		while (fxrn.reads_seen<fxrn.reads_filled) {
 			iterations++;
-			int reads_to_process=options.read_rate;
-
-			//READ IN DATA
-			#pragma omp parallel for schedule(guided)
-			for (i=0; i<options.number_of_sam_files; i++) {
-				obs[omp_get_thread_num()].used=0;
-				if (sam_files[i]->fb->frb.eof!=1 || sam_files[i]->fb->unseen_end!=sam_files[i]->fb->unseen_inter) {
-					fill_fb(sam_files[i]->fb);	
-					parse_sam(sam_files[i],&fxrn);
-				}
+			int reads_to_process=reads_ready(&have_non_eof_file);
+			if (reads_to_process==0 && have_non_eof_file) {
+				//nothing was parsed ahead of the last window, parse now
+				parse_sam_files();
+				reads_to_process=reads_ready(&have_non_eof_file);
 			}
-			process_sam_headers();	
-			
-			//find the minimum number of complete read alignments in memory
-			have_non_eof_file=false;
-			for (i=0; i<options.number_of_sam_files; i++) {
-				if (sam_files[i]->fb->frb.eof!=1 || sam_files[i]->fb->unseen_end!=sam_files[i]->fb->unseen_inter) {
-					//fprintf(stderr,"MIN(%d,%d)\n",reads_to_process,sam_files[i]->last_tested-fxrn.reads_seen);
-					reads_to_process=MIN(reads_to_process,sam_files[i]->last_tested-fxrn.reads_seen);
-					have_non_eof_file=true;
-				}
+			if (!have_non_eof_file && reads_to_process==0) {
+				break;
 			}
-			if (!have_non_eof_file) {
-				reads_to_process=fxrn.reads_filled-fxrn.reads_seen;
-				for (i=0; i<options.number_of_sam_files; i++) {
-					if (sam_files[i]->last_tested>fxrn.reads_seen) {
-						reads_to_process=MAX(reads_to_process,sam_files[i]->last_tested-fxrn.reads_seen);
-					}
-				}
-				if (reads_to_process==0) {
-					break;
+			if (reads_to_process==0) {
+				if (grow_stuck_files()) {
+					continue;
 				}
-				reads_to_process=MIN(reads_to_process,options.read_rate);
-			}
-			assert(reads_to_process<=options.read_rate);
-			//fprintf(stderr,"Processing %d reads entries on this iteration..\n",reads_to_process);
-			if (reads_to_process>0) {
-				for (i=0; i<options.number_of_sam_files; i++) {
-					const size_t read_id=(fxrn.reads_seen+reads_to_process-1)%options.read_rate;
-					//fprintf(stderr,"read rate %lu, using read_id %lu %lu\n",options.read_rate,read_id,sam_files[i]->inter_offsets[read_id]);
-					sam_files[i]->fb->unseen_start=sam_files[i]->inter_offsets[read_id];
-					sam_files[i]->pretty_stack_start=sam_files[i]->pretty_stack_ends[read_id];
+				if (options.max_memory!=0) {
+					//alignments are merged in place in the input buffers, there is no
+					//spilling to a temporary file, so the whole read has to fit
+					fprintf(stderr," ! The alignments of read %lu do not fit in '--max-memory', mergesam does not spill to disk, try increasing it\n",fxrn.reads_seen);
+				} else {
+					fprintf(stderr,"AN ERROR HAS OCCURED! - try increasing buffer size?\n");
 				}
-			} else {
-				fprintf(stderr,"AN ERROR HAS OCCURED! - try increasing buffer size?\n");
 				exit(1);	
 			}
-	
+			if (have_non_eof_file) {
+				//leave the parser room to work ahead of the window
+				reads_to_process=MIN(reads_to_process,MAX(1,options.read_rate/2));
+			}
+			assert(reads_to_process<=options.read_rate);
 
 			if (options.paired && options.unpaired) {
 				fprintf(stderr,"FAIL! can't have both paired and unpaired data in input file!\n");
 				exit(1);
 			}
-			//fprintf(stderr,"reads to process %lu\n",reads_to_process);
-			//prepare output
-			#pragma omp parallel for schedule(guided) //schedule(static,10)
-			for (i=0; i<reads_to_process; i++) {	
-				const size_t read_id=(fxrn.reads_seen+i)%options.read_rate;
-				int thread_num = omp_get_thread_num();
-				pp_ll_combine_and_check(master_ll+i,pp_ll_index+read_id*options.number_of_sam_files,thread_heaps+thread_num,obs+thread_num);
-				int j;
-				for (j=0; j<options.number_of_sam_files; j++) {
-					memset(pp_ll_index[read_id*options.number_of_sam_files+j],0,sizeof(pp_ll)*LL_ALL);
-				}
+			//memory of this window can be reused once it has been merged
+			const size_t last_read_id=(fxrn.reads_seen+reads_to_process-1)%options.read_rate;
+			size_t window_ends[options.number_of_sam_files];
+			size_t pretty_stack_starts[options.number_of_sam_files];
+			size_t window_input=0;
+			for (i=0; i<options.number_of_sam_files; i++) {
+				window_ends[i]=sam_files[i]->inter_offsets[last_read_id];
+				pretty_stack_starts[i]=sam_files[i]->pretty_stack_ends[last_read_id];
+				window_input+=window_ends[i]-sam_files[i]->window_start;
 			}
-
-			//output
-			for (i=0; i<reads_to_process; i++) {
-				pretty * pa=master_ll[i].head;
-				while (pa!=NULL) {
-					if (pa->paired_sequencing) {
-						if (pa->first_in_pair) {
-							fprintf(output_file,"%s\n",pa->sam_string);		
-							if (pa->mate_pair!=NULL) {
-								fprintf(output_file,"%s\n",pa->mate_pair->sam_string);		
-							}
-						} else {
-							if (pa->mate_pair!=NULL) {
-								fprintf(output_file,"%s\n",pa->mate_pair->sam_string);		
-							}
-							fprintf(output_file,"%s\n",pa->sam_string);		
-						}
-					} else {
-						fprintf(output_file,"%s\n",pa->sam_string);		
+			grow_output_buffers(obs[set],window_input);
+			for (i=0; i<options.threads; i++) {
+				obs[set][i].used=0;
+			}
+			const int merge_chunk=MAX(1,reads_to_process/(options.threads*4));
+			#pragma omp parallel
+			{
+				#pragma omp single
+				{
+					if (pending_reads>0) {
+						#pragma omp task
+						write_window(output_file,obs[1-set],spans[1-set],pending_reads);
+					}
+					int j;
+					for (j=0; j<options.number_of_sam_files; j++) {
+						#pragma omp task firstprivate(j)
+						parse_sam_file(sam_files[j]);
+					}
+					for (j=0; j<reads_to_process; j+=merge_chunk) {
+						#pragma omp task firstprivate(j)
+						merge_reads(j,MIN(j+merge_chunk,reads_to_process),obs[set],spans[set]);
 					}
-					pa=pa->next;
 				}
 			}
-			memset(master_ll,0,sizeof(pp_ll)*reads_to_process);
-			//update counters
-			if (reads_to_process>0) {
-				fxrn.reads_exhausted=false;
-				fxrn.reads_seen+=reads_to_process;
-				fxrn.reads_unseen-=reads_to_process;
+			process_sam_headers();
+			for (i=0; i<options.number_of_sam_files; i++) {
+				sam_files[i]->window_start=window_ends[i];
+				sam_files[i]->pretty_stack_start=pretty_stack_starts[i];
 			}
+			pending_reads=reads_to_process;
+			set=1-set;
+
+			//update counters
+			fxrn.reads_exhausted=false;
+			fxrn.reads_seen+=reads_to_process;
+			fxrn.reads_unseen-=reads_to_process;
 			reads_processed+=reads_to_process;
+			shrink_grown_files();
 			//fprintf(stderr,"XReads seen %lu, reads unseen %lu, reads filled %lu\n",fxrn.reads_seen,fxrn.reads_unseen,fxrn.reads_filled);
 			if ( (clock()-last_time)/options.threads > CLOCKS_PER_SEC/4) {
 				double reads_per_second=reads_processed/( (double)(clock()-start_time)/(CLOCKS_PER_SEC*options.threads));
@@ -793,6 +1028,11 @@ int main (int argc, char ** argv) {
 			} 
 		}
 	}
+	write_window(output_file,obs[1-set],spans[1-set],pending_reads);
+	if (bam_output!=NULL) {
+		bgzf_writer_close(bam_output);
+	}
+	fflush(output_file);
 	fprintf(stderr,"Processed %lu reads\n",reads_processed);
 	free(master_ll);
 	free(sam_headers);
@@ -803,11 +1043,16 @@ int main (int argc, char ** argv) {
 	free(sam_files);
 	for (i=0; i<options.threads; i++) {
 		heap_pa_destroy(thread_heaps+i);
-		free(obs[i].base);
+		free(obs[0][i].base);
+		free(obs[1][i].base);
 	}
+	free(spans[0]);
+	free(spans[1]);
 	free(thread_heaps);
-	fb_close(fxrn.fb);
-	free(fxrn.read_names);
+	if (!options.read_ordinals) {
+		fb_close(fxrn.fb);
+		free(fxrn.read_names);
+	}
 	return 0;
 }
 
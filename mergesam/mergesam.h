@@ -7,6 +7,7 @@
 #define DEF_INSERT_SIZE -1
 
 #define GROWTH_FACTOR 1.7
+#define QUIET_WINDOWS 8
 #define SIZE_READ_NAME 255
 //#define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #define MAX_INT32	2147483647
@@ -29,6 +30,7 @@ typedef struct runtime_options {
 	size_t buffer_size;
 	size_t read_size;
 	size_t alignments_stack_size;
+	size_t max_memory; //budget for growing the input buffers, 0 for none
 	int read_rate;
 	int threads;
 	int min_mapq;
@@ -44,6 +46,7 @@ typedef struct runtime_options {
 	bool half_paired;
 	bool sam_unaligned;
 	bool sam_format;
+	bool bam_format; //write BAM instead of SAM text
 	int32_t max_alignments;
 	int32_t max_outputs;
 	FILE * unaligned_reads_file;
@@ -56,6 +59,7 @@ typedef struct runtime_options {
 	int number_of_sam_files;
 	bool single_best;
 	bool all_contigs;
+	bool read_ordinals; //merge on the ZO:i tag instead of the reads file
 	//determined at runtime options
 	bool paired;
 	bool unpaired; 
@@ -69,5 +73,12 @@ typedef struct output_buffer {
 	char * base;
 };
 
+//where the output text of one read lives in the per-thread output buffers
+typedef struct output_span {
+	int thread;
+	size_t start;
+	size_t length;
+};
+
 extern int64_t genome_length;
 #endif
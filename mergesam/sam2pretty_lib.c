@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <emmintrin.h>	/* SSE2 */
 
 #include "sam2pretty_lib.h"
 #include "render.h"
@@ -1240,6 +1241,42 @@ static inline int32_t field2int32_t(char* s) {
 	return (s[0]<<8) + s[1]; 
 }
 
+//atoi for the fields of a SAM line, which have no spaces or plus signs
+static inline int parse_int(const char * s) {
+	const bool negative=(*s=='-');
+	if (negative) {
+		s++;
+	}
+	int x=0;
+	while ((unsigned int)(*s-'0')<10) {
+		x=x*10+(*s++-'0');
+	}
+	return negative ? -x : x;
+}
+
+//the 11 mandatory fields, AS and the Z fields that follow it
+#define SAM2PRETTY_MAX_TABS 24
+
+//find the first max_tabs tabs of a line, 16 bytes at a time
+static inline int find_tabs(char * s, size_t length, char ** tabs, int max_tabs) {
+	const __m128i tab=_mm_set1_epi8('\t');
+	int n=0;
+	size_t i=0;
+	for (; i+16<=length && n<max_tabs; i+=16) {
+		unsigned int mask=_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s+i)),tab));
+		while (mask!=0 && n<max_tabs) {
+			tabs[n++]=s+i+__builtin_ctz(mask);
+			mask&=mask-1;
+		}
+	}
+	for (; i<length && n<max_tabs; i++) {
+		if (s[i]=='\t') {
+			tabs[n++]=s+i;
+		}
+	}
+	return n;
+}
+
 
 static inline void not_sam(char * next_tab) {
 	if (next_tab==NULL) {
@@ -1251,11 +1288,11 @@ static inline void not_sam(char * next_tab) {
 static inline void switch_and_fill(int32_t k, char * data, pretty * pa) {
 	switch (k) {
 		case ('N'<<8)+'M':
-			pa->edit_distance=atoi(data);			
+			pa->edit_distance=parse_int(data);			
 			pa->has_edit_distance=true;
 			break;
 		case ('C'<<8)+'M':
-			pa->cs_mismatches=atoi(data);
+			pa->cs_mismatches=parse_int(data);
 			pa->has_cs_mismatches=true;
 			break;
 		case ('R'<<8)+'2':
@@ -1281,51 +1318,51 @@ static inline void switch_and_fill(int32_t k, char * data, pretty * pa) {
 			break;
 		case ('I'<<8)+'H':
 			pa->has_ih=true;
-			pa->ih=atoi(data);
+			pa->ih=parse_int(data);
 			break;
 		case ('H'<<8)+'I':
 			pa->has_hi=true;
-			pa->hi=atoi(data);
+			pa->hi=parse_int(data);
 			break;
 		case ('H'<<8)+'0':
 			pa->has_h0=true;
-			pa->h0=atoi(data);
+			pa->h0=parse_int(data);
 			break;
 		case ('H'<<8)+'1':
 			pa->has_h1=true;
-			pa->h1=atoi(data);
+			pa->h1=parse_int(data);
 			break;
 		case ('H'<<8)+'2':
 			pa->has_h2=true;
-			pa->h2=atoi(data);
+			pa->h2=parse_int(data);
 			break;
 		case ('Z'<<8)+'0':
 			pa->has_zs|=HAS_Z0;
-			pa->z[0]=inv_tnlog(atoi(data));
+			pa->z[0]=inv_tnlog(parse_int(data));
 			break;
 		case ('Z'<<8)+'1':
 			pa->has_zs|=HAS_Z1;	
-			pa->z[1]=inv_tnlog(atoi(data));
+			pa->z[1]=inv_tnlog(parse_int(data));
 			break;
 		case ('Z'<<8)+'2':
 			pa->has_zs|=HAS_Z2;
-			pa->z[2]=inv_tnlog(atoi(data));
+			pa->z[2]=inv_tnlog(parse_int(data));
 			break;
 		case ('Z'<<8)+'3':
 			pa->has_zs|=HAS_Z3;	
-			pa->z[3]=inv_tnlog(atoi(data));
+			pa->z[3]=inv_tnlog(parse_int(data));
 			break;
 		case ('Z'<<8)+'4':
 			pa->has_zs|=HAS_Z4;	
-			pa->z[4]=inv_tnlog(atoi(data));
+			pa->z[4]=inv_tnlog(parse_int(data));
 			break;
 		case ('Z'<<8)+'5':
 			pa->has_zs|=HAS_Z5;	
-			pa->z[5]=inv_tnlog(atoi(data));
+			pa->z[5]=inv_tnlog(parse_int(data));
 			break;
 		case ('Z'<<8)+'6':
 			pa->has_zs|=HAS_Z6;	
-			pa->z[6]=inv_tnlog(atoi(data));
+			pa->z[6]=inv_tnlog(parse_int(data));
 			break;
 		default: 
 			break;
@@ -1361,78 +1398,48 @@ pretty * pretty_from_string_inplace(char * sam_string,size_t length_of_string,pr
 	memset(pa,0,sizeof(pretty));
 	pa->sam_string=sam_string;
 	pa->sam_string_length=length_of_string;
-	char * start_of_string = sam_string;
-	//get the read name
-	char * next_tab = (char*)memchr(start_of_string,'\t',length_of_string);
-	not_sam(next_tab); *next_tab='\0';
-	pa->read_name=start_of_string;
-	start_of_string=++next_tab;
-	//get the flags
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
-	not_sam(next_tab); *next_tab='\0';
-	pa->flags=atoi(start_of_string);
-	start_of_string=++next_tab;
-	//get the reference name
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
-	not_sam(next_tab); *next_tab='\0';
-	pa->reference_name=start_of_string;
-	start_of_string=++next_tab;
-	//get the position
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
-	not_sam(next_tab); *next_tab='\0';
-	pa->genome_start_unpadded=atoi(start_of_string);
-	start_of_string=++next_tab;
-	//get the mapq
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
-	not_sam(next_tab); *next_tab='\0';
-	pa->mapq=atoi(start_of_string);
-	start_of_string=++next_tab;
-	//get the cigar strign
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
-	not_sam(next_tab); *next_tab='\0';
-	pa->cigar=start_of_string;
-	start_of_string=++next_tab;
-	//get the mate reference name
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
-	not_sam(next_tab); *next_tab='\0';
-	pa->mate_reference_name=start_of_string;
-	start_of_string=++next_tab;
-	//get the mate position
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
-	not_sam(next_tab); *next_tab='\0';
-	pa->mate_genome_start_unpadded=atoi(start_of_string);
-	start_of_string=++next_tab;
-	//get the isize
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
-	not_sam(next_tab); *next_tab='\0';
-	pa->isize=atoi(start_of_string);
-	start_of_string=++next_tab;
-	//get the sequence
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
-	not_sam(next_tab); *next_tab='\0';
-	pa->read_string=start_of_string;
-	start_of_string=++next_tab;
-	//get the qualities
-	next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
+	//find the field boundaries in one pass, then cut the fields out
+	char * tabs[SAM2PRETTY_MAX_TABS];
+	const int number_of_tabs=find_tabs(sam_string,length_of_string,tabs,SAM2PRETTY_MAX_TABS);
+	if (number_of_tabs<10) {
+		not_sam(NULL);
+	}
+	int i;
+	for (i=0; i<10; i++) {
+		*tabs[i]='\0';
+	}
+	pa->read_name=sam_string;
+	pa->flags=parse_int(tabs[0]+1);
+	pa->reference_name=tabs[1]+1;
+	pa->genome_start_unpadded=parse_int(tabs[2]+1);
+	pa->mapq=parse_int(tabs[3]+1);
+	pa->cigar=tabs[4]+1;
+	pa->mate_reference_name=tabs[5]+1;
+	pa->mate_genome_start_unpadded=parse_int(tabs[6]+1);
+	pa->isize=parse_int(tabs[7]+1);
+	pa->read_string=tabs[8]+1;
+	pa->read_qualities=tabs[9]+1;
+	//the tab after field t, NULL if it is the last field
+	int t=10;
+	char * next_tab=(t<number_of_tabs ? tabs[t] : NULL);
 	if (next_tab!=NULL) {
 		*next_tab='\0';
 	}
-	pa->read_qualities=start_of_string;
 	//get the score
 	pa->aux=NULL;
 	if (next_tab!=NULL && next_tab+6<length_of_string+sam_string) {
-		start_of_string=++next_tab;
-		next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
+		char * start_of_string=++next_tab;
+		t++;
+		next_tab=(t<number_of_tabs ? tabs[t] : NULL);
 		if (start_of_string[0]=='A' && start_of_string[1]=='S') {
 			if (next_tab!=NULL) {
 				*next_tab='\0';
 			}
-			pa->score=atoi(start_of_string+5);
+			pa->score=parse_int(start_of_string+5);
 			pa->has_score=true;
 			//TODO ERROR NEED TO FIX THIS!!!!!
 			assert(pa->has_zs==0);
 			if (next_tab!=NULL && (next_tab-sam_string)+6<length_of_string) {
-				int i;
 				for (i=0; next_tab!=NULL && i<SAM2PRETTY_NUM_ZS; i++) {
 					if (next_tab[1]!='Z') {
 						break;
@@ -1450,7 +1457,8 @@ pretty * pretty_from_string_inplace(char * sam_string,size_t length_of_string,pr
 						fprintf(stderr,"There has been an error in parsing ZX fields\n");
 						exit(1);
 					}
-					next_tab=(char*)memchr(start_of_string,'\t',length_of_string-(next_tab-sam_string));
+					t++;
+					next_tab=(t<number_of_tabs ? tabs[t] : NULL);
 					if (next_tab!=NULL) {
 						*next_tab='\0';											
 					}
@@ -1459,7 +1467,7 @@ pretty * pretty_from_string_inplace(char * sam_string,size_t length_of_string,pr
 						fprintf(stderr,"there has been an error parsing ZX fields! there must be 5 of them!\n");
 						exit(1);
 					}
-					pa->z[z_index]=inv_tnlog(atoi(start_of_string+5));	
+					pa->z[z_index]=inv_tnlog(parse_int(start_of_string+5));	
 				}
 				if (next_tab!=NULL) {
 					next_tab++;
@@ -11,6 +11,8 @@
 
 bool found_sam_headers;
 
+//the output buffer holds the final output text of the read, so each rendered
+//line is terminated with a newline instead of the null character
 static void render_sam_unaligned_to_buffer(pretty * pa, output_buffer * ob) {
 	pa->sam_string=ob->base+ob->used;
 	ob->used+= render_sam_unaligned_string(pa,ob->base+ob->used,ob->size-ob->used)+1;
@@ -18,6 +20,7 @@ static void render_sam_unaligned_to_buffer(pretty * pa, output_buffer * ob) {
 		fprintf(stderr,"An error in allocating size of output has occured");
 		exit(1);
 	}
+	ob->base[ob->used-1]='\n';
 }
 
 static void render_fastx_to_buffer(pretty * pa, output_buffer * ob) {
@@ -27,6 +30,7 @@ static void render_fastx_to_buffer(pretty * pa, output_buffer * ob) {
 		fprintf(stderr,"An error in allocating size of output has occured");
 		exit(1);
 	}
+	ob->base[ob->used-1]='\n';
 }
 
 static void render_sam_to_buffer(pretty * pa, output_buffer * ob) {
@@ -36,6 +40,7 @@ static void render_sam_to_buffer(pretty * pa, output_buffer * ob) {
 		fprintf(stderr,"An error in allocating size of output has occured");
 		exit(1);
 	}
+	ob->base[ob->used-1]='\n';
 }
 
 static inline double
@@ -406,13 +411,32 @@ static inline void remove_offending_fields(pretty * pa) {
 	pa->has_h2=false;
 }
 
+static inline void render_unaligned_to_buffer(pretty * pa, output_buffer * ob) {
+	pretty_from_aux_inplace(pa);
+	if (options.unaligned_reads_file!=NULL) {
+		render_fastx_to_buffer(pa,ob);
+	} else {
+		render_sam_unaligned_to_buffer(pa,ob);
+	}
+}
+
+static inline void render_mapped_to_buffer(pretty * pa, output_buffer * ob) {
+	if (options.aligned_reads_file!=NULL) {
+		pretty_from_aux_inplace(pa);
+		render_fastx_to_buffer(pa,ob);
+	} else {
+		remove_offending_fields(pa);
+		render_sam_to_buffer(pa,ob);
+	}
+}
+
 //This function is entered with the following
 //ll - an array of linked lists
 //	it has a set of linked lists for each open SAM file
 //      it is indexed like this
 //             ll[fileno]+map_class
 //	this returns a linked list of SAM entry structures for this read, for this file, for this class
-//m_ll - a final list where to store SAM structures to be printed (happens outside of this function), they are printed by just printing the sam structures sam_string, so all rendering must be done in here, more specifically in an update sam string function call at the end
+//m_ll - a final list of the SAM structures kept for this read, all rendering must be done in here, the output text of the read is appended to ob in the order it is written out
 //h - a heap for convience
 void pp_ll_combine_and_check(pp_ll * m_ll,pp_ll ** ll,heap_pa *h,output_buffer * ob) {
 	//want to make a heap
@@ -653,22 +677,14 @@ void pp_ll_combine_and_check(pp_ll * m_ll,pp_ll ** ll,heap_pa *h,output_buffer *
 			m_ll->tail=unaligned_pa;
 			unaligned_pa->next=NULL;
 			
-			pretty_from_aux_inplace(unaligned_pa);
-			if (options.unaligned_reads_file!=NULL) {
-				//render_fastx(unaligned_pa, true);
-				render_fastx_to_buffer(unaligned_pa,ob);
+			//render in output order, the first read in a pair leads
+			if (unaligned_pa->paired_sequencing && !unaligned_pa->first_in_pair) {
+				render_unaligned_to_buffer(unaligned_pa->mate_pair,ob);
+				render_unaligned_to_buffer(unaligned_pa,ob);
 			} else {
-				//render_sam_unaligned(unaligned_pa,true);
-				render_sam_unaligned_to_buffer(unaligned_pa,ob);	
-			}
-			if (unaligned_pa->paired_sequencing) {
-				pretty_from_aux_inplace(unaligned_pa->mate_pair);
-				if (options.unaligned_reads_file!=NULL) {
-					//render_fastx(unaligned_pa->mate_pair, true);
-					render_fastx_to_buffer(unaligned_pa->mate_pair,ob);
-				} else {
-					//render_sam_unaligned(unaligned_pa->mate_pair,true);
-					render_sam_unaligned_to_buffer(unaligned_pa->mate_pair,ob);
+				render_unaligned_to_buffer(unaligned_pa,ob);
+				if (unaligned_pa->paired_sequencing) {
+					render_unaligned_to_buffer(unaligned_pa->mate_pair,ob);
 				}
 			}
 		}
@@ -678,33 +694,20 @@ void pp_ll_combine_and_check(pp_ll * m_ll,pp_ll ** ll,heap_pa *h,output_buffer *
 		//past here is only rendering of the final output string
 		pa=m_ll->head;
 		while(pa!=NULL) {
-			//pretty_from_aux_inplace(pa);
 			if (options.aligned_reads_file!=NULL) {
 				pa->next=NULL;
-				pretty_from_aux_inplace(pa);
-				//render_fastx(pa, true);
-				render_fastx_to_buffer(pa,ob);
-			} else {
-				remove_offending_fields(pa);
-				//render the new sam string in place
-				//render_sam(pa, true);
-				render_sam_to_buffer(pa, ob);
 			}
-			//revert_sam_string(pa);
 			assert(pa->mapped);
-			if (pa->mate_pair!=NULL) {
-				assert(pa->mate_pair->mate_pair!=NULL);
-				if (options.aligned_reads_file!=NULL) {
-					pretty_from_aux_inplace(pa->mate_pair);
-					//render_fastx(pa->mate_pair, true);
-					render_fastx_to_buffer(pa->mate_pair, ob);
-				} else {
-					remove_offending_fields(pa->mate_pair);
-					//render the new sam string in place
-					//render_sam(pa->mate_pair, true);
-					render_sam_to_buffer(pa->mate_pair, ob);
+			assert(pa->mate_pair==NULL || pa->mate_pair->mate_pair!=NULL);
+			//render in output order, the first read in a pair leads
+			if (pa->mate_pair!=NULL && pa->paired_sequencing && !pa->first_in_pair) {
+				render_mapped_to_buffer(pa->mate_pair,ob);
+				render_mapped_to_buffer(pa,ob);
+			} else {
+				render_mapped_to_buffer(pa,ob);
+				if (pa->mate_pair!=NULL && pa->paired_sequencing) {
+					render_mapped_to_buffer(pa->mate_pair,ob);
 				}
-				//revert_sam_string(pa->mate_pair);
 			}
 			pa=pa->next;
 		}
@@ -858,13 +861,85 @@ void sam_close(sam_reader * sr) {
 	free(sr);
 }
 
+//logical offset in the file buffer of a pointer into its ring
+static size_t fb_offset(file_buffer * fb, size_t window_start, char * p) {
+	const size_t window_start_mod=window_start%fb->size;
+	return window_start+((p-fb->base)+fb->size-window_start_mod)%fb->size;
+}
+
+//move the text of the reads from reads_seen on into a file buffer and an
+//alignments stack of new sizes, these reads are parsed again afterwards
+void sam_resize(sam_reader * sr, size_t buffer_size, size_t stack_size, size_t reads_seen) {
+	file_buffer * const fb=sr->fb;
+	//parsing cut the lines at their tabs and newlines, put those back, SAM
+	//text has no NULs so whatever else is left is padding
+	size_t start=fb->unseen_inter;
+	bool found_start=false;
+	size_t i;
+	for (i=sr->pretty_stack_start; i<sr->pretty_stack_end; i++) {
+		pretty * const pa=sr->pretty_stack+i%sr->pretty_stack_size;
+		if (pa->sam_header) {
+			continue;
+		}
+		if (!found_start) {
+			start=fb_offset(fb,sr->window_start,pa->sam_string);
+			found_start=true;
+		}
+		size_t j;
+		for (j=0; j<pa->sam_string_length; j++) {
+			if (pa->sam_string[j]=='\0') {
+				pa->sam_string[j]='\t';
+			}
+		}
+		pa->sam_string[pa->sam_string_length]='\n';
+	}
+	char * base=(char*)malloc(buffer_size);
+	if (base==NULL) {
+		fprintf(stderr,"Failed to allocate %lu bytes for the file buffer\n",buffer_size);
+		exit(1);
+	}
+	size_t used=0;
+	size_t offset;
+	for (offset=start; offset<fb->unseen_end; offset++) {
+		const char c=fb->base[offset%fb->size];
+		if (c!='\0') {
+			assert(used<buffer_size);
+			base[used++]=c;
+		}
+	}
+	free(fb->base);
+	fb->base=base;
+	fb->size=buffer_size;
+	fb->unseen_start=0;
+	fb->unseen_inter=0;
+	fb->unseen_end=used;
+	fb->exhausted=false;
+	sr->window_start=0;
+	sr->quiet_windows=0;
+
+	if (stack_size!=sr->pretty_stack_size) {
+		free(sr->pretty_stack);
+		sr->pretty_stack_size=stack_size;
+		sr->pretty_stack=(pretty*)malloc(sizeof(pretty)*sr->pretty_stack_size);
+		if (sr->pretty_stack==NULL) {
+			fprintf(stderr,"Failed to allocate memory for pretty_stack\n");
+			exit(1);
+		}
+	}
+	memset(sr->pretty_stack,0,sizeof(pretty)*sr->pretty_stack_size);
+	sr->pretty_stack_start=0;
+	sr->pretty_stack_end=0;
+	memset(sr->pp_lls,0,sizeof(pp_ll)*LL_ALL*options.read_rate);
+	sr->last_tested=reads_seen;
+}
+
 sam_reader * sam_open(char * sam_filename,fastx_readnames * fxrn) {
 	sam_reader * sr = (sam_reader*)malloc(sizeof(sam_reader));
 	if (sr==NULL) {
 		fprintf(stderr,"thread_open_sam : failed to allocate memory for thread info structure\n");
 		exit(1);
 	}
-	sr->fb=fb_open(sam_filename,options.buffer_size,options.read_size);
+	sr->fb=fb_open_bgzf(sam_filename,options.buffer_size,options.read_size,options.threads);
 	sr->pretty_stack_start=0;
 	sr->pretty_stack_end=0;
 	fprintf(stderr,"Starting a alignments stack with size %lu\n",options.alignments_stack_size);
@@ -888,8 +963,28 @@ sam_reader * sam_open(char * sam_filename,fastx_readnames * fxrn) {
 		exit(1);
 	}
 	sr->last_tested=0;
+	sr->window_start=0;
+	sr->quiet_windows=0;
 	return sr;
 }
+//the read ordinal written by 'gmapper --sam-read-ordinals', gmapper appends it
+//at the end of the line so the fields are searched from the back
+static size_t sam_read_ordinal(char * line, size_t length) {
+	char * field_end=line+length;
+	while (field_end>line) {
+		char * const tab=(char*)memrchr(line,'\t',field_end-line);
+		if (tab==NULL) {
+			break;
+		}
+		if (field_end-tab>6 && strncmp(tab+1,"ZO:i:",5)==0) {
+			return strtoull(tab+6,NULL,10);
+		}
+		field_end=tab;
+	}
+	fprintf(stderr,"Cannot find the ZO:i read ordinal, was gmapper run with '--sam-read-ordinals'?\n");
+	exit(1);
+}
+
 void parse_sam(sam_reader * sr,fastx_readnames * fxrn) {
 	char * current_newline=NULL;
 	while (sr->fb->unseen_end!=sr->fb->unseen_inter && sr->last_tested<options.read_rate+fxrn->reads_seen) {
@@ -925,21 +1020,31 @@ void parse_sam(sam_reader * sr,fastx_readnames * fxrn) {
 					//if (sr->pretty_stack_size==sr->pretty_stack_filled) {	
 					//	grow_sam_pretty(sr);
 					//}
+					const size_t read_ordinal = options.read_ordinals ? sam_read_ordinal(line,length_of_string) : 0;
+					if (options.read_ordinals && read_ordinal<sr->last_tested) {
+						fprintf(stderr,"Read ordinal %lu is out of order in SAM file %d!\n",read_ordinal,sr->fileno);
+						exit(1);
+					}
+					char * const first_tab = (char*)memchr(line,'\t',length_of_string);
+					if (first_tab==NULL) {
+						fprintf(stderr,"CANNOT FIND FIRST TAB!\n");
+						exit(1);
+					}
+					const size_t compare_length = first_tab-line;
+					assert(compare_length!=0);
 					for (; sr->last_tested<options.read_rate+fxrn->reads_seen; sr->last_tested++) {
 						if (sr->last_tested==fxrn->reads_filled) {
 							return;
 						}
 						//clear the row before using it!!!!!!!!!!
 						const size_t read_id = sr->last_tested%options.read_rate;
-						//ERRRROROROROROOROROROROROOROROROROORORORRRRR@!!!!
-						char * const first_tab = (char*)memchr(line,'\t',length_of_string);
-						if (first_tab==NULL) {
-							fprintf(stderr,"CANNOT FIND FIRST TAB!\n");
-							exit(1);
+						bool same_read;
+						if (options.read_ordinals) {
+							same_read=(read_ordinal==sr->last_tested);
+						} else {
+							char * const hit_list_read_name=fxrn->read_names+(sr->last_tested%fxrn->reads_inmem)*SIZE_READ_NAME*sizeof(char);
+							same_read=(strncmp(line,hit_list_read_name,compare_length)==0);
 						}
-						const size_t compare_length = first_tab-line;
-						assert(compare_length!=0);
-						char * const hit_list_read_name=fxrn->read_names+(sr->last_tested%fxrn->reads_inmem)*SIZE_READ_NAME*sizeof(char);
 						//char buffer[SIZE_READ_NAME];
 						//strncpy(buffer,hit_list_read_name,compare_length);
 						//buffer[compare_length]='\0';
@@ -949,13 +1054,10 @@ void parse_sam(sam_reader * sr,fastx_readnames * fxrn) {
 						//fprintf(stderr,"L: %s, %lu\n",buffer,read_id);
 						//fprintf(stderr,"id: %d name: ||%s|| %lu seen %lu last\n",read_id,buffer,fxrn->reads_seen,sr->last_tested);
 						//fprintf(stderr,"%s vs %s\n",buffer,hit_list_read_name);	
-						if (strncmp(line,hit_list_read_name,compare_length)==0 ) {//&& !isdigit(hit_list_read_name[compare_length])) {	
+						if (same_read) {
 							//fprintf(stderr,"XXXX %lu END, %lu read id\n",sr->pretty_stack_end,read_id);
+							//a read that fills the whole stack is grown by sam_resize
 							if (sr->pretty_stack_end-sr->pretty_stack_start>=sr->pretty_stack_size) {
-								if (sr->last_tested==fxrn->reads_seen) {
-									fprintf(stderr,"Alignments stack size is too small! Please use a larger size then '%lu' using '--alignments-stack-size'\n",options.alignments_stack_size);
-									exit(1);
-								}
 								return;	
 							}
 							const size_t pa_index=(sr->pretty_stack_end++%sr->pretty_stack_size);
@@ -1019,7 +1121,7 @@ void parse_sam(sam_reader * sr,fastx_readnames * fxrn) {
 		}
 	}
 	//fprintf(stderr,"RETURN GRACE %lu!=%lu,%lu<%d+%lu \n",sr->fb->unseen_end,sr->fb->unseen_inter, sr->last_tested,options.read_rate,fxrn->reads_seen);
-	if (sr->fb->frb.eof==1 && sr->fb->unseen_end==sr->fb->unseen_inter && sr->last_tested==fxrn->reads_seen) {
+	if (sam_eof(sr) && sr->last_tested==fxrn->reads_seen) {
 		//sr->last_tested++;
 		fprintf(stderr,"EOF\n");
 	}
@@ -25,6 +25,8 @@ struct sam_reader {
 	size_t last_tested;
 	size_t * inter_offsets;
 	size_t * pretty_stack_ends;
+	size_t window_start; //oldest buffer offset still referenced by a window being merged
+	int quiet_windows; //windows in a row that used little of a grown buffer
 	int fileno;
 };
 void parse_sam(sam_reader * sr,fastx_readnames * fxrn);
@@ -33,5 +35,12 @@ void grow_sam_pretty(sam_reader * sr);
 int sam_header_sort(const void * a, const void *b);
 void sam_close(sam_reader * sr);
 sam_reader * sam_open(char * sam_filename,fastx_readnames * fxrn);
+void sam_resize(sam_reader * sr, size_t buffer_size, size_t stack_size, size_t reads_seen);
+
+//the whole file has been read and parsed, the read buffer can still hold
+//lines at the end of the file that did not fit into a small file buffer
+static inline bool sam_eof(sam_reader * sr) {
+	return sr->fb->frb.eof==1 && sr->fb->frb.unseen==0 && sr->fb->unseen_end==sr->fb->unseen_inter;
+}
 extern bool found_sam_headers;
 #endif
@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
+#include <omp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -35,6 +36,8 @@ static bool Bflag = false;		/* print a progress bar */
 static bool Gflag = false;		/* calculate rates and output them */
 static bool Rflag = false;		/* include read sequence in output */
 static bool Sflag = false;		/* do it all in one pass (save in ram)*/
+static bool Cflag = false;		/* stream reads, matches are consecutive */
+static int  num_threads = 1;		/* -N threads for the streaming mode */
 
 static char *rates_file;		/* -g flag specifies a rates file */
 static char *rates_string;		/* -r user-supplied rates */
@@ -72,6 +75,8 @@ struct pass_cb {
 	uint64_t	nfiles;
 	uint64_t	total_files;
 	int		pass;
+	struct readinfo **batch;	/* streamed reads waiting to be processed */
+	int		batch_reads;
 };
 
 enum {
@@ -156,6 +161,50 @@ save_match(struct readinfo *ri, struct input *input)
 	reheap(stats, 1);
 }
 
+static struct readinfo *
+readinfo_alloc(char *name)
+{
+	struct readinfo *ri;
+	int i;
+
+	ri = (struct readinfo *)xmalloc(sizeof(*ri) +
+	    sizeof(ri->number_matches[0]) * (number_matches + 1));
+	memset(ri, 0, sizeof(*ri) +
+	    sizeof(ri->number_matches[0]) * (number_matches + 1));
+
+	ri->name = name;
+	ri->number_matches[0].score = number_matches;
+	for (i = 1; i <= number_matches; i++)
+		ri->number_matches[i].score = 0x80000000 + i;
+
+	return (ri);
+}
+
+/*
+ * Contig names repeat across all the alignments, so keep a single copy of
+ * each one.
+ */
+static void
+cache_contig(struct input *input)
+{
+	char *key;
+
+	if (dynhash_find(contig_cache, input->genome,
+	    (void **)(void *)&key,
+	    NULL)) {
+		free(input->genome);
+		input->genome = key;
+	} else {
+		if (dynhash_add(contig_cache, input->genome,
+		    NULL) == false) {
+			fprintf(stderr, "error: failed to add to "
+			    "contig cache (%d) - probably out of "
+			    "memory\n", __LINE__);
+			exit(1);
+		}
+	}
+}
+
 /* Returns the number of bytes read */
 static void
 read_file(const char *fpath)
@@ -164,7 +213,6 @@ read_file(const char *fpath)
 	struct readinfo *ri;
 	char *key;
 	gzFile fp;
-	int i;
 
 	fp = gzopen(fpath, "r");
 	if (fp == NULL) {
@@ -202,20 +250,7 @@ read_file(const char *fpath)
 		/*
 		 * Cache the contig names similarly, so we don't waste memory.
 		 */
-		if (dynhash_find(contig_cache, input.genome,
-		    (void **)(void *)&key,
-		    NULL)) {
-			free(input.genome);
-			input.genome = key;
-		} else {
-			if (dynhash_add(contig_cache, input.genome,
-			    NULL) == false) {
-				fprintf(stderr, "error: failed to add to "
-				    "contig cache (%d) - probably out of "
-				    "memory\n", __LINE__);
-				exit(1);
-			}
-		}
+		cache_contig(&input);
 
 		/*
 		 * Finally, cache edit strings for memory happiness.
@@ -250,16 +285,7 @@ read_file(const char *fpath)
 			total_unique_reads++;
 
 			/* alloc, init, insert in dynhash */
-			ri = (struct readinfo *)xmalloc(sizeof(*ri) +
-			    sizeof(ri->number_matches[0]) * (number_matches + 1));
-			memset(ri, 0, sizeof(*ri) +
-			    sizeof(ri->number_matches[0]) * (number_matches + 1));
-
-			ri->name = input.read;
-			ri->number_matches[0].score = number_matches;
-			for (i = 1; i <= number_matches; i++)
-				ri->number_matches[i].score = 0x80000000 + i;
-
+			ri = readinfo_alloc(input.read);
 			save_match(ri, &input);
 
 			if (dynhash_add(read_list, ri->name, ri) == false) {
@@ -335,23 +361,13 @@ p_chance(uint64_t l, int k, int nsubs, int nerrors, int nindels, int origlen, in
 }
 
 static void
-calc_rates(void *arg, void *key, void *val)
+add_read_rates(struct rates *rates, struct readinfo *ri)
 {
-	struct rates *rates = (struct rates *)arg;
-	struct readinfo *ri = (struct readinfo *)val;
 	struct input *rs;
 	double d;
 	int32_t best;
 	int i, rlen;
 
-	(void)key;
-
-	if (Sflag) {
-		static uint64_t calls;
-		PROGRESS_BAR(stderr, calls, total_unique_reads, 100);
-		calls++;
-	}
-
 	best = 0;
 	for (i = 1; i <= ri->number_matches[0].score; i++) {
 		if (best == 0 ||
@@ -363,6 +379,7 @@ calc_rates(void *arg, void *key, void *val)
 	}
 
 	if (!Sflag) {
+		/* the double pass and streaming modes keep only the best */
 		assert(ri->number_matches[0].score == 1);
 		assert(ri->number_matches[1].score >= 0);
 	}
@@ -388,6 +405,23 @@ calc_rates(void *arg, void *key, void *val)
 	}
 }
 
+static void
+calc_rates(void *arg, void *key, void *val)
+{
+	struct rates *rates = (struct rates *)arg;
+	struct readinfo *ri = (struct readinfo *)val;
+
+	(void)key;
+
+	if (Sflag) {
+		static uint64_t calls;
+		PROGRESS_BAR(stderr, calls, total_unique_reads, 100);
+		calls++;
+	}
+
+	add_read_rates(rates, ri);
+}
+
 static double
 p_thissource(int k, int nerrors, double erate, int nsubs, double subrate,
     int nindels, double indelrate, int nmatches, double matchrate, int origlen)
@@ -473,26 +507,28 @@ rspvcmp(const void *a, const void *b)
 }
 
 static void
-calc_probs(void *arg, void *key, void *val)
+print_format()
 {
-	static struct readstatspval *rspv;
 	static bool called = false;
 
-	struct rates *rates = (struct rates *)arg;
-	struct readinfo *ri = (struct readinfo *)val;
-	double s, norm;
-	int i, j, rlen;
-
-	(void)key;
-
-	if (Sflag) {
-		static uint64_t calls;
-		PROGRESS_BAR(stderr, calls, total_unique_reads, 10);
-		calls++;
+	if (!called) {
+		printf("#FORMAT: readname contigname strand contigstart contigend readstart readend "
+		    "readlength score editstring %snormodds pgenome pchance\n",
+		    (Rflag) ? "readsequence " : "");
+		called = true;
 	}
+}
 
-	if (rspv == NULL)
-		rspv = (struct readstatspval *)xmalloc(sizeof(rspv[0]) * (number_matches + 1));
+/*
+ * Print the top matches of one read to out, rspv is scratch space for
+ * number_matches + 1 entries.
+ */
+static void
+read_probs(struct rates *rates, struct readinfo *ri, struct readstatspval *rspv,
+    FILE *out)
+{
+	double s, norm;
+	int i, j, rlen;
 
 	/* 1: Calculate P(chance) and P(genome) for each hit */
 	norm = 0;
@@ -539,13 +575,6 @@ calc_probs(void *arg, void *key, void *val)
 	qsort(rspv, j, sizeof(*rspv), rspvcmp);
 
 	/* 4: Finally, print out values in ascending order until the cutoff */
-	if (!called) {
-		printf("#FORMAT: readname contigname strand contigstart contigend readstart readend "
-		    "readlength score editstring %snormodds pgenome pchance\n",
-		    (Rflag) ? "readsequence " : "");
-		called = true;
-	}
-
 	for (i = 0; i < j && i < top_matches; i++) {
 		struct input *rs = rspv[i].rs;
 		char *readseq = (char *)"";
@@ -575,11 +604,11 @@ calc_probs(void *arg, void *key, void *val)
 		  readseq = (char *)" ";
 
 		/* the only sane way is to reproduce the output code, sadly. */
-		printf(">%s\t%s\t%c", rs->read, rs->genome,
+		fprintf(out, ">%s\t%s\t%c", rs->read, rs->genome,
 		    (INPUT_IS_REVCMPL(rs)) ? '-' : '+');
 
 		/* NB: internally 0 is first position, output is 1. adjust */
-		printf("\t%u\t%u\t%d\t%d\t%d\t%d\t%s\t%s%s%e\t%e\t%e\n",
+		fprintf(out, "\t%u\t%u\t%d\t%d\t%d\t%d\t%s\t%s%s%e\t%e\t%e\n",
 		    rs->genome_start + 1, rs->genome_end + 1, rs->read_start + 1,
 		    rs->read_end + 1, rs->read_length, rs->score, rs->edit,
 		    (Rflag) ? readseq : "", (Rflag) ? "\t" : "",
@@ -589,6 +618,29 @@ calc_probs(void *arg, void *key, void *val)
 	//exit(1);
 }
 
+static void
+calc_probs(void *arg, void *key, void *val)
+{
+	static struct readstatspval *rspv;
+
+	struct rates *rates = (struct rates *)arg;
+	struct readinfo *ri = (struct readinfo *)val;
+
+	(void)key;
+
+	if (Sflag) {
+		static uint64_t calls;
+		PROGRESS_BAR(stderr, calls, total_unique_reads, 10);
+		calls++;
+	}
+
+	if (rspv == NULL)
+		rspv = (struct readstatspval *)xmalloc(sizeof(rspv[0]) * (number_matches + 1));
+
+	print_format();
+	read_probs(rates, ri, rspv, stdout);
+}
+
 static unsigned int cleanup_cb_called = 0;
 
 static void
@@ -964,6 +1016,267 @@ do_double_pass(char **objs, int nobjs, uint64_t files)
 	    (double)pcb.nbytes / (1024 * 1024), comma_integer(pcb.nfiles));
 }
 
+static void
+readinfo_free(struct readinfo *ri)
+{
+	int i;
+
+	/* contig names belong to contig_cache, read names to ri */
+	for (i = 1; i <= ri->number_matches[0].score; i++) {
+		free(ri->number_matches[i].edit);
+		free(ri->number_matches[i].read_seq);
+	}
+	free(ri->name);
+	free(ri);
+}
+
+static void
+stream_rates(struct rates *rates, struct readinfo **reads, int nreads)
+{
+	int i;
+
+#pragma omp parallel num_threads(num_threads)
+	{
+		struct rates sum;
+
+		memset(&sum, 0, sizeof(sum));
+
+#pragma omp for schedule(dynamic, 64)
+		for (i = 0; i < nreads; i++)
+			add_read_rates(&sum, reads[i]);
+
+#pragma omp critical
+		{
+			rates->samples    += sum.samples;
+			rates->total_len  += sum.total_len;
+			rates->insertions += sum.insertions;
+			rates->deletions  += sum.deletions;
+			rates->matches    += sum.matches;
+			rates->mismatches += sum.mismatches;
+			rates->crossovers += sum.crossovers;
+		}
+	}
+}
+
+/*
+ * Each thread prints a contiguous share of the reads into memory, the shares
+ * are then written out in order so the output follows the input.
+ */
+static void
+stream_probs(struct rates *rates, struct readinfo **reads, int nreads)
+{
+	char *bufs[num_threads];
+	size_t lens[num_threads];
+	int i;
+
+	memset(bufs, 0, sizeof(bufs));
+	memset(lens, 0, sizeof(lens));
+
+#pragma omp parallel num_threads(num_threads)
+	{
+		struct readstatspval *rspv;
+		FILE *out;
+		int j, t, first, last;
+
+		t = omp_get_thread_num();
+		first = (int)((int64_t)nreads * t / omp_get_num_threads());
+		last = (int)((int64_t)nreads * (t + 1) / omp_get_num_threads());
+
+		out = open_memstream(&bufs[t], &lens[t]);
+		if (out == NULL) {
+			fprintf(stderr, "error: failed to open output stream "
+			    "for thread %d\n", t);
+			exit(1);
+		}
+		rspv = (struct readstatspval *)xmalloc(sizeof(rspv[0]) * (number_matches + 1));
+
+		for (j = first; j < last; j++)
+			read_probs(rates, reads[j], rspv, out);
+
+		fclose(out);
+		free(rspv);
+	}
+
+	print_format();
+	for (i = 0; i < num_threads; i++) {
+		if (bufs[i] == NULL)
+			continue;
+		fwrite(bufs[i], 1, lens[i], stdout);
+		free(bufs[i]);
+	}
+}
+
+static void
+stream_flush(struct pass_cb *pcb)
+{
+	int i;
+
+	if (pcb->batch_reads == 0)
+		return;
+
+	initStats(max_read_len);
+	if (pcb->pass == 1)
+		stream_rates(&pcb->rates, pcb->batch, pcb->batch_reads);
+	else
+		stream_probs(&pcb->rates, pcb->batch, pcb->batch_reads);
+
+	for (i = 0; i < pcb->batch_reads; i++)
+		readinfo_free(pcb->batch[i]);
+	pcb->batch_reads = 0;
+}
+
+/*
+ * Read a file whose alignments are grouped by read, as gmapper writes them.
+ * A read is complete as soon as the next one starts, so only its top matches
+ * and a batch of finished reads are ever held in memory.
+ */
+static void
+stream_file(const char *fpath, struct pass_cb *pcb)
+{
+	struct input input;
+	struct readinfo *ri;
+	struct input *worst;
+	gzFile fp;
+
+	fp = gzopen(fpath, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "error: could not open file [%s]: %s\n",
+		    fpath, strerror(errno));
+		exit(1);
+	}
+
+	ri = NULL;
+	while (input_parseline(fp, &input)) {
+		if (!Rflag) {
+			free(input.read_seq);
+			input.read_seq = NULL;
+		}
+		cache_contig(&input);
+
+		total_alignments++;
+
+		if (ri == NULL || strcmp(ri->name, input.read) != 0) {
+			if (ri != NULL) {
+				pcb->batch[pcb->batch_reads++] = ri;
+				if (pcb->batch_reads == STREAM_BATCH_READS)
+					stream_flush(pcb);
+			}
+			total_unique_reads++;
+			ri = readinfo_alloc(input.read);
+		} else {
+			free(input.read);
+		}
+		input.read = ri->name;
+
+		/* the match pushed out of the heap owns its strings */
+		worst = &ri->number_matches[1];
+		if (input.score > worst->score) {
+			free(worst->edit);
+			free(worst->read_seq);
+			save_match(ri, &input);
+		} else {
+			free(input.edit);
+			free(input.read_seq);
+		}
+
+		max_read_len = MAX(max_read_len, input.read_length);
+	}
+	if (ri != NULL) {
+		pcb->batch[pcb->batch_reads++] = ri;
+		if (pcb->batch_reads == STREAM_BATCH_READS)
+			stream_flush(pcb);
+	}
+
+	gzclose(fp);
+}
+
+static void
+stream_pass_cb(char *path, struct stat *sb, void *arg)
+{
+	struct pass_cb *pcb = (struct pass_cb *)arg;
+
+	stream_file(path, pcb);
+	pcb->nbytes += sb->st_size;
+	pcb->nfiles++;
+	PROGRESS_BAR(stderr, pcb->nfiles, pcb->total_files, 100);
+}
+
+/*
+ * Like the double pass, but each file is streamed a read at a time instead
+ * of being loaded into read_list, so memory does not grow with the input.
+ *
+ * This mode requires that all matches for a single read are consecutive.
+ */
+static void
+do_stream(char **objs, int nobjs, uint64_t files)
+{
+	struct pass_cb pcb;
+	int tmp_number_matches;
+
+	memset(&pcb, 0, sizeof(pcb));
+	pcb.batch = (struct readinfo **)xmalloc(sizeof(pcb.batch[0]) *
+	    STREAM_BATCH_READS);
+
+	/*
+	 * First pass: Calculate rates from the best match of each read.
+	 */
+	if (rates_file != NULL) {
+		fprintf(stderr, "\nUsing user-defined rates file...\n");
+		load_rates(rates_file, &pcb.rates);
+	} else if (rates_string != NULL) {
+		fprintf(stderr, "\nUsing user-defined rates...\n");
+	} else {
+		tmp_number_matches = number_matches;
+		number_matches = 1;
+
+		pcb.pass = 1;
+		pcb.total_files = files;
+
+		fprintf(stderr, "PASS 1: Streaming %s file(s) to calculate "
+		    "rates...\n", comma_integer(files));
+		PROGRESS_BAR(stderr, 0, 0, 100);
+		file_iterator_n(objs, nobjs, stream_pass_cb, &pcb);
+		stream_flush(&pcb);
+		PROGRESS_BAR(stderr, files, files, 100);
+		fprintf(stderr, "\nParsed %.2f MB in %s file(s).\n",
+		    (double)pcb.nbytes / (1024 * 1024),
+		    comma_integer(pcb.nfiles));
+		fprintf(stderr, "Maximum read length: %d\n", max_read_len);
+
+		number_matches = tmp_number_matches;
+	}
+
+	if (total_unique_reads == 0 && rates_string == NULL) {
+		fprintf(stderr, "error: no matches were found in input "
+		    "file(s)\n");
+		exit(1);
+	}
+
+	if (rates_string == NULL)
+		ratestats(&pcb.rates);
+	else
+		parse_rates_string(rates_string, &pcb.rates);
+
+	/*
+	 * Second pass: Determine probabilities, a batch of reads at a time.
+	 */
+	pcb.pass = 2;
+	pcb.nbytes = pcb.nfiles = 0;
+	pcb.total_files = files;
+
+	fprintf(stderr, "\n%sStreaming %s file(s) to calculate "
+	    "probabilities...\n", (rates_file == NULL) ? "PASS 2: " : "",
+	    comma_integer(files));
+	PROGRESS_BAR(stderr, 0, 0, 100);
+	file_iterator_n(objs, nobjs, stream_pass_cb, &pcb);
+	stream_flush(&pcb);
+	PROGRESS_BAR(stderr, files, files, 100);
+	fprintf(stderr, "\nParsed %.2f MB in %s file(s).\n",
+	    (double)pcb.nbytes / (1024 * 1024), comma_integer(pcb.nfiles));
+
+	free(pcb.batch);
+}
+
 static void
 count_files(char *path, struct stat *sb, void *arg)
 {
@@ -987,7 +1300,7 @@ usage(char *progname)
 
 	fprintf(stderr, "usage: %s [-g rates_file] [-n normodds_cutoff] [-o pgenome_cutoff] "
 	    "[-p pchance_cutoff] [-r erate,srate,irate,mrate] [-s normodds|pgenome|pchance] "
-	    "[-t top_matches] [-m total_matches] [-B] [-G] [-R] [-S] "
+	    "[-t top_matches] [-m total_matches] [-N threads] [-B] [-C] [-G] [-R] [-S] "
 	    "total_genome_len results_dir1|results_file1 "
 	    "results_dir2|results_file2 ...\n", progname);
 	exit(1);
@@ -1010,7 +1323,7 @@ main(int argc, char **argv)
 	    "------------------------------\n");
 
 	progname = argv[0];
-	while ((ch = getopt(argc, argv, "n:o:p:g:r:s:t:m:BGRS")) != -1) {
+	while ((ch = getopt(argc, argv, "n:o:p:g:r:s:t:m:N:BCGRS")) != -1) {
 		switch (ch) {
 		case 'g':
 			rates_file = xstrdup(optarg);
@@ -1046,9 +1359,20 @@ main(int argc, char **argv)
 		case 'm':
 			number_matches = atoi(optarg);
 			break;
+		case 'N':
+			num_threads = atoi(optarg);
+			if (num_threads < 1) {
+				fprintf(stderr, "error: invalid number of "
+				    "threads\n");
+				usage(progname);
+			}
+			break;
 		case 'B':
 			Bflag = true;
 			break;
+		case 'C':
+			Cflag = true;
+			break;
 		case 'G':
 			Gflag = true;
 			break;
@@ -1070,6 +1394,11 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (Cflag && Sflag) {
+		fprintf(stderr, "error: -C and -S flags cannot be mixed\n");
+		exit(1);
+	}
+
 	if (Gflag && rates_file != NULL) {
 		fprintf(stderr, "error: -G and -g flags cannot be mixed\n");
 		exit(1);
@@ -1099,6 +1428,8 @@ main(int argc, char **argv)
 	    (sort_field == SORT_NORMODDS) ? "normodds" : "<unknown>");
 	fprintf(stderr, "    Nr of Matches:      %d\n", number_matches);
 	fprintf(stderr, "    Top Matches:        %d\n", top_matches);
+	if (Cflag)
+		fprintf(stderr, "    Threads:            %d\n", num_threads);
 	fprintf(stderr, "    Genome Length:      %s\n",
 	    comma_integer(genome_len));
 
@@ -1141,6 +1472,8 @@ main(int argc, char **argv)
 
 	if (Sflag)
 		do_single_pass(argv, argc, total_files);
+	else if (Cflag)
+		do_stream(argv, argc, total_files);
 	else
 		do_double_pass(argv, argc, total_files);
 
@@ -5,6 +5,7 @@
 #define DEF_NORMODDS_CUTOFF	0.0
 #define DEF_TOP_MATCHES		10
 #define DEF_NUMBER_MATCHES	10
+#define STREAM_BATCH_READS	16384	/* reads processed at once by -C */
 
 
 /* Stats stuff */
@@ -12,7 +12,6 @@
  * readme.
  ***************************************************************************/
 
-#include <alloca.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -31,6 +30,7 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/mman.h>
+#include <omp.h>
 
 #include "dbtypes.h"
 #include "probcalc_mp.h"
@@ -67,6 +67,7 @@ static int quickmode = 0;				// TODO boolean quickmode option
 static double nr_stdev = 2;				// number of standard deviations for second M assignment
 static int allow_diff_chr = 1;			// allow the same chromosome or not
 static int input_file_type = ASCII;	// input file type, ascii or binary
+static int num_threads = 1;				// threads going through the mapping file
 
 // debug variables
 static uint64_t gl_debug_call = 0;		// the number of times mp_analysis is called
@@ -112,7 +113,7 @@ int main(int argc, char **argv) {
 	int giveng = 0;
 	int givenM = 0;
 	
-	while ((ch = getopt(argc, argv, "m:x:R:f:b:M:g:duL:T:D:C:G:qs:cei:")) != -1) {
+	while ((ch = getopt(argc, argv, "m:x:R:f:b:M:g:duL:T:D:C:G:qs:cei:N:")) != -1) {
 		switch (ch) {
 		
 			case 'R': // Rflag was included in probcalc runs
@@ -176,6 +177,13 @@ int main(int argc, char **argv) {
 				else 
 					input_file_type = BINARY;
 				
+			case 'N': // number of threads
+				num_threads = atoi(optarg);
+				if (num_threads < 1) {
+					fprintf(stderr, "Error: the number of threads must be at least 1\n");
+					exit(1);
+				}
+				break;
 			case 'M': // hard distance cut off. 
 				distcutoff = atoll(optarg);
 				hist_distcutoff = distcutoff;
@@ -311,22 +319,252 @@ int main(int argc, char **argv) {
 
 
 /*
- * Pass through the readfile and mappingfile once through the method
- * specified by pass_type (MEAN_PASS or OUTPUT_PASS)
+ * Parse the mapping at *pos into mapping, moving *pos past it. Comment lines
+ * are skipped. Returns 0 at end.
+ */
+static int next_mapping(const char **pos, const char *end, mapping_t *mapping) {
+	
+	if (input_file_type == BINARY) {
+		if (*pos + sizeof(mapping_t) > end)
+			return 0;
+		memcpy(mapping, *pos, sizeof(mapping_t));
+		*pos += sizeof(mapping_t);
+		return 1;
+	}
+	
+	while (*pos < end) {
+		const char *line = *pos;
+		const char *eol = (const char *)memchr(line, '\n', end - line);
+		*pos = (eol == NULL) ? end : eol + 1;
+		
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		
+		parse_probcalc_line(line, *pos - line, mapping);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Cut the forward or reverse suffix off the read name of mapping into root,
+ * returns whether the read is the forward one.
+ */
+static int read_root(mapping_t *mapping, char *root) {
+	
+	strcpy(root, mapping->readname);
+	int readlen = strlen(root);
+	int is_forward = is_forward_test(root, readlen);
+	
+	if (is_forward) 
+		root[readlen - fwdsuflen] = '\0';
+	else 
+		root[readlen - revsuflen] = '\0';
+	
+	return is_forward;
+}
+
+/*
+ * The first read group that starts at or after pos. Mate groups are never
+ * split between threads, so a boundary is moved on to where the read name
+ * (up to the suffixes) changes.
+ */
+static const char * group_start_after(const char *data, const char *pos, const char *end) {
+	
+	if (pos >= end)
+		return end;
+	
+	// move on to the start of a line or record
+	if (input_file_type == BINARY) {
+		uint64_t rem = (pos - data) % sizeof(mapping_t);
+		if (rem != 0)
+			pos += sizeof(mapping_t) - rem;
+	} else if (pos > data && pos[-1] != '\n') {
+		const char *eol = (const char *)memchr(pos, '\n', end - pos);
+		pos = (eol == NULL) ? end : eol + 1;
+	}
+	
+	mapping_t mapping;
+	char first_root[READNAME_LEN];
+	char root[READNAME_LEN];
+	const char *next = pos;
+	
+	if (!next_mapping(&next, end, &mapping))
+		return end;
+	read_root(&mapping, first_root);
+	
+	while (pos = next, next_mapping(&next, end, &mapping)) {
+		read_root(&mapping, root);
+		if (strcmp(first_root, root) != 0)
+			return pos;
+	}
+	return end;
+}
+
+/*
+ * The analysis of a read group is done as soon as the next group starts, the
+ * statistics of the mean pass are kept per group so they can be added up in
+ * file order once all threads are done with a block.
+ */
+static void finish_group(pass_thread *pt, int pass_type) {
+	
+	uint64_t dist = 0;
+	
+	if (debugmode && pass_type == OUTPUT_PASS)
+		fprintf(outdebugfp, "fwd_nr:%i, rev_nr:%i\n", pt->fwd_index, pt->rev_index);
+	
+	if (pt->fwd_index > 0 && pt->rev_index > 0 && pt->do_analysis) {
+		double start = omp_get_wtime();
+		if (pass_type == MEAN_PASS)
+			dist = mp_mean_dist(pt->fwd_maps, pt->rev_maps, pt->fwd_index, pt->rev_index);
+		else
+			pt->called |= mp_output(pt->fwd_maps, pt->rev_maps, pt->fwd_index, pt->rev_index, pt->out);
+		pt->analysis_time += omp_get_wtime() - start;
+	}
+	
+	int uniq = (pt->fwd_index > 0) + (pt->rev_index > 0);
+	
+	if (pass_type == MEAN_PASS) {
+		if (pt->nr_groups == pt->groups_size) {
+			pt->groups_size = MAX(1024, pt->groups_size * 2);
+			pt->groups = (group_stat *)realloc(pt->groups, sizeof(group_stat) * pt->groups_size);
+			if (pt->groups == NULL) {
+				fprintf(stderr, "Error: could not allocate the read group statistics\n");
+				exit(1);
+			}
+		}
+		pt->groups[pt->nr_groups].dist = dist;
+		pt->groups[pt->nr_groups].lines = pt->group_lines;
+		pt->groups[pt->nr_groups].uniq = uniq;
+		pt->nr_groups++;
+	} else {
+		pt->uniq_reads += uniq;
+	}
+	
+	// if you are in debugmode, lower the debuglimit
+	if (debugmode) {
+		if (pt->fwd_index * pt->rev_index == 0) pt->debugwithzero += pt->fwd_index + pt->rev_index;
+		else pt->debugwithoutzero += pt->fwd_index + pt->rev_index;
+		
+		if (pt->nr_reads % 100000 == 0)
+			fprintf(stderr, "DEBUGLINE: #reads:%"
+			    PRIu64 ", #mappings_now:%i "
+			    "| w/0:%" PRIu64 ", wo/0:%"
+			    PRIu64 "\n", 
+			    pt->nr_reads, pt->fwd_index * pt->rev_index, 
+			    pt->debugwithzero, pt->debugwithoutzero);
+		
+		if (pass_type != MEAN_PASS) debuglimit--;
+	}
+}
+
+static void add_mapping(mapping_t **maps, int *index, int *size, mapping_t *mapping) {
+	
+	if (*index == *size) {
+		*size *= 2;
+		*maps = (mapping_t *)realloc(*maps, sizeof(mapping_t) * *size);
+		if (*maps == NULL) {
+			fprintf(stderr, "Error: could not allocate %i read mappings\n", *size);
+			exit(1);
+		}
+	}
+	(*maps)[(*index)++] = *mapping;
+}
+
+/*
+ * Go through the read groups of one thread's share of a block.
+ */
+static void thread_pass(pass_thread *pt, int pass_type) {
+	
+	const char *pos = pt->start;
+	mapping_t mapping;
+	char cur_name[READNAME_LEN]; 	// the read root we are currently adding to  
+	char test_name[READNAME_LEN]; 	// the read just parsed
+	int started = 0;
+	
+	cur_name[0] = '\0';
+	pt->nr_groups = 0;
+	
+	double start = omp_get_wtime() - pt->analysis_time;
+	while (next_mapping(&pos, pt->end, &mapping)) {
+		pt->lines++;
+		
+		int is_forward = read_root(&mapping, test_name);
+		
+		// see if this is a new read: only compare reads up to suffixes.
+		if (!started || strcmp(cur_name, test_name) != 0) { 
+			if (started) {
+				finish_group(pt, pass_type);
+				if (debugmode && pass_type != MEAN_PASS && debuglimit < 0) {
+					started = 0;
+					break;
+				}
+			}
+			started = 1;
+			strcpy(cur_name, test_name);
+			pt->fwd_index = 0;
+			pt->rev_index = 0;
+			pt->do_analysis = 1;
+			pt->group_lines = 0;
+			pt->nr_reads++;
+		}
+		pt->group_lines++;
+		
+		// don't do the analysis if you are calculating the mean with unique 
+		// mappings only, and you already have more than one mapping in the 
+		// fwd (if its a fwd read) or rev (if its a reverse read), since its 
+		// clearly not a unique mapping.
+		if (pass_type == MEAN_PASS && do_unique &&
+				((is_forward && pt->fwd_index >= 1) ||
+						(!is_forward && pt->rev_index >= 1))) {
+			pt->do_analysis = 0;
+		}
+		
+		if (is_forward && pt->do_analysis) {
+			add_mapping(&pt->fwd_maps, &pt->fwd_index, &pt->fwd_size, &mapping);
+		} else if (pt->do_analysis) { 
+			add_mapping(&pt->rev_maps, &pt->rev_index, &pt->rev_size, &mapping);
+		}
+	}
+	if (started)
+		finish_group(pt, pass_type);
+	pt->parse_time += omp_get_wtime() - start - pt->analysis_time;
+}
+
+/*
+ * Pass through the mapping file once through the method specified by
+ * pass_type (MEAN_PASS or OUTPUT_PASS).
+ *
+ * The file is mapped into memory and gone through a block at a time, each
+ * block is split at read group boundaries between the threads. The mean
+ * pass adds up the statistics of the groups in file order, so that it stops
+ * at the same read as going through the file in one go would, and the
+ * output pass writes the mate pairs of the threads out in order.
  */
 uint64_t filepass(char * mappingfilename, int pass_type) {
 	
 	// open files
-	FILE *mappingfile = fopen(mappingfilename, "r");
-	if (mappingfile == NULL) {
+	int fd = open(mappingfilename, O_RDONLY);
+	if (fd < 0) {
 		fprintf(stderr, "Error: could not open readfile: %s\n", mappingfilename);
 		exit(1);
 	}
 	struct stat fs;
-	stat(mappingfilename, &fs);
+	fstat(fd, &fs);
 	uint64_t nr_mappings = (uint64_t) (fs.st_size * 1.0 / sizeof(mapping_t)); 
 	// TODO: could check if it actually rounds to an integer.
 	
+	const char *data = (const char *)"";
+	if (fs.st_size > 0) {
+		data = (const char *)mmap(NULL, fs.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			fprintf(stderr, "Error: could not map readfile: %s\n", mappingfilename);
+			exit(1);
+		}
+		madvise((void *)data, fs.st_size, MADV_SEQUENTIAL);
+	}
+	const char *end = data + fs.st_size;
+	
 	if (pass_type != MEAN_PASS || gl_mean_nr == 0)
 		fprintf(stderr, "Detected number of mappings: %s. Progress:\n",
 				comma_integer(nr_mappings));
@@ -337,173 +575,149 @@ uint64_t filepass(char * mappingfilename, int pass_type) {
 				"        60        70        80        90       100\n");
 	}
 	
-	
 	// start later into the readfile. 
-	if (debugseek > 0) {
-		fseek(mappingfile, debugseek * sizeof(mapping_t), SEEK_SET);
+	const char *pos = data;
+	if (debugseek > 0 && input_file_type == BINARY) {
+		pos = MIN(end, data + debugseek * sizeof(mapping_t));
 	}
 	
 	// (re) setup the some counts
 	gl_good_mps = 0;
 	gl_debug_lines = 0;
 	
-	// prepare structure arrays
-	// note: max_reads + 1 because we read dirrectly to these arrays, but may need to
-	// switch
-	//mapping_t *fwd_maps = (mapping_t *) malloc(sizeof(mapping_t) * (max_reads + 1));
-
-	// Sun Studio does not allow variable-sized array declarations
-	//mapping_t fwd_maps[max_reads + 1];
-	mapping_t *fwd_maps = (mapping_t *)alloca(sizeof(mapping_t) * (max_reads + 1));
-	assert(fwd_maps);
-	//mapping_t *rev_maps = (mapping_t *) malloc(sizeof(mapping_t) * (max_reads + 1));
-	//mapping_t rev_maps[max_reads + 1];
-	mapping_t *rev_maps = (mapping_t *)alloca(sizeof(mapping_t) * (max_reads + 1));
-	assert(rev_maps);
-	mapping_t *mapping = fwd_maps;
-	
-	// indeces into the arrays. These need to be reset after each mp group 
-	int fwd_index = 0; 
-	int rev_index = 0;
-	
-	uint64_t debugwithzero = 0;
-	uint64_t debugwithoutzero = 0;
+	// debug mode works through the groups in order 
+	int threads = debugmode ? 1 : num_threads;
+	pass_thread pts[threads];
+	int t;
+	memset(pts, 0, sizeof(pts));
+	for (t = 0; t < threads; t++) {
+		pts[t].fwd_size = max_reads + 1;
+		pts[t].fwd_maps = (mapping_t *)malloc(sizeof(mapping_t) * pts[t].fwd_size);
+		pts[t].rev_size = max_reads + 1;
+		pts[t].rev_maps = (mapping_t *)malloc(sizeof(mapping_t) * pts[t].rev_size);
+		if (pts[t].fwd_maps == NULL || pts[t].rev_maps == NULL) {
+			fprintf(stderr, "Error: could not allocate the read mappings\n");
+			exit(1);
+		}
+	}
 	
 	uint64_t nr_reads = 0;
+	int done = 0;
 	
-	int is_forward = -1; // is forward read
-	int do_analysis = 1; // boolean on whether to do theanalysis with the current read 
-	
-	char cur_name[READNAME_LEN]; 	// the read root we are currently adding to  
-	cur_name[0] = '\0';
-	char test_name[READNAME_LEN]; 	// the read just taken from fread. 
-		
-	// loop over all reads...
-	///while(fread (mapping, sizeof(mapping_t), 1, mappingfile) == 1) {
-	while(read_probcalc_line(mappingfile, mapping) == 1) {
-		
-		// process bar
-		gl_debug_lines++;
+	while (pos < end && !done) {
 		
-		int condition = 0;
-		if ( !debugmode && pass_type == MEAN_PASS && gl_mean_nr != 0) {
-			if (gl_good_mps * 100.0 / gl_mean_nr > perc)
-				condition = 1;
-		} else if (! debugmode && (pass_type == OUTPUT_PASS || gl_mean_nr == 0)) {
-			if (gl_debug_lines * 100.0 / nr_mappings > perc) {
-				condition = 1;
+		// split the block at read group boundaries
+		const char *block_end = group_start_after(data, pos + (uint64_t)BLOCK_BYTES * threads, end);
+		for (t = 0; t < threads; t++) {
+			pts[t].start = (t == 0) ? pos : pts[t - 1].end;
+			pts[t].end = (t == threads - 1) ? block_end : 
+				MIN(block_end, group_start_after(data, pos + (uint64_t)BLOCK_BYTES * (t + 1), end));
+			if (pass_type == OUTPUT_PASS) {
+				pts[t].out = open_memstream(&pts[t].out_buf, &pts[t].out_len);
+				if (pts[t].out == NULL) {
+					fprintf(stderr, "Error: could not open the output of thread %i\n", t);
+					exit(1);
+				}
 			}
-		} 
-		
-		if (condition) {
-			if (perc % 10 == 0) 
-				fprintf(stderr, "|");
-			else
-				fprintf(stderr, "-");
-			perc++;
 		}
 		
-		// check if the read is forward, 
-		strcpy(test_name, mapping->readname);
-		int readlen = strlen(test_name);
-		is_forward = is_forward_test(test_name, readlen);
-		
-		if (is_forward) 
-			test_name[readlen - fwdsuflen] = '\0';
-		else 
-			test_name[readlen - revsuflen] = '\0';
+		#pragma omp parallel for num_threads(threads) schedule(static, 1)
+		for (t = 0; t < threads; t++) {
+			thread_pass(&pts[t], pass_type);
+		}
 		
-		// see if this is a new read: only compare reads up to suffixes.
-		if (strcmp(cur_name, test_name) != 0) { 
+		for (t = 0; t < threads; t++) {
+			pass_thread *pt = &pts[t];
 			
-			if (debugmode && pass_type == OUTPUT_PASS)
-				fprintf(outdebugfp, "fwd_nr:%i, rev_nr:%i\n", fwd_index, rev_index);
-			
-			if (nr_reads > 0 && fwd_index > 0 && rev_index > 0 && do_analysis) {
-				start_clock[ANALYSIS_TIME] = clock();
-				mp_analysis(fwd_maps, rev_maps, fwd_index, rev_index, pass_type);
-				end_clock[ANALYSIS_TIME] = clock();
-				elapsed_clock[ANALYSIS_TIME] += ((double) 
-						(end_clock[ANALYSIS_TIME] - start_clock[ANALYSIS_TIME]))
-						/ CLOCKS_PER_SEC;
-			} 
-			
-			if (fwd_index > 0) gl_uniq_reads++;
-			if (rev_index > 0) gl_uniq_reads++;
-			
-			do_analysis = 1;
-			
-			// if doing the mean, and we're done the mean
-			if (pass_type == MEAN_PASS && gl_done_mean)  {
-				break;
-			}
-			
-			// copy the new readname to cur_name (up to suffix)
-			strcpy(cur_name, test_name);
-			
-			// if you are in debugmode, lower the debuglimit
-			if (debugmode) {
-				if (fwd_index * rev_index == 0) debugwithzero += fwd_index + rev_index;
-				else debugwithoutzero += fwd_index + rev_index;
+			if (pass_type == MEAN_PASS) {
+				uint64_t g;
+				for (g = 0; g < pt->nr_groups && !done; g++) {
+					nr_reads++;
+					gl_debug_call++;
+					gl_debug_lines += pt->groups[g].lines;
+					gl_uniq_reads += pt->groups[g].uniq;
+					if (pt->groups[g].dist > 0)
+						increments_stats(pt->groups[g].dist);
+					
+					// if doing the mean, and we're done the mean
+					if (gl_done_mean) {
+						done = 1;
+						// the first mapping of the next group has been read 
+						if (g + 1 < pt->nr_groups || t + 1 < threads || block_end < end)
+							gl_debug_lines++;
+					}
+				}
+			} else {
+				nr_reads += pt->nr_reads;
+				gl_debug_call += pt->nr_reads;
+				gl_debug_lines += pt->lines;
+				gl_uniq_reads += pt->uniq_reads;
 				
-				if (nr_reads % 100000 == 0)
-					fprintf(stderr, "DEBUGLINE: #reads:%"
-					    PRIu64 ", #mappings_now:%i "
-					    "| w/0:%" PRIu64 ", wo/0:%"
-					    PRIu64 "\n", 
-					    nr_reads, fwd_index * rev_index, 
-					    debugwithzero, debugwithoutzero);
+				fclose(pt->out);
+				if (pt->called && !calledMP) {
+					printf("#FORMAT: fwd_name fwd_chr fwd_editstring fwd_strand fwd_start fwd_end fwd_pg"
+							"rev_name rev_chr rev_editstring rev_strand rev_start rev_end rev_pg"
+							"distance normodds pgenome pchance\n");
+					calledMP = true;
+				}
 				
-				if (pass_type != MEAN_PASS) debuglimit--;
-				if (pass_type != MEAN_PASS && debuglimit < 0) break;
+				// number the mate pairs in file order 
+				const char *line = pt->out_buf;
+				const char *out_end = pt->out_buf + pt->out_len;
+				while (line < out_end) {
+					const char *eol = (const char *)memchr(line, '\n', out_end - line);
+					const char *next = (eol == NULL) ? out_end : eol + 1;
+					printf("%lli\t", (long long int) gl_printed_mp);
+					gl_printed_mp++;
+					fwrite(line, 1, next - line, stdout);
+					line = next;
+				}
+				free(pt->out_buf);
+				pt->out_buf = NULL;
+				pt->out_len = 0;
+				pt->called = 0;
 			}
-			
-			// reset variables as needed
-			fwd_index = 0;
-			fwd_maps[fwd_index] = *mapping;
-			rev_index = 0;
-	
-			// the number of times mp_analysis is called
-			gl_debug_call++;
-
-			nr_reads++;
-		} 
-		
-		// make sure the max_reads variable holds
-		assert(fwd_index < max_reads);
-		assert(rev_index < max_reads);
-		
-		// don't do the analysis if you are calculating the mean with unique 
-		// mappings only, and you already have more than one mapping in the 
-		// fwd (if its a fwd read) or rev (if its a reverse read), since its 
-		// clearly not a unique mapping. The check is done here to avoid 
-		// seeking (costly) if its not necessary.
-		if (pass_type == MEAN_PASS && do_unique &&
-				((is_forward && fwd_index >= 1) ||
-						(!is_forward && rev_index >= 1))) {
-			do_analysis = 0;
+			pt->nr_reads = 0;
+			pt->lines = 0;
+			pt->uniq_reads = 0;
 		}
+		if (debugmode && pass_type != MEAN_PASS && debuglimit < 0)
+			done = 1;
 		
+		pos = block_end;
 		
-		start_clock[SYS_TIME] = clock();
-		
-		if (is_forward && do_analysis) {
-			fwd_index++;
-			mapping = &fwd_maps[fwd_index]; // the new mapping space
-		} else if (do_analysis) { 
-			rev_maps[rev_index++] = *mapping;
+		// process bar
+		int target = perc;
+		if (!debugmode && pass_type == MEAN_PASS && gl_mean_nr != 0) {
+			target = (int) ceil(gl_good_mps * 100.0 / gl_mean_nr);
+		} else if (!debugmode && fs.st_size > 0) {
+			target = (int) ceil((pos - data) * 100.0 / fs.st_size);
+		}
+		target = MIN(target, 101);
+		while (perc < target) {
+			if (perc % 10 == 0) 
+				fprintf(stderr, "|");
+			else
+				fprintf(stderr, "-");
+			perc++;
 		}
-		
-		end_clock[SYS_TIME] = clock();
-		elapsed_clock[SYS_TIME] += ((double) 
-				(end_clock[SYS_TIME] - start_clock[SYS_TIME])) / CLOCKS_PER_SEC;
 	}
 	
 	if (!debugmode)
 		fprintf(stderr, "|\n");
 	
+	for (t = 0; t < threads; t++) {
+		elapsed_clock[SYS_TIME] += pts[t].parse_time;
+		elapsed_clock[ANALYSIS_TIME] += pts[t].analysis_time;
+		free(pts[t].fwd_maps);
+		free(pts[t].rev_maps);
+		free(pts[t].groups);
+	}
+	
 	// close the files
-	fclose(mappingfile);
+	if (fs.st_size > 0)
+		munmap((void *)data, fs.st_size);
+	close(fd);
 	
 	return nr_reads;
 }
@@ -511,11 +725,11 @@ uint64_t filepass(char * mappingfilename, int pass_type) {
 
 
 /*
- * The Mate Pair analysis. This does one or two passes over the combinations
- * of mate pairs...
+ * The distance of the only good mate pair of a read group, 0 if there is
+ * none or more than one.
  */
-void mp_analysis(mapping_t *fwd_maps, mapping_t *rev_maps, 
-		int fwd_nr, int rev_nr, int pass_type) {
+uint64_t mp_mean_dist(mapping_t *fwd_maps, mapping_t *rev_maps, 
+		int fwd_nr, int rev_nr) {
 
 	// iteration variables
 	int i,j;
@@ -527,98 +741,103 @@ void mp_analysis(mapping_t *fwd_maps, mapping_t *rev_maps,
 	uint64_t dist = 0; 			// local distance
 	
 	// looking in every combination
-	if (pass_type == MEAN_PASS || discordant) {
-		for(i = 0; i < fwd_nr; i++) {
-			for (j = 0; j < rev_nr; j++) {
-				
-				// compute the distance between these two IF the mate pair is good
-				// good: (d < M) and (R+F+ or F-R-)
-				// if the mate pair is not good, good_mp_dst returns 0
-				dist = good_mp_dst(&fwd_maps[i], &rev_maps[j]);
-				
-				if (dist > 0) {
-					good_mps_dist = dist;
-					good_mps++;
-				}
-				
-				if (pass_type == MEAN_PASS && good_mps > 1)
-					break; 
-			}
+	for(i = 0; i < fwd_nr && good_mps <= 1; i++) {
+		for (j = 0; j < rev_nr && good_mps <= 1; j++) {
 			
-			if (pass_type == MEAN_PASS && good_mps > 1)
-				break;
+			// compute the distance between these two IF the mate pair is good
+			// good: (d < M) and (R+F+ or F-R-)
+			// if the mate pair is not good, good_mp_dst returns 0
+			dist = good_mp_dst(&fwd_maps[i], &rev_maps[j]);
+			
+			if (dist > 0) {
+				good_mps_dist = dist;
+				good_mps++;
+			}
 		}
 	}
 	
-	// add to m, stdev, etc
-	if (pass_type == MEAN_PASS && good_mps == 1) {
-		increments_stats(good_mps_dist);
-	}
-	
-	// if the discordant flag is NOT set, 
-	// OR discordant is set and the mp is NOT conc2, 
-	if (pass_type == OUTPUT_PASS && (!discordant || good_mps == 0)) {   
-		
-		double totnormodds = 0;
-		int mp_set_index = 0;
-		
-		mate_pair_val *mp_set = (mate_pair_val *) 
-				malloc(sizeof(mate_pair_val) * fwd_nr * rev_nr);
-		assert(mp_set);
+	return (good_mps == 1) ? good_mps_dist : 0;
+}
+
+/*
+ * The Mate Pair analysis of the output pass. Prints the mate pairs of a read
+ * group to out, without their running number, and returns whether the group
+ * was considered for output.
+ */
+int mp_output(mapping_t *fwd_maps, mapping_t *rev_maps, 
+		int fwd_nr, int rev_nr, FILE *out) {
+
+	// iteration variables
+	int i,j;
 		
-		// look through all the combinations
+	// the number of "good" mp mappings.
+	// good: d < M and R+F+, F-R-
+	int good_mps = 0;  
+	
+	// looking in every combination
+	if (discordant) {
 		for(i = 0; i < fwd_nr; i++) {
 			for (j = 0; j < rev_nr; j++) {
-				add_p_stats(&fwd_maps[i], &rev_maps[j], mp_set, 
-						&totnormodds, &mp_set_index);
+				if (good_mp_dst(&fwd_maps[i], &rev_maps[j]) > 0)
+					good_mps++;
 			}
 		}
-				
-		// fix norm odds (normalize)
-		for (i = 0; i < mp_set_index; i++) {
-			mp_set[i].normodds = mp_set[i].normodds/totnormodds; 
-		}
-		
-		//qsort
-		qsort(mp_set, mp_set_index, sizeof(*mp_set), mate_pair_val_cmp);
-		
-		// output
-		if (!calledMP) {
-			printf("#FORMAT: fwd_name fwd_chr fwd_editstring fwd_strand fwd_start fwd_end fwd_pg"
-					"rev_name rev_chr rev_editstring rev_strand rev_start rev_end rev_pg"
-					"distance normodds pgenome pchance\n");
-			calledMP = true;
+	}
+	
+	// if the discordant flag is NOT set, 
+	// OR discordant is set and the mp is NOT conc2, 
+	if (discordant && good_mps != 0)
+		return false;
+	
+	double totnormodds = 0;
+	int mp_set_index = 0;
+	
+	mate_pair_val *mp_set = (mate_pair_val *) 
+			malloc(sizeof(mate_pair_val) * fwd_nr * rev_nr);
+	assert(mp_set);
+	
+	// look through all the combinations
+	for(i = 0; i < fwd_nr; i++) {
+		for (j = 0; j < rev_nr; j++) {
+			add_p_stats(&fwd_maps[i], &rev_maps[j], mp_set, 
+					&totnormodds, &mp_set_index);
 		}
-		
-		// output
-		for (i = 0; i < mp_set_index; i++) {
-			
-			if (i >= print_max) {
-				if (mate_pair_val_cmp(&mp_set[i-1], &mp_set[i]) != 0)
-					break;
-			}
-			
+	}
 			
-			printf("%lli\t", (long long int) gl_printed_mp);
-			gl_printed_mp++;
-			printf("%s\t%s\t%s\t%c\t%lli\t%lli\t%1.3f\t", 
-					&(mp_set[i].fwd_rs->readname[1]), mp_set[i].fwd_rs->contigname,
-					mp_set[i].fwd_rs->editstring, mp_set[i].fwd_rs->strand, 
-					(long long int) mp_set[i].fwd_rs->contigstart, 
-					(long long int) mp_set[i].fwd_rs->contigend, mp_set[i].fwd_rs->pgenome);
-			printf("%s\t%s\t%s\t%c\t%lli\t%lli\t%1.3f\t", 
-					&(mp_set[i].rev_rs->readname[1]), mp_set[i].rev_rs->contigname,
-					mp_set[i].rev_rs->editstring, mp_set[i].rev_rs->strand, 
-					(long long int) mp_set[i].rev_rs->contigstart, 
-					(long long int) mp_set[i].rev_rs->contigend, mp_set[i].rev_rs->pgenome);
-			printf("%lli\t%1.3f\t%1.3f\t%1.10f\n",
-					(long long int) mp_set[i].dist, 
-					mp_set[i].normodds, mp_set[i].pgenome, mp_set[i].pchance);
+	// fix norm odds (normalize)
+	for (i = 0; i < mp_set_index; i++) {
+		mp_set[i].normodds = mp_set[i].normodds/totnormodds; 
+	}
+	
+	//qsort
+	qsort(mp_set, mp_set_index, sizeof(*mp_set), mate_pair_val_cmp);
+	
+	// output
+	for (i = 0; i < mp_set_index; i++) {
+		
+		if (i >= print_max) {
+			if (mate_pair_val_cmp(&mp_set[i-1], &mp_set[i]) != 0)
+				break;
 		}
 		
-		free(mp_set);
+		fprintf(out, "%s\t%s\t%s\t%c\t%lli\t%lli\t%1.3f\t", 
+				&(mp_set[i].fwd_rs->readname[1]), mp_set[i].fwd_rs->contigname,
+				mp_set[i].fwd_rs->editstring, mp_set[i].fwd_rs->strand, 
+				(long long int) mp_set[i].fwd_rs->contigstart, 
+				(long long int) mp_set[i].fwd_rs->contigend, mp_set[i].fwd_rs->pgenome);
+		fprintf(out, "%s\t%s\t%s\t%c\t%lli\t%lli\t%1.3f\t", 
+				&(mp_set[i].rev_rs->readname[1]), mp_set[i].rev_rs->contigname,
+				mp_set[i].rev_rs->editstring, mp_set[i].rev_rs->strand, 
+				(long long int) mp_set[i].rev_rs->contigstart, 
+				(long long int) mp_set[i].rev_rs->contigend, mp_set[i].rev_rs->pgenome);
+		fprintf(out, "%lli\t%1.3f\t%1.3f\t%1.10f\n",
+				(long long int) mp_set[i].dist, 
+				mp_set[i].normodds, mp_set[i].pgenome, mp_set[i].pchance);
 	}
 	
+	free(mp_set);
+	
+	return true;
 }
 
 /*
@@ -696,7 +915,7 @@ static void usage(char *progname) {
 			" -g genome_length -M hard_distance_limit [-L nr_mate_pairs] [-q] "
 			"[-C PCHANCE_CUTOFF] [-G PGENOME_CUTOFF] [-R] "
 			"[-x max_reads_to_expect] [-d] [-u] [-D] [-T max_reads_to_output] "
-			"[-s nr_stdev] [-c]", progname);
+			"[-s nr_stdev] [-c] [-N threads]", progname);
 	exit(1);
 }
 
@@ -993,136 +1212,115 @@ void print_dashed_line() {
 
 
 /*
- * Read a line from the mapping file, and assign the apropriate values to 
- * the mapping_t mapping.
- * The mappingfile can be binary or ascii, with input_file_type appropriately 
- * set.  
+ * Parse a line of the mapping file, and assign the apropriate values to 
+ * the mapping_t mapping. The line is len characters long, and may or may
+ * not end in a newline.
  */
-int read_probcalc_line(FILE *mappingfile, mapping_t * mapping) {
+void parse_probcalc_line(const char *line, size_t len, mapping_t * mapping) {
 	
-	if (input_file_type == BINARY) {
-		return fread (mapping, sizeof(mapping_t), 1, mappingfile);
-		
-	} else {
-		
-		char line[MAXLINELEN];
-		int linelen = 0;
-		int i;
-		
-		char ech; 	// temp character
-		char field[256];
-		int fieldnr = 1;
-		int fieldindex = 0;
-		
-		// look though all of the tab-delimited fields
-		while (fgets(line, MAXLINELEN, mappingfile) != NULL) {
-			if (line[0] == '#')
-				continue;
+	size_t i;
+	
+	char ech; 	// temp character
+	char field[256];
+	int fieldnr = 1;
+	int fieldindex = 0;
+	
+	// look though all of the tab-delimited fields, the last one ends the line
+	for (i = 0; i <= len; i++) {
+		ech = (i < len) ? line[i] : '\n';
+			
+		if (ech == '\t' || ech == '\n') {
+			field[fieldindex] = '\0';
 			
-			linelen = strlen(line);
-			for (i = 0; i < linelen; i++) {
-				ech = line[i];
+			switch (fieldnr) {
+				case 1:
+					strcpy(mapping->readname, field);
+					break;
 					
-				if (ech == '\t') {
-					field[fieldindex] = '\0';
+				case 2:
+					strcpy(mapping->contigname, field);
+					break;
 					
-					switch (fieldnr) {
-						case 1:
-							strcpy(mapping->readname, field);
-							break;
-							
-						case 2:
-							strcpy(mapping->contigname, field);
-							break;
-							
-						case 3:
-							if (strlen(field) != 1) {
-								fprintf(stderr, "Error, strand is not single character: [len:%zu] %s\n", strlen(field), field);
-								exit(1);
-							}
-							mapping->strand = field[0];
-							break;
-							
-						case 4:
-							mapping->contigstart = atoll(field);
-							break;
-							
-						case 5:
-							mapping->contigend = atoll(field);
-							break;
-							
-						case 6:
-							mapping->readstart = atoll(field);
-							break;
-							
-						case 7:
-							mapping->readend = atoll(field);
-							break;
-							
-						case 8:
-							mapping->readlength = atoi(field);
-							break;
-							
-						case 9:
-							mapping->score = atoi(field);
-							break;
-							
-						case 10:
-							strcpy(mapping->editstring, field);
-							break;
-							
-						case 11:
-							if (!Rflag)
-								mapping->normodds = atof(field);
-							break;
-							
-						case 12:
-							if (Rflag)
-								mapping->normodds = atof(field);
-							else
-								mapping->pgenome = atof(field);
-							break;
-							
-						case 13:
-							if (Rflag)
-								mapping->pgenome = atof(field);
-							else
-								mapping->pchance = atof(field);
-							break;
-							
-						case 14:
-							if (Rflag)
-								mapping->pchance = atof(field);
-							else {
-								fprintf(stderr, "no R Flag, and too many fields. line:\n");
-								fprintf(stderr, "%s\n", line);
-								exit(1);
-							}
-							break;
-							
-						default:
-							fprintf(stderr, "error: failed to parse file line [%s]"
-									" fieldnr:%i\n", line, fieldnr);
-							break;
-							
+				case 3:
+					if (strlen(field) != 1) {
+						fprintf(stderr, "Error, strand is not single character: [len:%zu] %s\n", strlen(field), field);
+						exit(1);
 					}
+					mapping->strand = field[0];
+					break;
 					
-					fieldnr++;
-					fieldindex = 0;
+				case 4:
+					mapping->contigstart = atoll(field);
+					break;
 					
-				} else {
-					field[fieldindex++] = ech;
-				}
-			} // for loop through the line
+				case 5:
+					mapping->contigend = atoll(field);
+					break;
+					
+				case 6:
+					mapping->readstart = atoll(field);
+					break;
+					
+				case 7:
+					mapping->readend = atoll(field);
+					break;
+					
+				case 8:
+					mapping->readlength = atoi(field);
+					break;
+					
+				case 9:
+					mapping->score = atoi(field);
+					break;
+					
+				case 10:
+					strcpy(mapping->editstring, field);
+					break;
+					
+				case 11:
+					if (!Rflag)
+						mapping->normodds = atof(field);
+					break;
+					
+				case 12:
+					if (Rflag)
+						mapping->normodds = atof(field);
+					else
+						mapping->pgenome = atof(field);
+					break;
+					
+				case 13:
+					if (Rflag)
+						mapping->pgenome = atof(field);
+					else
+						mapping->pchance = atof(field);
+					break;
+					
+				case 14:
+					if (Rflag)
+						mapping->pchance = atof(field);
+					else {
+						fprintf(stderr, "no R Flag, and too many fields. line:\n");
+						fprintf(stderr, "%.*s\n", (int) len, line);
+						exit(1);
+					}
+					break;
+					
+				default:
+					fprintf(stderr, "error: failed to parse file line [%.*s]"
+							" fieldnr:%i\n", (int) len, line, fieldnr);
+					break;
+					
+			}
 			
-			return 1;
-		} // while loop skipping over comment lines
-		return 0; // since the result was therefore NULL
-		
-	}
-
-	// avoid unreachable compiler warning; we'd get a no return warning if it were
-	//assert(0);
-	//return -1;
+			if (ech == '\n')
+				break;
+			
+			fieldnr++;
+			fieldindex = 0;
+			
+		} else if (fieldindex < (int) sizeof(field) - 1) {
+			field[fieldindex++] = ech;
+		}
+	} // for loop through the line
 }
-
@@ -49,6 +49,8 @@
 
 #define MAXLINELEN 1023
 
+#define BLOCK_BYTES (4 << 20) // mapping file bytes given to each thread at once
+
 // mate pair mapping struct
 typedef struct {
 	mapping_t 	*fwd_rs;
@@ -59,6 +61,48 @@ typedef struct {
 	double     	normodds;
 } mate_pair_val ;
 
+// what the mean pass keeps of a read group
+typedef struct {
+	uint64_t	dist;		// distance of its only good mate pair, or 0
+	int			lines;		// its number of mappings
+	int			uniq;		// whether it had fwd and rev mappings
+} group_stat;
+
+// a thread's share of a block of the mapping file
+typedef struct {
+	const char	*start;
+	const char	*end;
+	
+	// the mappings of the current read group
+	mapping_t	*fwd_maps;
+	mapping_t	*rev_maps;
+	int			fwd_size;
+	int			rev_size;
+	int			fwd_index;
+	int			rev_index;
+	int			do_analysis;
+	int			group_lines;
+	
+	// mean pass: the groups, in order
+	group_stat	*groups;
+	uint64_t	nr_groups;
+	uint64_t	groups_size;
+	
+	// output pass: the mate pairs, in order
+	FILE		*out;
+	char		*out_buf;
+	size_t		out_len;
+	int			called;
+	
+	uint64_t	nr_reads;
+	uint64_t	lines;
+	uint64_t	uniq_reads;
+	uint64_t	debugwithzero;
+	uint64_t	debugwithoutzero;
+	double		parse_time;
+	double		analysis_time;
+} pass_thread;
+
 
 
 /*
@@ -67,11 +111,18 @@ typedef struct {
 static void usage(char *progname);
 
 /*
- * The Mate Pair analysis. This does one or two passes over the combinations
- * of mate pairs...
+ * The distance of the only good mate pair of a read group, 0 if there is
+ * none or more than one.
+ */
+uint64_t mp_mean_dist(mapping_t *fwd_maps, mapping_t *rev_maps, int fwd_nr, 
+		int rev_nr);
+
+/*
+ * The Mate Pair analysis of the output pass. Prints the mate pairs of a read
+ * group to out and returns whether the group was considered for output.
  */
-void mp_analysis(mapping_t *fwd_maps, mapping_t *rev_maps, int fwd_nr, 
-		int rev_nr, int pass_type);
+int mp_output(mapping_t *fwd_maps, mapping_t *rev_maps, int fwd_nr, 
+		int rev_nr, FILE *out);
 
 /*
  * test if the string readname is a forward or a reverse read
@@ -138,9 +189,7 @@ char * comma_integer(uint64_t val);
 void print_dashed_line();
 
 /*
- * Read a line from the mapping file, and assign the apropriate values to 
+ * Parse a line of the mapping file, and assign the apropriate values to 
  * the mapping_t mapping.
- * The mappingfile can be binary or ascii, with input_file_type appropriately 
- * set.  
  */
-int read_probcalc_line(FILE *mappingfile, mapping_t * mapping);
+void parse_probcalc_line(const char *line, size_t len, mapping_t * mapping);
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <zlib.h>
 #include <assert.h>
 
@@ -11,18 +12,25 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <omp.h>
 
 
 
 #include "shrimp_var.h"
 
-#define LINE_MAX 256
-
 static int Rflag = false;
 static int nlines = 0;
 static FILE *outfile;
 
 static int inputtype = NONE;
+static int num_threads = 1;
+
+// the files to transform, in the order given
+static input_file *inputs = NULL;
+static int ninputs = 0;
+static int inputs_size = 0;
 
 int main(int argc, char **argv) {
 
@@ -32,7 +40,7 @@ int main(int argc, char **argv) {
 	
 	char ch;
 	
-	while ((ch = getopt(argc, argv, "Ro:rpv")) != -1) {
+	while ((ch = getopt(argc, argv, "Ro:rpvN:")) != -1) {
 		switch (ch) {
 			case 'R':
 				Rflag = true;
@@ -49,6 +57,13 @@ int main(int argc, char **argv) {
 			case 'o':
 				outfile = fopen(optarg, "w");
 				break;
+			case 'N':
+				num_threads = atoi(optarg);
+				if (num_threads < 1) {
+					fprintf(stderr, "error: the number of threads must be at least 1\n");
+					exit(1);
+				}
+				break;
 			default:
 				usage(progname);
 		}
@@ -67,6 +82,7 @@ int main(int argc, char **argv) {
 		    (Rflag) ? "readsequence " : "");
 	
 	file_iterator_n(argv, argc);
+	transform_inputs();
 	
 	fclose(outfile);
 	
@@ -104,6 +120,12 @@ int file_iterator(char *path) {
 	struct dirent *de;
 	int files;
 
+	/* is standard input... */
+	if (strcmp("-", path) == 0) {
+		add_input(path);
+		return (1);
+	}
+	
 	/* is a regular file... */
 	if (stat(path, &sb) != 0) {
 		fprintf(stderr, "error: failed to stat [%s]: %s\n", path,
@@ -112,7 +134,7 @@ int file_iterator(char *path) {
 	}
 	
 	if (S_ISREG(sb.st_mode)) {
-		variant_transform(path);
+		add_input(path);
 		return (1);
 	}
 
@@ -156,7 +178,7 @@ int file_iterator(char *path) {
 
 		/* ensure it's a regular file or link to one */
 		if (S_ISREG(sb.st_mode)) {
-			variant_transform(fpath);
+			add_input(fpath);
 			files++;
 		} else {
 			fprintf(stderr, "warning: [%s] is neither a regular "
@@ -173,29 +195,173 @@ int file_iterator(char *path) {
 }
 
 
-/* 
- * read in the file probcalc output file in path, do output with a
- * more detailed variant info
+/*
+ * Queue the file in path to be transformed.
  */
-int variant_transform(char *fpath) {
+void add_input(char *path) {
 	
-	FILE *fp;
+	if (ninputs == inputs_size) {
+		inputs_size = (inputs_size == 0) ? 16 : inputs_size * 2;
+		inputs = (input_file *)realloc(inputs, sizeof(input_file) * inputs_size);
+		if (inputs == NULL) {
+			fprintf(stderr, "error: could not allocate the input list\n");
+			exit(1);
+		}
+	}
+	inputs[ninputs].path = strdup(path);
+	inputs[ninputs].data = NULL;
+	inputs[ninputs].size = 0;
+	inputs[ninputs].mapped = 0;
+	ninputs++;
+}
+
+/*
+ * Bring the file in memory: regular files are mapped, standard input is
+ * read in whole.
+ */
+static void load_input(input_file *in) {
 	
-	if (strcmp("-", fpath) == 0) {
-		fp = stdin;
-	} else {
-		fp = fopen(fpath, "r");
+	if (strcmp("-", in->path) == 0) {
+		size_t size = 1 << 20;
+		char *data = (char *)malloc(size);
+		size_t n;
+		
+		while (data != NULL && 
+				(n = fread(data + in->size, 1, size - in->size, stdin)) > 0) {
+			in->size += n;
+			if (in->size == size) {
+				size *= 2;
+				data = (char *)realloc(data, size);
+			}
+		}
+		if (data == NULL) {
+			fprintf(stderr, "error: could not read standard input\n");
+			exit(1);
+		}
+		in->data = data;
+		return;
 	}
-	if (fp == NULL) {
+	
+	int fd = open(in->path, O_RDONLY);
+	struct stat sb;
+	if (fd < 0 || fstat(fd, &sb) != 0) {
 		fprintf(stderr, "error: could not open file [%s]: %s\n",
-		    fpath, strerror(3));
+		    in->path, strerror(errno));
+		exit(1);
+	}
+	in->size = sb.st_size;
+	if (in->size > 0) {
+		in->data = (char *)mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (in->data == MAP_FAILED) {
+			fprintf(stderr, "error: could not map file [%s]: %s\n",
+			    in->path, strerror(errno));
+			exit(1);
+		}
+		madvise(in->data, in->size, MADV_SEQUENTIAL);
+		in->mapped = 1;
+	}
+	close(fd);
+}
+
+static void unload_input(input_file *in) {
+	
+	if (in->mapped)
+		munmap(in->data, in->size);
+	else
+		free(in->data);
+	in->data = NULL;
+}
+
+/*
+ * Transform all queued files. Each file is cut into chunks of about
+ * CHUNK_BYTES at line boundaries, and the chunks of all files are shared
+ * out between the threads a round at a time. The output of a round is
+ * written in input order, so it is the same for any number of threads.
+ */
+void transform_inputs() {
+	
+	int round_size = num_threads * CHUNKS_PER_THREAD;
+	chunk *chunks = (chunk *)malloc(sizeof(chunk) * round_size);
+	int nchunks = 0;
+	int next_input = 0;		// the next file to load
+	int first_loaded = 0;	// the first file that is still loaded
+	const char *pos = NULL;	// where the next chunk starts in the last loaded file
+	int i;
+	
+	if (chunks == NULL) {
+		fprintf(stderr, "error: could not allocate the chunk list\n");
 		exit(1);
 	}
 	
+	while (1) {
+		
+		// cut the next round of chunks
+		nchunks = 0;
+		while (nchunks < round_size) {
+			if (pos == NULL) {
+				if (next_input == ninputs)
+					break;
+				load_input(&inputs[next_input++]);
+				pos = inputs[next_input - 1].data;
+			}
+			input_file *in = &inputs[next_input - 1];
+			const char *end = in->data + in->size;
+			const char *cut = end;
+			
+			if (end - pos > CHUNK_BYTES) {
+				cut = (const char *)memchr(pos + CHUNK_BYTES, '\n', end - pos - CHUNK_BYTES);
+				cut = (cut == NULL) ? end : cut + 1;
+			}
+			if (cut > pos) {
+				chunks[nchunks].start = pos;
+				chunks[nchunks].end = cut;
+				nchunks++;
+			}
+			pos = (cut == end) ? NULL : cut;
+		}
+		if (nchunks == 0)
+			break;
+		
+		#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+		for (i = 0; i < nchunks; i++) {
+			FILE *out = open_memstream(&chunks[i].out_buf, &chunks[i].out_len);
+			if (out == NULL) {
+				fprintf(stderr, "error: could not open a chunk's output\n");
+				exit(1);
+			}
+			chunks[i].nlines = variant_transform(chunks[i].start, chunks[i].end, out);
+			fclose(out);
+		}
+		
+		for (i = 0; i < nchunks; i++) {
+			fwrite(chunks[i].out_buf, 1, chunks[i].out_len, outfile);
+			free(chunks[i].out_buf);
+			nlines += chunks[i].nlines;
+		}
+		
+		// the files that were done this round are not needed anymore
+		int last_needed = (pos == NULL) ? next_input : next_input - 1;
+		for (; first_loaded < last_needed; first_loaded++)
+			unload_input(&inputs[first_loaded]);
+	}
+	
+	for (i = 0; i < ninputs; i++)
+		free(inputs[i].path);
+	free(inputs);
+	free(chunks);
+}
+
+
+/* 
+ * read the probcalc output lines from start to end, do output with a
+ * more detailed variant info
+ */
+int variant_transform(const char *start, const char *end, FILE *out) {
+	
 	int nlines_local = 0;
 	
 	// reading in variables
-	char readname[256], contigname[256], strand[256], editstring[100];
+	char readname[256], contigname[256], strand[256], editstring[256];
 	char readsequence[256];
 	long contigstart = -1; 
 	long contigend = -1; 
@@ -209,7 +375,7 @@ int variant_transform(char *fpath) {
 	float pgenome = -1; 
 	float pchance  = -1;
 	
-	char line[LINE_MAX];
+	const char *line;
 	int linelen = 0;
 	int i;
 	
@@ -218,13 +384,16 @@ int variant_transform(char *fpath) {
 	int fieldnr = 1;
 	int fieldindex = 0;
 	
+	readname[0] = contigname[0] = strand[0] = editstring[0] = '\0';
 	
-	while (fgets(line, LINE_MAX, fp) != NULL) {
+	for (line = start; line < end; line += linelen) {
+		
+		const char *eol = (const char *)memchr(line, '\n', end - line);
+		linelen = (eol == NULL) ? end - line : eol + 1 - line;
 		
 		if (line[0] == '#')
 			continue;
 		
-		linelen = strlen(line);
 		for (i = 0; i < linelen; i++) {
 		
 			ech = line[i];
@@ -297,14 +466,14 @@ int variant_transform(char *fpath) {
 						break;
 						
 					default:
-						fprintf(stderr, "error: failed to parse file line [%s] fieldnr:%i\n", line, fieldnr);
+						fprintf(stderr, "error: failed to parse file line [%.*s] fieldnr:%i\n", linelen, line, fieldnr);
 						break;
 						
 				}	
 				fieldnr++;
 				fieldindex = 0;
 				
-			} else {
+			} else if (fieldindex < (int) sizeof(field) - 1) {
 				field[fieldindex++] = ech;
 				
 			}
@@ -314,13 +483,12 @@ int variant_transform(char *fpath) {
 		fieldindex = 0;
 		
 		nlines_local++;
-		fprintf(outfile, "%s\t%s\t%li", readname, editstring, contigstart);
-		editstr_to_stats(editstring, contigstart, (strcmp(strand, "+") == 0));
-		fprintf(outfile, "\n");
+		fprintf(out, "%s\t%s\t%li", readname, editstring, contigstart);
+		editstr_to_stats(editstring, contigstart, (strcmp(strand, "+") == 0), out);
+		fprintf(out, "\n");
 			
 	}
 	
-	nlines += nlines_local;
 	return nlines_local;
 }
 
@@ -336,7 +504,7 @@ static void usage(char *progname) {
 	if (slash != NULL)
 		progname = slash + 1;
 
-	fprintf(stderr, "usage: %s (-v|-p|-r) [-R] -o outfile results_dir1|results_file1 "
+	fprintf(stderr, "usage: %s (-v|-p|-r) [-R] [-N threads] -o outfile results_dir1|results_file1 "
 	    "results_dir2|results_file2 ...\n", progname);
 	exit(1);
 }
@@ -346,7 +514,7 @@ static void usage(char *progname) {
 /* 
  * shrimp edit string to stats 
  */  
-void editstr_to_stats(char * str, long readloc, int is_forward) {
+void editstr_to_stats(char * str, long readloc, int is_forward, FILE *out) {
 
 	// control variables
 	int inins = 0; 
@@ -477,8 +645,8 @@ void editstr_to_stats(char * str, long readloc, int is_forward) {
 		}
 	}	
 	
-	fprintf(outfile, "\t%i %i %i\t", nr_snps, nr_ins, nr_dels);
-	fprintf(outfile, "%s",outstring);
+	fprintf(out, "\t%i %i %i\t", nr_snps, nr_ins, nr_dels);
+	fprintf(out, "%s",outstring);
 }
 
 /*
@@ -7,6 +7,26 @@
 #define PROBCALC_CUR 2
 #define RMAPPER_V09 3
 
+// input is shared out between threads in chunks of about this many bytes
+#define CHUNK_BYTES (1 << 20)
+#define CHUNKS_PER_THREAD 4
+
+// a file to transform
+typedef struct {
+	char	*path;
+	char	*data;
+	size_t	size;
+	int		mapped;
+} input_file;
+
+// a piece of a file, and its output
+typedef struct {
+	const char	*start;
+	const char	*end;
+	char		*out_buf;
+	size_t		out_len;
+	int			nlines;
+} chunk;
 
 
 
@@ -14,7 +34,9 @@ static void usage(char *progname);
 int file_iterator_n(char **paths, int npaths); 
 int file_iterator(char *path);
 static void usage(char *progname); 
-int variant_transform(char *path);
-void editstr_to_stats(char * str, long readloc, int is_forward);
+void add_input(char *path);
+void transform_inputs();
+int variant_transform(const char *start, const char *end, FILE *out);
+void editstr_to_stats(char * str, long readloc, int is_forward, FILE *out);
 int assert_editstring_char(char echar) ;
 int complement(char ech);
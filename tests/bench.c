@@ -0,0 +1,721 @@
+/*
+ * bench.c
+ *
+ * Micro-benchmarks for the mapping kernels. A synthetic reference and
+ * synthetic reads (with substitutions and short indels) are made from a fixed
+ * random seed, so two builds given the same options time the same work and
+ * must print the same checksums. Every kernel is run for a number of rounds
+ * and the fastest round is reported.
+ */
+
+#define _MODULE_GMAPPER
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../gmapper/gmapper.h"
+#include "../gmapper/seeds.h"
+#include "../gmapper/genome.h"
+#include "../gmapper/mapping.h"
+
+#include "../common/fasta.h"
+#include "../common/util.h"
+#include "../common/sw-full-common.h"
+#include "../common/sw-full-cs.h"
+#include "../common/sw-full-ls.h"
+#include "../common/sw-vector.h"
+#include "../common/sw-gapless.h"
+#include "../common/sw-post.h"
+
+#define DEF_BENCH_GENOME_LEN	1000000
+#define DEF_BENCH_READS		10000
+#define DEF_BENCH_READ_LEN	100
+#define DEF_BENCH_ROUNDS	3
+#define DEF_BENCH_SEED		1
+
+#define BENCH_PR_SUBST		0.02
+#define BENCH_PR_INDEL		0.002
+
+
+typedef struct bench_read {
+  int		origin;		// where the read was taken from, forward strand
+  int		st;		// 1 if the read is the reverse complement
+  char *	fwd;		// read as it lies on the forward strand
+  uint32_t *	cs;		// colour space version of fwd, primed with a T
+  int		cs_len;
+} bench_read;
+
+typedef struct bench_result {
+  uint64_t	reads;
+  uint64_t	cells;
+  uint64_t	checksum;
+} bench_result;
+
+static int genome_size = DEF_BENCH_GENOME_LEN;
+static int n_bench_reads = DEF_BENCH_READS;
+static int bench_read_len = DEF_BENCH_READ_LEN;
+static int n_rounds = DEF_BENCH_ROUNDS;
+static uint64_t rng_state;
+static char const * kernels = NULL;
+
+static char * ref;
+static bench_read * breads;
+static read_entry * res;
+static int * vector_scores;	// input to the full SW, as in hit_run_full_sw()
+static int max_read_len;
+static int max_w_len;
+static char bench_genome_file[] = "/tmp/shrimp-bench-genome-XXXXXX";
+static char bench_reads_file[] = "/tmp/shrimp-bench-reads-XXXXXX";
+
+
+/*
+ * xorshift64*; the sequences must not depend on the C library.
+ */
+static inline uint32_t
+rng_next()
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (uint32_t)((rng_state * 2685821657736338717ull) >> 32);
+}
+
+static inline double
+rng_real()
+{
+  return (double)rng_next() / 4294967296.0;
+}
+
+
+static char
+complement(char c)
+{
+  switch (c) {
+  case 'A': return 'T';
+  case 'C': return 'G';
+  case 'G': return 'C';
+  case 'T': return 'A';
+  default: return 'N';
+  }
+}
+
+
+/*
+ * Write a random reference and reads sampled from it to temporary files.
+ */
+static void
+make_inputs()
+{
+  static char const bases[] = "ACGT";
+  FILE * f;
+  int fd, i, j;
+
+  rng_state = rng_state * 0x9e3779b97f4a7c15ull + 1;
+  ref = (char *)xmalloc(genome_size + 1);
+  for (i = 0; i < genome_size; i++)
+    ref[i] = bases[rng_next() & 0x3];
+  ref[genome_size] = 0;
+
+  fd = mkstemp(bench_genome_file);
+  if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+    fprintf(stderr, "error: cannot create genome file [%s] (%s)\n", bench_genome_file, strerror(errno));
+    exit(1);
+  }
+  fprintf(f, ">bench\n");
+  for (i = 0; i < genome_size; i += 80)
+    fprintf(f, "%.*s\n", MIN(80, genome_size - i), ref + i);
+  fclose(f);
+
+  fd = mkstemp(bench_reads_file);
+  if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+    fprintf(stderr, "error: cannot create reads file [%s] (%s)\n", bench_reads_file, strerror(errno));
+    exit(1);
+  }
+  breads = (bench_read *)xcalloc(n_bench_reads * sizeof(breads[0]));
+  max_read_len = 0;
+  char * seq = (char *)xmalloc(bench_read_len + 2);
+  for (i = 0; i < n_bench_reads; i++) {
+    bench_read * br = &breads[i];
+    int len = 0, k = 0;
+
+    br->origin = rng_next() % (genome_size - 2 * bench_read_len);
+    br->st = rng_next() & 0x1;
+    j = br->origin;
+    while (len < bench_read_len) {
+      double r = rng_real();
+      if (r < BENCH_PR_INDEL / 2) { // deletion
+	j++;
+      } else if (r < BENCH_PR_INDEL && len > 0) { // insertion
+	seq[len++] = bases[rng_next() & 0x3];
+      } else if (r < BENCH_PR_INDEL + BENCH_PR_SUBST) {
+	seq[len++] = bases[(strchr(bases, ref[j++]) - bases + 1 + rng_next() % 3) & 0x3];
+      } else {
+	seq[len++] = ref[j++];
+      }
+    }
+    seq[len] = 0;
+    br->fwd = strdup(seq);
+
+    // colour space: the first colour is the transition from the T primer
+    br->cs_len = len;
+    br->cs = (uint32_t *)xcalloc(BPTO32BW(len) * sizeof(uint32_t));
+    for (k = 0; k < len; k++) {
+      int c = lstocs(k == 0 ? BASE_T : char_to_base(seq[k - 1]), char_to_base(seq[k]), false);
+      br->cs[k / 8] |= (uint32_t)c << (4 * (k % 8));
+    }
+
+    if (br->st == 1)
+      for (k = 0; k < len; k++)
+	seq[k] = complement(br->fwd[len - 1 - k]);
+
+    fprintf(f, "@r%d\n%s\n+\n", i, seq);
+    for (k = 0; k < len; k++)
+      fputc(33 + 20 + rng_next() % 21, f);
+    fputc('\n', f);
+    if (len > max_read_len)
+      max_read_len = len;
+  }
+  free(seq);
+  fclose(f);
+
+  max_w_len = (int)ceil((double)max_read_len * window_len / 100.0) + 1;
+}
+
+
+static void
+free_parsed_read(read_entry * re)
+{
+  free(re->name);
+  if (re->orig_seq != re->seq)
+    free(re->orig_seq);
+  free(re->seq);
+  if (re->orig_qual != re->qual)
+    free(re->orig_qual);
+  free(re->qual);
+  free(re->plus_line);
+}
+
+
+/*
+ * Load the reads the way the scan threads do, for the kernels that need them.
+ */
+static void
+load_reads()
+{
+  fasta_t fasta = fasta_open(bench_reads_file, MODE_LETTER_SPACE, true);
+  int i;
+
+  if (fasta == NULL) {
+    fprintf(stderr, "error: cannot open reads file [%s]\n", bench_reads_file);
+    exit(1);
+  }
+  res = (read_entry *)xcalloc(n_bench_reads * sizeof(res[0]));
+  for (i = 0; i < n_bench_reads; i++) {
+    read_entry * re = &res[i];
+
+    if (!fasta_get_next_read_with_range(fasta, re)) {
+      fprintf(stderr, "error: reads file [%s] ended early\n", bench_reads_file);
+      exit(1);
+    }
+    re->read_len = strlen(re->seq);
+    re->max_n_kmers = re->read_len - min_seed_span + 1;
+    re->read[0] = fasta_sequence_to_bitfield(fasta, re->seq);
+    re->read[1] = reverse_complement_read_ls(re->read[0], re->read_len, false);
+  }
+  fasta_close(fasta);
+}
+
+
+static inline void
+get_window(int i, int len, int * goff, int * w_len)
+{
+  *w_len = (int)ceil((double)len * window_len / 100.0);
+  *goff = breads[i].origin - (*w_len - len) / 2;
+  if (*goff < 0)
+    *goff = 0;
+  if (*goff + *w_len > genome_size)
+    *goff = genome_size - *w_len;
+}
+
+
+static inline int
+full_threshold(int len)
+{
+  return (int)ceil(sw_full_threshold / 100.0 * len * match_score);
+}
+
+
+/*
+ * Kernels. Each one makes a full round over the reads and fills in r.
+ */
+static void
+bench_fasta(bench_result * r)
+{
+  fasta_t fasta = fasta_open(bench_reads_file, MODE_LETTER_SPACE, true);
+  read_entry re;
+
+  if (fasta == NULL) {
+    fprintf(stderr, "error: cannot open reads file [%s]\n", bench_reads_file);
+    exit(1);
+  }
+  memset(&re, 0, sizeof(re));
+  while (fasta_get_next_read_with_range(fasta, &re)) {
+    r->reads++;
+    r->cells += strlen(re.seq);
+    r->checksum += (uint8_t)re.qual[0];
+    free_parsed_read(&re);
+    memset(&re, 0, sizeof(re));
+  }
+  fasta_close(fasta);
+}
+
+
+static inline void
+bench_kmers(bench_result * r, bool hashed)
+{
+  uint32_t kmerWindow[BPTO32BW(max_seed_span)];
+  int i, j, sn;
+
+  for (i = 0; i < n_bench_reads; i++) {
+    read_entry * re = &res[i];
+
+    memset(kmerWindow, 0, sizeof(kmerWindow));
+    for (j = 0; j < re->read_len; j++) {
+      bitfield_prepend(kmerWindow, max_seed_span, EXTRACT(re->read[0], j));
+      for (sn = 0; sn < n_seeds; sn++) {
+	if (j + 1 < seed[sn].span)
+	  continue;
+	r->checksum += hashed ? kmer_to_mapidx_hash(kmerWindow, sn) : kmer_to_mapidx_orig(kmerWindow, sn);
+	r->cells++;
+      }
+    }
+    r->reads++;
+  }
+}
+
+static void
+bench_kmers_orig(bench_result * r)
+{
+  bench_kmers(r, false);
+}
+
+static void
+bench_kmers_hash(bench_result * r)
+{
+  bench_kmers(r, true);
+}
+
+
+static void
+bench_anchor_list(bench_result * r)
+{
+  struct anchor_list_options options;
+  int i, st;
+
+  memset(&options, 0, sizeof(options));
+  options.collapse = true;
+  for (i = 0; i < n_bench_reads; i++) {
+    for (st = 0; st < 2; st++) {
+      read_get_anchor_list_per_strand(&res[i], st, &options);
+      r->cells += res[i].n_anchors[st];
+      if (res[i].n_anchors[st] > 0)
+	r->checksum += res[i].anchors[st][0].x;
+    }
+    read_free_anchor_list(&res[i], &mem_mapping);
+    r->reads++;
+  }
+}
+
+
+static void
+bench_sw_vector(bench_result * r)
+{
+  int i, goff, w_len;
+
+  for (i = 0; i < n_bench_reads; i++) {
+    read_entry * re = &res[i];
+
+    get_window(i, re->read_len, &goff, &w_len);
+    r->checksum += sw_vector(genome_contigs[0], goff, w_len, re->read[breads[i].st], re->read_len,
+			     NULL, -1, false);
+    r->reads++;
+  }
+}
+
+
+static void
+bench_sw_gapless(bench_result * r)
+{
+  int i;
+
+  for (i = 0; i < n_bench_reads; i++) {
+    read_entry * re = &res[i];
+
+    // anchor on the first base, as a seed hit at the start of the read would
+    r->checksum += sw_gapless(genome_contigs[0], genome_size, re->read[breads[i].st], re->read_len,
+			      breads[i].origin, 0, NULL, -1, false);
+    r->reads++;
+  }
+}
+
+
+static void
+bench_sw_full_ls(bench_result * r)
+{
+  struct sw_full_results sfr;
+  struct anchor a;
+  int i, goff, w_len, score_vector;
+
+  for (i = 0; i < n_bench_reads; i++) {
+    read_entry * re = &res[i];
+
+    get_window(i, re->read_len, &goff, &w_len);
+    score_vector = vector_scores[i];
+    if (score_vector < full_threshold(re->read_len))
+      continue;
+
+    memset(&a, 0, sizeof(a));
+    a.x = breads[i].origin - goff;
+    a.y = 0;
+    a.length = re->read_len;
+    a.width = 1;
+    memset(&sfr, 0, sizeof(sfr));
+    sw_full_ls(genome_contigs[0], goff, w_len, re->read[breads[i].st], re->read_len,
+	       full_threshold(re->read_len), score_vector, &sfr, false, &a, 1, 0);
+    r->checksum += sfr.score;
+    r->reads++;
+    free(sfr.dbalign);
+    free(sfr.qralign);
+  }
+}
+
+
+static struct sw_full_results * cs_sfr;
+
+static void
+bench_sw_full_cs(bench_result * r)
+{
+  struct anchor a;
+  int i, goff, w_len;
+
+  for (i = 0; i < n_bench_reads; i++) {
+    bench_read * br = &breads[i];
+
+    get_window(i, br->cs_len, &goff, &w_len);
+    memset(&a, 0, sizeof(a));
+    a.x = br->origin - goff;
+    a.y = 0;
+    a.length = br->cs_len;
+    a.width = 1;
+    free(cs_sfr[i].dbalign);
+    free(cs_sfr[i].qralign);
+    memset(&cs_sfr[i], 0, sizeof(cs_sfr[i]));
+    sw_full_cs(genome_contigs[0], goff, w_len, br->cs, br->cs_len, BASE_T,
+	       full_threshold(br->cs_len), &cs_sfr[i], false, false, &a, 1, 0);
+    r->checksum += cs_sfr[i].score;
+    r->reads++;
+  }
+}
+
+
+static char * cs_qual;
+
+static void
+bench_post_sw(bench_result * r)
+{
+  int i;
+
+  for (i = 0; i < n_bench_reads; i++) {
+    if (cs_sfr[i].dbalign == NULL)
+      continue;
+
+    post_sw(breads[i].cs, BASE_T, cs_qual, &cs_sfr[i]);
+    for (char * c = cs_sfr[i].qual; *c != 0; c++)
+      r->checksum += *c;
+    free(cs_sfr[i].qual);
+    cs_sfr[i].qual = NULL;
+    r->reads++;
+  }
+}
+
+
+/*
+ * Cell counts kept by the SW kernels themselves.
+ */
+static uint64_t
+sw_vector_cells()
+{
+  uint64_t invocs, cells;
+  double secs;
+
+  sw_vector_stats(&invocs, &cells, &secs);
+  return cells;
+}
+
+static uint64_t
+sw_gapless_cells()
+{
+  uint64_t invocs, cells, ticks;
+
+  sw_gapless_stats(&invocs, &cells, &ticks);
+  return cells;
+}
+
+static uint64_t
+sw_full_ls_cells()
+{
+  uint64_t invocs, cells;
+  double secs;
+
+  sw_full_ls_stats(&invocs, &cells, &secs);
+  return cells;
+}
+
+static uint64_t
+sw_full_cs_cells()
+{
+  uint64_t invocs, cells;
+  double secs;
+
+  sw_full_cs_stats(&invocs, &cells, &secs);
+  return cells;
+}
+
+static uint64_t
+post_sw_cells()
+{
+  uint64_t invocs, cells;
+  double secs;
+
+  post_sw_stats(&invocs, &cells, &secs);
+  return cells;
+}
+
+
+typedef struct bench_kernel {
+  char const *	name;
+  void		(*run)(bench_result *);
+  uint64_t	(*cells)();	// NULL if the kernel counts its own cells
+} bench_kernel;
+
+static bench_kernel const bench_kernels[] = {
+  { "fasta_get_next_read_with_range",	bench_fasta,		NULL },
+  { "kmer_to_mapidx_orig",		bench_kmers_orig,	NULL },
+  { "kmer_to_mapidx_hash",		bench_kmers_hash,	NULL },
+  { "read_get_anchor_list_per_strand",	bench_anchor_list,	NULL },
+  { "sw_vector",			bench_sw_vector,	sw_vector_cells },
+  { "sw_gapless",			bench_sw_gapless,	sw_gapless_cells },
+  { "sw_full_ls",			bench_sw_full_ls,	sw_full_ls_cells },
+  { "sw_full_cs",			bench_sw_full_cs,	sw_full_cs_cells },
+  { "post_sw",				bench_post_sw,		post_sw_cells },
+};
+static int const n_bench_kernels = sizeof(bench_kernels) / sizeof(bench_kernels[0]);
+
+
+static bool
+kernel_selected(char const * name)
+{
+  char const * p;
+  size_t len = strlen(name);
+
+  if (kernels == NULL)
+    return true;
+  for (p = strstr(kernels, name); p != NULL; p = strstr(p + 1, name))
+    if ((p == kernels || p[-1] == ',') && (p[len] == 0 || p[len] == ','))
+      return true;
+  return false;
+}
+
+
+static void
+run_kernel(bench_kernel const * k)
+{
+  bench_result r, best;
+  llint best_usecs = -1;
+  int round;
+
+  memset(&best, 0, sizeof(best));
+  for (round = 0; round < n_rounds; round++) {
+    uint64_t cells_before = (k->cells != NULL ? k->cells() : 0);
+    llint before = gettimeinusecs();
+
+    memset(&r, 0, sizeof(r));
+    k->run(&r);
+
+    llint usecs = (llint)gettimeinusecs() - before;
+    if (k->cells != NULL)
+      r.cells = k->cells() - cells_before;
+    if (round > 0 && r.checksum != best.checksum) {
+      fprintf(stderr, "error: %s gave checksum %" PRIu64 " in round %d, %" PRIu64 " before\n",
+	      k->name, r.checksum, round + 1, best.checksum);
+      exit(1);
+    }
+    if (best_usecs < 0 || usecs < best_usecs) {
+      best_usecs = usecs;
+      best = r;
+    }
+  }
+
+  double secs = MAX(best_usecs, 1) / 1.0e6;
+  fprintf(stdout, "%-32s %10" PRIu64 " %12.0f %14" PRIu64 " %10.2f %10.3f %20" PRIu64 "\n",
+	  k->name, best.reads, (double)best.reads / secs, best.cells,
+	  (double)best.cells / secs / 1.0e6, secs, best.checksum);
+}
+
+
+static void
+usage(char * progname)
+{
+  fprintf(stderr,
+	  "usage: %s [-g genome_len] [-n reads] [-l read_len] [-r rounds] [-s seed]\n"
+	  "       [-k kernel[,kernel...]]\n\n", progname);
+  fprintf(stderr, "  -g  Length of the synthetic reference (default %d)\n", DEF_BENCH_GENOME_LEN);
+  fprintf(stderr, "  -n  Number of synthetic reads (default %d)\n", DEF_BENCH_READS);
+  fprintf(stderr, "  -l  Read length (default %d)\n", DEF_BENCH_READ_LEN);
+  fprintf(stderr, "  -r  Rounds per kernel; the fastest is reported (default %d)\n", DEF_BENCH_ROUNDS);
+  fprintf(stderr, "  -s  Random seed for the reference and reads (default %d)\n", DEF_BENCH_SEED);
+  fprintf(stderr, "  -k  Only run these kernels:");
+  for (int i = 0; i < n_bench_kernels; i++)
+    fprintf(stderr, "%s %s", i > 0 ? "," : "", bench_kernels[i].name);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+
+int
+main(int argc, char * argv[])
+{
+  char * progname = argv[0];
+  char * genome_files[1];
+  int ch, i;
+
+  rng_state = DEF_BENCH_SEED;
+  while ((ch = getopt(argc, argv, "g:n:l:r:s:k:h")) != -1) {
+    switch (ch) {
+    case 'g':
+      genome_size = atoi(optarg);
+      break;
+    case 'n':
+      n_bench_reads = atoi(optarg);
+      break;
+    case 'l':
+      bench_read_len = atoi(optarg);
+      break;
+    case 'r':
+      n_rounds = atoi(optarg);
+      break;
+    case 's':
+      rng_state = strtoull(optarg, NULL, 10);
+      break;
+    case 'k':
+      kernels = optarg;
+      break;
+    default:
+      usage(progname);
+    }
+  }
+  if (argc != optind || n_bench_reads <= 0 || n_rounds <= 0 || bench_read_len < 20
+      || genome_size < 4 * bench_read_len)
+    usage(progname);
+
+  for (i = 0; i < n_bench_kernels; i++)
+    if (kernel_selected(bench_kernels[i].name))
+      break;
+  if (i == n_bench_kernels) {
+    fprintf(stderr, "error: no known kernel in [%s]\n", kernels);
+    usage(progname);
+  }
+
+  make_inputs();
+
+  // same setup as gmapper in letter space, with the default seeds
+  Qflag = true;
+  Cflag = Fflag = true;
+  load_default_seeds(0);
+  init_seed_hash_mask();
+  genome_files[0] = bench_genome_file;
+  if (!load_genome(genome_files, 1))
+    exit(1);
+  gen_st_init(&contig_offsets_gen_st, 17, contig_offsets, num_contigs);
+  load_reads();
+  for (i = 0; i < n_bench_reads; i++)
+    read_get_mapidxs(&res[i]);
+
+  if (sw_gapless_setup(match_score, mismatch_score, true)
+      || sw_vector_setup(max_w_len, max_read_len,
+			 a_gap_open_score, a_gap_extend_score, b_gap_open_score, b_gap_extend_score,
+			 match_score, mismatch_score, false, true)
+      || sw_full_ls_setup(max_w_len, max_read_len,
+			  a_gap_open_score, a_gap_extend_score, b_gap_open_score, b_gap_extend_score,
+			  match_score, mismatch_score, true, anchor_width)) {
+    fprintf(stderr, "error: failed to initialise letter space Smith-Waterman (%s)\n", strerror(errno));
+    exit(1);
+  }
+
+  // vector scores for the full SW, outside of the timed rounds
+  vector_scores = (int *)xmalloc(n_bench_reads * sizeof(vector_scores[0]));
+  for (i = 0; i < n_bench_reads; i++) {
+    int goff, w_len;
+
+    get_window(i, res[i].read_len, &goff, &w_len);
+    vector_scores[i] = sw_vector(genome_contigs[0], goff, w_len, res[i].read[breads[i].st], res[i].read_len,
+				     NULL, -1, false);
+  }
+
+  fprintf(stdout, "# genome_len:%d reads:%d read_len:%d rounds:%d seeds:%d\n",
+	  genome_size, n_bench_reads, bench_read_len, n_rounds, n_seeds);
+  fprintf(stdout, "%-32s %10s %12s %14s %10s %10s %20s\n",
+	  "#kernel", "reads", "reads/sec", "cells", "Mcells/sec", "secs", "checksum");
+  for (i = 0; i < n_bench_kernels; i++) {
+    if (strcmp(bench_kernels[i].name, "sw_full_cs") == 0) {
+      // colour space scores; the alignments are kept for post_sw
+      match_score = DEF_CS_MATCH_SCORE;
+      mismatch_score = DEF_CS_MISMATCH_SCORE;
+      a_gap_open_score = DEF_CS_A_GAP_OPEN;
+      a_gap_extend_score = DEF_CS_A_GAP_EXTEND;
+      b_gap_open_score = DEF_CS_B_GAP_OPEN;
+      b_gap_extend_score = DEF_CS_B_GAP_EXTEND;
+      pr_xover = .03;
+      score_alpha = (double)crossover_score / (log(pr_xover/3)/log(2.0));
+      pr_mismatch = 1.0/(1.0 + 1.0/3.0 * pow(2.0, ((double)match_score - (double)mismatch_score)/score_alpha));
+      pr_del_open = pow(2.0, (double)a_gap_open_score/score_alpha);
+      pr_ins_open = pow(2.0, (double)b_gap_open_score/score_alpha);
+      pr_del_extend = pow(2.0, (double)a_gap_extend_score/score_alpha);
+      pr_ins_extend = pow(2.0, (double)b_gap_extend_score/score_alpha);
+      if (sw_full_cs_setup(max_w_len, max_read_len,
+			   a_gap_open_score, a_gap_extend_score, b_gap_open_score, b_gap_extend_score,
+			   match_score, mismatch_score, crossover_score, true, anchor_width, indel_taboo_len)) {
+	fprintf(stderr, "error: failed to initialise colour space Smith-Waterman (%s)\n", strerror(errno));
+	exit(1);
+      }
+      post_sw_setup(max_w_len + max_read_len,
+		    pr_mismatch, pr_xover, pr_del_open, pr_del_extend, pr_ins_open, pr_ins_extend,
+		    false, use_sanger_qvs, qual_vector_offset, qual_delta, true);
+      cs_sfr = (struct sw_full_results *)xcalloc(n_bench_reads * sizeof(cs_sfr[0]));
+      cs_qual = (char *)xmalloc(max_read_len + 1);
+      memset(cs_qual, qual_delta + 20, max_read_len);
+      cs_qual[max_read_len] = 0;
+      // post_sw needs the alignments even if sw_full_cs is not timed
+      if (!kernel_selected("sw_full_cs") && kernel_selected("post_sw")) {
+	bench_result r;
+	memset(&r, 0, sizeof(r));
+	bench_sw_full_cs(&r);
+      }
+    }
+    if (kernel_selected(bench_kernels[i].name))
+      run_kernel(&bench_kernels[i]);
+  }
+
+  unlink(bench_genome_file);
+  unlink(bench_reads_file);
+  return 0;
+}
@@ -0,0 +1,652 @@
+/*
+ * sim-bench.c
+ *
+ * End-to-end benchmark for gmapper. Makes a synthetic genome (with repeat
+ * families and runs of Ns), simulates letter space or colour space reads from
+ * it (with substitutions, indels, colour errors and, for pairs, normally
+ * distributed inserts), maps them with gmapper once for every thread count
+ * asked for, and reports throughput, peak memory and accuracy against the
+ * simulated origins. Everything is made from a fixed random seed.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../common/util.h"
+
+#define DEF_SIM_GENOME_LEN	5000000
+#define DEF_SIM_CONTIGS		4
+#define DEF_SIM_REPEATS		0.05	// fraction of the genome in repeat copies
+#define DEF_SIM_N_RUNS		10	// per Mbp
+#define DEF_SIM_READS		100000
+#define DEF_SIM_READ_LEN_LS	100
+#define DEF_SIM_READ_LEN_CS	50
+#define DEF_SIM_SUBST		0.01
+#define DEF_SIM_INDEL		0.001
+#define DEF_SIM_XOVER		0.02	// colour errors, colour space only
+#define DEF_SIM_INSERT_MEAN	300
+#define DEF_SIM_INSERT_STDDEV	30
+#define DEF_SIM_THREADS		"1"
+#define DEF_SIM_SEED		1
+#define DEF_SIM_POS_SLACK	20	// how far from its origin a mapping may start
+
+#define REPEAT_FAMILIES		16
+#define REPEAT_MIN_LEN		300
+#define REPEAT_MAX_LEN		3000
+#define REPEAT_DIVERGENCE	0.03
+
+
+typedef struct sim_origin {
+  int		cn;
+  int		pos;	// 1-based, leftmost on the forward strand
+  int		st;
+} sim_origin;
+
+static int genome_size = DEF_SIM_GENOME_LEN;
+static int n_contigs = DEF_SIM_CONTIGS;
+static double repeat_fraction = DEF_SIM_REPEATS;
+static double n_runs_per_mbp = DEF_SIM_N_RUNS;
+static int n_sim_reads = DEF_SIM_READS;
+static int read_len = 0;
+static double pr_subst = DEF_SIM_SUBST;
+static double pr_indel = DEF_SIM_INDEL;
+static double pr_colour_error = DEF_SIM_XOVER;
+static bool colour_space = false;
+static bool paired = false;
+static double insert_mean = DEF_SIM_INSERT_MEAN;
+static double insert_stddev = DEF_SIM_INSERT_STDDEV;
+static char const * thread_counts = DEF_SIM_THREADS;
+static char const * gmapper_path = NULL;
+static char const * work_dir = NULL;
+static bool keep_files = false;
+static bool own_work_dir = false;
+static uint64_t rng_state = DEF_SIM_SEED;
+
+static char * * contigs;
+static int * contig_lens;
+static sim_origin * origins;	// one per read, mates next to each other
+static int n_origins;
+
+
+/*
+ * xorshift64*; the sequences must not depend on the C library.
+ */
+static inline uint32_t
+rng_next()
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (uint32_t)((rng_state * 2685821657736338717ull) >> 32);
+}
+
+static inline double
+rng_real()
+{
+  return (double)rng_next() / 4294967296.0;
+}
+
+static inline double
+rng_normal()
+{
+  double u = rng_real(), v = rng_real();
+
+  return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * v);
+}
+
+
+static char const bases[] = "ACGT";
+
+static inline char
+other_base(char c)
+{
+  char const * p = strchr(bases, c);
+
+  return bases[((p != NULL ? p - bases : 0) + 1 + rng_next() % 3) & 0x3];
+}
+
+// A, C, G, T as 0..3, as in fasta.h
+static inline int
+base_index(char c)
+{
+  return strchr(bases, c) - bases;
+}
+
+static char
+complement(char c)
+{
+  switch (c) {
+  case 'A': return 'T';
+  case 'C': return 'G';
+  case 'G': return 'C';
+  case 'T': return 'A';
+  default: return 'N';
+  }
+}
+
+static void
+reverse_complement(char * s, int len)
+{
+  int i;
+
+  for (i = 0; i < len / 2; i++) {
+    char tmp = complement(s[i]);
+    s[i] = complement(s[len - 1 - i]);
+    s[len - 1 - i] = tmp;
+  }
+  if (len % 2 == 1)
+    s[len / 2] = complement(s[len / 2]);
+}
+
+
+/*
+ * Contigs are unique sequence interleaved with diverged copies of a few
+ * repeat families, in either orientation; N runs are laid over the result.
+ */
+static void
+make_genome(char const * file)
+{
+  char * family[REPEAT_FAMILIES];
+  int family_len[REPEAT_FAMILIES];
+  FILE * f;
+  int i, j, cn;
+
+  for (i = 0; i < REPEAT_FAMILIES; i++) {
+    family_len[i] = REPEAT_MIN_LEN + rng_next() % (REPEAT_MAX_LEN - REPEAT_MIN_LEN + 1);
+    family[i] = (char *)xmalloc(family_len[i] + 1);
+    for (j = 0; j < family_len[i]; j++)
+      family[i][j] = bases[rng_next() & 0x3];
+    family[i][family_len[i]] = 0;
+  }
+
+  f = fopen(file, "w");
+  if (f == NULL) {
+    fprintf(stderr, "error: cannot create genome file [%s] (%s)\n", file, strerror(errno));
+    exit(1);
+  }
+  contigs = (char * *)xmalloc(n_contigs * sizeof(contigs[0]));
+  contig_lens = (int *)xmalloc(n_contigs * sizeof(contig_lens[0]));
+  for (cn = 0; cn < n_contigs; cn++) {
+    int len = genome_size / n_contigs + (cn < genome_size % n_contigs ? 1 : 0);
+    char * s = (char *)xmalloc(len + 1);
+    int pos = 0;
+
+    while (pos < len) {
+      // repeat and unique segments have the same mean length
+      int seg_len = REPEAT_MIN_LEN + rng_next() % (REPEAT_MAX_LEN - REPEAT_MIN_LEN + 1);
+
+      if (rng_real() < repeat_fraction) {
+	int fam = rng_next() % REPEAT_FAMILIES;
+	bool rc = rng_next() & 0x1;
+
+	seg_len = MIN(family_len[fam], len - pos);
+	for (j = 0; j < seg_len; j++) {
+	  char c = rc ? complement(family[fam][family_len[fam] - 1 - j]) : family[fam][j];
+	  s[pos + j] = rng_real() < REPEAT_DIVERGENCE ? other_base(c) : c;
+	}
+      } else {
+	seg_len = MIN(seg_len, len - pos);
+	for (j = 0; j < seg_len; j++)
+	  s[pos + j] = bases[rng_next() & 0x3];
+      }
+      pos += seg_len;
+    }
+
+    int n_runs = (int)(n_runs_per_mbp * len / 1.0e6 + 0.5);
+    for (i = 0; i < n_runs; i++) {
+      int run_len = 50 + rng_next() % 951;
+      int start = rng_next() % len;
+      for (j = start; j < MIN(start + run_len, len); j++)
+	s[j] = 'N';
+    }
+    s[len] = 0;
+
+    contigs[cn] = s;
+    contig_lens[cn] = len;
+    fprintf(f, ">chr%d\n", cn);
+    for (i = 0; i < len; i += 80)
+      fprintf(f, "%.*s\n", MIN(80, len - i), s + i);
+  }
+  fclose(f);
+
+  for (i = 0; i < REPEAT_FAMILIES; i++)
+    free(family[i]);
+}
+
+
+/*
+ * Copy a read starting at pos on the forward strand, with errors, then turn
+ * it around if it comes from the reverse strand. Fails on N.
+ */
+static bool
+sim_letters(int cn, int pos, int st, char * seq)
+{
+  char const * s = contigs[cn];
+  int len = 0, j = pos;
+
+  while (len < read_len) {
+    double r = rng_real();
+
+    if (j >= contig_lens[cn] || s[j] == 'N')
+      return false;
+    if (r < pr_indel / 2) { // deletion from the read
+      j++;
+    } else if (r < pr_indel && len > 0) { // insertion into the read
+      seq[len++] = bases[rng_next() & 0x3];
+    } else if (r < pr_indel + pr_subst) {
+      seq[len++] = other_base(s[j++]);
+    } else {
+      seq[len++] = s[j++];
+    }
+  }
+  seq[len] = 0;
+  if (st == 1)
+    reverse_complement(seq, len);
+  return true;
+}
+
+
+static void
+write_read(FILE * f, char const * name, char const * seq)
+{
+  int i, n_quals = read_len;
+
+  if (!colour_space) {
+    fprintf(f, "@%s\n%s\n+\n", name, seq);
+  } else {
+    // T primer, then one colour per base, some of them wrong
+    fprintf(f, "@%s\nT", name);
+    for (i = 0; i < read_len; i++) {
+      int c = lstocs(base_index(i == 0 ? 'T' : seq[i - 1]), base_index(seq[i]), false);
+      if (rng_real() < pr_colour_error)
+	c = (c + 1 + rng_next() % 3) & 0x3;
+      fputc('0' + c, f);
+    }
+    fprintf(f, "\n+\n");
+  }
+  for (i = 0; i < n_quals; i++)
+    fputc(33 + 20 + rng_next() % 21, f);
+  fputc('\n', f);
+}
+
+
+static inline int
+pick_contig()
+{
+  uint32_t x = rng_next() % genome_size;
+  int cn;
+
+  for (cn = 0; cn < n_contigs - 1 && x >= (uint32_t)contig_lens[cn]; cn++)
+    x -= contig_lens[cn];
+  return cn;
+}
+
+
+static void
+make_reads(char const * file1, char const * file2)
+{
+  char * seq = (char *)xmalloc(read_len + 1);
+  char name[32];
+  FILE * f1, * f2 = NULL;
+  int i;
+
+  f1 = fopen(file1, "w");
+  if (f1 == NULL || (paired && (f2 = fopen(file2, "w")) == NULL)) {
+    fprintf(stderr, "error: cannot create reads files in [%s] (%s)\n", work_dir, strerror(errno));
+    exit(1);
+  }
+  n_origins = paired ? 2 * n_sim_reads : n_sim_reads;
+  origins = (sim_origin *)xcalloc(n_origins * sizeof(origins[0]));
+  for (i = 0; i < n_sim_reads; i++) {
+    int tries;
+
+    for (tries = 0; ; tries++) {
+      if (tries == 1000) {
+	fprintf(stderr, "error: cannot place reads; is the genome mostly Ns?\n");
+	exit(1);
+      }
+
+      int cn = pick_contig();
+      if (!paired) {
+	sim_origin * o = &origins[i];
+	o->cn = cn;
+	o->st = rng_next() & 0x1;
+	o->pos = rng_next() % contig_lens[cn];
+	if (!sim_letters(cn, o->pos, o->st, seq))
+	  continue;
+	o->pos++;
+	sprintf(name, "s%d", i);
+	write_read(f1, name, seq);
+	break;
+      }
+
+      // opposite strands, facing each other
+      int insert = (int)(insert_mean + insert_stddev * rng_normal() + 0.5);
+      sim_origin * o1 = &origins[2 * i], * o2 = &origins[2 * i + 1];
+      if (insert < read_len)
+	insert = read_len;
+      o1->cn = o2->cn = cn;
+      o1->st = 0;
+      o2->st = 1;
+      o1->pos = rng_next() % contig_lens[cn];
+      o2->pos = o1->pos + insert - read_len;
+      if (!sim_letters(cn, o1->pos, o1->st, seq))
+	continue;
+      char * seq2 = strdup(seq);
+      if (!sim_letters(cn, o2->pos, o2->st, seq)) {
+	free(seq2);
+	continue;
+      }
+      o1->pos++;
+      o2->pos++;
+      sprintf(name, "s%d/1", i);
+      write_read(f1, name, seq2);
+      sprintf(name, "s%d/2", i);
+      write_read(f2, name, seq);
+      free(seq2);
+      break;
+    }
+  }
+  fclose(f1);
+  if (f2 != NULL)
+    fclose(f2);
+  free(seq);
+}
+
+
+/*
+ * First mapping of every read against where it came from.
+ */
+static void
+score_mappings(char const * file, int * mapped, int * correct)
+{
+  bool * seen = (bool *)xcalloc(n_origins * sizeof(seen[0]));
+  char * line = NULL;
+  size_t line_size = 0;
+  FILE * f = fopen(file, "r");
+
+  *mapped = *correct = 0;
+  if (f == NULL) {
+    fprintf(stderr, "error: cannot open gmapper output [%s] (%s)\n", file, strerror(errno));
+    exit(1);
+  }
+  while (getline(&line, &line_size, f) > 0) {
+    char name[64], rname[64];
+    int flag, pos, idx, cn;
+
+    if (line[0] == '@' || sscanf(line, "%63s %d %63s %d", name, &flag, rname, &pos) != 4)
+      continue;
+    if (name[0] != 's' || (flag & 0x4) != 0)
+      continue;
+    idx = atoi(name + 1);
+    if (paired)
+      idx = 2 * idx + ((flag & 0x80) != 0 ? 1 : 0);
+    if (idx < 0 || idx >= n_origins || seen[idx])
+      continue;
+
+    seen[idx] = true;
+    (*mapped)++;
+    if (sscanf(rname, "chr%d", &cn) == 1 && cn == origins[idx].cn
+	&& ((flag & 0x10) != 0) == (origins[idx].st == 1)
+	&& abs(pos - origins[idx].pos) <= DEF_SIM_POS_SLACK)
+      (*correct)++;
+  }
+  free(line);
+  fclose(f);
+  free(seen);
+}
+
+
+static double
+stats_value(char const * file, char const * key)
+{
+  char * line = NULL;
+  size_t line_size = 0, key_len = strlen(key);
+  double v = 0;
+  FILE * f = fopen(file, "r");
+
+  if (f == NULL)
+    return 0;
+  while (getline(&line, &line_size, f) > 0)
+    if (strncmp(line, key, key_len) == 0 && line[key_len] == '\t') {
+      v = atof(line + key_len + 1);
+      break;
+    }
+  free(line);
+  fclose(f);
+  return v;
+}
+
+
+static void
+run_gmapper(int threads, char * * extra_args, int n_extra_args)
+{
+  char genome_file[1024], reads1_file[1024], reads2_file[1024];
+  char sam_file[1024], log_file[1024], stats_file[1024], threads_arg[16];
+  char const * args[32 + n_extra_args];
+  struct rusage ru;
+  int n_args = 0, status, i;
+  pid_t pid;
+
+  snprintf(genome_file, sizeof(genome_file), "%s/genome.fa", work_dir);
+  snprintf(reads1_file, sizeof(reads1_file), "%s/reads_1.fq", work_dir);
+  snprintf(reads2_file, sizeof(reads2_file), "%s/reads_2.fq", work_dir);
+  snprintf(sam_file, sizeof(sam_file), "%s/out.%d.sam", work_dir, threads);
+  snprintf(log_file, sizeof(log_file), "%s/log.%d.txt", work_dir, threads);
+  snprintf(stats_file, sizeof(stats_file), "%s/stats.%d.tsv", work_dir, threads);
+  snprintf(threads_arg, sizeof(threads_arg), "%d", threads);
+
+  args[n_args++] = gmapper_path;
+  args[n_args++] = "-N";
+  args[n_args++] = threads_arg;
+  args[n_args++] = "-Q";
+  args[n_args++] = "--qv-offset";
+  args[n_args++] = "33";
+  args[n_args++] = "-o";
+  args[n_args++] = "1";
+  args[n_args++] = "--stats-file";
+  args[n_args++] = stats_file;
+  for (i = 0; i < n_extra_args; i++)
+    args[n_args++] = extra_args[i];
+  if (paired) {
+    args[n_args++] = "-p";
+    args[n_args++] = "opp-in";
+    args[n_args++] = "-1";
+    args[n_args++] = reads1_file;
+    args[n_args++] = "-2";
+    args[n_args++] = reads2_file;
+  } else {
+    args[n_args++] = reads1_file;
+  }
+  args[n_args++] = genome_file;
+  args[n_args] = NULL;
+
+  fflush(stdout);
+  llint before = gettimeinusecs();
+  pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "error: fork failed (%s)\n", strerror(errno));
+    exit(1);
+  }
+  if (pid == 0) {
+    int out = open(sam_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int err = open(log_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0 || err < 0 || dup2(out, 1) < 0 || dup2(err, 2) < 0)
+      _exit(127);
+    execv(gmapper_path, (char * const *)args);
+    fprintf(stderr, "error: cannot run [%s] (%s)\n", gmapper_path, strerror(errno));
+    _exit(127);
+  }
+  if (wait4(pid, &status, 0, &ru) < 0) {
+    fprintf(stderr, "error: wait for gmapper failed (%s)\n", strerror(errno));
+    exit(1);
+  }
+  double wall_secs = (double)((llint)gettimeinusecs() - before) / 1.0e6;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "error: gmapper failed with %d threads; see [%s]\n", threads, log_file);
+    exit(1);
+  }
+
+  int mapped, correct;
+  score_mappings(sam_file, &mapped, &correct);
+
+  double load_secs = stats_value(stats_file, "load_genome_secs");
+  double map_secs = stats_value(stats_file, "mapping_secs");
+  double cpu_secs = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1.0e6
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1.0e6;
+  fprintf(stdout, "%8d %10d %10.2f %10.2f %10.2f %10.2f %16.0f %12.1f %9.2f %9.2f %11.2f\n",
+	  threads, n_origins, load_secs, map_secs, wall_secs, cpu_secs,
+	  map_secs > 0 ? (double)n_origins / (map_secs / 3600.0) / threads : 0,
+	  (double)ru.ru_maxrss / 1024.0,
+	  100.0 * mapped / n_origins, 100.0 * correct / n_origins,
+	  mapped > 0 ? 100.0 * correct / mapped : 0);
+
+  if (!keep_files) {
+    unlink(sam_file);
+    unlink(log_file);
+    unlink(stats_file);
+  }
+}
+
+
+static void
+usage(char * progname)
+{
+  fprintf(stderr, "usage: %s [options] [-- gmapper options]\n\n", progname);
+  fprintf(stderr, "Genome:\n");
+  fprintf(stderr, "  -g  Genome length (default %d)\n", DEF_SIM_GENOME_LEN);
+  fprintf(stderr, "  -c  Number of contigs (default %d)\n", DEF_SIM_CONTIGS);
+  fprintf(stderr, "  -R  Fraction in repeat copies (default %.2f)\n", DEF_SIM_REPEATS);
+  fprintf(stderr, "  -Z  Runs of Ns per Mbp (default %d)\n", DEF_SIM_N_RUNS);
+  fprintf(stderr, "Reads:\n");
+  fprintf(stderr, "  -C  Colour space reads (mapped with gmapper-cs)\n");
+  fprintf(stderr, "  -n  Number of reads, or pairs (default %d)\n", DEF_SIM_READS);
+  fprintf(stderr, "  -l  Read length (default %d, or %d in colour space)\n", DEF_SIM_READ_LEN_LS, DEF_SIM_READ_LEN_CS);
+  fprintf(stderr, "  -e  Substitution rate (default %.3f)\n", DEF_SIM_SUBST);
+  fprintf(stderr, "  -i  Indel rate (default %.3f)\n", DEF_SIM_INDEL);
+  fprintf(stderr, "  -x  Colour error rate (default %.3f)\n", DEF_SIM_XOVER);
+  fprintf(stderr, "  -P  Paired reads, on opposite strands facing each other\n");
+  fprintf(stderr, "  -I  Mean insert size (default %d)\n", DEF_SIM_INSERT_MEAN);
+  fprintf(stderr, "  -D  Insert size standard deviation (default %d)\n", DEF_SIM_INSERT_STDDEV);
+  fprintf(stderr, "Run:\n");
+  fprintf(stderr, "  -t  Thread counts to run, e.g. 1,2,4 (default %s)\n", DEF_SIM_THREADS);
+  fprintf(stderr, "  -b  gmapper binary (default bin/gmapper-ls or bin/gmapper-cs)\n");
+  fprintf(stderr, "  -d  Directory for the inputs and outputs (default: a new one in /tmp)\n");
+  fprintf(stderr, "  -k  Keep the inputs and outputs\n");
+  fprintf(stderr, "  -s  Random seed (default %d)\n", DEF_SIM_SEED);
+  exit(1);
+}
+
+
+int
+main(int argc, char * argv[])
+{
+  char * progname = argv[0];
+  char dir_template[] = "/tmp/shrimp-sim-bench-XXXXXX";
+  char file[1024], file2[1024];
+  int ch;
+
+  while ((ch = getopt(argc, argv, "g:c:R:Z:Cn:l:e:i:x:PI:D:t:b:d:ks:h")) != -1) {
+    switch (ch) {
+    case 'g': genome_size = atoi(optarg); break;
+    case 'c': n_contigs = atoi(optarg); break;
+    case 'R': repeat_fraction = atof(optarg); break;
+    case 'Z': n_runs_per_mbp = atof(optarg); break;
+    case 'C': colour_space = true; break;
+    case 'n': n_sim_reads = atoi(optarg); break;
+    case 'l': read_len = atoi(optarg); break;
+    case 'e': pr_subst = atof(optarg); break;
+    case 'i': pr_indel = atof(optarg); break;
+    case 'x': pr_colour_error = atof(optarg); break;
+    case 'P': paired = true; break;
+    case 'I': insert_mean = atof(optarg); break;
+    case 'D': insert_stddev = atof(optarg); break;
+    case 't': thread_counts = optarg; break;
+    case 'b': gmapper_path = optarg; break;
+    case 'd': work_dir = optarg; break;
+    case 'k': keep_files = true; break;
+    case 's': rng_state = strtoull(optarg, NULL, 10); break;
+    default: usage(progname);
+    }
+  }
+  if (read_len == 0)
+    read_len = colour_space ? DEF_SIM_READ_LEN_CS : DEF_SIM_READ_LEN_LS;
+  if (gmapper_path == NULL)
+    gmapper_path = colour_space ? "bin/gmapper-cs" : "bin/gmapper-ls";
+  if (n_contigs <= 0 || n_sim_reads <= 0 || read_len < 20
+      || genome_size / n_contigs < 10 * MAX(read_len, (int)insert_mean)
+      || repeat_fraction < 0 || repeat_fraction > 1)
+    usage(progname);
+  if (access(gmapper_path, X_OK) != 0) {
+    fprintf(stderr, "error: cannot run [%s]; use -b\n", gmapper_path);
+    exit(1);
+  }
+  if (work_dir == NULL) {
+    work_dir = mkdtemp(dir_template);
+    if (work_dir == NULL) {
+      fprintf(stderr, "error: cannot create a directory in /tmp (%s)\n", strerror(errno));
+      exit(1);
+    }
+    own_work_dir = true;
+  } else if (mkdir(work_dir, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "error: cannot create directory [%s] (%s)\n", work_dir, strerror(errno));
+    exit(1);
+  }
+
+  rng_state = rng_state * 0x9e3779b97f4a7c15ull + 1;
+  snprintf(file, sizeof(file), "%s/genome.fa", work_dir);
+  make_genome(file);
+  snprintf(file, sizeof(file), "%s/reads_1.fq", work_dir);
+  snprintf(file2, sizeof(file2), "%s/reads_2.fq", work_dir);
+  make_reads(file, file2);
+
+  fprintf(stdout, "# genome_len:%d contigs:%d repeats:%.2f n_runs_per_mbp:%g\n",
+	  genome_size, n_contigs, repeat_fraction, n_runs_per_mbp);
+  fprintf(stdout, "# %s %s reads:%d read_len:%d subst:%g indel:%g%s",
+	  colour_space ? "colour space" : "letter space", paired ? "paired" : "unpaired",
+	  n_origins, read_len, pr_subst, pr_indel, colour_space ? "" : "\n");
+  if (colour_space)
+    fprintf(stdout, " colour_errors:%g\n", pr_colour_error);
+  if (paired)
+    fprintf(stdout, "# insert:%g+-%g\n", insert_mean, insert_stddev);
+  fprintf(stdout, "# gmapper:%s dir:%s\n", gmapper_path, work_dir);
+  fprintf(stdout, "%8s %10s %10s %10s %10s %10s %16s %12s %9s %9s %11s\n",
+	  "#threads", "reads", "load_secs", "map_secs", "wall_secs", "cpu_secs",
+	  "reads/hour/core", "peak_rss_mb", "mapped%", "correct%", "precision%");
+
+  char * counts = strdup(thread_counts);
+  for (char * c = strtok(counts, ","); c != NULL; c = strtok(NULL, ",")) {
+    int threads = atoi(c);
+    if (threads <= 0) {
+      fprintf(stderr, "error: bad thread count [%s]\n", c);
+      exit(1);
+    }
+    run_gmapper(threads, argv + optind, argc - optind);
+  }
+  free(counts);
+
+  if (!keep_files) {
+    snprintf(file, sizeof(file), "%s/genome.fa", work_dir);
+    unlink(file);
+    unlink(file2);
+    snprintf(file, sizeof(file), "%s/reads_1.fq", work_dir);
+    unlink(file);
+    if (own_work_dir)
+      rmdir(work_dir);
+  }
+  return 0;
+}
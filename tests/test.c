@@ -207,6 +207,100 @@ void test__fasta_load () {
 	CU_ASSERT_EQUAL(r, 20);
 }
 
+/* Gapless alignment tests */
+
+/*
+ * The per-base extension sw_gapless used before it compared packed words,
+ * the word-parallel version must give the same scores.
+ */
+static int __sw_gapless_per_base(uint32_t * genome, int glen, uint32_t * read, int rlen, int g_idx, int r_idx,
+		uint32_t * genome_ls, int init_bp, int match, int mismatch) {
+	int g_right, r_right, score, max_score;
+	if (g_idx < r_idx) {
+		g_right = 0;
+		r_right = r_idx - g_idx;
+	} else {
+		g_right = g_idx - r_idx;
+		r_right = 0;
+	}
+	score = 0;
+	if (genome_ls != NULL && r_right == 0) {
+		if (lstocs(EXTRACT(genome_ls, g_right), init_bp, false) == (int)EXTRACT(read, 0))
+			score = match;
+		r_right++;
+		g_right++;
+	}
+	max_score = score;
+	while (g_right < glen && r_right < rlen) {
+		score += (EXTRACT(genome, g_right) == EXTRACT(read, r_right) ? match : mismatch);
+		if (score > max_score)
+			max_score = score;
+		g_right++;
+		r_right++;
+		if (score < 0)
+			score = 0;
+	}
+	return max_score;
+}
+
+#define __SW_GAPLESS_GLEN 75
+#define __SW_GAPLESS_MAX_RLEN 40
+
+static void __pack_bases(uint32_t * packed, const int * bases, int len) {
+	int i;
+	memset(packed, 0, BPTO32BW(len) * sizeof(uint32_t));
+	for (i = 0; i < len; ++i) {
+		packed[i / 8] |= (uint32_t)bases[i] << (4 * (i % 8));
+	}
+}
+
+void test__sw_gapless_word_parallel () {
+	const int match = 10, mismatch = -15;
+	int genome_ls[__SW_GAPLESS_GLEN], genome_cs[__SW_GAPLESS_GLEN], read[__SW_GAPLESS_MAX_RLEN];
+	/* exactly as many words as the bases need, so reading past them shows */
+	uint32_t * packed_ls = (uint32_t *)xmalloc(BPTO32BW(__SW_GAPLESS_GLEN) * sizeof(uint32_t));
+	uint32_t * packed_cs = (uint32_t *)xmalloc(BPTO32BW(__SW_GAPLESS_GLEN) * sizeof(uint32_t));
+	int i, cs, rlen, g_idx, r_idx, trial;
+	srand(1);
+	sw_gapless_setup(match, mismatch, true);
+	for (trial = 0; trial < 20; ++trial) {
+		for (i = 0; i < __SW_GAPLESS_GLEN; ++i) {
+			genome_ls[i] = rand() % 4;
+			genome_cs[i] = lstocs(i == 0 ? BASE_A : genome_ls[i - 1], genome_ls[i], false);
+		}
+		__pack_bases(packed_ls, genome_ls, __SW_GAPLESS_GLEN);
+		__pack_bases(packed_cs, genome_cs, __SW_GAPLESS_GLEN);
+		for (cs = 0; cs < 2; ++cs) {
+			int * genome = (cs ? genome_cs : genome_ls);
+			uint32_t * packed_genome = (cs ? packed_cs : packed_ls);
+			/* read lengths on both sides of the 8 bases in a word */
+			for (rlen = 1; rlen <= __SW_GAPLESS_MAX_RLEN; ++rlen) {
+				uint32_t * packed_read = (uint32_t *)xmalloc(BPTO32BW(rlen) * sizeof(uint32_t));
+				/* every offset, including reads hanging off both contig ends */
+				for (g_idx = 0; g_idx < __SW_GAPLESS_GLEN; ++g_idx) {
+					for (r_idx = 0; r_idx < rlen; r_idx += 1 + rlen / 8) {
+						const int init_bp = rand() % 4;
+						/* a copy of the genome under the read, with some errors */
+						for (i = 0; i < rlen; ++i) {
+							const int g = g_idx - r_idx + i;
+							read[i] = (g >= 0 && g < __SW_GAPLESS_GLEN && rand() % 4 != 0 ? genome[g] : rand() % 5);
+						}
+						__pack_bases(packed_read, read, rlen);
+						CU_ASSERT_EQUAL(
+							sw_gapless(packed_genome, __SW_GAPLESS_GLEN, packed_read, rlen, g_idx, r_idx,
+								   cs ? packed_ls : NULL, init_bp, false),
+							__sw_gapless_per_base(packed_genome, __SW_GAPLESS_GLEN, packed_read, rlen, g_idx, r_idx,
+									      cs ? packed_ls : NULL, init_bp, match, mismatch));
+					}
+				}
+				free(packed_read);
+			}
+		}
+	}
+	free(packed_ls);
+	free(packed_cs);
+}
+
 /* Read quality tests */
 
 #ifdef ENABLE_LOW_QUALITY_FILTER
@@ -244,4 +338,26 @@ void test__seed_quality_filter() {
   }
 }
 
+void test__seed_quality_filter_prefix_sums() {
+  const char processed_qual[__QUAL_LEN]         = {10, 10, 10, 10, 10, 10,  5,  7,  UNTRUSTED_QUALITY,  3,  3, 10, 10, 10,  UNTRUSTED_QUALITY,  6,  UNTRUSTED_QUALITY,  4,  4,  3};
+  int qual_prefix[__QUAL_LEN + 1];
+  uint32_t filtered[2] = {0, 0};
+  const int bit_offset = 27;	// straddle a word boundary
+  char* seed_string = "111001101011";
+  struct seed_type seed;
+  int i, n_pos;
+  parse_spaced_seed(seed_string, &seed);
+  qual_prefix[0] = 0;
+  for (i = 0; i < __QUAL_LEN; ++i) {
+	qual_prefix[i + 1] = qual_prefix[i] + MAX(processed_qual[i], UNTRUSTED_QUALITY);
+  }
+  n_pos = __QUAL_LEN - seed.span + 1;
+  read_quality_filter_seed(qual_prefix, 0, n_pos, seed, filtered, bit_offset);
+  for (i = 0; i < 64; ++i) {
+	bool expected = (i >= bit_offset && i < bit_offset + n_pos
+			 && is_low_quality_read_subsequence(processed_qual, i - bit_offset, seed));
+	CU_ASSERT_EQUAL(is_filtered_kmer(filtered, i), expected);
+  }
+}
+
 #endif
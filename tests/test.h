@@ -12,6 +12,7 @@
 #include "../common/debug.h"
 #include "../common/util.h"
 #include "../common/bitmap.h"
+#include "../common/sw-gapless.h"
 #include "../gmapper/seeds.h"
 #include "../gmapper/gmapper.h"
 
@@ -29,9 +30,14 @@ void test__parse_spaced_seed ();
 
 void test__fasta_load ();
 
+/* Gapless alignment tests */
+
+void test__sw_gapless_word_parallel ();
+
 /* Read quality tests */
 
 void test__read_quality_preprocess ();
 void test__seed_quality_filter();
+void test__seed_quality_filter_prefix_sums();
 
 #endif /* TEST_H_ */
@@ -37,9 +37,14 @@ int main () {
       {"read load", test__fasta_load},
       CU_TEST_INFO_NULL
   };
+  CU_TestInfo gapless_tests[] = {
+      {"word-parallel sw_gapless", test__sw_gapless_word_parallel},
+      CU_TEST_INFO_NULL
+  };
   CU_TestInfo quality_tests[] = {
       {"read quality pre-process", test__read_quality_preprocess},
       {"seed quality filter", test__seed_quality_filter},
+      {"seed quality filter, prefix sums", test__seed_quality_filter_prefix_sums},
       CU_TEST_INFO_NULL
   };
 
@@ -47,6 +52,7 @@ int main () {
       {"Bitmap operation suite", NULL, NULL, bitmap_operation_tests},
       {"Load suite", NULL, NULL, fasta_load_tests},
       {"Seeds suite", NULL, NULL, seed_tests},
+      {"Gapless alignment suite", NULL, NULL, gapless_tests},
       {"Quality filter suite", NULL, NULL, quality_tests},
       CU_SUITE_INFO_NULL
   };